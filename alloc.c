@@ -15,9 +15,13 @@
 #include "commit.h"
 #include "tag.h"
 #include "alloc.h"
+#include "memory-budget.h"
 
 #define BLOCKING 1024
 
+static struct memory_consumer parsed_objects_memory =
+	MEMORY_CONSUMER_INIT("parsed objects");
+
 union any_object {
 	struct object object;
 	struct blob blob;
@@ -34,6 +38,7 @@ struct alloc_state {
 	/* bookkeeping of allocations */
 	void **slabs;
 	int slab_nr, slab_alloc;
+	size_t slab_bytes; /* total size of the slabs */
 };
 
 struct alloc_state *allocate_alloc_state(void)
@@ -47,6 +52,8 @@ void clear_alloc_state(struct alloc_state *s)
 		s->slab_nr--;
 		free(s->slabs[s->slab_nr]);
 	}
+	memory_uncharge(&parsed_objects_memory, s->slab_bytes);
+	s->slab_bytes = 0;
 
 	FREE_AND_NULL(s->slabs);
 }
@@ -61,6 +68,8 @@ static inline void *alloc_node(struct alloc_state *s, size_t node_size)
 
 		ALLOC_GROW(s->slabs, s->slab_nr + 1, s->slab_alloc);
 		s->slabs[s->slab_nr++] = s->p;
+		s->slab_bytes += BLOCKING * node_size;
+		memory_charge(&parsed_objects_memory, BLOCKING * node_size);
 	}
 	s->nr--;
 	s->count++;
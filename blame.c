@@ -9,6 +9,8 @@
 #include "blame.h"
 #include "alloc.h"
 #include "commit-slab.h"
+#include "commit-graph.h"
+#include "bloom.h"
 
 define_commit_slab(blame_suspects, struct blame_origin *);
 static struct blame_suspects blame_suspects;
@@ -536,6 +538,40 @@ static int fill_blob_sha1_and_mode(struct repository *repo,
 	return -1;
 }
 
+/*
+ * Consult the changed-path Bloom filter of the commit-graph, if any,
+ * to see whether origin->path can differ between the commit and its
+ * first parent.  Returns 0 only when the filter says it definitely
+ * does not; otherwise the caller has to run the tree diff.
+ */
+static int maybe_changed_path(struct commit *parent,
+			      struct blame_origin *origin)
+{
+	struct commit *commit = origin->commit;
+	struct bloom_filter_settings *settings;
+	struct bloom_filter *filter;
+	struct bloom_key key;
+	int result;
+
+	if (!commit->parents || commit->parents->item != parent)
+		return 1;
+	if (!prepare_commit_graph(the_repository))
+		return 1;
+	settings = the_repository->objects->commit_graph->bloom_filter_settings;
+	if (!settings)
+		return 1;
+
+	filter = get_bloom_filter(the_repository, commit, 0);
+	if (!filter)
+		return 1;
+
+	fill_bloom_key(origin->path, strlen(origin->path), &key, settings);
+	result = bloom_filter_contains(filter, &key, settings);
+	clear_bloom_key(&key);
+
+	return !!result;
+}
+
 /*
  * We have an origin -- check if the same path exists in the
  * parent and return an origin structure to represent it.
@@ -575,7 +611,7 @@ static struct blame_origin *find_origin(struct commit *parent,
 
 	if (is_null_oid(&origin->commit->object.oid))
 		do_diff_cache(get_commit_tree_oid(parent), &diff_opts);
-	else
+	else if (maybe_changed_path(parent, origin))
 		diff_tree_oid(get_commit_tree_oid(parent),
 			      get_commit_tree_oid(origin->commit),
 			      "", &diff_opts);
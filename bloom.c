@@ -0,0 +1,313 @@
+#include "git-compat-util.h"
+#include "bloom.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "revision.h"
+#include "object-store.h"
+#include "commit-graph.h"
+#include "commit.h"
+#include "commit-slab.h"
+#include "string-list.h"
+
+define_commit_slab(bloom_filter_slab, struct bloom_filter);
+
+static struct bloom_filter_slab bloom_filters;
+static int bloom_filters_initialized;
+
+static uint32_t rotate_left(uint32_t value, int32_t count)
+{
+	uint32_t mask = 8 * sizeof(uint32_t) - 1;
+	count &= mask;
+	return ((value << count) | (value >> ((-count) & mask)));
+}
+
+static inline unsigned char get_bitmask(uint32_t pos)
+{
+	return ((unsigned char)1) << (pos & (BITS_PER_WORD - 1));
+}
+
+static int load_bloom_filter_from_graph(struct commit_graph *g,
+					struct bloom_filter *filter,
+					struct commit *c,
+					const struct bloom_filter_settings *settings)
+{
+	uint32_t lex_pos, start_index, end_index;
+
+	if (c->graph_pos == COMMIT_NOT_FROM_GRAPH)
+		return 0;
+
+	while (g && c->graph_pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	/*
+	 * The layer holding the commit may have been written without
+	 * filters, or with settings other than the ones keys are built
+	 * with.
+	 */
+	if (!g || !g->chunk_bloom_indexes ||
+	    c->graph_pos >= g->num_commits + g->num_commits_in_base ||
+	    g->bloom_filter_settings->hash_version != settings->hash_version ||
+	    g->bloom_filter_settings->num_hashes != settings->num_hashes ||
+	    g->bloom_filter_settings->bits_per_entry != settings->bits_per_entry)
+		return 0;
+
+	lex_pos = c->graph_pos - g->num_commits_in_base;
+	end_index = get_be32(g->chunk_bloom_indexes + 4 * lex_pos);
+	if (lex_pos > 0)
+		start_index = get_be32(g->chunk_bloom_indexes + 4 * (lex_pos - 1));
+	else
+		start_index = 0;
+
+	if (end_index < start_index ||
+	    end_index > g->chunk_bloom_data_len - BLOOMDATA_CHUNK_HEADER_SIZE)
+		return 0;
+
+	filter->len = end_index - start_index;
+	filter->data = (unsigned char *)(g->chunk_bloom_data +
+					 BLOOMDATA_CHUNK_HEADER_SIZE +
+					 start_index);
+
+	return 1;
+}
+
+/*
+ * Calculate the murmur3 32-bit hash value for the given data
+ * using the given seed.
+ * Produces a uniformly distributed hash value.
+ * Not considered to be cryptographically secure.
+ * Implemented as described in https://en.wikipedia.org/wiki/MurmurHash#Algorithm
+ */
+uint32_t murmur3_seeded(uint32_t seed, const char *data_, size_t len)
+{
+	const unsigned char *data = (const unsigned char *)data_;
+	const uint32_t c1 = 0xcc9e2d51;
+	const uint32_t c2 = 0x1b873593;
+	const uint32_t r1 = 15;
+	const uint32_t r2 = 13;
+	const uint32_t m = 5;
+	const uint32_t n = 0xe6546b64;
+	size_t i, len4 = len / sizeof(uint32_t);
+	uint32_t k1 = 0;
+	const unsigned char *tail;
+
+	for (i = 0; i < len4; i++) {
+		uint32_t byte1 = (uint32_t)data[4*i];
+		uint32_t byte2 = ((uint32_t)data[4*i + 1]) << 8;
+		uint32_t byte3 = ((uint32_t)data[4*i + 2]) << 16;
+		uint32_t byte4 = ((uint32_t)data[4*i + 3]) << 24;
+		uint32_t k = byte1 | byte2 | byte3 | byte4;
+
+		k *= c1;
+		k = rotate_left(k, r1);
+		k *= c2;
+
+		seed ^= k;
+		seed = rotate_left(seed, r2) * m + n;
+	}
+
+	tail = (data + len4 * sizeof(uint32_t));
+
+	switch (len & (sizeof(uint32_t) - 1)) {
+	case 3:
+		k1 ^= ((uint32_t)tail[2]) << 16;
+		/*-fallthrough*/
+	case 2:
+		k1 ^= ((uint32_t)tail[1]) << 8;
+		/*-fallthrough*/
+	case 1:
+		k1 ^= ((uint32_t)tail[0]) << 0;
+		k1 *= c1;
+		k1 = rotate_left(k1, r1);
+		k1 *= c2;
+		seed ^= k1;
+		break;
+	}
+
+	seed ^= (uint32_t)len;
+	seed ^= (seed >> 16);
+	seed *= 0x85ebca6b;
+	seed ^= (seed >> 13);
+	seed *= 0xc2b2ae35;
+	seed ^= (seed >> 16);
+
+	return seed;
+}
+
+void fill_bloom_key(const char *data,
+		    size_t len,
+		    struct bloom_key *key,
+		    const struct bloom_filter_settings *settings)
+{
+	int i;
+	const uint32_t seed0 = 0x293ae76f;
+	const uint32_t seed1 = 0x7e646e2c;
+	const uint32_t hash0 = murmur3_seeded(seed0, data, len);
+	const uint32_t hash1 = murmur3_seeded(seed1, data, len);
+
+	key->hashes = (uint32_t *)xcalloc(settings->num_hashes, sizeof(uint32_t));
+	for (i = 0; i < settings->num_hashes; i++)
+		key->hashes[i] = hash0 + i * hash1;
+}
+
+void clear_bloom_key(struct bloom_key *key)
+{
+	FREE_AND_NULL(key->hashes);
+}
+
+void add_key_to_filter(const struct bloom_key *key,
+		       struct bloom_filter *filter,
+		       const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+
+		filter->data[block_pos] |= get_bitmask(hash_mod);
+	}
+}
+
+static void init_bloom_filters(void)
+{
+	if (bloom_filters_initialized)
+		return;
+	init_bloom_filter_slab(&bloom_filters);
+	bloom_filters_initialized = 1;
+}
+
+/*
+ * Add 'path' and each of its leading directories to 'paths', so that
+ * the filter of a commit touching 'dir/subdir/file' can also answer
+ * queries for 'dir' and 'dir/subdir'.  Directories are added without
+ * their trailing slash.
+ */
+static void add_path_and_leading_dirs(struct string_list *paths,
+				      const char *path)
+{
+	struct strbuf buf = STRBUF_INIT;
+	const char *slash;
+
+	strbuf_addstr(&buf, path);
+	while (!string_list_has_string(paths, buf.buf)) {
+		string_list_insert(paths, buf.buf);
+		slash = strrchr(buf.buf, '/');
+		if (!slash)
+			break;
+		strbuf_setlen(&buf, slash - buf.buf);
+	}
+	strbuf_release(&buf);
+}
+
+static void fill_filter_from_diff(struct repository *r,
+				  struct commit *c,
+				  struct bloom_filter *filter,
+				  const struct bloom_filter_settings *settings)
+{
+	struct diff_options diffopt;
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	int i;
+
+	diff_setup(&diffopt);
+	diffopt.flags.recursive = 1;
+	diffopt.detect_rename = 0;
+	diffopt.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&diffopt);
+
+	if (c->parents)
+		diff_tree_oid(get_commit_tree_oid(c->parents->item),
+			      get_commit_tree_oid(c), "", &diffopt);
+	else
+		diff_tree_oid(NULL, get_commit_tree_oid(c), "", &diffopt);
+	diffcore_std(&diffopt);
+
+	if (diff_queued_diff.nr <= BLOOM_FILTER_MAX_CHANGED_PATHS) {
+		for (i = 0; i < diff_queued_diff.nr; i++)
+			add_path_and_leading_dirs(&paths,
+						  diff_queued_diff.queue[i]->two->path);
+	}
+
+	if (diff_queued_diff.nr > BLOOM_FILTER_MAX_CHANGED_PATHS) {
+		/* too many changes to be useful: every query says "maybe" */
+		filter->len = 1;
+		filter->data = xmalloc(1);
+		filter->data[0] = 0xFF;
+	} else if (!paths.nr) {
+		/* no changes: every query says "definitely not" */
+		filter->len = 1;
+		filter->data = xcalloc(1, 1);
+	} else {
+		filter->len = (paths.nr * settings->bits_per_entry +
+			       BITS_PER_WORD - 1) / BITS_PER_WORD;
+		filter->data = xcalloc(filter->len, sizeof(unsigned char));
+
+		for (i = 0; i < paths.nr; i++) {
+			struct bloom_key key;
+			const char *path = paths.items[i].string;
+
+			fill_bloom_key(path, strlen(path), &key, settings);
+			add_key_to_filter(&key, filter, settings);
+			clear_bloom_key(&key);
+		}
+	}
+
+	diff_flush(&diffopt);
+	string_list_clear(&paths, 0);
+}
+
+struct bloom_filter *get_bloom_filter(struct repository *r,
+				      struct commit *c,
+				      int compute_if_not_present)
+{
+	struct bloom_filter *filter;
+	struct bloom_filter_settings settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	struct commit_graph *g;
+
+	init_bloom_filters();
+
+	filter = bloom_filter_slab_at(&bloom_filters, c);
+	if (filter->data)
+		return filter;
+
+	g = prepare_commit_graph(r) ? r->objects->commit_graph : NULL;
+	if (g && g->bloom_filter_settings)
+		settings = *g->bloom_filter_settings;
+
+	if (g) {
+		if (c->graph_pos == COMMIT_NOT_FROM_GRAPH)
+			load_commit_graph_info(r, c);
+		if (load_bloom_filter_from_graph(g, filter, c, &settings))
+			return filter;
+	}
+
+	if (!compute_if_not_present)
+		return NULL;
+
+	if (parse_commit(c) ||
+	    (c->parents && parse_commit(c->parents->item)))
+		return NULL;
+
+	fill_filter_from_diff(r, c, filter, &settings);
+	return filter;
+}
+
+int bloom_filter_contains(const struct bloom_filter *filter,
+			  const struct bloom_key *key,
+			  const struct bloom_filter_settings *settings)
+{
+	int i;
+	uint64_t mod = filter->len * BITS_PER_WORD;
+
+	if (!mod)
+		return -1;
+
+	for (i = 0; i < settings->num_hashes; i++) {
+		uint64_t hash_mod = key->hashes[i] % mod;
+		uint64_t block_pos = hash_mod / BITS_PER_WORD;
+		if (!(filter->data[block_pos] & get_bitmask(hash_mod)))
+			return 0;
+	}
+
+	return 1;
+}
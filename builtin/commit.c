@@ -35,6 +35,7 @@
 #include "help.h"
 #include "commit-reach.h"
 #include "commit-graph.h"
+#include "sparse-index.h"
 
 static const char * const builtin_commit_usage[] = {
 	N_("git commit [<options>] [--] <pathspec>..."),
@@ -1280,6 +1281,14 @@ static int git_status_config(const char *k, const char *v, void *cb)
 		s->rename_limit = git_config_int(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "status.threads")) {
+		int is_bool;
+
+		s->threads = git_config_bool_or_int(k, v, &is_bool);
+		if (is_bool)
+			s->threads = s->threads ? 0 : 1;
+		return 0;
+	}
 	if (!strcmp(k, "diff.renames")) {
 		if (s->detect_rename == -1)
 			s->detect_rename = git_config_rename(k, v);
@@ -1357,6 +1366,7 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 		       PATHSPEC_PREFER_FULL,
 		       prefix, argv);
 
+	command_requires_full_index = 0;
 	read_cache_preload(&s.pathspec);
 	refresh_index(&the_index, REFRESH_QUIET|REFRESH_UNMERGED, &s.pathspec, NULL, NULL);
 
@@ -1446,7 +1456,6 @@ int run_commit_hook(int editor_is_used, const char *index_file, const char *name
 
 int cmd_commit(int argc, const char **argv, const char *prefix)
 {
-	const char *argv_gc_auto[] = {"gc", "--auto", NULL};
 	static struct wt_status s;
 	static struct option builtin_commit_options[] = {
 		OPT__QUIET(&quiet, N_("suppress summary after successful commit")),
@@ -1654,10 +1663,10 @@ int cmd_commit(int argc, const char **argv, const char *prefix)
 		      "not exceeded, and then \"git reset HEAD\" to recover."));
 
 	if (git_env_bool(GIT_TEST_COMMIT_GRAPH, 0))
-		write_commit_graph_reachable(get_object_directory(), 0);
+		write_commit_graph_reachable(get_object_directory(), 0, NULL);
 
 	rerere(0);
-	run_command_v_opt(argv_gc_auto, RUN_GIT_CMD);
+	run_auto_maintenance(quiet);
 	run_commit_hook(use_editor, get_index_file(), "post-commit", NULL);
 	if (amend && !no_post_rewrite) {
 		commit_post_rewrite(current_head, &oid);
@@ -27,6 +27,11 @@
 #include "pack-objects.h"
 #include "blob.h"
 #include "tree.h"
+#include "refs.h"
+#include "remote.h"
+#include "revision.h"
+#include "trace-event.h"
+#include "dir.h"
 
 #define FAILED_RUN "failed to run %s"
 
@@ -646,7 +651,7 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 		clean_pack_garbage();
 
 	if (gc_write_commit_graph)
-		write_commit_graph_reachable(get_object_directory(), 0);
+		write_commit_graph_reachable(get_object_directory(), 0, NULL);
 
 	if (auto_gc && too_many_loose_objects())
 		warning(_("There are too many unreachable loose objects; "
@@ -657,3 +662,642 @@ int cmd_gc(int argc, const char **argv, const char *prefix)
 
 	return 0;
 }
+
+static const char * const builtin_maintenance_usage[] = {
+	N_("git maintenance run [<options>]"),
+	NULL
+};
+
+static const char * const builtin_maintenance_run_usage[] = {
+	N_("git maintenance run [--auto | --schedule] [--[no-]quiet] [--task=<task>]"),
+	NULL
+};
+
+struct maintenance_run_opts {
+	int auto_flag;
+	int schedule;
+	int quiet;
+};
+
+enum schedule_priority {
+	SCHEDULE_NONE = 0,
+	SCHEDULE_WEEKLY,
+	SCHEDULE_DAILY,
+	SCHEDULE_HOURLY,
+};
+
+static const char *schedule_names[] = {
+	"none", "weekly", "daily", "hourly"
+};
+
+static const time_t schedule_periods[] = {
+	0, 7 * 24 * 3600, 24 * 3600, 3600
+};
+
+static enum schedule_priority parse_schedule(const char *value)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(schedule_names); i++)
+		if (!strcasecmp(value, schedule_names[i]))
+			return i;
+	return -1;
+}
+
+static int maintenance_auto_limit(const char *task, int limit)
+{
+	char *key = xstrfmt("maintenance.%s.auto", task);
+
+	git_config_get_int(key, &limit);
+	free(key);
+	return limit;
+}
+
+static int maintenance_task_gc(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_push(&child.args, "gc");
+	if (opts->auto_flag)
+		argv_array_push(&child.args, "--auto");
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+
+	close_all_packs(the_repository->objects);
+	return run_command(&child);
+}
+
+static int maintenance_task_commit_graph(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "commit-graph", "write",
+			 "--split", "--reachable", NULL);
+
+	close_all_packs(the_repository->objects);
+	return run_command(&child);
+}
+
+static int add_ref_tip(const char *refname, const struct object_id *oid,
+		       int flags, void *data)
+{
+	struct commit_list **stack = data;
+	struct commit *c = lookup_commit_reference_gently(the_repository,
+							  oid, 1);
+
+	if (c && !(c->object.flags & SEEN)) {
+		c->object.flags |= SEEN;
+		commit_list_insert(c, stack);
+	}
+	return 0;
+}
+
+/*
+ * Count the commits reachable from the references which are not in the
+ * commit-graph, stopping at the commits which are.
+ */
+static int commit_graph_condition(void)
+{
+	struct commit_list *stack = NULL;
+	int limit = maintenance_auto_limit("commit-graph", 100);
+	int count = 0;
+
+	if (!limit)
+		return 0;
+	if (limit < 0)
+		return 1;
+
+	for_each_ref(add_ref_tip, &stack);
+	while (stack && count < limit) {
+		struct commit *c = pop_commit(&stack);
+		struct commit_list *parent;
+
+		if (parse_commit(c) || c->graph_pos != COMMIT_NOT_FROM_GRAPH)
+			continue;
+		count++;
+		for (parent = c->parents; parent; parent = parent->next) {
+			if (parent->item->object.flags & SEEN)
+				continue;
+			parent->item->object.flags |= SEEN;
+			commit_list_insert(parent->item, &stack);
+		}
+	}
+	free_commit_list(stack);
+	return count >= limit;
+}
+
+static int append_remote(struct remote *remote, void *data)
+{
+	string_list_append((struct string_list *)data, remote->name);
+	return 0;
+}
+
+/*
+ * Fetch the branches of the remote into refs/prefetch/, without touching
+ * the remote-tracking branches and FETCH_HEAD, so that a later "git
+ * fetch" only has the objects pushed since to download.
+ */
+static int fetch_remote(const char *name, struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+	struct remote *remote = remote_get(name);
+	struct strbuf refspec = STRBUF_INIT;
+	int i, nr = 0;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "fetch", name, "--prune", "--no-tags",
+			 "--no-write-fetch-head", "--no-auto-maintenance",
+			 "--recurse-submodules=no", "--refmap=", NULL);
+	if (opts->quiet)
+		argv_array_push(&child.args, "--quiet");
+
+	for (i = 0; i < remote->fetch.nr; i++) {
+		const struct refspec_item *item = &remote->fetch.items[i];
+		const char *dst = item->dst;
+
+		if (!item->src || !dst || item->exact_sha1)
+			continue;
+		skip_prefix(dst, "refs/", &dst);
+		strbuf_reset(&refspec);
+		strbuf_addf(&refspec, "%s%s:refs/prefetch/%s",
+			    item->force ? "+" : "", item->src, dst);
+		argv_array_push(&child.args, refspec.buf);
+		nr++;
+	}
+	strbuf_release(&refspec);
+
+	if (!nr) {
+		child_process_clear(&child);
+		return 0;
+	}
+	return !!run_command(&child);
+}
+
+static int maintenance_task_prefetch(struct maintenance_run_opts *opts)
+{
+	struct string_list remotes = STRING_LIST_INIT_DUP;
+	int i, result = 0;
+
+	for_each_remote(append_remote, &remotes);
+	for (i = 0; i < remotes.nr; i++)
+		if (fetch_remote(remotes.items[i].string, opts))
+			result = error(_("failed to prefetch remote '%s'"),
+				       remotes.items[i].string);
+
+	string_list_clear(&remotes, 0);
+	return result;
+}
+
+static int count_loose_object(const struct object_id *oid, const char *path,
+			      void *data)
+{
+	int *count = data;
+
+	return --*count <= 0;
+}
+
+static int loose_objects_condition(void)
+{
+	int count = maintenance_auto_limit("loose-objects", 100);
+
+	if (!count)
+		return 0;
+	if (count < 0)
+		return 1;
+
+	return for_each_loose_file_in_objdir(get_object_directory(),
+					     count_loose_object,
+					     NULL, NULL, &count);
+}
+
+/* The number of loose objects packed by one run of the task. */
+#define LOOSE_OBJECT_BATCH_SIZE 50000
+
+struct write_loose_object_data {
+	FILE *in;
+	int count;
+};
+
+static int write_loose_object_to_stdin(const struct object_id *oid,
+				       const char *path, void *data)
+{
+	struct write_loose_object_data *d = data;
+
+	fprintf(d->in, "%s\n", oid_to_hex(oid));
+	return ++d->count >= LOOSE_OBJECT_BATCH_SIZE;
+}
+
+/*
+ * Pack the loose objects, reachable or not, and delete those which were
+ * packed by the previous run. They are not deleted right after being
+ * packed, so that a process which just found a loose object can still
+ * read it.
+ */
+static int maintenance_task_loose_objects(struct maintenance_run_opts *opts)
+{
+	struct child_process prune_packed = CHILD_PROCESS_INIT;
+	struct child_process pack = CHILD_PROCESS_INIT;
+	struct write_loose_object_data data = { NULL, 0 };
+
+	prune_packed.git_cmd = 1;
+	argv_array_pushl(&prune_packed.args, "prune-packed", "--quiet", NULL);
+	if (run_command(&prune_packed))
+		return error(FAILED_RUN, "prune-packed");
+
+	pack.git_cmd = 1;
+	pack.in = -1;
+	pack.no_stdout = 1;
+	argv_array_pushl(&pack.args, "pack-objects", "--non-empty", NULL);
+	if (opts->quiet)
+		argv_array_push(&pack.args, "--quiet");
+	argv_array_pushf(&pack.args, "%s/pack/loose", get_object_directory());
+
+	if (start_command(&pack))
+		return error(FAILED_RUN, "pack-objects");
+	data.in = xfdopen(pack.in, "w");
+	for_each_loose_file_in_objdir(get_object_directory(),
+				      write_loose_object_to_stdin,
+				      NULL, NULL, &data);
+	fclose(data.in);
+
+	if (finish_command(&pack))
+		return error(FAILED_RUN, "pack-objects");
+	return 0;
+}
+
+static int maintenance_task_incremental_repack(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "repack", "--geometric=2", "-d", "-l",
+			 "--no-write-bitmap-index", NULL);
+	if (opts->quiet)
+		argv_array_push(&child.args, "-q");
+
+	close_all_packs(the_repository->objects);
+	return run_command(&child);
+}
+
+/* The packs which are not in the multi-pack-index yet. */
+static int incremental_repack_condition(void)
+{
+	struct packed_git *p;
+	int limit = maintenance_auto_limit("incremental-repack", 10);
+	int count = 0;
+
+	if (!limit)
+		return 0;
+	if (limit < 0)
+		return 1;
+
+	for (p = get_packed_git(the_repository); p; p = p->next)
+		if (p->pack_local && !p->pack_keep)
+			count++;
+	return count >= limit;
+}
+
+static int maintenance_task_pack_refs(struct maintenance_run_opts *opts)
+{
+	struct child_process child = CHILD_PROCESS_INIT;
+
+	child.git_cmd = 1;
+	argv_array_pushl(&child.args, "pack-refs", "--all", "--prune", NULL);
+	return run_command(&child);
+}
+
+static int count_loose_refs(struct strbuf *path, int limit)
+{
+	DIR *dir = opendir(path->buf);
+	struct dirent *e;
+	size_t len = path->len;
+	int count = 0;
+
+	if (!dir)
+		return 0;
+
+	while (count < limit && (e = readdir(dir))) {
+		struct stat st;
+
+		if (is_dot_or_dotdot(e->d_name))
+			continue;
+		strbuf_setlen(path, len);
+		strbuf_addf(path, "/%s", e->d_name);
+		if (lstat(path->buf, &st))
+			continue;
+		if (S_ISDIR(st.st_mode))
+			count += count_loose_refs(path, limit - count);
+		else if (!ends_with(e->d_name, ".lock"))
+			count++;
+	}
+	strbuf_setlen(path, len);
+	closedir(dir);
+	return count;
+}
+
+static int pack_refs_condition(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	int limit = maintenance_auto_limit("pack-refs", 100);
+	int count;
+
+	if (!limit)
+		return 0;
+	if (limit < 0)
+		return 1;
+
+	strbuf_addstr(&path, git_common_path("refs"));
+	count = count_loose_refs(&path, limit);
+	strbuf_release(&path);
+	return count >= limit;
+}
+
+typedef int maintenance_task_fn(struct maintenance_run_opts *opts);
+
+/*
+ * Return 1 if the task should run with --auto, because enough work has
+ * piled up since its last run.
+ */
+typedef int maintenance_auto_fn(void);
+
+struct maintenance_task {
+	const char *name;
+	maintenance_task_fn *fn;
+	maintenance_auto_fn *auto_condition;
+	unsigned enabled:1;
+	enum schedule_priority schedule;
+
+	/* the position given by --task, -1 if not selected */
+	int selected_order;
+};
+
+enum maintenance_task_label {
+	TASK_PREFETCH,
+	TASK_LOOSE_OBJECTS,
+	TASK_INCREMENTAL_REPACK,
+	TASK_GC,
+	TASK_COMMIT_GRAPH,
+	TASK_PACK_REFS,
+
+	/* leave as final value */
+	TASK__COUNT
+};
+
+static struct maintenance_task tasks[] = {
+	[TASK_PREFETCH] = {
+		"prefetch",
+		maintenance_task_prefetch,
+	},
+	[TASK_LOOSE_OBJECTS] = {
+		"loose-objects",
+		maintenance_task_loose_objects,
+		loose_objects_condition,
+	},
+	[TASK_INCREMENTAL_REPACK] = {
+		"incremental-repack",
+		maintenance_task_incremental_repack,
+		incremental_repack_condition,
+	},
+	[TASK_GC] = {
+		"gc",
+		maintenance_task_gc,
+		need_to_gc,
+		1,
+	},
+	[TASK_COMMIT_GRAPH] = {
+		"commit-graph",
+		maintenance_task_commit_graph,
+		commit_graph_condition,
+	},
+	[TASK_PACK_REFS] = {
+		"pack-refs",
+		maintenance_task_pack_refs,
+		pack_refs_condition,
+	},
+};
+
+static void initialize_maintenance_strategy(void)
+{
+	const char *strategy;
+
+	if (git_config_get_string_const("maintenance.strategy", &strategy))
+		return;
+
+	if (!strcasecmp(strategy, "incremental")) {
+		tasks[TASK_GC].enabled = 0;
+		tasks[TASK_PREFETCH].enabled = 1;
+		tasks[TASK_PREFETCH].schedule = SCHEDULE_HOURLY;
+		tasks[TASK_COMMIT_GRAPH].enabled = 1;
+		tasks[TASK_COMMIT_GRAPH].schedule = SCHEDULE_HOURLY;
+		tasks[TASK_LOOSE_OBJECTS].enabled = 1;
+		tasks[TASK_LOOSE_OBJECTS].schedule = SCHEDULE_DAILY;
+		tasks[TASK_INCREMENTAL_REPACK].enabled = 1;
+		tasks[TASK_INCREMENTAL_REPACK].schedule = SCHEDULE_DAILY;
+		tasks[TASK_PACK_REFS].enabled = 1;
+		tasks[TASK_PACK_REFS].schedule = SCHEDULE_WEEKLY;
+	} else if (strcasecmp(strategy, "none")) {
+		die(_("unknown maintenance strategy: '%s'"), strategy);
+	}
+}
+
+static void initialize_task_config(void)
+{
+	struct strbuf key = STRBUF_INIT;
+	int i;
+
+	initialize_maintenance_strategy();
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		const char *value;
+		int enabled;
+
+		strbuf_reset(&key);
+		strbuf_addf(&key, "maintenance.%s.enabled", tasks[i].name);
+		if (!git_config_get_bool(key.buf, &enabled))
+			tasks[i].enabled = enabled;
+
+		strbuf_reset(&key);
+		strbuf_addf(&key, "maintenance.%s.schedule", tasks[i].name);
+		if (!git_config_get_string_const(key.buf, &value)) {
+			int schedule = parse_schedule(value);
+
+			if (schedule < 0)
+				die(_("unknown schedule for %s: '%s'"),
+				    key.buf, value);
+			tasks[i].schedule = schedule;
+		}
+	}
+
+	strbuf_release(&key);
+}
+
+static int task_option_parse(const struct option *opt,
+			     const char *arg, int unset)
+{
+	static int selected_nr;
+	int i;
+
+	for (i = 0; i < TASK__COUNT; i++)
+		if (!strcasecmp(tasks[i].name, arg))
+			break;
+	if (i == TASK__COUNT)
+		return error(_("'%s' is not a valid task"), arg);
+	if (tasks[i].selected_order >= 0)
+		return error(_("task '%s' cannot be selected multiple times"),
+			     arg);
+
+	tasks[i].selected_order = selected_nr++;
+	return 0;
+}
+
+static int compare_tasks_by_selection(const void *a_, const void *b_)
+{
+	const struct maintenance_task *a = a_, *b = b_;
+
+	return a->selected_order - b->selected_order;
+}
+
+/*
+ * The file recording when the task last ran, which is replaced through
+ * its lock file at the end of each successful run. The lock also keeps
+ * two processes from running the same task at once.
+ */
+static char *task_stamp_path(const struct maintenance_task *task)
+{
+	return xstrfmt("%s/maintenance/%s", get_object_directory(), task->name);
+}
+
+static int schedule_is_due(const struct maintenance_task *task)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *path = task_stamp_path(task);
+	timestamp_t last_run = 0;
+
+	if (strbuf_read_file(&buf, path, 0) > 0)
+		last_run = parse_timestamp(buf.buf, NULL, 10);
+	strbuf_release(&buf);
+	free(path);
+
+	return time(NULL) - last_run >= schedule_periods[task->schedule];
+}
+
+static int maintenance_run_task(struct maintenance_task *task,
+				struct maintenance_run_opts *opts)
+{
+	struct lock_file lk = LOCK_INIT;
+	char *path = task_stamp_path(task);
+	int result = 0;
+
+	if (safe_create_leading_directories(path) ||
+	    hold_lock_file_for_update(&lk, path, 0) < 0) {
+		/* another process is doing the work */
+		if (!opts->auto_flag && !opts->schedule && !opts->quiet)
+			warning(_("skipping task '%s', which is already running"),
+				task->name);
+		free(path);
+		return 0;
+	}
+
+	trace_event_region_enter("maintenance", task->name);
+	if (task->fn(opts)) {
+		result = error(_("task '%s' failed"), task->name);
+		rollback_lock_file(&lk);
+	} else {
+		struct strbuf stamp = STRBUF_INIT;
+
+		strbuf_addf(&stamp, "%"PRItime"\n", (timestamp_t)time(NULL));
+		if (write_in_full(get_lock_file_fd(&lk), stamp.buf,
+				  stamp.len) < 0 ||
+		    commit_lock_file(&lk))
+			result = error_errno(_("unable to write '%s'"), path);
+		strbuf_release(&stamp);
+	}
+	trace_event_region_leave("maintenance", task->name);
+
+	free(path);
+	return result;
+}
+
+static int maintenance_run_tasks(struct maintenance_run_opts *opts,
+				 int selected)
+{
+	int i, result = 0;
+
+	if (selected)
+		QSORT(tasks, TASK__COUNT, compare_tasks_by_selection);
+
+	for (i = 0; i < TASK__COUNT; i++) {
+		struct maintenance_task *task = &tasks[i];
+
+		if (selected ? task->selected_order < 0 : !task->enabled)
+			continue;
+		if (opts->auto_flag &&
+		    (!task->auto_condition || !task->auto_condition()))
+			continue;
+		if (opts->schedule &&
+		    (task->schedule == SCHEDULE_NONE || !schedule_is_due(task)))
+			continue;
+
+		if (maintenance_run_task(task, opts))
+			result = 1;
+	}
+
+	return result;
+}
+
+static int maintenance_run(int argc, const char **argv, const char *prefix)
+{
+	struct maintenance_run_opts opts;
+	int i, selected = 0;
+
+	struct option builtin_maintenance_run_options[] = {
+		OPT_BOOL(0, "auto", &opts.auto_flag,
+			 N_("run the tasks which have enough work to do")),
+		OPT_BOOL(0, "schedule", &opts.schedule,
+			 N_("run the tasks whose schedule is due")),
+		OPT_BOOL(0, "quiet", &opts.quiet,
+			 N_("do not report progress or other information over stderr")),
+		{ OPTION_CALLBACK, 0, "task", NULL, N_("task"),
+			N_("run a specific task"),
+			PARSE_OPT_NONEG, task_option_parse },
+		OPT_END()
+	};
+
+	memset(&opts, 0, sizeof(opts));
+	opts.quiet = !isatty(2);
+	for (i = 0; i < TASK__COUNT; i++)
+		tasks[i].selected_order = -1;
+
+	argc = parse_options(argc, argv, prefix,
+			     builtin_maintenance_run_options,
+			     builtin_maintenance_run_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+	if (argc)
+		usage_with_options(builtin_maintenance_run_usage,
+				   builtin_maintenance_run_options);
+	if (opts.auto_flag && opts.schedule)
+		die(_("use at most one of --auto and --schedule"));
+
+	for (i = 0; i < TASK__COUNT; i++)
+		if (tasks[i].selected_order >= 0)
+			selected = 1;
+
+	initialize_task_config();
+	return maintenance_run_tasks(&opts, selected);
+}
+
+int cmd_maintenance(int argc, const char **argv, const char *prefix)
+{
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage(builtin_maintenance_usage[0]);
+
+	/* for the gc task and its condition */
+	gc_config();
+
+	if (argc > 1 && !strcmp(argv[1], "run"))
+		return maintenance_run(argc - 1, argv + 1, prefix);
+
+	usage(builtin_maintenance_usage[0]);
+}
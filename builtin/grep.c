@@ -23,6 +23,7 @@
 #include "submodule.h"
 #include "submodule-config.h"
 #include "object-store.h"
+#include "fetch-object.h"
 
 static char const * const grep_usage[] = {
 	N_("git grep [<options>] [-e] <pattern> [<rev>...] [[--] <path>...]"),
@@ -201,12 +202,12 @@ static void start_threads(struct grep_opt *opt)
 	int i;
 
 	pthread_mutex_init(&grep_mutex, NULL);
-	pthread_mutex_init(&grep_read_mutex, NULL);
 	pthread_mutex_init(&grep_attr_mutex, NULL);
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
 	grep_use_locks = 1;
+	enable_obj_read_lock();
 
 	for (i = 0; i < ARRAY_SIZE(todo); i++) {
 		strbuf_init(&todo[i].out, 0);
@@ -255,12 +256,12 @@ static int wait_all(void)
 	free(threads);
 
 	pthread_mutex_destroy(&grep_mutex);
-	pthread_mutex_destroy(&grep_read_mutex);
 	pthread_mutex_destroy(&grep_attr_mutex);
 	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
 	pthread_cond_destroy(&cond_result);
 	grep_use_locks = 0;
+	disable_obj_read_lock();
 
 	return hit;
 }
@@ -302,16 +303,6 @@ static int grep_cmd_config(const char *var, const char *value, void *cb)
 	return st;
 }
 
-static void *lock_and_read_oid_file(const struct object_id *oid, enum object_type *type, unsigned long *size)
-{
-	void *data;
-
-	grep_read_lock();
-	data = read_object_file(oid, type, size);
-	grep_read_unlock();
-	return data;
-}
-
 static int grep_oid(struct grep_opt *opt, const struct object_id *oid,
 		     const char *filename, int tree_name_len,
 		     const char *path)
@@ -424,8 +415,15 @@ static int grep_submodule(struct grep_opt *opt, struct repository *superproject,
 	if (!is_submodule_active(superproject, path))
 		return 0;
 
-	if (repo_submodule_init(&submodule, superproject, path))
+	/*
+	 * The worker threads may be reading objects meanwhile, and setting
+	 * up the submodule reads its config and .gitmodules.
+	 */
+	obj_read_lock();
+	if (repo_submodule_init(&submodule, superproject, path)) {
+		obj_read_unlock();
 		return 0;
+	}
 
 	repo_read_gitmodules(&submodule);
 
@@ -439,9 +437,8 @@ static int grep_submodule(struct grep_opt *opt, struct repository *superproject,
 	 * store is no longer global and instead is a member of the repository
 	 * object.
 	 */
-	grep_read_lock();
 	add_to_alternates_memory(submodule.objects->objectdir);
-	grep_read_unlock();
+	obj_read_unlock();
 
 	if (oid) {
 		struct object *object;
@@ -450,12 +447,11 @@ static int grep_submodule(struct grep_opt *opt, struct repository *superproject,
 		unsigned long size;
 		struct strbuf base = STRBUF_INIT;
 
+		obj_read_lock();
 		object = parse_object_or_die(oid, oid_to_hex(oid));
-
-		grep_read_lock();
 		data = read_object_with_reference(&object->oid, tree_type,
 						  &size, NULL);
-		grep_read_unlock();
+		obj_read_unlock();
 
 		if (!data)
 			die(_("unable to read tree (%s)"), oid_to_hex(&object->oid));
@@ -476,6 +472,37 @@ static int grep_submodule(struct grep_opt *opt, struct repository *superproject,
 	return hit;
 }
 
+/*
+ * In a partial clone, fetch at once the blobs of the index entries that
+ * grep_cache() is going to read, instead of one at a time.
+ */
+static void prefetch_cache(struct repository *repo,
+			   const struct pathspec *pathspec, int cached)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	int nr;
+
+	if (!repository_format_partial_clone || repo != the_repository)
+		return;
+
+	for (nr = 0; nr < repo->index->cache_nr; nr++) {
+		const struct cache_entry *ce = repo->index->cache[nr];
+
+		if (!S_ISREG(ce->ce_mode) || ce_stage(ce) ||
+		    ce_intent_to_add(ce))
+			continue;
+		if (!cached && !(ce->ce_flags & CE_VALID) &&
+		    !ce_skip_worktree(ce))
+			continue;
+		if (!match_pathspec(repo->index, pathspec, ce->name,
+				    ce_namelen(ce), 0, NULL, 0))
+			continue;
+		oid_array_append(&to_fetch, &ce->oid);
+	}
+	prefetch_objects(&to_fetch);
+	oid_array_clear(&to_fetch);
+}
+
 static int grep_cache(struct grep_opt *opt, struct repository *repo,
 		      const struct pathspec *pathspec, int cached)
 {
@@ -491,6 +518,8 @@ static int grep_cache(struct grep_opt *opt, struct repository *repo,
 	if (repo_read_index(repo) < 0)
 		die(_("index file corrupt"));
 
+	prefetch_cache(repo, pathspec, cached);
+
 	for (nr = 0; nr < repo->index->cache_nr; nr++) {
 		const struct cache_entry *ce = repo->index->cache[nr];
 		strbuf_setlen(&name, name_base_len);
@@ -577,7 +606,9 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			void *data;
 			unsigned long size;
 
-			data = lock_and_read_oid_file(entry.oid, &type, &size);
+			obj_read_lock();
+			data = read_object_file(entry.oid, &type, &size);
+			obj_read_unlock();
 			if (!data)
 				die(_("unable to read tree (%s)"),
 				    oid_to_hex(entry.oid));
@@ -602,6 +633,37 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 	return hit;
 }
 
+static int collect_blob(const struct object_id *oid, struct strbuf *base,
+			const char *path, unsigned int mode, int stage,
+			void *context)
+{
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+	if (S_ISREG(mode))
+		oid_array_append(context, oid);
+	return 0;
+}
+
+/*
+ * In a partial clone, fetch at once the blobs of the tree of `obj` that
+ * grep_tree() is going to read, instead of one at a time.
+ */
+static void prefetch_tree(const struct pathspec *pathspec, struct object *obj)
+{
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	struct tree *tree;
+
+	if (!repository_format_partial_clone)
+		return;
+
+	tree = parse_tree_indirect(&obj->oid);
+	if (!tree)
+		return;
+	read_tree_recursive(tree, "", 0, 0, pathspec, collect_blob, &to_fetch);
+	prefetch_objects(&to_fetch);
+	oid_array_clear(&to_fetch);
+}
+
 static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 		       struct object *obj, const char *name, const char *path)
 {
@@ -614,10 +676,11 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 		struct strbuf base;
 		int hit, len;
 
-		grep_read_lock();
+		obj_read_lock();
+		prefetch_tree(pathspec, obj);
 		data = read_object_with_reference(&obj->oid, tree_type,
 						  &size, NULL);
-		grep_read_unlock();
+		obj_read_unlock();
 
 		if (!data)
 			die(_("unable to read tree (%s)"), oid_to_hex(&obj->oid));
@@ -647,6 +710,8 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 
 	for (i = 0; i < nr; i++) {
 		struct object *real_obj;
+
+		obj_read_lock();
 		real_obj = deref_tag(the_repository, list->objects[i].item,
 				     NULL, 0);
 
@@ -655,6 +720,7 @@ static int grep_objects(struct grep_opt *opt, const struct pathspec *pathspec,
 			submodule_free(the_repository);
 			gitmodules_config_oid(&real_obj->oid);
 		}
+		obj_read_unlock();
 		if (grep_object(opt, pathspec, real_obj, list->objects[i].name,
 				list->objects[i].path)) {
 			hit = 1;
@@ -1036,7 +1102,7 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	pathspec.recurse_submodules = !!recurse_submodules;
 
 #ifndef NO_PTHREADS
-	if (list.nr || cached || show_in_pager)
+	if (show_in_pager)
 		num_threads = 0;
 	else if (num_threads == 0)
 		num_threads = GREP_NUM_THREADS_DEFAULT;
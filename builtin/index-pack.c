@@ -14,6 +14,8 @@
 #include "thread-utils.h"
 #include "packfile.h"
 #include "object-store.h"
+#include "memory-budget.h"
+#include "pack-sizes.h"
 
 static const char index_pack_usage[] =
 "git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
@@ -77,6 +79,7 @@ static int nr_resolved_deltas;
 static int nr_threads;
 
 static int from_stdin;
+static int write_sizes;
 static int strict;
 static int do_fsck_object;
 static struct fsck_options fsck_options = FSCK_OPTIONS_STRICT;
@@ -126,6 +129,32 @@ static pthread_mutex_t type_cas_mutex;
 
 static pthread_key_t key;
 
+/*
+ * In the first pass, the main thread reads and inflates the objects (it
+ * has to, to find where each of them ends) and hands the non-delta ones
+ * over to the threads, which hash and check them.
+ */
+struct hash_job {
+	struct object_entry *obj;
+	void *data;
+};
+
+/* a ring buffer of jobs, protected by work_mutex */
+static struct hash_job *hash_jobs;
+static int hash_jobs_alloc, hash_jobs_first, hash_jobs_nr;
+/* the size of the objects being queued or hashed */
+static unsigned long hash_jobs_size;
+static int hash_jobs_done;
+static pthread_cond_t hash_jobs_cond;
+static pthread_cond_t hash_space_cond;
+static int hash_in_threads;
+
+/*
+ * The most memory we let inflated objects wait for a thread; a larger
+ * object is still queued alone.
+ */
+#define HASH_QUEUE_SIZE (32 * 1024 * 1024)
+
 static inline void lock_mutex(pthread_mutex_t *mutex)
 {
 	if (threads_active)
@@ -181,6 +210,8 @@ static void cleanup_thread(void)
 
 #else
 
+#define hash_in_threads 0
+
 #define read_lock()
 #define read_unlock()
 
@@ -381,6 +412,35 @@ static void set_thread_data(struct thread_local *data)
 }
 #endif
 
+static struct memory_consumer base_cache_memory =
+	MEMORY_CONSUMER_INIT("index-pack base cache");
+static int account_memory;
+
+/*
+ * The base caches are per thread, but they count towards the memory
+ * budget as a whole; charges are serialized with the object store
+ * accesses, which is what the budget expects.
+ */
+static void charge_base_data(struct base_data *c)
+{
+	get_thread_data()->base_cache_used += c->size;
+	if (account_memory) {
+		read_lock();
+		memory_charge(&base_cache_memory, c->size);
+		read_unlock();
+	}
+}
+
+static void uncharge_base_data(struct base_data *c)
+{
+	get_thread_data()->base_cache_used -= c->size;
+	if (account_memory) {
+		read_lock();
+		memory_uncharge(&base_cache_memory, c->size);
+		read_unlock();
+	}
+}
+
 static struct base_data *alloc_base_data(void)
 {
 	struct base_data *base = xcalloc(1, sizeof(struct base_data));
@@ -393,7 +453,7 @@ static void free_base_data(struct base_data *c)
 {
 	if (c->data) {
 		FREE_AND_NULL(c->data);
-		get_thread_data()->base_cache_used -= c->size;
+		uncharge_base_data(c);
 	}
 }
 
@@ -402,7 +462,8 @@ static void prune_base_data(struct base_data *retain)
 	struct base_data *b;
 	struct thread_local *data = get_thread_data();
 	for (b = data->base_cache;
-	     data->base_cache_used > delta_base_cache_limit && b;
+	     (data->base_cache_used > delta_base_cache_limit ||
+	      memory_budget_exceeded()) && b;
 	     b = b->child) {
 		if (b->data && b != retain)
 			free_base_data(b);
@@ -419,7 +480,7 @@ static void link_base_data(struct base_data *base, struct base_data *c)
 	c->base = base;
 	c->child = NULL;
 	if (c->data)
-		get_thread_data()->base_cache_used += c->size;
+		charge_base_data(c);
 	prune_base_data(c);
 }
 
@@ -449,17 +510,20 @@ static void *unpack_entry_data(off_t offset, unsigned long size,
 	char hdr[32];
 	int hdrlen;
 
-	if (!is_delta_type(type)) {
-		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %lu", type_name(type), size) + 1;
-		the_hash_algo->init_fn(&c);
-		the_hash_algo->update_fn(&c, hdr, hdrlen);
-	} else
-		oid = NULL;
 	if (type == OBJ_BLOB && size > big_file_threshold)
 		buf = fixed_buf;
 	else
 		buf = xmallocz(size);
 
+	/* objects we keep in memory may be hashed by the threads */
+	if (is_delta_type(type) || (hash_in_threads && buf != fixed_buf))
+		oid = NULL;
+	if (oid) {
+		hdrlen = xsnprintf(hdr, sizeof(hdr), "%s %lu", type_name(type), size) + 1;
+		the_hash_algo->init_fn(&c);
+		the_hash_algo->update_fn(&c, hdr, hdrlen);
+	}
+
 	memset(&stream, 0, sizeof(stream));
 	git_inflate_init(&stream);
 	stream.next_out = buf;
@@ -917,7 +981,7 @@ static void *get_base_data(struct base_data *c)
 		if (!delta_nr) {
 			c->data = get_data_from_pack(obj);
 			c->size = obj->size;
-			get_thread_data()->base_cache_used += c->size;
+			charge_base_data(c);
 			prune_base_data(c);
 		}
 		for (; delta_nr > 0; delta_nr--) {
@@ -933,7 +997,7 @@ static void *get_base_data(struct base_data *c)
 			free(raw);
 			if (!c->data)
 				bad_object(obj->idx.offset, _("failed to apply delta"));
-			get_thread_data()->base_cache_used += c->size;
+			charge_base_data(c);
 			prune_base_data(c);
 		}
 		free(delta);
@@ -1118,10 +1182,101 @@ static void *threaded_second_pass(void *data)
 }
 #endif
 
+#ifndef NO_PTHREADS
+static void *threaded_first_pass(void *data)
+{
+	set_thread_data(data);
+	for (;;) {
+		struct hash_job job;
+
+		work_lock();
+		while (!hash_jobs_nr && !hash_jobs_done)
+			pthread_cond_wait(&hash_jobs_cond, &work_mutex);
+		if (!hash_jobs_nr) {
+			work_unlock();
+			break;
+		}
+		job = hash_jobs[hash_jobs_first];
+		hash_jobs_first = (hash_jobs_first + 1) % hash_jobs_alloc;
+		hash_jobs_nr--;
+		pthread_cond_signal(&hash_space_cond);
+		work_unlock();
+
+		hash_object_file(job.data, job.obj->size,
+				 type_name(job.obj->type), &job.obj->idx.oid);
+		sha1_object(job.data, NULL, job.obj->size, job.obj->type,
+			    &job.obj->idx.oid);
+		free(job.data);
+
+		work_lock();
+		hash_jobs_size -= job.obj->size;
+		pthread_cond_signal(&hash_space_cond);
+		work_unlock();
+	}
+	return NULL;
+}
+
+static void start_hash_threads(void)
+{
+	int i;
+
+	init_thread();
+	pthread_cond_init(&hash_jobs_cond, NULL);
+	pthread_cond_init(&hash_space_cond, NULL);
+	hash_jobs_alloc = nr_threads * 16;
+	ALLOC_ARRAY(hash_jobs, hash_jobs_alloc);
+	hash_jobs_first = hash_jobs_nr = 0;
+	hash_jobs_size = 0;
+	hash_jobs_done = 0;
+	hash_in_threads = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		int ret = pthread_create(&thread_data[i].thread, NULL,
+					 threaded_first_pass, thread_data + i);
+		if (ret)
+			die(_("unable to create thread: %s"), strerror(ret));
+	}
+}
+
+static void queue_hash_job(struct object_entry *obj, void *data)
+{
+	work_lock();
+	while (hash_jobs_nr == hash_jobs_alloc ||
+	       (hash_jobs_size &&
+		hash_jobs_size + obj->size > HASH_QUEUE_SIZE))
+		pthread_cond_wait(&hash_space_cond, &work_mutex);
+	hash_jobs[(hash_jobs_first + hash_jobs_nr) % hash_jobs_alloc].obj = obj;
+	hash_jobs[(hash_jobs_first + hash_jobs_nr) % hash_jobs_alloc].data = data;
+	hash_jobs_nr++;
+	hash_jobs_size += obj->size;
+	pthread_cond_signal(&hash_jobs_cond);
+	work_unlock();
+}
+
+static void finish_hash_threads(void)
+{
+	int i;
+
+	work_lock();
+	hash_jobs_done = 1;
+	pthread_cond_broadcast(&hash_jobs_cond);
+	work_unlock();
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(thread_data[i].thread, NULL);
+
+	hash_in_threads = 0;
+	FREE_AND_NULL(hash_jobs);
+	pthread_cond_destroy(&hash_jobs_cond);
+	pthread_cond_destroy(&hash_space_cond);
+	cleanup_thread();
+}
+#endif
+
 /*
  * First pass:
  * - find locations of all objects;
- * - calculate SHA1 of all non-delta objects;
+ * - calculate SHA1 of all non-delta objects, in threads if we can, so
+ *   that only reading and inflating the pack is serialized;
  * - remember base (SHA1 or offset) for all deltas.
  */
 static void parse_pack_objects(unsigned char *hash)
@@ -1135,6 +1290,10 @@ static void parse_pack_objects(unsigned char *hash)
 		progress = start_progress(
 				from_stdin ? _("Receiving objects") : _("Indexing objects"),
 				nr_objects);
+#ifndef NO_PTHREADS
+	if (nr_threads > 1 || getenv("GIT_FORCE_THREADS"))
+		start_hash_threads();
+#endif
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
 		void *data = unpack_raw_entry(obj, &ofs_delta->offset,
@@ -1154,13 +1313,24 @@ static void parse_pack_objects(unsigned char *hash)
 			/* large blobs, check later */
 			obj->real_type = OBJ_BAD;
 			nr_delays++;
-		} else
+		}
+#ifndef NO_PTHREADS
+		else if (hash_in_threads) {
+			queue_hash_job(obj, data);
+			data = NULL;
+		}
+#endif
+		else
 			sha1_object(data, NULL, obj->size, obj->type,
 				    &obj->idx.oid);
 		free(data);
 		display_progress(progress, i+1);
 	}
 	objects[i].idx.offset = consumed_bytes;
+#ifndef NO_PTHREADS
+	if (hash_in_threads)
+		finish_hash_threads();
+#endif
 	stop_progress(&progress);
 
 	/* Check pack integrity */
@@ -1483,6 +1653,9 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 	} else
 		chmod(final_index_name, 0444);
 
+	if (write_sizes && from_stdin)
+		write_pack_sizes_file(the_repository, final_index_name);
+
 	if (do_fsck_object) {
 		struct packed_git *p;
 		p = add_packed_git(final_index_name, strlen(final_index_name), 0);
@@ -1526,6 +1699,10 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die(_("bad pack.indexversion=%"PRIu32), opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.writesizes")) {
+		write_sizes = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.threads")) {
 		nr_threads = git_config_int(k, v);
 		if (nr_threads < 0)
@@ -1800,6 +1977,10 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	}
 #endif
 
+	account_memory = memory_accounting_enabled();
+	if (account_memory)
+		register_memory_consumer(&base_cache_memory);
+
 	curr_pack = open_pack_file(pack_name);
 	parse_pack_header();
 	objects = xcalloc(st_add(nr_objects, 1), sizeof(struct object_entry));
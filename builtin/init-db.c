@@ -22,6 +22,7 @@
 
 static int init_is_bare_repository = 0;
 static int init_shared_repository = -1;
+static const char *init_ref_storage;
 static const char *init_db_template_dir;
 
 static void copy_templates_1(struct strbuf *path, struct strbuf *template_path,
@@ -181,6 +182,7 @@ static int create_default_files(const char *template_path,
 	char repo_version_string[10];
 	char junk[2];
 	int reinit;
+	int repo_version;
 	int filemode;
 	struct strbuf err = STRBUF_INIT;
 
@@ -224,6 +226,34 @@ static int create_default_files(const char *template_path,
 	safe_create_dir(git_path("refs"), 1);
 	adjust_shared_perm(git_path("refs"));
 
+	path = git_path_buf(&buf, "HEAD");
+	reinit = (!access(path, R_OK)
+		  || readlink(path, junk, sizeof(junk)-1) != -1);
+
+	/*
+	 * The ref storage format has to be recorded before the ref
+	 * store is first set up, as it is read from the config.
+	 */
+	repo_version = GIT_REPO_VERSION;
+	if (reinit) {
+		struct repository_format format;
+		const char *existing;
+
+		read_repository_format(&format, git_path_buf(&buf, "config"));
+		existing = format.ref_storage ? format.ref_storage : "files";
+		if (init_ref_storage && strcmp(init_ref_storage, existing))
+			die(_("attempt to reinitialize repository with different "
+			      "ref storage format '%s'"), init_ref_storage);
+		if (strcmp(existing, "files"))
+			repo_version = 1;
+		clear_repository_format(&format);
+	} else if (init_ref_storage && strcmp(init_ref_storage, "files")) {
+		/* Older versions of Git must not touch this repository. */
+		repo_version = 1;
+		git_config_set("core.repositoryformatversion", "1");
+		git_config_set("extensions.refStorage", init_ref_storage);
+	}
+
 	if (refs_init_db(&err))
 		die("failed to set up refs db: %s", err.buf);
 
@@ -231,9 +261,6 @@ static int create_default_files(const char *template_path,
 	 * Create the default symlink from ".git/HEAD" to the "master"
 	 * branch, if it does not exist yet.
 	 */
-	path = git_path_buf(&buf, "HEAD");
-	reinit = (!access(path, R_OK)
-		  || readlink(path, junk, sizeof(junk)-1) != -1);
 	if (!reinit) {
 		if (create_symref("HEAD", "refs/heads/master", NULL) < 0)
 			exit(1);
@@ -241,7 +268,7 @@ static int create_default_files(const char *template_path,
 
 	/* This forces creation of new config file */
 	xsnprintf(repo_version_string, sizeof(repo_version_string),
-		  "%d", GIT_REPO_VERSION);
+		  "%d", repo_version);
 	git_config_set("core.repositoryformatversion", repo_version_string);
 
 	/* Check filemode trustability */
@@ -456,7 +483,7 @@ static int shared_callback(const struct option *opt, const char *arg, int unset)
 }
 
 static const char *const init_db_usage[] = {
-	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [<directory>]"),
+	N_("git init [-q | --quiet] [--bare] [--template=<template-directory>] [--shared[=<permissions>]] [--ref-storage=<format>] [<directory>]"),
 	NULL
 };
 
@@ -485,11 +512,16 @@ int cmd_init_db(int argc, const char **argv, const char *prefix)
 		OPT_BIT('q', "quiet", &flags, N_("be quiet"), INIT_DB_QUIET),
 		OPT_STRING(0, "separate-git-dir", &real_git_dir, N_("gitdir"),
 			   N_("separate git dir from working tree")),
+		OPT_STRING(0, "ref-storage", &init_ref_storage, N_("format"),
+			   N_("specify the format used to store references")),
 		OPT_END()
 	};
 
 	argc = parse_options(argc, argv, prefix, init_db_options, init_db_usage, 0);
 
+	if (init_ref_storage && !ref_storage_backend_exists(init_ref_storage))
+		die(_("unknown ref storage format '%s'"), init_ref_storage);
+
 	if (real_git_dir && !is_absolute_path(real_git_dir))
 		real_git_dir = real_pathdup(real_git_dir, 1);
 
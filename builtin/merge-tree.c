@@ -6,8 +6,16 @@
 #include "blob.h"
 #include "exec-cmd.h"
 #include "merge-blobs.h"
-
-static const char merge_tree_usage[] = "git merge-tree <base-tree> <branch1> <branch2>";
+#include "merge-ort.h"
+#include "parse-options.h"
+#include "quote.h"
+
+static const char * const merge_tree_usage[] = {
+	N_("git merge-tree --write-tree [--merge-base=<base>] <branch1> <branch2>"),
+	N_("git merge-tree --write-tree --stdin"),
+	N_("git merge-tree <base-tree> <branch1> <branch2>"),
+	NULL
+};
 
 struct merge_list {
 	struct merge_list *next;
@@ -27,7 +35,7 @@ static void add_merge_entry(struct merge_list *entry)
 	merge_result_end = &entry->next;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base);
+static void trivial_merge_trees(struct tree_desc t[3], const char *base);
 
 static const char *explanation(struct merge_list *entry)
 {
@@ -222,7 +230,7 @@ static void unresolved_directory(const struct traverse_info *info,
 	buf2 = fill_tree_descriptor(t + 2, ENTRY_OID(n + 2));
 #undef ENTRY_OID
 
-	merge_trees(t, newbase);
+	trivial_merge_trees(t, newbase);
 
 	free(buf0);
 	free(buf1);
@@ -339,7 +347,7 @@ static int threeway_callback(int n, unsigned long mask, unsigned long dirmask, s
 	return mask;
 }
 
-static void merge_trees(struct tree_desc t[3], const char *base)
+static void trivial_merge_trees(struct tree_desc t[3], const char *base)
 {
 	struct traverse_info info;
 
@@ -361,18 +369,198 @@ static void *get_tree_descriptor(struct tree_desc *desc, const char *rev)
 	return buf;
 }
 
+static struct tree *get_tree(const char *rev)
+{
+	struct object_id oid;
+	struct tree *tree;
+
+	if (get_oid(rev, &oid)) {
+		error(_("unknown rev %s"), rev);
+		return NULL;
+	}
+	tree = parse_tree_indirect(&oid);
+	if (!tree)
+		error(_("%s is not a tree"), rev);
+	return tree;
+}
+
+static struct commit *get_commit(const char *rev)
+{
+	struct commit *commit = lookup_commit_reference_by_name(rev);
+
+	if (!commit)
+		error(_("could not parse as commit '%s'"), rev);
+	return commit;
+}
+
+static void show_merge_result(struct merge_result *result)
+{
+	int i, stage;
+
+	printf("%s\n", oid_to_hex(&result->tree->object.oid));
+	if (result->clean)
+		return;
+
+	for (i = 0; i < result->conflicts.nr; i++) {
+		struct string_list_item *item = &result->conflicts.items[i];
+		struct merge_conflict *conflict = item->util;
+
+		for (stage = 0; stage < 3; stage++) {
+			if (!conflict->mode[stage])
+				continue;
+			printf("%06o %s %d\t", conflict->mode[stage],
+			       oid_to_hex(&conflict->oid[stage]), stage + 1);
+			write_name_quoted(item->string, stdout, '\n');
+		}
+	}
+	putchar('\n');
+	fputs(result->messages.buf, stdout);
+}
+
+/*
+ * Merge the two branches in core, with rename detection, and write the
+ * merged tree. Return -1 if the revisions cannot be merged.
+ */
+static int merge_branches(struct merge_options *opt, const char *merge_base,
+			  const char *branch1, const char *branch2,
+			  struct merge_result *result)
+{
+	opt->branch1 = branch1;
+	opt->branch2 = branch2;
+
+	if (merge_base) {
+		struct tree *base_tree = get_tree(merge_base);
+		struct tree *tree1 = get_tree(branch1);
+		struct tree *tree2 = get_tree(branch2);
+
+		if (!base_tree || !tree1 || !tree2)
+			return -1;
+		opt->ancestor = merge_base;
+		merge_incore_nonrecursive(opt, base_tree, tree1, tree2, result);
+		opt->ancestor = NULL;
+	} else {
+		struct commit *commit1 = get_commit(branch1);
+		struct commit *commit2 = get_commit(branch2);
+
+		if (!commit1 || !commit2)
+			return -1;
+		merge_incore_recursive(opt, NULL, commit1, commit2, result);
+	}
+	return result->clean < 0 ? -1 : 0;
+}
+
+static int real_merge(const char *merge_base,
+		      const char *branch1, const char *branch2)
+{
+	struct merge_options opt;
+	struct merge_result result = MERGE_RESULT_INIT;
+	int clean;
+
+	init_merge_options(&opt);
+	if (merge_branches(&opt, merge_base, branch1, branch2, &result))
+		die(_("failure to merge"));
+
+	show_merge_result(&result);
+	clean = result.clean;
+	merge_result_release(&result);
+	return !clean;
+}
+
+/*
+ * Merge the "[<base>] <branch1> <branch2>" of each line of the standard
+ * input, and write a line with the merged tree, the status of the merge
+ * and the conflicted paths. The objects, the parsed commits and the
+ * detected renames are kept from one merge to the next.
+ */
+static int batch_merge(void)
+{
+	struct merge_options opt;
+	struct strbuf line = STRBUF_INIT;
+	struct string_list words = STRING_LIST_INIT_NODUP;
+
+	init_merge_options(&opt);
+	opt.rename_cache = merge_rename_cache_new();
+
+	while (strbuf_getline(&line, stdin) != EOF) {
+		struct merge_result result = MERGE_RESULT_INIT;
+		int i, ret;
+
+		string_list_clear(&words, 0);
+		string_list_split_in_place(&words, line.buf, ' ', -1);
+		string_list_remove_empty_items(&words, 0);
+		if (words.nr == 3)
+			ret = merge_branches(&opt, words.items[0].string,
+					     words.items[1].string,
+					     words.items[2].string, &result);
+		else if (words.nr == 2)
+			ret = merge_branches(&opt, NULL, words.items[0].string,
+					     words.items[1].string, &result);
+		else
+			ret = error(_("expected two or three revisions, got %d"),
+				    (int)words.nr);
+
+		if (ret) {
+			printf("%s error\n", oid_to_hex(&null_oid));
+		} else {
+			printf("%s %s", oid_to_hex(&result.tree->object.oid),
+			       result.clean ? "clean" : "conflicted");
+			for (i = 0; i < result.conflicts.nr; i++) {
+				putchar('\t');
+				quote_c_style(result.conflicts.items[i].string,
+					      NULL, stdout, 0);
+			}
+			putchar('\n');
+		}
+		fflush(stdout);
+		merge_result_release(&result);
+	}
+
+	string_list_clear(&words, 0);
+	strbuf_release(&line);
+	merge_rename_cache_free(opt.rename_cache);
+	return 0;
+}
+
 int cmd_merge_tree(int argc, const char **argv, const char *prefix)
 {
 	struct tree_desc t[3];
 	void *buf1, *buf2, *buf3;
+	int write_tree = 0, use_stdin = 0;
+	const char *merge_base = NULL;
+
+	struct option mt_options[] = {
+		OPT_BOOL(0, "write-tree", &write_tree,
+			 N_("do a real merge and write the merged tree")),
+		OPT_STRING(0, "merge-base", &merge_base, N_("tree-ish"),
+			   N_("use the given merge base")),
+		OPT_BOOL(0, "stdin", &use_stdin,
+			 N_("merge the revisions of each line of the standard input")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, mt_options,
+			     merge_tree_usage, 0);
+
+	if (use_stdin) {
+		if (!write_tree || merge_base || argc)
+			usage_with_options(merge_tree_usage, mt_options);
+		return batch_merge();
+	}
+	if (write_tree) {
+		if (argc != 2)
+			usage_with_options(merge_tree_usage, mt_options);
+		return real_merge(merge_base, argv[0], argv[1]);
+	}
 
-	if (argc != 4)
-		usage(merge_tree_usage);
+	if (merge_base)
+		die(_("--merge-base requires --write-tree"));
+	if (argc != 3)
+		usage_with_options(merge_tree_usage, mt_options);
 
-	buf1 = get_tree_descriptor(t+0, argv[1]);
-	buf2 = get_tree_descriptor(t+1, argv[2]);
-	buf3 = get_tree_descriptor(t+2, argv[3]);
-	merge_trees(t, "");
+	buf1 = get_tree_descriptor(t+0, argv[0]);
+	buf2 = get_tree_descriptor(t+1, argv[1]);
+	buf3 = get_tree_descriptor(t+2, argv[2]);
+	trivial_merge_trees(t, "");
 	free(buf1);
 	free(buf2);
 	free(buf3);
@@ -5,12 +5,13 @@
 #include "midx.h"
 
 static char const * const builtin_multi_pack_index_usage[] = {
-	N_("git multi-pack-index [--object-dir=<dir>] write"),
+	N_("git multi-pack-index [--object-dir=<dir>] write [--bitmap]"),
 	NULL
 };
 
 static struct opts_multi_pack_index {
 	const char *object_dir;
+	unsigned flags;
 } opts;
 
 int cmd_multi_pack_index(int argc, const char **argv,
@@ -19,6 +20,9 @@ int cmd_multi_pack_index(int argc, const char **argv,
 	static struct option builtin_multi_pack_index_options[] = {
 		OPT_FILENAME(0, "object-dir", &opts.object_dir,
 		  N_("object directory containing set of packfile and pack-index pairs")),
+		OPT_BIT(0, "bitmap", &opts.flags,
+			N_("write a reachability bitmap for the multi-pack-index"),
+			MIDX_WRITE_BITMAP),
 		OPT_END(),
 	};
 
@@ -41,7 +45,7 @@ int cmd_multi_pack_index(int argc, const char **argv,
 	}
 
 	if (!strcmp(argv[0], "write"))
-		return write_midx_file(opts.object_dir);
+		return write_midx_file(opts.object_dir, opts.flags);
 
 	die(_("unrecognized verb: %s"), argv[0]);
 }
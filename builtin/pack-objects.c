@@ -33,6 +33,9 @@
 #include "object-store.h"
 #include "dir.h"
 #include "midx.h"
+#include "memory-budget.h"
+#include "pack-sizes.h"
+#include "trace-event.h"
 
 #define IN_PACK(obj) oe_in_pack(&to_pack, obj)
 #define SIZE(obj) oe_size(&to_pack, obj)
@@ -95,6 +98,7 @@ static off_t reuse_packfile_offset;
 static int use_bitmap_index_default = 1;
 static int use_bitmap_index = -1;
 static int write_bitmap_index;
+static int write_sizes;
 static uint16_t write_bitmap_options;
 
 static int exclude_promisor_objects;
@@ -103,6 +107,8 @@ static int use_delta_islands;
 
 static unsigned long delta_cache_size = 0;
 static unsigned long max_delta_cache_size = DEFAULT_DELTA_CACHE_SIZE;
+static struct memory_consumer delta_cache_memory =
+	MEMORY_CONSUMER_INIT("pack-objects delta cache");
 static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
@@ -930,6 +936,14 @@ static void write_pack_file(void)
 					    written_list, nr_written,
 					    &pack_idx_opts, oid.hash);
 
+			if (write_sizes) {
+				size_t base_len = tmpname.len;
+
+				strbuf_addf(&tmpname, "%s.idx", oid_to_hex(&oid));
+				write_pack_sizes_file(the_repository, tmpname.buf);
+				strbuf_setlen(&tmpname, base_len);
+			}
+
 			if (write_bitmap_index) {
 				strbuf_addf(&tmpname, "%s.bitmap", oid_to_hex(&oid));
 
@@ -1907,6 +1921,9 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	if (max_delta_cache_size && delta_cache_size + delta_size > max_delta_cache_size)
 		return 0;
 
+	if (memory_budget_exceeded())
+		return 0;
+
 	if (delta_size < cache_max_small_delta_size)
 		return 1;
 
@@ -2124,10 +2141,12 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	cache_lock();
 	if (trg_entry->delta_data) {
 		delta_cache_size -= DELTA_SIZE(trg_entry);
+		memory_uncharge(&delta_cache_memory, DELTA_SIZE(trg_entry));
 		trg_entry->delta_data = NULL;
 	}
 	if (delta_cacheable(src_size, trg_size, delta_size)) {
 		delta_cache_size += delta_size;
+		memory_charge(&delta_cache_memory, delta_size);
 		cache_unlock();
 		trg_entry->delta_data = xrealloc(delta_buf, delta_size);
 	} else {
@@ -2265,6 +2284,8 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 				cache_lock();
 				delta_cache_size -= DELTA_SIZE(entry);
 				delta_cache_size += entry->z_delta_size;
+				memory_uncharge(&delta_cache_memory, DELTA_SIZE(entry));
+				memory_charge(&delta_cache_memory, entry->z_delta_size);
 				cache_unlock();
 			} else {
 				FREE_AND_NULL(entry->delta_data);
@@ -2380,6 +2401,7 @@ static void *threaded_find_deltas(void *arg)
 {
 	struct thread_params *me = arg;
 
+	trace_event_thread_start("find_deltas");
 	progress_lock();
 	while (me->remaining) {
 		progress_unlock();
@@ -2409,6 +2431,7 @@ static void *threaded_find_deltas(void *arg)
 		progress_lock();
 	}
 	progress_unlock();
+	trace_event_thread_exit();
 	/* leave ->working 1 so that this doesn't get more work assigned */
 	return NULL;
 }
@@ -2689,6 +2712,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		else
 			write_bitmap_options &= ~BITMAP_OPT_HASH_CACHE;
 	}
+	if (!strcmp(k, "pack.writesizes")) {
+		write_sizes = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.usebitmaps")) {
 		use_bitmap_index_default = git_config_bool(k, v);
 		return 0;
@@ -3034,7 +3061,7 @@ static int pack_options_allow_reuse(void)
 
 static int get_object_list_from_bitmap(struct rev_info *revs)
 {
-	if (!(bitmap_git = prepare_bitmap_walk(revs)))
+	if (!(bitmap_git = prepare_bitmap_walk(revs, &filter_options)))
 		return -1;
 
 	if (pack_options_allow_reuse() &&
@@ -3281,6 +3308,8 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			 N_("use a bitmap index if available to speed up counting objects")),
 		OPT_BOOL(0, "write-bitmap-index", &write_bitmap_index,
 			 N_("write a bitmap index together with the pack index")),
+		OPT_BOOL(0, "write-sizes", &write_sizes,
+			 N_("write a table of object sizes together with the pack index")),
 		OPT_PARSE_LIST_OBJECTS_FILTER(&filter_options),
 		{ OPTION_CALLBACK, 0, "missing", NULL, N_("action"),
 		  N_("handling for missing objects"), PARSE_OPT_NONEG,
@@ -3299,6 +3328,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	reset_pack_idx_option(&pack_idx_opts);
 	git_config(git_pack_config, NULL);
+	register_memory_consumer(&delta_cache_memory);
 
 	progress = isatty(2);
 	argc = parse_options(argc, argv, prefix, pack_objects_options,
@@ -3390,7 +3420,6 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (filter_options.choice) {
 		if (!pack_to_stdout)
 			die(_("cannot use --filter without --stdout"));
-		use_bitmap_index = 0;
 	}
 
 	/*
@@ -3449,6 +3478,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress(_("Enumerating objects"), 0);
+	trace_event_region_enter("pack-objects", "enumerate-objects");
 	if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
@@ -3458,13 +3488,19 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	cleanup_preferred_base();
 	if (include_tag && nr_result)
 		for_each_ref(add_ref_tag, NULL);
+	trace_event_region_leave("pack-objects", "enumerate-objects");
 	stop_progress(&progress_state);
 
 	if (non_empty && !nr_result)
 		return 0;
-	if (nr_result)
+	if (nr_result) {
+		trace_event_region_enter("pack-objects", "prepare-pack");
 		prepare_pack(window, depth);
+		trace_event_region_leave("pack-objects", "prepare-pack");
+	}
+	trace_event_region_enter("pack-objects", "write-pack-file");
 	write_pack_file();
+	trace_event_region_leave("pack-objects", "write-pack-file");
 	if (progress)
 		fprintf_ln(stderr,
 			   _("Total %"PRIu32" (delta %"PRIu32"),"
@@ -127,9 +127,116 @@ static void get_non_kept_pack_filenames(struct string_list *fname_list,
 	closedir(dir);
 }
 
+/*
+ * The local packs which --geometric may roll up, i.e. all of them except
+ * the promisor packs and the packs which are kept, sorted by increasing
+ * number of objects. The packs before `split` are those to roll up.
+ */
+struct pack_geometry {
+	struct packed_git **pack;
+	uint32_t pack_nr, pack_alloc;
+	uint32_t split;
+};
+
+static uint32_t geometry_pack_weight(struct packed_git *p)
+{
+	if (open_pack_index(p))
+		die(_("cannot open index for %s"), p->pack_name);
+	return p->num_objects;
+}
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	uint32_t aw = geometry_pack_weight(*(struct packed_git **)va),
+		 bw = geometry_pack_weight(*(struct packed_git **)vb);
+
+	if (aw < bw)
+		return -1;
+	if (aw > bw)
+		return 1;
+	return 0;
+}
+
+static void init_pack_geometry(struct pack_geometry *geometry,
+			       const struct string_list *extra_keep)
+{
+	struct packed_git *p;
+
+	for (p = get_all_packs(the_repository); p; p = p->next) {
+		int i;
+
+		if (!p->pack_local || p->pack_keep || p->pack_promisor)
+			continue;
+
+		for (i = 0; i < extra_keep->nr; i++)
+			if (!fspathcmp(basename(p->pack_name),
+				       extra_keep->items[i].string))
+				break;
+		if (i < extra_keep->nr)
+			continue;
+
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+
+	QSORT(geometry->pack, geometry->pack_nr, geometry_cmp);
+}
+
+/*
+ * Find the packs to roll up so that, once they are replaced by a single
+ * pack, each pack has at least `factor` times as many objects as the
+ * next smaller one.
+ *
+ * Starting from the largest pack, find the first one which does not have
+ * `factor` times as many objects as the pack below it: it and all of the
+ * smaller packs are rolled up. The larger packs are then rolled up too
+ * for as long as they would not have `factor` times as many objects as
+ * the pack resulting from the roll up.
+ */
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint32_t i, total = 0;
+
+	for (i = geometry->pack_nr; i > 1; i--) {
+		struct packed_git *ours = geometry->pack[i - 1];
+		struct packed_git *prev = geometry->pack[i - 2];
+
+		if (unsigned_mult_overflows(factor, geometry_pack_weight(prev)))
+			die(_("pack %s too large to consider in geometric progression"),
+			    prev->pack_name);
+		if (geometry_pack_weight(ours) < factor * geometry_pack_weight(prev))
+			break;
+	}
+	if (i <= 1) {
+		/* the packs already form a geometric progression */
+		geometry->split = 0;
+		return;
+	}
+
+	for (geometry->split = 0; geometry->split < i; geometry->split++)
+		total += geometry_pack_weight(geometry->pack[geometry->split]);
+
+	for (; geometry->split < geometry->pack_nr; geometry->split++) {
+		struct packed_git *ours = geometry->pack[geometry->split];
+
+		if (unsigned_mult_overflows(factor, total))
+			die(_("pack %s too large to roll up"), ours->pack_name);
+		if (geometry_pack_weight(ours) >= factor * total)
+			break;
+		total += geometry_pack_weight(ours);
+	}
+}
+
+static void free_pack_geometry(struct pack_geometry *geometry)
+{
+	free(geometry->pack);
+}
+
 static void remove_redundant_pack(const char *dir_name, const char *base_name)
 {
-	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".promisor"};
+	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".sizes",
+			      ".promisor"};
 	int i;
 	struct strbuf buf = STRBUF_INIT;
 	size_t plen;
@@ -268,6 +375,7 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		{".pack"},
 		{".idx"},
 		{".bitmap", 1},
+		{".sizes", 1},
 		{".promisor", 1},
 	};
 	struct child_process cmd = CHILD_PROCESS_INIT;
@@ -287,6 +395,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	struct string_list keep_pack_list = STRING_LIST_INIT_NODUP;
 	int no_update_server_info = 0;
 	int midx_cleared = 0;
+	int geometric_factor = 0;
+	struct pack_geometry geometry = { NULL };
 	struct pack_objects_args po_args = {NULL};
 
 	struct option builtin_repack_options[] = {
@@ -295,6 +405,8 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 		OPT_BIT('A', NULL, &pack_everything,
 				N_("same as -a, and turn unreachable objects loose"),
 				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				N_("roll up the smallest packs to keep a geometric progression of pack sizes")),
 		OPT_BOOL('d', NULL, &delete_redundant,
 				N_("remove redundant packs, and run git-prune-packed")),
 		OPT_BOOL('f', NULL, &po_args.no_reuse_delta,
@@ -343,6 +455,13 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 	    (unpack_unreachable || (pack_everything & LOOSEN_UNREACHABLE)))
 		die(_("--keep-unreachable and -A are incompatible"));
 
+	if (geometric_factor) {
+		if (pack_everything)
+			die(_("--geometric is incompatible with -A, -a"));
+		if (geometric_factor < 2)
+			die(_("--geometric factor must be at least 2"));
+	}
+
 	if (pack_kept_objects < 0)
 		pack_kept_objects = write_bitmaps;
 
@@ -394,6 +513,34 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 				argv_array_push(&cmd.env_array, "GIT_REF_PARANOIA=1");
 			}
 		}
+	} else if (geometric_factor) {
+		struct packed_git *p;
+
+		init_pack_geometry(&geometry, &keep_pack_list);
+		split_pack_geometry(&geometry, geometric_factor);
+
+		/*
+		 * Keep the other local packs, and pack all of the objects
+		 * of the packs rolled up, whether they are reachable or
+		 * not, together with the reachable loose objects.
+		 */
+		for (p = get_all_packs(the_repository); p; p = p->next) {
+			const char *name = basename(p->pack_name);
+			size_t len;
+
+			if (!p->pack_local)
+				continue;
+			for (i = 0; i < geometry.split; i++)
+				if (geometry.pack[i] == p)
+					break;
+			if (i == geometry.split)
+				argv_array_pushf(&cmd.args, "--keep-pack=%s", name);
+			else if (strip_suffix(name, ".pack", &len))
+				string_list_append_nodup(&existing_packs,
+							 xmemdupz(name, len));
+		}
+		argv_array_push(&cmd.args, "--unpacked");
+		argv_array_push(&cmd.args, "--keep-unreachable");
 	} else {
 		argv_array_push(&cmd.args, "--unpacked");
 		argv_array_push(&cmd.args, "--incremental");
@@ -543,20 +690,34 @@ int cmd_repack(int argc, const char **argv, const char *prefix)
 			if (len < 40)
 				continue;
 			sha1 = item->string + len - 40;
-			if (!string_list_has_string(&names, sha1))
-				remove_redundant_pack(packdir, item->string);
+			if (string_list_has_string(&names, sha1))
+				continue;
+			if (!midx_cleared) {
+				/* the midx must not refer to a removed pack */
+				clear_midx_file(get_object_directory());
+				midx_cleared = 1;
+			}
+			remove_redundant_pack(packdir, item->string);
 		}
 		if (!po_args.quiet && isatty(2))
 			opts |= PRUNE_PACKED_VERBOSE;
 		prune_packed_objects(opts);
 	}
 
+	/*
+	 * Look the objects up in the packs of the progression through a
+	 * single index.
+	 */
+	if (geometric_factor && write_midx_file(get_object_directory(), 0))
+		die(_("could not write multi-pack-index"));
+
 	if (!no_update_server_info)
 		update_server_info(0);
 	remove_temporary_files();
 	string_list_clear(&names, 0);
 	string_list_clear(&rollback, 0);
 	string_list_clear(&existing_packs, 0);
+	free_pack_geometry(&geometry);
 	strbuf_release(&line);
 
 	return 0;
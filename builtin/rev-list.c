@@ -500,9 +500,6 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (revs.show_notes)
 		die(_("rev-list does not support display of notes"));
 
-	if (filter_options.choice && use_bitmap_index)
-		die(_("cannot combine --use-bitmap-index with object filtering"));
-
 	save_commit_buffer = (revs.verbose_header ||
 			      revs.grep_filter.pattern_list ||
 			      revs.grep_filter.header_list);
@@ -517,7 +514,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			uint32_t commit_count;
 			int max_count = revs.max_count;
 			struct bitmap_index *bitmap_git;
-			if ((bitmap_git = prepare_bitmap_walk(&revs))) {
+			if ((bitmap_git = prepare_bitmap_walk(&revs, NULL))) {
 				count_bitmap_commit_list(bitmap_git, &commit_count, NULL, NULL, NULL);
 				if (max_count >= 0 && max_count < commit_count)
 					commit_count = max_count;
@@ -526,9 +523,10 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 				return 0;
 			}
 		} else if (revs.max_count < 0 &&
-			   revs.tag_objects && revs.tree_objects && revs.blob_objects) {
+			   revs.tag_objects && revs.tree_objects && revs.blob_objects &&
+			   !arg_print_omitted && arg_missing_action == MA_ERROR) {
 			struct bitmap_index *bitmap_git;
-			if ((bitmap_git = prepare_bitmap_walk(&revs))) {
+			if ((bitmap_git = prepare_bitmap_walk(&revs, &filter_options))) {
 				traverse_bitmap_commit_list(bitmap_git, &show_object_fast);
 				free_bitmap_index(bitmap_git);
 				return 0;
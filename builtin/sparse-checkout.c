@@ -0,0 +1,314 @@
+#include "builtin.h"
+#include "config.h"
+#include "dir.h"
+#include "lockfile.h"
+#include "parse-options.h"
+#include "repository.h"
+#include "run-command.h"
+#include "string-list.h"
+
+static char const * const builtin_sparse_checkout_usage[] = {
+	N_("git sparse-checkout list"),
+	N_("git sparse-checkout init [--cone]"),
+	N_("git sparse-checkout set [--stdin] [<patterns>...]"),
+	N_("git sparse-checkout disable"),
+	NULL
+};
+
+static const char * const builtin_sparse_checkout_init_usage[] = {
+	N_("git sparse-checkout init [--cone]"),
+	NULL
+};
+
+static const char * const builtin_sparse_checkout_set_usage[] = {
+	N_("git sparse-checkout set [--stdin] [<patterns>...]"),
+	NULL
+};
+
+static char *get_sparse_checkout_filename(void)
+{
+	return git_pathdup("info/sparse-checkout");
+}
+
+static int sparse_checkout_list(int argc, const char **argv)
+{
+	char *sparse_filename = get_sparse_checkout_filename();
+	struct strbuf buf = STRBUF_INIT;
+	struct exclude_list el;
+
+	memset(&el, 0, sizeof(el));
+	el.use_cone_patterns = core_sparse_checkout_cone;
+	if (add_excludes_from_file_to_list(sparse_filename, "", 0, &el, NULL) < 0)
+		die(_("this worktree is not sparse (sparse-checkout file may not exist)"));
+
+	if (el.use_cone_patterns) {
+		struct string_list dirs = STRING_LIST_INIT_DUP;
+		struct hashmap_iter iter;
+		struct cone_dir_entry *e;
+		int i;
+
+		/* the directories that are included recursively */
+		hashmap_iter_init(&el.recursive_hashmap, &iter);
+		while ((e = hashmap_iter_next(&iter)))
+			string_list_append(&dirs, e->path);
+		string_list_sort(&dirs);
+		for (i = 0; i < dirs.nr; i++)
+			printf("%s\n", dirs.items[i].string);
+		string_list_clear(&dirs, 0);
+	} else {
+		if (strbuf_read_file(&buf, sparse_filename, 0) < 0)
+			die_errno(_("could not read '%s'"), sparse_filename);
+		fwrite(buf.buf, 1, buf.len, stdout);
+	}
+
+	strbuf_release(&buf);
+	clear_exclude_list(&el);
+	free(sparse_filename);
+	return 0;
+}
+
+static int update_working_directory(void)
+{
+	const char *argv[] = { "read-tree", "-m", "-u", "HEAD", NULL };
+	struct object_id oid;
+
+	/* there is nothing to check out yet on an unborn branch */
+	if (get_oid("HEAD", &oid))
+		return 0;
+	return run_command_v_opt(argv, RUN_GIT_CMD);
+}
+
+static void write_sparse_checkout_file(const char *sparse_filename,
+				       const struct strbuf *patterns)
+{
+	struct lock_file lk = LOCK_INIT;
+
+	if (safe_create_leading_directories_const(sparse_filename))
+		die(_("failed to create directory for sparse-checkout file"));
+	hold_lock_file_for_update(&lk, sparse_filename, LOCK_DIE_ON_ERROR);
+	if (write_in_full(get_lock_file_fd(&lk), patterns->buf,
+			  patterns->len) < 0 ||
+	    commit_lock_file(&lk))
+		die_errno(_("unable to write '%s'"), sparse_filename);
+}
+
+/*
+ * Replace the patterns and update the working tree accordingly, or
+ * restore the previous patterns if the working tree cannot be updated,
+ * e.g. because of local changes in the paths that would be removed.
+ */
+static int write_patterns_and_update(const struct strbuf *patterns)
+{
+	char *sparse_filename = get_sparse_checkout_filename();
+	struct strbuf old = STRBUF_INIT;
+	int had_old, result;
+
+	had_old = strbuf_read_file(&old, sparse_filename, 0) >= 0;
+	write_sparse_checkout_file(sparse_filename, patterns);
+
+	result = update_working_directory();
+	if (result) {
+		if (had_old)
+			write_sparse_checkout_file(sparse_filename, &old);
+		else
+			unlink_or_warn(sparse_filename);
+		error(_("could not update the working tree, the sparse-checkout patterns are unchanged"));
+	}
+
+	strbuf_release(&old);
+	free(sparse_filename);
+	return result;
+}
+
+static int sparse_checkout_init(int argc, const char **argv)
+{
+	char *sparse_filename = get_sparse_checkout_filename();
+	struct strbuf patterns = STRBUF_INIT;
+	int cone = 0, result = 0;
+
+	struct option builtin_sparse_checkout_init_options[] = {
+		OPT_BOOL(0, "cone", &cone,
+			 N_("initialize the sparse-checkout in cone mode")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL,
+			     builtin_sparse_checkout_init_options,
+			     builtin_sparse_checkout_init_usage, 0);
+
+	git_config_set("core.sparseCheckout", "true");
+	if (cone)
+		git_config_set("core.sparseCheckoutCone", "true");
+
+	/* keep the existing patterns, otherwise only the top-level files */
+	if (!file_exists(sparse_filename)) {
+		strbuf_addstr(&patterns, "/*\n!/*/\n");
+		result = write_patterns_and_update(&patterns);
+	} else {
+		result = update_working_directory();
+	}
+
+	strbuf_release(&patterns);
+	free(sparse_filename);
+	return result;
+}
+
+/*
+ * Turn the leading directories of the cone mode directories into
+ * "parent" patterns, which include only the files directly in them.
+ */
+static void cone_patterns_from_dirs(struct strbuf *out,
+				    struct string_list *dirs)
+{
+	struct string_list recursive = STRING_LIST_INIT_DUP;
+	struct string_list all = STRING_LIST_INIT_DUP;
+	struct strbuf dir = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < dirs->nr; i++) {
+		const char *p = dirs->items[i].string;
+
+		while (*p == '/')
+			p++;
+		strbuf_reset(&dir);
+		strbuf_addstr(&dir, p);
+		while (dir.len && dir.buf[dir.len - 1] == '/')
+			strbuf_setlen(&dir, dir.len - 1);
+		if (!dir.len)
+			continue;
+		if (simple_length(dir.buf) != dir.len)
+			die(_("'%s' is not a directory path"),
+			    dirs->items[i].string);
+		string_list_insert(&recursive, dir.buf);
+	}
+
+	for (i = 0; i < recursive.nr; i++) {
+		const char *path = recursive.items[i].string;
+		const char *slash;
+		int inside = 0;
+
+		/* a directory inside of another one is already included */
+		for (slash = strchr(path, '/'); slash && !inside;
+		     slash = strchr(slash + 1, '/')) {
+			strbuf_reset(&dir);
+			strbuf_add(&dir, path, slash - path);
+			inside = !!string_list_lookup(&recursive, dir.buf);
+		}
+		if (inside)
+			continue;
+
+		string_list_insert(&all, path)->util = (void *)1;
+		for (slash = strchr(path, '/'); slash;
+		     slash = strchr(slash + 1, '/')) {
+			strbuf_reset(&dir);
+			strbuf_add(&dir, path, slash - path);
+			string_list_insert(&all, dir.buf);
+		}
+	}
+
+	/* the parents sort before their subdirectories */
+	strbuf_addstr(out, "/*\n!/*/\n");
+	for (i = 0; i < all.nr; i++) {
+		strbuf_addf(out, "/%s/\n", all.items[i].string);
+		if (!all.items[i].util)
+			strbuf_addf(out, "!/%s/*/\n", all.items[i].string);
+	}
+
+	strbuf_release(&dir);
+	string_list_clear(&all, 0);
+	string_list_clear(&recursive, 0);
+}
+
+static int sparse_checkout_set(int argc, const char **argv)
+{
+	struct string_list args = STRING_LIST_INIT_DUP;
+	struct strbuf patterns = STRBUF_INIT;
+	int from_stdin = 0, result, i;
+
+	struct option builtin_sparse_checkout_set_options[] = {
+		OPT_BOOL(0, "stdin", &from_stdin,
+			 N_("read patterns from standard in")),
+		OPT_END(),
+	};
+
+	argc = parse_options(argc, argv, NULL,
+			     builtin_sparse_checkout_set_options,
+			     builtin_sparse_checkout_set_usage, 0);
+
+	if (from_stdin) {
+		struct strbuf line = STRBUF_INIT;
+
+		while (strbuf_getline(&line, stdin) != EOF)
+			string_list_append(&args, line.buf);
+		strbuf_release(&line);
+	}
+	for (i = 0; i < argc; i++)
+		string_list_append(&args, argv[i]);
+
+	if (core_sparse_checkout_cone) {
+		cone_patterns_from_dirs(&patterns, &args);
+	} else {
+		for (i = 0; i < args.nr; i++)
+			strbuf_addf(&patterns, "%s\n", args.items[i].string);
+	}
+
+	git_config_set("core.sparseCheckout", "true");
+	result = write_patterns_and_update(&patterns);
+
+	strbuf_release(&patterns);
+	string_list_clear(&args, 0);
+	return result;
+}
+
+static int sparse_checkout_disable(int argc, const char **argv)
+{
+	char *sparse_filename = get_sparse_checkout_filename();
+	struct strbuf patterns = STRBUF_INIT;
+
+	/*
+	 * Check out all of the files before disabling the sparse
+	 * checkout, which would leave the skip-worktree bits alone.
+	 */
+	strbuf_addstr(&patterns, "/*\n");
+	if (write_patterns_and_update(&patterns))
+		die(_("could not check out all of the files"));
+
+	git_config_set("core.sparseCheckout", "false");
+	git_config_set("core.sparseCheckoutCone", NULL);
+	unlink_or_warn(sparse_filename);
+
+	strbuf_release(&patterns);
+	free(sparse_filename);
+	return 0;
+}
+
+int cmd_sparse_checkout(int argc, const char **argv, const char *prefix)
+{
+	static struct option builtin_sparse_checkout_options[] = {
+		OPT_END(),
+	};
+
+	if (argc == 2 && !strcmp(argv[1], "-h"))
+		usage_with_options(builtin_sparse_checkout_usage,
+				   builtin_sparse_checkout_options);
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix,
+			     builtin_sparse_checkout_options,
+			     builtin_sparse_checkout_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (argc > 0) {
+		if (!strcmp(argv[0], "list"))
+			return sparse_checkout_list(argc, argv);
+		if (!strcmp(argv[0], "init"))
+			return sparse_checkout_init(argc, argv);
+		if (!strcmp(argv[0], "set"))
+			return sparse_checkout_set(argc, argv);
+		if (!strcmp(argv[0], "disable"))
+			return sparse_checkout_disable(argc, argv);
+	}
+
+	usage_with_options(builtin_sparse_checkout_usage,
+			   builtin_sparse_checkout_options);
+}
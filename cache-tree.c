@@ -44,7 +44,7 @@ static int subtree_name_cmp(const char *one, int onelen,
 	return memcmp(one, two, onelen);
 }
 
-static int subtree_pos(struct cache_tree *it, const char *path, int pathlen)
+int cache_tree_subtree_pos(struct cache_tree *it, const char *path, int pathlen)
 {
 	struct cache_tree_sub **down = it->down;
 	int lo, hi;
@@ -71,7 +71,7 @@ static struct cache_tree_sub *find_subtree(struct cache_tree *it,
 					   int create)
 {
 	struct cache_tree_sub *down;
-	int pos = subtree_pos(it, path, pathlen);
+	int pos = cache_tree_subtree_pos(it, path, pathlen);
 	if (0 <= pos)
 		return it->down[pos];
 	if (!create)
@@ -122,7 +122,7 @@ static int do_invalidate_path(struct cache_tree *it, const char *path)
 	it->entry_count = -1;
 	if (!*slash) {
 		int pos;
-		pos = subtree_pos(it, path, namelen);
+		pos = cache_tree_subtree_pos(it, path, namelen);
 		if (0 <= pos) {
 			cache_tree_free(&it->down[pos]->cache_tree);
 			free(it->down[pos]);
@@ -293,12 +293,22 @@ static int update_one(struct cache_tree *it,
 		sub = find_subtree(it, path + baselen, sublen, 1);
 		if (!sub->cache_tree)
 			sub->cache_tree = cache_tree();
-		subcnt = update_one(sub->cache_tree,
-				    cache + i, entries - i,
-				    path,
-				    baselen + sublen + 1,
-				    &subskip,
-				    flags);
+		if (S_ISSPARSEDIR(ce->ce_mode) &&
+		    pathlen == baselen + sublen + 1) {
+			/* a sparse directory entry is the whole subtree */
+			cache_tree_free(&sub->cache_tree);
+			sub->cache_tree = cache_tree();
+			oidcpy(&sub->cache_tree->oid, &ce->oid);
+			sub->cache_tree->entry_count = 1;
+			subcnt = 1;
+			subskip = 0;
+		} else
+			subcnt = update_one(sub->cache_tree,
+					    cache + i, entries - i,
+					    path,
+					    baselen + sublen + 1,
+					    &subskip,
+					    flags);
 		if (subcnt < 0)
 			return subcnt;
 		if (!subcnt)
@@ -579,7 +589,7 @@ struct cache_tree *cache_tree_read(const char *buffer, unsigned long size)
 	return read_one(&buffer, &size);
 }
 
-static struct cache_tree *cache_tree_find(struct cache_tree *it, const char *path)
+struct cache_tree *cache_tree_find(struct cache_tree *it, const char *path)
 {
 	if (!it)
 		return NULL;
@@ -743,6 +753,12 @@ static void verify_one(struct index_state *istate,
 
 	if (path->len) {
 		pos = index_name_pos(istate, path->buf, path->len);
+		if (pos >= 0) {
+			/* a sparse directory entry, checked by its parent */
+			if (!S_ISSPARSEDIR(istate->cache[pos]->ce_mode))
+				BUG("cache-tree for file %s", path->buf);
+			return;
+		}
 		pos = -pos - 1;
 	} else {
 		pos = 0;
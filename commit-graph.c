@@ -13,12 +13,16 @@
 #include "commit-graph.h"
 #include "object-store.h"
 #include "alloc.h"
+#include "bloom.h"
 
 #define GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
 #define GRAPH_CHUNKID_OIDFANOUT 0x4f494446 /* "OIDF" */
 #define GRAPH_CHUNKID_OIDLOOKUP 0x4f49444c /* "OIDL" */
 #define GRAPH_CHUNKID_DATA 0x43444154 /* "CDAT" */
 #define GRAPH_CHUNKID_LARGEEDGES 0x45444745 /* "EDGE" */
+#define GRAPH_CHUNKID_BLOOMINDEXES 0x42494458 /* "BIDX" */
+#define GRAPH_CHUNKID_BLOOMDATA 0x42444154 /* "BDAT" */
+#define GRAPH_CHUNKID_BASE 0x42415345 /* "BASE" */
 
 #define GRAPH_DATA_WIDTH 36
 
@@ -48,6 +52,18 @@ char *get_commit_graph_filename(const char *obj_dir)
 	return xstrfmt("%s/info/commit-graph", obj_dir);
 }
 
+static char *get_split_graph_filename(const char *obj_dir,
+				      const char *oid_hex)
+{
+	return xstrfmt("%s/info/commit-graphs/graph-%s.graph",
+		       obj_dir, oid_hex);
+}
+
+char *get_commit_graph_chain_filename(const char *obj_dir)
+{
+	return xstrfmt("%s/info/commit-graphs/commit-graph-chain", obj_dir);
+}
+
 static struct commit_graph *alloc_commit_graph(void)
 {
 	struct commit_graph *g = xcalloc(1, sizeof(*g));
@@ -110,9 +126,12 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 
 	graph->hash_len = GRAPH_OID_LEN;
 	graph->num_chunks = *(unsigned char*)(data + 6);
+	graph->num_base_graphs = *(unsigned char*)(data + 7);
 	graph->graph_fd = fd;
 	graph->data = graph_map;
 	graph->data_len = graph_size;
+	graph->filename = xstrdup(graph_file);
+	hashcpy(graph->oid.hash, data + graph_size - graph->hash_len);
 
 	last_chunk_id = 0;
 	last_chunk_offset = 8;
@@ -120,9 +139,11 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 	for (i = 0; i < graph->num_chunks; i++) {
 		uint32_t chunk_id = get_be32(chunk_lookup + 0);
 		uint64_t chunk_offset = get_be64(chunk_lookup + 4);
+		uint64_t next_chunk_offset;
 		int chunk_repeated = 0;
 
 		chunk_lookup += GRAPH_CHUNKLOOKUP_WIDTH;
+		next_chunk_offset = get_be64(chunk_lookup + 4);
 
 		if (chunk_offset > graph_size - GIT_MAX_RAWSZ) {
 			error(_("improper chunk offset %08x%08x"), (uint32_t)(chunk_offset >> 32),
@@ -158,6 +179,30 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 			else
 				graph->chunk_large_edges = data + chunk_offset;
 			break;
+
+		case GRAPH_CHUNKID_BASE:
+			if (graph->chunk_base_graphs)
+				chunk_repeated = 1;
+			else
+				graph->chunk_base_graphs = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			if (graph->chunk_bloom_indexes)
+				chunk_repeated = 1;
+			else
+				graph->chunk_bloom_indexes = data + chunk_offset;
+			break;
+
+		case GRAPH_CHUNKID_BLOOMDATA:
+			if (graph->chunk_bloom_data)
+				chunk_repeated = 1;
+			else if (next_chunk_offset >= chunk_offset + BLOOMDATA_CHUNK_HEADER_SIZE &&
+				 next_chunk_offset <= graph_size) {
+				graph->chunk_bloom_data = data + chunk_offset;
+				graph->chunk_bloom_data_len = next_chunk_offset - chunk_offset;
+			}
+			break;
 		}
 
 		if (chunk_repeated) {
@@ -175,6 +220,26 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 		last_chunk_offset = chunk_offset;
 	}
 
+	if (graph->chunk_bloom_indexes && graph->chunk_bloom_data) {
+		uint32_t hash_version = get_be32(graph->chunk_bloom_data);
+
+		/*
+		 * Filters written with an unknown hashing scheme cannot
+		 * answer our queries; behave as if there were none.
+		 */
+		if (hash_version == 1) {
+			graph->bloom_filter_settings = xmalloc(sizeof(struct bloom_filter_settings));
+			graph->bloom_filter_settings->hash_version = hash_version;
+			graph->bloom_filter_settings->num_hashes = get_be32(graph->chunk_bloom_data + 4);
+			graph->bloom_filter_settings->bits_per_entry = get_be32(graph->chunk_bloom_data + 8);
+		}
+	}
+	if (!graph->bloom_filter_settings) {
+		graph->chunk_bloom_indexes = NULL;
+		graph->chunk_bloom_data = NULL;
+		graph->chunk_bloom_data_len = 0;
+	}
+
 	return graph;
 
 cleanup_fail:
@@ -183,18 +248,125 @@ struct commit_graph *load_commit_graph_one(const char *graph_file)
 	exit(1);
 }
 
-static void prepare_commit_graph_one(struct repository *r, const char *obj_dir)
+/*
+ * Make 'chain' the base of 'g', after checking that the base graphs
+ * recorded in 'g' are exactly the first 'n' entries of 'oids', which
+ * are the layers of 'chain' from the bottom up.
+ */
+static int add_graph_to_chain(struct commit_graph *g,
+			      struct commit_graph *chain,
+			      struct object_id *oids,
+			      int n)
 {
-	char *graph_name;
+	struct commit_graph *cur_g = chain;
+
+	if (g->num_base_graphs != n) {
+		warning(_("commit-graph %s has %d base graphs, expected %d"),
+			g->filename, g->num_base_graphs, n);
+		return 0;
+	}
+	if (n && !g->chunk_base_graphs) {
+		warning(_("commit-graph %s has no base graphs chunk"),
+			g->filename);
+		return 0;
+	}
 
+	while (n) {
+		n--;
+		if (!cur_g ||
+		    !oideq(&oids[n], &cur_g->oid) ||
+		    !hasheq(oids[n].hash, g->chunk_base_graphs + g->hash_len * n)) {
+			warning(_("commit-graph chain does not match"));
+			return 0;
+		}
+		cur_g = cur_g->base_graph;
+	}
+
+	g->base_graph = chain;
+	if (chain)
+		g->num_commits_in_base = chain->num_commits + chain->num_commits_in_base;
+
+	return 1;
+}
+
+static struct commit_graph *load_commit_graph_chain(const char *obj_dir)
+{
+	struct commit_graph *graph_chain = NULL;
+	struct strbuf line = STRBUF_INIT;
+	struct stat st;
+	struct object_id *oids = NULL;
+	int i, valid = 1;
+	size_t alloc = 0;
+	char *chain_name = get_commit_graph_chain_filename(obj_dir);
+	FILE *fp;
+
+	fp = fopen(chain_name, "r");
+	free(chain_name);
+	if (!fp)
+		return NULL;
+
+	if (fstat(fileno(fp), &st) < 0 ||
+	    st.st_size <= the_hash_algo->hexsz) {
+		fclose(fp);
+		return NULL;
+	}
+
+	for (i = 0; strbuf_getline_lf(&line, fp) != EOF; i++) {
+		struct commit_graph *g;
+		char *graph_name;
+
+		ALLOC_GROW(oids, i + 1, alloc);
+		if (get_oid_hex(line.buf, &oids[i])) {
+			warning(_("invalid commit-graph chain: line '%s' not a hash"),
+				line.buf);
+			valid = 0;
+			break;
+		}
+
+		graph_name = get_split_graph_filename(obj_dir, line.buf);
+		g = load_commit_graph_one(graph_name);
+		free(graph_name);
+
+		if (g && add_graph_to_chain(g, graph_chain, oids, i)) {
+			g->obj_dir = xstrdup(obj_dir);
+			graph_chain = g;
+		} else {
+			free_commit_graph(g);
+			valid = 0;
+			break;
+		}
+	}
+
+	if (!valid)
+		warning(_("unable to find all commit-graph files"));
+
+	free(oids);
+	fclose(fp);
+	strbuf_release(&line);
+
+	return graph_chain;
+}
+
+struct commit_graph *read_commit_graph_one(const char *obj_dir)
+{
+	char *graph_name = get_commit_graph_filename(obj_dir);
+	struct commit_graph *g = load_commit_graph_one(graph_name);
+
+	free(graph_name);
+	if (g)
+		g->obj_dir = xstrdup(obj_dir);
+	else
+		g = load_commit_graph_chain(obj_dir);
+
+	return g;
+}
+
+static void prepare_commit_graph_one(struct repository *r, const char *obj_dir)
+{
 	if (r->objects->commit_graph)
 		return;
 
-	graph_name = get_commit_graph_filename(obj_dir);
-	r->objects->commit_graph =
-		load_commit_graph_one(graph_name);
-
-	FREE_AND_NULL(graph_name);
+	r->objects->commit_graph = read_commit_graph_one(obj_dir);
 }
 
 /*
@@ -203,7 +375,7 @@ static void prepare_commit_graph_one(struct repository *r, const char *obj_dir)
  * On the first invocation, this function attemps to load the commit
  * graph if the_repository is configured to have one.
  */
-static int prepare_commit_graph(struct repository *r)
+int prepare_commit_graph(struct repository *r)
 {
 	struct alternate_object_database *alt;
 	char *obj_dir;
@@ -258,23 +430,64 @@ static void close_commit_graph(void)
 	the_repository->objects->commit_graph = NULL;
 }
 
-static int bsearch_graph(struct commit_graph *g, struct object_id *oid, uint32_t *pos)
+static int bsearch_graph(struct commit_graph *g, const struct object_id *oid, uint32_t *pos)
 {
 	return bsearch_hash(oid->hash, g->chunk_oid_fanout,
 			    g->chunk_oid_lookup, g->hash_len, pos);
 }
 
+/*
+ * Look 'oid' up in 'g' and all of its base layers, and return its
+ * position in the whole chain in 'pos'.
+ */
+static int bsearch_graph_chain(struct commit_graph *g,
+			       const struct object_id *oid,
+			       uint32_t *pos)
+{
+	uint32_t lex_index;
+
+	for (; g; g = g->base_graph) {
+		if (bsearch_graph(g, oid, &lex_index)) {
+			*pos = lex_index + g->num_commits_in_base;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Return the layer of the chain 'g' that holds position 'pos', and
+ * the position within that layer in 'lex_index'.
+ */
+static struct commit_graph *graph_layer_for_pos(struct commit_graph *g,
+						uint32_t pos,
+						uint32_t *lex_index)
+{
+	while (g && pos < g->num_commits_in_base)
+		g = g->base_graph;
+
+	if (!g)
+		BUG("NULL commit-graph");
+	if (pos >= g->num_commits + g->num_commits_in_base)
+		die(_("invalid commit position. commit-graph is likely corrupt"));
+
+	*lex_index = pos - g->num_commits_in_base;
+	return g;
+}
+
 static struct commit_list **insert_parent_or_die(struct commit_graph *g,
 						 uint64_t pos,
 						 struct commit_list **pptr)
 {
 	struct commit *c;
 	struct object_id oid;
+	uint32_t lex_index;
 
-	if (pos >= g->num_commits)
+	if (pos >= g->num_commits + g->num_commits_in_base)
 		die("invalid parent position %"PRIu64, pos);
 
-	hashcpy(oid.hash, g->chunk_oid_lookup + g->hash_len * pos);
+	g = graph_layer_for_pos(g, pos, &lex_index);
+	hashcpy(oid.hash, g->chunk_oid_lookup + g->hash_len * lex_index);
 	c = lookup_commit(the_repository, &oid);
 	if (!c)
 		die(_("could not find commit %s"), oid_to_hex(&oid));
@@ -284,7 +497,11 @@ static struct commit_list **insert_parent_or_die(struct commit_graph *g,
 
 static void fill_commit_graph_info(struct commit *item, struct commit_graph *g, uint32_t pos)
 {
-	const unsigned char *commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * pos;
+	const unsigned char *commit_data;
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, pos, &lex_index);
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 	item->graph_pos = pos;
 	item->generation = get_be32(commit_data + g->hash_len + 8) >> 2;
 }
@@ -295,7 +512,11 @@ static int fill_commit_in_graph(struct commit *item, struct commit_graph *g, uin
 	uint32_t *parent_data_ptr;
 	uint64_t date_low, date_high;
 	struct commit_list **pptr;
-	const unsigned char *commit_data = g->chunk_commit_data + (g->hash_len + 16) * pos;
+	const unsigned char *commit_data;
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, pos, &lex_index);
+	commit_data = g->chunk_commit_data + (g->hash_len + 16) * lex_index;
 
 	item->object.parsed = 1;
 	item->graph_pos = pos;
@@ -342,7 +563,7 @@ static int find_commit_in_graph(struct commit *item, struct commit_graph *g, uin
 		*pos = item->graph_pos;
 		return 1;
 	} else {
-		return bsearch_graph(g, &(item->object.oid), pos);
+		return bsearch_graph_chain(g, &(item->object.oid), pos);
 	}
 }
 
@@ -378,8 +599,11 @@ void load_commit_graph_info(struct repository *r, struct commit *item)
 static struct tree *load_tree_for_commit(struct commit_graph *g, struct commit *c)
 {
 	struct object_id oid;
-	const unsigned char *commit_data = g->chunk_commit_data +
-					   GRAPH_DATA_WIDTH * (c->graph_pos);
+	const unsigned char *commit_data;
+	uint32_t lex_index;
+
+	g = graph_layer_for_pos(g, c->graph_pos, &lex_index);
+	commit_data = g->chunk_commit_data + GRAPH_DATA_WIDTH * lex_index;
 
 	hashcpy(oid.hash, commit_data);
 	c->maybe_tree = lookup_tree(the_repository, &oid);
@@ -442,8 +666,29 @@ static const unsigned char *commit_to_sha1(size_t index, void *table)
 	return commits[index]->object.oid.hash;
 }
 
+/*
+ * Return the position 'parent' will have in the graph being written,
+ * which consists of 'commits' on top of the layers in 'base' (if any),
+ * or GRAPH_PARENT_MISSING if it is in neither.
+ */
+static int graph_edge_position(struct commit *parent,
+			       struct commit **commits, int nr_commits,
+			       struct commit_graph *base)
+{
+	int pos = sha1_pos(parent->object.oid.hash, commits, nr_commits,
+			   commit_to_sha1);
+	uint32_t base_pos;
+
+	if (pos >= 0)
+		return pos + (base ? base->num_commits + base->num_commits_in_base : 0);
+	if (base && bsearch_graph_chain(base, &parent->object.oid, &base_pos))
+		return base_pos;
+	return GRAPH_PARENT_MISSING;
+}
+
 static void write_graph_chunk_data(struct hashfile *f, int hash_len,
-				   struct commit **commits, int nr_commits)
+				   struct commit **commits, int nr_commits,
+				   struct commit_graph *base)
 {
 	struct commit **list = commits;
 	struct commit **last = commits + nr_commits;
@@ -461,15 +706,9 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 
 		if (!parent)
 			edge_value = GRAPH_PARENT_NONE;
-		else {
-			edge_value = sha1_pos(parent->item->object.oid.hash,
-					      commits,
-					      nr_commits,
-					      commit_to_sha1);
-
-			if (edge_value < 0)
-				edge_value = GRAPH_PARENT_MISSING;
-		}
+		else
+			edge_value = graph_edge_position(parent->item, commits,
+							 nr_commits, base);
 
 		hashwrite_be32(f, edge_value);
 
@@ -480,14 +719,9 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 			edge_value = GRAPH_PARENT_NONE;
 		else if (parent->next)
 			edge_value = GRAPH_OCTOPUS_EDGES_NEEDED | num_extra_edges;
-		else {
-			edge_value = sha1_pos(parent->item->object.oid.hash,
-					      commits,
-					      nr_commits,
-					      commit_to_sha1);
-			if (edge_value < 0)
-				edge_value = GRAPH_PARENT_MISSING;
-		}
+		else
+			edge_value = graph_edge_position(parent->item, commits,
+							 nr_commits, base);
 
 		hashwrite_be32(f, edge_value);
 
@@ -512,9 +746,66 @@ static void write_graph_chunk_data(struct hashfile *f, int hash_len,
 	}
 }
 
+static void write_graph_chunk_bloom_indexes(struct hashfile *f,
+					    struct commit **commits,
+					    int nr_commits)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+	uint32_t cur_pos = 0;
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(the_repository, *list, 0);
+		cur_pos += filter->len;
+		hashwrite_be32(f, cur_pos);
+		list++;
+	}
+}
+
+static void write_graph_chunk_bloom_data(struct hashfile *f,
+					 struct commit **commits,
+					 int nr_commits,
+					 const struct bloom_filter_settings *settings)
+{
+	struct commit **list = commits;
+	struct commit **last = commits + nr_commits;
+
+	hashwrite_be32(f, settings->hash_version);
+	hashwrite_be32(f, settings->num_hashes);
+	hashwrite_be32(f, settings->bits_per_entry);
+
+	while (list < last) {
+		struct bloom_filter *filter = get_bloom_filter(the_repository, *list, 0);
+		hashwrite(f, filter->data, filter->len * sizeof(unsigned char));
+		list++;
+	}
+}
+
+static size_t compute_bloom_filters(struct commit **commits, int nr_commits)
+{
+	int i;
+	size_t total_size = 0;
+
+	for (i = 0; i < nr_commits; i++) {
+		struct bloom_filter *filter =
+			get_bloom_filter(the_repository, commits[i], 1);
+
+		if (!filter)
+			die(_("unable to compute changed-path Bloom filter for %s"),
+			    oid_to_hex(&commits[i]->object.oid));
+		total_size += filter->len;
+	}
+
+	if (total_size > UINT32_MAX)
+		die(_("changed-path Bloom filters are too large to be written"));
+
+	return total_size;
+}
+
 static void write_graph_chunk_large_edges(struct hashfile *f,
 					  struct commit **commits,
-					  int nr_commits)
+					  int nr_commits,
+					  struct commit_graph *base)
 {
 	struct commit **list = commits;
 	struct commit **last = commits + nr_commits;
@@ -533,14 +824,11 @@ static void write_graph_chunk_large_edges(struct hashfile *f,
 
 		/* Since num_parents > 2, this initializer is safe. */
 		for (parent = (*list)->parents->next; parent; parent = parent->next) {
-			int edge_value = sha1_pos(parent->item->object.oid.hash,
-						  commits,
-						  nr_commits,
-						  commit_to_sha1);
-
-			if (edge_value < 0)
-				edge_value = GRAPH_PARENT_MISSING;
-			else if (!parent->next)
+			int edge_value = graph_edge_position(parent->item,
+							     commits, nr_commits,
+							     base);
+
+			if (edge_value != GRAPH_PARENT_MISSING && !parent->next)
 				edge_value |= GRAPH_LAST_EDGE;
 
 			hashwrite_be32(f, edge_value);
@@ -606,10 +894,17 @@ static void add_missing_parents(struct packed_oid_list *oids, struct commit *com
 	}
 }
 
-static void close_reachable(struct packed_oid_list *oids)
+/*
+ * Add the missing ancestors of the commits in 'oids'.  The walk does
+ * not go past commits found in 'stop_at' (if not NULL), as those are
+ * already in a commit-graph layer.
+ */
+static void close_reachable(struct packed_oid_list *oids,
+			    struct commit_graph *stop_at)
 {
 	int i;
 	struct commit *commit;
+	uint32_t pos;
 
 	for (i = 0; i < oids->nr; i++) {
 		commit = lookup_commit(the_repository, &oids->list[i]);
@@ -623,6 +918,9 @@ static void close_reachable(struct packed_oid_list *oids)
 	 * closure.
 	 */
 	for (i = 0; i < oids->nr; i++) {
+		if (stop_at && bsearch_graph_chain(stop_at, &oids->list[i], &pos))
+			continue;
+
 		commit = lookup_commit(the_repository, &oids->list[i]);
 
 		if (commit && !parse_commit(commit))
@@ -686,19 +984,121 @@ static int add_ref_to_list(const char *refname,
 	return 0;
 }
 
-void write_commit_graph_reachable(const char *obj_dir, int append)
+void write_commit_graph_reachable(const char *obj_dir, unsigned int flags,
+				  const struct split_commit_graph_opts *split_opts)
 {
 	struct string_list list;
 
 	string_list_init(&list, 1);
 	for_each_ref(add_ref_to_list, &list);
-	write_commit_graph(obj_dir, NULL, &list, append);
+	write_commit_graph(obj_dir, NULL, &list, flags, split_opts);
+}
+
+/*
+ * Decide how many of the top-most layers of 'g' are merged into the
+ * new layer of 'num_commits' commits, and return the first layer that
+ * is kept as its base (or NULL if everything is merged).  A layer is
+ * merged while it is not much bigger than what is being written on top
+ * of it, so that the chain stays logarithmic in the number of commits
+ * while small writes only produce small layers.
+ */
+static struct commit_graph *split_graph_merge_strategy(struct commit_graph *g,
+						       uint32_t num_commits,
+						       const struct split_commit_graph_opts *opts)
+{
+	uint64_t size_mult = 2;
+	uint32_t max_commits = 0;
+
+	if (opts) {
+		if (opts->size_multiple > 0)
+			size_mult = opts->size_multiple;
+		if (opts->max_commits > 0)
+			max_commits = opts->max_commits;
+	}
+
+	while (g && (g->num_commits <= size_mult * num_commits ||
+		     (max_commits && num_commits > max_commits))) {
+		num_commits += g->num_commits;
+		g = g->base_graph;
+	}
+
+	return g;
+}
+
+/*
+ * Remove the layers in the "info/commit-graphs" directory of 'obj_dir'
+ * that are not listed in 'keep' and were not modified after
+ * 'expire_time'.
+ */
+static void expire_commit_graphs(const char *obj_dir,
+				 struct string_list *keep,
+				 timestamp_t expire_time)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	size_t dirnamelen;
+	DIR *dir;
+
+	strbuf_addf(&path, "%s/info/commit-graphs", obj_dir);
+	dir = opendir(path.buf);
+	if (!dir) {
+		strbuf_release(&path);
+		return;
+	}
+
+	strbuf_addch(&path, '/');
+	dirnamelen = path.len;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (!starts_with(de->d_name, "graph-") ||
+		    !ends_with(de->d_name, ".graph"))
+			continue;
+		if (unsorted_string_list_has_string(keep, de->d_name))
+			continue;
+
+		strbuf_setlen(&path, dirnamelen);
+		strbuf_addstr(&path, de->d_name);
+		if (stat(path.buf, &st) < 0 || st.st_mtime > expire_time)
+			continue;
+
+		unlink_or_warn(path.buf);
+	}
+
+	closedir(dir);
+	strbuf_release(&path);
+}
+
+static void fill_base_generation_numbers(struct packed_commit_list *commits,
+					 struct commit_graph *base)
+{
+	int i;
+	uint32_t pos;
+	struct commit_list *parent;
+
+	/*
+	 * Parents that live in the base layers may have been parsed from
+	 * the object database; read their generation numbers from the
+	 * graph instead of walking all of their history again.
+	 */
+	for (i = 0; i < commits->nr; i++) {
+		for (parent = commits->list[i]->parents; parent; parent = parent->next) {
+			struct commit *p = parent->item;
+
+			if (p->generation != GENERATION_NUMBER_INFINITY &&
+			    p->generation != GENERATION_NUMBER_ZERO)
+				continue;
+			if (bsearch_graph_chain(base, &p->object.oid, &pos))
+				fill_commit_graph_info(p, base, pos);
+		}
+	}
 }
 
 void write_commit_graph(const char *obj_dir,
 			struct string_list *pack_indexes,
 			struct string_list *commit_hex,
-			int append)
+			unsigned int flags,
+			const struct split_commit_graph_opts *split_opts)
 {
 	struct packed_oid_list oids;
 	struct packed_commit_list commits;
@@ -706,32 +1106,50 @@ void write_commit_graph(const char *obj_dir,
 	uint32_t i, count_distinct = 0;
 	char *graph_name;
 	struct lock_file lk = LOCK_INIT;
-	uint32_t chunk_ids[5];
-	uint64_t chunk_offsets[5];
+	struct lock_file chain_lk = LOCK_INIT;
+	uint32_t chunk_ids[8];
+	uint64_t chunk_offsets[8];
 	int num_chunks;
 	int num_extra_edges;
 	struct commit_list *parent;
+	int append = flags & COMMIT_GRAPH_APPEND;
+	int split = flags & COMMIT_GRAPH_SPLIT;
+	int write_bloom = flags & COMMIT_GRAPH_WRITE_BLOOM_FILTERS;
+	struct bloom_filter_settings bloom_settings = DEFAULT_BLOOM_FILTER_SETTINGS;
+	size_t total_bloom_filter_size = 0;
+	struct commit_graph *existing = NULL, *base = NULL, *g;
+	uint32_t num_commits_in_base = 0;
+	int num_base_graphs = 0, single_graph_is_base = 0;
+	struct object_id *base_oids = NULL;
+	struct object_id file_hash;
+	struct string_list keep = STRING_LIST_INIT_DUP;
 
 	oids.nr = 0;
 	oids.alloc = approximate_object_count() / 4;
 
-	if (append) {
+	if (append || split) {
 		prepare_commit_graph_one(the_repository, obj_dir);
-		if (the_repository->objects->commit_graph)
-			oids.alloc += the_repository->objects->commit_graph->num_commits;
+		existing = the_repository->objects->commit_graph;
 	}
 
+	/* The layers of another object directory cannot be built upon. */
+	if (split && existing && strcmp(existing->obj_dir, obj_dir))
+		existing = NULL;
+
+	if (append && !split && existing)
+		oids.alloc += existing->num_commits + existing->num_commits_in_base;
+
 	if (oids.alloc < 1024)
 		oids.alloc = 1024;
 	ALLOC_ARRAY(oids.list, oids.alloc);
 
-	if (append && the_repository->objects->commit_graph) {
-		struct commit_graph *commit_graph =
-			the_repository->objects->commit_graph;
-		for (i = 0; i < commit_graph->num_commits; i++) {
-			const unsigned char *hash = commit_graph->chunk_oid_lookup +
-				commit_graph->hash_len * i;
-			hashcpy(oids.list[oids.nr++].hash, hash);
+	if (append && !split) {
+		for (g = existing; g; g = g->base_graph) {
+			for (i = 0; i < g->num_commits; i++) {
+				const unsigned char *hash = g->chunk_oid_lookup +
+					g->hash_len * i;
+				hashcpy(oids.list[oids.nr++].hash, hash);
+			}
 		}
 	}
 
@@ -778,17 +1196,62 @@ void write_commit_graph(const char *obj_dir,
 	if (!pack_indexes && !commit_hex)
 		for_each_packed_object(add_packed_commits, &oids, 0);
 
-	close_reachable(&oids);
+	close_reachable(&oids, split ? existing : NULL);
 
 	QSORT(oids.list, oids.nr, commit_compare);
 
-	count_distinct = 1;
-	for (i = 1; i < oids.nr; i++) {
-		if (!oideq(&oids.list[i - 1], &oids.list[i]))
-			count_distinct++;
+	/*
+	 * Drop duplicates and, when writing a new layer, the commits that
+	 * are already in the existing layers.
+	 */
+	for (i = 0; i < oids.nr; i++) {
+		uint32_t pos;
+
+		if (count_distinct &&
+		    oideq(&oids.list[count_distinct - 1], &oids.list[i]))
+			continue;
+		if (split && existing &&
+		    bsearch_graph_chain(existing, &oids.list[i], &pos))
+			continue;
+		oidcpy(&oids.list[count_distinct++], &oids.list[i]);
+	}
+	oids.nr = count_distinct;
+
+	if (split) {
+		if (!oids.nr) {
+			/* nothing new to write; leave the chain alone */
+			free(oids.list);
+			return;
+		}
+
+		base = split_graph_merge_strategy(existing, oids.nr, split_opts);
+		for (g = existing; g != base; g = g->base_graph) {
+			ALLOC_GROW(oids.list, oids.nr + g->num_commits, oids.alloc);
+			for (i = 0; i < g->num_commits; i++) {
+				const unsigned char *hash = g->chunk_oid_lookup +
+					g->hash_len * i;
+				hashcpy(oids.list[oids.nr++].hash, hash);
+			}
+		}
+		QSORT(oids.list, oids.nr, commit_compare);
+		count_distinct = oids.nr;
+
+		for (g = base; g; g = g->base_graph)
+			num_base_graphs++;
+		ALLOC_ARRAY(base_oids, num_base_graphs);
+		for (g = base, i = num_base_graphs; g; g = g->base_graph)
+			oidcpy(&base_oids[--i], &g->oid);
+
+		if (base) {
+			char *single_graph_name = get_commit_graph_filename(obj_dir);
+
+			num_commits_in_base = base->num_commits + base->num_commits_in_base;
+			single_graph_is_base = !strcmp(base->filename, single_graph_name);
+			free(single_graph_name);
+		}
 	}
 
-	if (count_distinct >= GRAPH_PARENT_MISSING)
+	if (count_distinct >= GRAPH_PARENT_MISSING - num_commits_in_base)
 		die(_("the commit graph format cannot write %d commits"), count_distinct);
 
 	commits.nr = 0;
@@ -798,8 +1261,6 @@ void write_commit_graph(const char *obj_dir,
 	num_extra_edges = 0;
 	for (i = 0; i < oids.nr; i++) {
 		int num_parents = 0;
-		if (i > 0 && oideq(&oids.list[i - 1], &oids.list[i]))
-			continue;
 
 		commits.list[commits.nr] = lookup_commit(the_repository, &oids.list[i]);
 		parse_commit(commits.list[commits.nr]);
@@ -813,42 +1274,116 @@ void write_commit_graph(const char *obj_dir,
 
 		commits.nr++;
 	}
-	num_chunks = num_extra_edges ? 4 : 3;
-
-	if (commits.nr >= GRAPH_PARENT_MISSING)
-		die(_("too many commits to write graph"));
 
+	if (base)
+		fill_base_generation_numbers(&commits, base);
 	compute_generation_numbers(&commits);
 
-	graph_name = get_commit_graph_filename(obj_dir);
-	if (safe_create_leading_directories(graph_name))
-		die_errno(_("unable to create leading directories of %s"),
-			  graph_name);
+	if (git_env_bool(GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS, 0))
+		write_bloom = 1;
+	if (write_bloom) {
+		/*
+		 * Filters that are reused from the existing graph were
+		 * built with its settings, and get_bloom_filter() computes
+		 * the missing ones with the same, so record those.
+		 */
+		prepare_commit_graph(the_repository);
+		g = the_repository->objects->commit_graph;
+		if (g && g->bloom_filter_settings)
+			bloom_settings = *g->bloom_filter_settings;
+		total_bloom_filter_size = compute_bloom_filters(commits.list,
+								commits.nr);
+	}
 
-	hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
-	f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	if (split) {
+		char *lock_name = get_commit_graph_chain_filename(obj_dir);
+		int fd;
+
+		if (safe_create_leading_directories(lock_name))
+			die_errno(_("unable to create leading directories of %s"),
+				  lock_name);
+		hold_lock_file_for_update(&lk, lock_name, LOCK_DIE_ON_ERROR);
+		free(lock_name);
+
+		graph_name = xstrfmt("%s/info/commit-graphs/tmp_graph_XXXXXX", obj_dir);
+		fd = git_mkstemp_mode(graph_name, 0444);
+		if (fd < 0)
+			die_errno(_("unable to create '%s'"), graph_name);
+		f = hashfd(fd, graph_name);
+	} else {
+		char *chain_name = get_commit_graph_chain_filename(obj_dir);
 
-	hashwrite_be32(f, GRAPH_SIGNATURE);
+		/*
+		 * Keep "--split" writers from committing a chain while the
+		 * single file replaces it.
+		 */
+		if (safe_create_leading_directories(chain_name))
+			die_errno(_("unable to create leading directories of %s"),
+				  chain_name);
+		hold_lock_file_for_update(&chain_lk, chain_name, LOCK_DIE_ON_ERROR);
+		free(chain_name);
+
+		graph_name = get_commit_graph_filename(obj_dir);
+		if (safe_create_leading_directories(graph_name))
+			die_errno(_("unable to create leading directories of %s"),
+				  graph_name);
+
+		hold_lock_file_for_update(&lk, graph_name, LOCK_DIE_ON_ERROR);
+		f = hashfd(lk.tempfile->fd, lk.tempfile->filename.buf);
+	}
 
-	hashwrite_u8(f, GRAPH_VERSION);
-	hashwrite_u8(f, GRAPH_OID_VERSION);
-	hashwrite_u8(f, num_chunks);
-	hashwrite_u8(f, 0); /* unused padding byte */
+	hashwrite_be32(f, GRAPH_SIGNATURE);
 
+	num_chunks = 3;
 	chunk_ids[0] = GRAPH_CHUNKID_OIDFANOUT;
 	chunk_ids[1] = GRAPH_CHUNKID_OIDLOOKUP;
 	chunk_ids[2] = GRAPH_CHUNKID_DATA;
 	if (num_extra_edges)
-		chunk_ids[3] = GRAPH_CHUNKID_LARGEEDGES;
-	else
-		chunk_ids[3] = 0;
-	chunk_ids[4] = 0;
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_LARGEEDGES;
+	if (write_bloom) {
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_BLOOMINDEXES;
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_BLOOMDATA;
+	}
+	if (num_base_graphs)
+		chunk_ids[num_chunks++] = GRAPH_CHUNKID_BASE;
+	chunk_ids[num_chunks] = 0;
 
 	chunk_offsets[0] = 8 + (num_chunks + 1) * GRAPH_CHUNKLOOKUP_WIDTH;
-	chunk_offsets[1] = chunk_offsets[0] + GRAPH_FANOUT_SIZE;
-	chunk_offsets[2] = chunk_offsets[1] + GRAPH_OID_LEN * commits.nr;
-	chunk_offsets[3] = chunk_offsets[2] + (GRAPH_OID_LEN + 16) * commits.nr;
-	chunk_offsets[4] = chunk_offsets[3] + 4 * num_extra_edges;
+	for (i = 0; i < num_chunks; i++) {
+		uint64_t size;
+
+		switch (chunk_ids[i]) {
+		case GRAPH_CHUNKID_OIDFANOUT:
+			size = GRAPH_FANOUT_SIZE;
+			break;
+		case GRAPH_CHUNKID_OIDLOOKUP:
+			size = GRAPH_OID_LEN * commits.nr;
+			break;
+		case GRAPH_CHUNKID_DATA:
+			size = (GRAPH_OID_LEN + 16) * commits.nr;
+			break;
+		case GRAPH_CHUNKID_LARGEEDGES:
+			size = 4 * num_extra_edges;
+			break;
+		case GRAPH_CHUNKID_BLOOMINDEXES:
+			size = 4 * commits.nr;
+			break;
+		case GRAPH_CHUNKID_BLOOMDATA:
+			size = BLOOMDATA_CHUNK_HEADER_SIZE + total_bloom_filter_size;
+			break;
+		case GRAPH_CHUNKID_BASE:
+			size = GRAPH_OID_LEN * num_base_graphs;
+			break;
+		default:
+			BUG("unknown commit-graph chunk %08x", chunk_ids[i]);
+		}
+		chunk_offsets[i + 1] = chunk_offsets[i] + size;
+	}
+
+	hashwrite_u8(f, GRAPH_VERSION);
+	hashwrite_u8(f, GRAPH_OID_VERSION);
+	hashwrite_u8(f, num_chunks);
+	hashwrite_u8(f, num_base_graphs);
 
 	for (i = 0; i <= num_chunks; i++) {
 		uint32_t chunk_write[3];
@@ -861,13 +1396,80 @@ void write_commit_graph(const char *obj_dir,
 
 	write_graph_chunk_fanout(f, commits.list, commits.nr);
 	write_graph_chunk_oids(f, GRAPH_OID_LEN, commits.list, commits.nr);
-	write_graph_chunk_data(f, GRAPH_OID_LEN, commits.list, commits.nr);
-	write_graph_chunk_large_edges(f, commits.list, commits.nr);
+	write_graph_chunk_data(f, GRAPH_OID_LEN, commits.list, commits.nr, base);
+	write_graph_chunk_large_edges(f, commits.list, commits.nr, base);
+	if (write_bloom) {
+		write_graph_chunk_bloom_indexes(f, commits.list, commits.nr);
+		write_graph_chunk_bloom_data(f, commits.list, commits.nr,
+					     &bloom_settings);
+	}
+	for (i = 0; i < num_base_graphs; i++)
+		hashwrite(f, base_oids[i].hash, GRAPH_OID_LEN);
 
 	close_commit_graph();
-	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
-	commit_lock_file(&lk);
 
+	if (split) {
+		char *final_name;
+		FILE *chain;
+
+		finalize_hashfile(f, file_hash.hash,
+				  CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
+
+		final_name = get_split_graph_filename(obj_dir, oid_to_hex(&file_hash));
+		if (rename(graph_name, final_name))
+			die_errno(_("failed to rename temporary commit-graph file"));
+		free(final_name);
+
+		/* A single commit-graph file that is kept becomes the bottom layer. */
+		if (single_graph_is_base) {
+			char *single_graph_name = get_commit_graph_filename(obj_dir);
+
+			final_name = get_split_graph_filename(obj_dir, oid_to_hex(&base_oids[0]));
+			if (rename(single_graph_name, final_name))
+				die_errno(_("failed to move %s into the commit-graph chain"),
+					  single_graph_name);
+			free(final_name);
+			free(single_graph_name);
+		}
+
+		chain = fdopen_lock_file(&lk, "w");
+		if (!chain)
+			die_errno(_("unable to write commit-graph chain"));
+		for (i = 0; i < num_base_graphs; i++) {
+			fprintf(chain, "%s\n", oid_to_hex(&base_oids[i]));
+			string_list_append_nodup(&keep,
+				xstrfmt("graph-%s.graph", oid_to_hex(&base_oids[i])));
+		}
+		fprintf(chain, "%s\n", oid_to_hex(&file_hash));
+		string_list_append_nodup(&keep,
+			xstrfmt("graph-%s.graph", oid_to_hex(&file_hash)));
+		if (commit_lock_file(&lk))
+			die_errno(_("unable to write commit-graph chain"));
+
+		/* The chain is only read when there is no single file. */
+		FREE_AND_NULL(graph_name);
+		graph_name = get_commit_graph_filename(obj_dir);
+		unlink_or_warn(graph_name);
+	} else {
+		char *chain_name = get_commit_graph_chain_filename(obj_dir);
+
+		finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC);
+		commit_lock_file(&lk);
+
+		/* The single file replaces all the layers of a chain. */
+		unlink_or_warn(chain_name);
+		free(chain_name);
+	}
+
+	expire_commit_graphs(obj_dir, &keep,
+			     split_opts && split_opts->expire_time ?
+			     split_opts->expire_time : time(NULL));
+	rollback_lock_file(&chain_lk);
+
+	string_list_clear(&keep, 0);
+	free(base_oids);
+	free(graph_name);
+	free(commits.list);
 	free(oids.list);
 	oids.alloc = 0;
 	oids.nr = 0;
@@ -890,7 +1492,7 @@ static void graph_report(const char *fmt, ...)
 #define GENERATION_ZERO_EXISTS 1
 #define GENERATION_NUMBER_EXISTS 2
 
-int verify_commit_graph(struct repository *r, struct commit_graph *g)
+static int verify_one_commit_graph(struct repository *r, struct commit_graph *g)
 {
 	uint32_t i, cur_fanout_pos = 0;
 	struct object_id prev_oid, cur_oid, checksum;
@@ -898,11 +1500,6 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 	struct hashfile *f;
 	int devnull;
 
-	if (!g) {
-		graph_report("no commit-graph file loaded");
-		return 1;
-	}
-
 	verify_commit_graph_error = 0;
 
 	if (!g->chunk_oid_fanout)
@@ -968,6 +1565,7 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 		struct commit *graph_commit, *odb_commit;
 		struct commit_list *graph_parents, *odb_parents;
 		uint32_t max_generation = 0;
+		uint32_t parent_pos;
 
 		hashcpy(cur_oid.hash, g->chunk_oid_lookup + g->hash_len * i);
 
@@ -1002,6 +1600,14 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 					     oid_to_hex(&graph_parents->item->object.oid),
 					     oid_to_hex(&odb_parents->item->object.oid));
 
+			/*
+			 * A parent in a base layer is not necessarily
+			 * parsed from the graph yet.
+			 */
+			if (graph_parents->item->generation == GENERATION_NUMBER_INFINITY &&
+			    bsearch_graph_chain(g, &graph_parents->item->object.oid, &parent_pos))
+				fill_commit_graph_info(graph_parents->item, g, parent_pos);
+
 			if (graph_parents->item->generation > max_generation)
 				max_generation = graph_parents->item->generation;
 
@@ -1049,6 +1655,30 @@ int verify_commit_graph(struct repository *r, struct commit_graph *g)
 	return verify_commit_graph_error;
 }
 
+/*
+ * Verify the layers from the bottom up, so that the parents a layer
+ * refers to in its base have already been parsed from the graph.
+ */
+static int verify_commit_graph_chain(struct repository *r, struct commit_graph *g)
+{
+	int result = 0;
+
+	if (g->base_graph)
+		result = verify_commit_graph_chain(r, g->base_graph);
+
+	return result | verify_one_commit_graph(r, g);
+}
+
+int verify_commit_graph(struct repository *r, struct commit_graph *g)
+{
+	if (!g) {
+		graph_report("no commit-graph file loaded");
+		return 1;
+	}
+
+	return verify_commit_graph_chain(r, g);
+}
+
 void free_commit_graph(struct commit_graph *g)
 {
 	if (!g)
@@ -1058,5 +1688,9 @@ void free_commit_graph(struct commit_graph *g)
 		g->data = NULL;
 		close(g->graph_fd);
 	}
+	free(g->bloom_filter_settings);
+	free(g->filename);
+	free(g->obj_dir);
+	free_commit_graph(g->base_graph);
 	free(g);
 }
@@ -7,10 +7,13 @@
 #include "cache.h"
 
 #define GIT_TEST_COMMIT_GRAPH "GIT_TEST_COMMIT_GRAPH"
+#define GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS "GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS"
 
 struct commit;
+struct bloom_filter_settings;
 
 char *get_commit_graph_filename(const char *obj_dir);
+char *get_commit_graph_chain_filename(const char *obj_dir);
 
 /*
  * Given a commit struct, try to fill the commit struct info, including:
@@ -43,28 +46,93 @@ struct commit_graph {
 
 	unsigned char hash_len;
 	unsigned char num_chunks;
+	unsigned char num_base_graphs;
 	uint32_t num_commits;
 	struct object_id oid;
+	char *filename;
+	char *obj_dir;
+
+	/*
+	 * A layer of a commit-graph chain only stores the commits that
+	 * are not in its base layers.  Positions of commits (including
+	 * the parent positions stored in the file) count the commits of
+	 * all the layers below first, so a position p refers to this
+	 * layer iff p >= num_commits_in_base.
+	 */
+	uint32_t num_commits_in_base;
+	struct commit_graph *base_graph;
 
 	const uint32_t *chunk_oid_fanout;
 	const unsigned char *chunk_oid_lookup;
 	const unsigned char *chunk_commit_data;
 	const unsigned char *chunk_large_edges;
+	const unsigned char *chunk_base_graphs;
+	const unsigned char *chunk_bloom_indexes;
+	const unsigned char *chunk_bloom_data;
+	size_t chunk_bloom_data_len;
+
+	struct bloom_filter_settings *bloom_filter_settings;
 };
 
 struct commit_graph *load_commit_graph_one(const char *graph_file);
 
+/*
+ * Load the commit-graph of the given object directory: the single
+ * "info/commit-graph" file if there is one, otherwise the chain of
+ * layers listed in "info/commit-graphs/commit-graph-chain".  The
+ * returned struct is the top-most layer.
+ */
+struct commit_graph *read_commit_graph_one(const char *obj_dir);
+
+/*
+ * Return 1 if and only if the repository has a commit-graph file,
+ * loading it on the first call if the repository is configured to use
+ * one.
+ */
+int prepare_commit_graph(struct repository *r);
+
 /*
  * Return 1 if and only if the repository has a commit-graph
  * file and generation numbers are computed in that file.
  */
 int generation_numbers_enabled(struct repository *r);
 
-void write_commit_graph_reachable(const char *obj_dir, int append);
+enum commit_graph_write_flags {
+	COMMIT_GRAPH_APPEND               = (1 << 0),
+	/* Compute and write a changed-path Bloom filter for each commit. */
+	COMMIT_GRAPH_WRITE_BLOOM_FILTERS  = (1 << 1),
+	/*
+	 * Write the new commits as a new layer on top of the existing
+	 * commit-graph chain instead of rewriting the whole graph.
+	 */
+	COMMIT_GRAPH_SPLIT                = (1 << 2)
+};
+
+struct split_commit_graph_opts {
+	/*
+	 * Merge the new layer with the layer below it while that layer
+	 * has at most size_multiple times as many commits as the
+	 * layer being written (2 if not positive).
+	 */
+	int size_multiple;
+
+	/* If non-zero, also merge while the new layer is larger than this. */
+	int max_commits;
+
+	/*
+	 * Layers that are no longer part of the chain are deleted if
+	 * they are not newer than this (the current time if zero).
+	 */
+	timestamp_t expire_time;
+};
+
+void write_commit_graph_reachable(const char *obj_dir, unsigned int flags,
+				  const struct split_commit_graph_opts *split_opts);
 void write_commit_graph(const char *obj_dir,
 			struct string_list *pack_indexes,
 			struct string_list *commit_hex,
-			int append);
+			unsigned int flags,
+			const struct split_commit_graph_opts *split_opts);
 
 int verify_commit_graph(struct repository *r, struct commit_graph *g);
 
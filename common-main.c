@@ -1,6 +1,7 @@
 #include "cache.h"
 #include "exec-cmd.h"
 #include "attr.h"
+#include "trace-event.h"
 
 /*
  * Many parts of Git have subprograms communicate via pipe, expect the
@@ -42,5 +43,7 @@ int main(int argc, const char **argv)
 
 	restore_sigpipe_to_default();
 
-	return cmd_main(argc, argv);
+	trace_event_start(argv);
+
+	return trace_event_exit(cmd_main(argc, argv));
 }
@@ -13,6 +13,7 @@
 #include "submodule.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "sparse-index.h"
 
 /*
  * diff-files
@@ -511,6 +512,14 @@ static int diff_cache(struct rev_info *revs,
 	opts.pathspec = &revs->diffopt.pathspec;
 	opts.pathspec->recursive = 1;
 
+	/*
+	 * Only a "diff-index --cached" can walk past the sparse
+	 * directories, and only those that did not change.
+	 */
+	if (!opts.diff_index_cached ||
+	    !sparse_dirs_match_tree(&the_index, &tree->object.oid))
+		ensure_full_index(&the_index);
+
 	init_tree_desc(&t, tree->buffer, tree->size);
 	return unpack_trees(1, &t, &opts);
 }
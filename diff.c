@@ -24,6 +24,8 @@
 #include "graph.h"
 #include "packfile.h"
 #include "help.h"
+#include "fetch-object.h"
+#include "sha1-array.h"
 
 #ifdef NO_FAST_WORKING_DIRECTORY
 #define FAST_WORKING_DIRECTORY 0
@@ -6112,8 +6114,60 @@ void diffcore_fix_diff_index(struct diff_options *options)
 	QSORT(q->queue, q->nr, diffnamecmp);
 }
 
+static void add_if_missing(struct oid_array *to_fetch,
+			   const struct diff_filespec *filespec)
+{
+	if (DIFF_FILE_VALID(filespec) && filespec->oid_valid &&
+	    !S_ISGITLINK(filespec->mode))
+		oid_array_append(to_fetch, &filespec->oid);
+}
+
+/*
+ * In a partial clone, fetch at once the blobs that the transformations
+ * below and the output are going to read, instead of lazily fetching
+ * them one at a time.
+ */
+static void diff_prefetch_blobs(struct diff_options *options)
+{
+	struct diff_queue_struct *q = &diff_queued_diff;
+	struct oid_array to_fetch = OID_ARRAY_INIT;
+	int all, renames;
+	int i;
+
+	if (!repository_format_partial_clone)
+		return;
+
+	all = (options->output_format & (DIFF_FORMAT_PATCH |
+					 DIFF_FORMAT_NUMSTAT |
+					 DIFF_FORMAT_DIFFSTAT |
+					 DIFF_FORMAT_SHORTSTAT |
+					 DIFF_FORMAT_DIRSTAT |
+					 DIFF_FORMAT_CHECKDIFF)) ||
+		(options->pickaxe_opts & DIFF_PICKAXE_KINDS_MASK) ||
+		options->break_opt != -1 ||
+		options->flags.diff_from_contents ||
+		options->detect_rename == DIFF_DETECT_COPY;
+	/* the rename detection reads the added and deleted blobs */
+	renames = options->detect_rename && !options->found_follow;
+	if (!all && !renames)
+		return;
+
+	for (i = 0; i < q->nr; i++) {
+		struct diff_filepair *p = q->queue[i];
+
+		if (all || !DIFF_FILE_VALID(p->two))
+			add_if_missing(&to_fetch, p->one);
+		if (all || !DIFF_FILE_VALID(p->one))
+			add_if_missing(&to_fetch, p->two);
+	}
+	prefetch_objects(&to_fetch);
+	oid_array_clear(&to_fetch);
+}
+
 void diffcore_std(struct diff_options *options)
 {
+	diff_prefetch_blobs(options);
+
 	/* NOTE please keep the following in sync with diff_tree_combined() */
 	if (options->skip_stat_unmatch)
 		diffcore_skip_stat_unmatch(options);
@@ -16,7 +16,7 @@ static struct diff_rename_dst {
 } *rename_dst;
 static int rename_dst_nr, rename_dst_alloc;
 
-static int find_rename_dst(struct diff_filespec *two)
+static int find_rename_dst(const char *path)
 {
 	int first, last;
 
@@ -25,7 +25,7 @@ static int find_rename_dst(struct diff_filespec *two)
 	while (last > first) {
 		int next = (last + first) >> 1;
 		struct diff_rename_dst *dst = &(rename_dst[next]);
-		int cmp = strcmp(two->path, dst->two->path);
+		int cmp = strcmp(path, dst->two->path);
 		if (!cmp)
 			return next;
 		if (cmp < 0) {
@@ -39,7 +39,7 @@ static int find_rename_dst(struct diff_filespec *two)
 
 static struct diff_rename_dst *locate_rename_dst(struct diff_filespec *two)
 {
-	int ofs = find_rename_dst(two);
+	int ofs = find_rename_dst(two->path);
 	return ofs < 0 ? NULL : &rename_dst[ofs];
 }
 
@@ -48,7 +48,7 @@ static struct diff_rename_dst *locate_rename_dst(struct diff_filespec *two)
  */
 static int add_rename_dst(struct diff_filespec *two)
 {
-	int first = find_rename_dst(two);
+	int first = find_rename_dst(two->path);
 
 	if (first >= 0)
 		return -1;
@@ -356,6 +356,223 @@ static int find_exact_renames(struct diff_options *options)
 	return renames;
 }
 
+/*
+ * Before falling back to the full similarity matrix, pair up the
+ * sources and destinations that are most likely renames of each other:
+ * a source and a destination whose basename is not shared with any
+ * other remaining source or destination, respectively, are compared
+ * directly. The directory renames implied by the pairs found so far
+ * then tell which destination a source with a non-unique basename
+ * probably went to. Only the candidates that are left go into the
+ * matrix, which keeps it small for large refactorings.
+ */
+struct basename_entry {
+	struct hashmap_entry ent;
+	int index; /* -1 if the basename is not unique */
+	char name[FLEX_ARRAY];
+};
+
+static int basename_entry_cmp(const void *unused_cmp_data,
+			      const void *entry, const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct basename_entry *a = entry, *b = entry_or_key;
+
+	return strcmp(a->name, keydata ? keydata : b->name);
+}
+
+static void add_basename(struct hashmap *map, const char *path, int index)
+{
+	const char *base = strrchr(path, '/');
+	struct basename_entry *e;
+
+	base = base ? base + 1 : path;
+	e = hashmap_get_from_hash(map, strhash(base), base);
+	if (e) {
+		e->index = -1;
+		return;
+	}
+	FLEX_ALLOC_STR(e, name, base);
+	hashmap_entry_init(e, strhash(base));
+	e->index = index;
+	hashmap_add(map, e);
+}
+
+static int src_is_candidate(int src_index)
+{
+	return !rename_src[src_index].p->one->rename_used;
+}
+
+static int try_rename_pair(int dst_index, int src_index, int minimum_score)
+{
+	struct diff_filespec *one = rename_src[src_index].p->one;
+	struct diff_filespec *two = rename_dst[dst_index].two;
+	int score = estimate_similarity(one, two, minimum_score);
+
+	diff_free_filespec_blob(one);
+	diff_free_filespec_blob(two);
+	if (score < minimum_score)
+		return 0;
+	record_rename_pair(dst_index, src_index, score);
+	return 1;
+}
+
+static int find_basename_matches(int minimum_score)
+{
+	struct hashmap src_names, dst_names;
+	struct hashmap_iter iter;
+	struct basename_entry *e;
+	int i, renames = 0;
+
+	hashmap_init(&src_names, basename_entry_cmp, NULL, rename_src_nr);
+	hashmap_init(&dst_names, basename_entry_cmp, NULL, rename_dst_nr);
+	for (i = 0; i < rename_src_nr; i++)
+		if (src_is_candidate(i))
+			add_basename(&src_names, rename_src[i].p->one->path, i);
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair)
+			add_basename(&dst_names, rename_dst[i].two->path, i);
+
+	hashmap_iter_init(&src_names, &iter);
+	while ((e = hashmap_iter_next(&iter))) {
+		struct basename_entry *d;
+
+		if (e->index < 0)
+			continue;
+		d = hashmap_get_from_hash(&dst_names, strhash(e->name), e->name);
+		if (!d || d->index < 0)
+			continue;
+		renames += try_rename_pair(d->index, e->index, minimum_score);
+	}
+
+	hashmap_free(&src_names, 1);
+	hashmap_free(&dst_names, 1);
+	return renames;
+}
+
+static size_t dirname_len(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash - path + 1 : 0;
+}
+
+/*
+ * Record in `dir_renames` where the directory of each source renamed
+ * so far (without changing its basename) went to. The util of each
+ * item is a string_list of the destination directories, whose util
+ * counts the renames that went there.
+ */
+static void count_dir_renames(struct string_list *dir_renames)
+{
+	struct strbuf old_dir = STRBUF_INIT, new_dir = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *p = rename_dst[i].pair;
+		struct string_list_item *item;
+
+		if (!p || !basename_same(p->one, p->two))
+			continue;
+		strbuf_reset(&old_dir);
+		strbuf_add(&old_dir, p->one->path, dirname_len(p->one->path));
+		strbuf_reset(&new_dir);
+		strbuf_add(&new_dir, p->two->path, dirname_len(p->two->path));
+		if (!strcmp(old_dir.buf, new_dir.buf))
+			continue;
+
+		item = string_list_insert(dir_renames, old_dir.buf);
+		if (!item->util) {
+			struct string_list *targets = xmalloc(sizeof(*targets));
+			string_list_init(targets, 1);
+			item->util = targets;
+		}
+		item = string_list_insert(item->util, new_dir.buf);
+		item->util = (void *)((intptr_t)item->util + 1);
+	}
+	strbuf_release(&old_dir);
+	strbuf_release(&new_dir);
+}
+
+/*
+ * Return the directory most renames out of `dir` went to, or NULL if
+ * there is none or it is ambiguous.
+ */
+static const char *dir_rename_target(struct string_list *dir_renames,
+				     const char *dir)
+{
+	struct string_list_item *item = string_list_lookup(dir_renames, dir);
+	struct string_list *targets;
+	const char *best = NULL;
+	intptr_t best_count = 0;
+	int i;
+
+	if (!item)
+		return NULL;
+	targets = item->util;
+	for (i = 0; i < targets->nr; i++) {
+		intptr_t count = (intptr_t)targets->items[i].util;
+
+		if (count > best_count) {
+			best = targets->items[i].string;
+			best_count = count;
+		} else if (count == best_count) {
+			best = NULL;
+		}
+	}
+	return best;
+}
+
+/*
+ * Compare each remaining source with the destination of the same path
+ * below the directory its nearest renamed leading directory went to.
+ */
+static int find_dir_rename_matches(int minimum_score)
+{
+	struct string_list dir_renames = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	int i, renames = 0;
+
+	count_dir_renames(&dir_renames);
+	if (!dir_renames.nr)
+		return 0;
+
+	for (i = 0; i < rename_src_nr; i++) {
+		const char *src_path = rename_src[i].p->one->path;
+		size_t len = dirname_len(src_path);
+
+		if (!src_is_candidate(i))
+			continue;
+		while (len) {
+			const char *target;
+			int dst_index;
+
+			strbuf_reset(&path);
+			strbuf_add(&path, src_path, len);
+			target = dir_rename_target(&dir_renames, path.buf);
+			if (!target) {
+				/* try the parent directory */
+				len--;
+				while (len && src_path[len - 1] != '/')
+					len--;
+				continue;
+			}
+			strbuf_reset(&path);
+			strbuf_addf(&path, "%s%s", target, src_path + len);
+			dst_index = find_rename_dst(path.buf);
+			if (dst_index >= 0 && !rename_dst[dst_index].pair)
+				renames += try_rename_pair(dst_index, i,
+							   minimum_score);
+			break;
+		}
+	}
+
+	for (i = 0; i < dir_renames.nr; i++)
+		string_list_clear(dir_renames.items[i].util, 0);
+	string_list_clear(&dir_renames, 1);
+	strbuf_release(&path);
+	return renames;
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -378,11 +595,10 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
  * 1 if we need to disable inexact rename detection;
  * 2 if we would be under the limit if we were given -C instead of -C -C.
  */
-static int too_many_rename_candidates(int num_create,
+static int too_many_rename_candidates(int num_create, int num_src,
 				      struct diff_options *options)
 {
 	int rename_limit = options->rename_limit;
-	int num_src = rename_src_nr;
 	int i;
 
 	options->needed_rename_limit = 0;
@@ -449,7 +665,7 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
 	int i, j, rename_count, skip_unmodified = 0;
-	int num_create, dst_cnt;
+	int num_create, num_src, dst_cnt;
 	struct progress *progress = NULL;
 
 	if (!minimum_score)
@@ -520,7 +736,30 @@ void diffcore_rename(struct diff_options *options)
 	if (!num_create)
 		goto cleanup;
 
-	switch (too_many_rename_candidates(num_create, options)) {
+	/*
+	 * Without copy detection, a source can be used only once, so
+	 * pair up the likely renames first and leave only the rest to
+	 * the similarity matrix. As a pair found this way takes its
+	 * source away from the matrix, where a better match for it may
+	 * be, only accept it when it is well above minimum_score.
+	 */
+	if (detect_rename != DIFF_DETECT_COPY) {
+		int likely_score = minimum_score +
+			(MAX_SCORE - minimum_score) / 2;
+
+		rename_count += find_basename_matches(likely_score);
+		rename_count += find_dir_rename_matches(likely_score);
+		num_create = rename_dst_nr - rename_count;
+		if (!num_create)
+			goto cleanup;
+		for (num_src = i = 0; i < rename_src_nr; i++)
+			if (src_is_candidate(i))
+				num_src++;
+	} else {
+		num_src = rename_src_nr;
+	}
+
+	switch (too_many_rename_candidates(num_create, num_src, options)) {
 	case 1:
 		goto cleanup;
 	case 2:
@@ -534,7 +773,7 @@ void diffcore_rename(struct diff_options *options)
 	if (options->show_rename_progress) {
 		progress = start_delayed_progress(
 				_("Performing inexact rename detection"),
-				(uint64_t)rename_dst_nr * (uint64_t)rename_src_nr);
+				(uint64_t)num_create * (uint64_t)num_src);
 	}
 
 	mx = xcalloc(st_mult(NUM_CANDIDATE_PER_DST, num_create), sizeof(*mx));
@@ -556,6 +795,9 @@ void diffcore_rename(struct diff_options *options)
 			if (skip_unmodified &&
 			    diff_unmodified_pair(rename_src[j].p))
 				continue;
+			if (detect_rename != DIFF_DETECT_COPY &&
+			    !src_is_candidate(j))
+				continue;
 
 			this_src.score = estimate_similarity(one, two,
 							     minimum_score);
@@ -571,7 +813,7 @@ void diffcore_rename(struct diff_options *options)
 			diff_free_filespec_blob(two);
 		}
 		dst_cnt++;
-		display_progress(progress, (uint64_t)(i+1)*(uint64_t)rename_src_nr);
+		display_progress(progress, (uint64_t)dst_cnt*(uint64_t)num_src);
 	}
 	stop_progress(&progress);
 
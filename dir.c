@@ -21,6 +21,10 @@
 #include "ewah/ewok.h"
 #include "fsmonitor.h"
 #include "submodule-config.h"
+#include "sparse-index.h"
+#include "string-list.h"
+#include "thread-utils.h"
+#include "trace-event.h"
 
 /*
  * Tells read_directory_recursive how a file or directory should be treated.
@@ -202,6 +206,8 @@ int fill_directory(struct dir_struct *dir,
 	prefix_len = common_prefix_len(pathspec);
 	prefix = prefix_len ? pathspec->items[0].match : "";
 
+	ensure_full_index_for_worktree(istate);
+
 	/* Read the directory and prune it */
 	read_directory(dir, istate, prefix, prefix_len, pathspec);
 
@@ -631,6 +637,121 @@ void parse_exclude_pattern(const char **pattern,
 	*patternlen = len;
 }
 
+static int cone_dir_entry_cmp(const void *unused_cmp_data,
+			      const void *entry,
+			      const void *entry_or_key,
+			      const void *keydata)
+{
+	const struct cone_dir_entry *a = entry;
+	const struct cone_dir_entry *b = entry_or_key;
+
+	return a->len != b->len ||
+	       fspathncmp(a->path, keydata ? keydata : b->path, a->len);
+}
+
+static unsigned int cone_dir_hash(const char *path, size_t len)
+{
+	return ignore_case ? memihash(path, len) : memhash(path, len);
+}
+
+static struct cone_dir_entry *cone_dir_get(struct hashmap *map,
+					   const char *path, size_t len)
+{
+	struct cone_dir_entry key;
+
+	hashmap_entry_init(&key, cone_dir_hash(path, len));
+	key.len = len;
+	return hashmap_get(map, &key, path);
+}
+
+static void cone_dir_add(struct hashmap *map, const char *path, size_t len)
+{
+	struct cone_dir_entry *e;
+
+	if (cone_dir_get(map, path, len))
+		return;
+	FLEX_ALLOC_MEM(e, path, path, len);
+	e->len = len;
+	hashmap_entry_init(e, cone_dir_hash(path, len));
+	hashmap_add(map, e);
+}
+
+static void clear_cone_patterns(struct exclude_list *el)
+{
+	hashmap_free(&el->recursive_hashmap, 1);
+	hashmap_free(&el->parent_hashmap, 1);
+	el->use_cone_patterns = 0;
+	el->full_cone = 0;
+}
+
+/*
+ * Record a pattern of a cone mode sparse-checkout file. Apart from the
+ * two patterns for the top-level directory, these are "/<dir>/" to
+ * include <dir> recursively, possibly followed by the negation of the
+ * subdirectories of <dir> ("!/<dir>/" followed by a star and a slash)
+ * to only include the files directly in <dir>.
+ */
+static void add_exclude_to_hashsets(struct exclude_list *el,
+				    struct exclude *x)
+{
+	const char *dir = x->pattern + 1;
+	size_t i, len = x->patternlen - 1;
+
+	if (!el->recursive_hashmap.tablesize) {
+		hashmap_init(&el->recursive_hashmap, cone_dir_entry_cmp, NULL, 0);
+		hashmap_init(&el->parent_hashmap, cone_dir_entry_cmp, NULL, 0);
+	}
+
+	if (x->patternlen == 2 && !strncmp(x->pattern, "/*", 2)) {
+		if (!(x->flags & (EXC_FLAG_NEGATIVE | EXC_FLAG_MUSTBEDIR))) {
+			el->full_cone = 1;
+			return;
+		}
+		if ((x->flags & EXC_FLAG_NEGATIVE) &&
+		    (x->flags & EXC_FLAG_MUSTBEDIR)) {
+			el->full_cone = 0;
+			return;
+		}
+		goto invalid;
+	}
+	if (x->baselen || *x->pattern != '/' ||
+	    !(x->flags & EXC_FLAG_MUSTBEDIR))
+		goto invalid;
+
+	if (x->flags & EXC_FLAG_NEGATIVE) {
+		struct cone_dir_entry key, *e;
+
+		if (len < 3 || strcmp(dir + len - 2, "/*") ||
+		    simple_length(dir) != len - 1)
+			goto invalid;
+		len -= 2;
+		/* the directory was included recursively by the line before */
+		hashmap_entry_init(&key, cone_dir_hash(dir, len));
+		key.len = len;
+		e = hashmap_remove(&el->recursive_hashmap, &key, dir);
+		if (!e)
+			goto invalid;
+		free(e);
+		cone_dir_add(&el->parent_hashmap, dir, len);
+		return;
+	}
+
+	if (!len || simple_length(dir) != len)
+		goto invalid;
+	cone_dir_add(&el->recursive_hashmap, dir, len);
+	for (i = 0; i < len; i++)
+		if (dir[i] == '/')
+			cone_dir_add(&el->parent_hashmap, dir, i);
+	return;
+
+invalid:
+	warning(_("unrecognized pattern: '%s%s%s'"),
+		x->flags & EXC_FLAG_NEGATIVE ? "!" : "", x->pattern,
+		x->flags & EXC_FLAG_MUSTBEDIR ? "/" : "");
+	warning(_("disabling cone pattern matching"));
+	clear_cone_patterns(el);
+}
+
 void add_exclude(const char *string, const char *base,
 		 int baselen, struct exclude_list *el, int srcpos)
 {
@@ -655,6 +776,9 @@ void add_exclude(const char *string, const char *base,
 	ALLOC_GROW(el->excludes, el->nr + 1, el->alloc);
 	el->excludes[el->nr++] = x;
 	x->el = el;
+
+	if (el->use_cone_patterns)
+		add_exclude_to_hashsets(el, x);
 }
 
 static int read_skip_worktree_file_from_index(const struct index_state *istate,
@@ -686,6 +810,7 @@ void clear_exclude_list(struct exclude_list *el)
 		free(el->excludes[i]);
 	free(el->excludes);
 	free(el->filebuf);
+	clear_cone_patterns(el);
 
 	memset(el, 0, sizeof(*el));
 }
@@ -1100,20 +1225,59 @@ static struct exclude *last_exclude_matching_from_list(const char *pathname,
 	return exc;
 }
 
+/*
+ * Match `pathname` against cone patterns, with one hash lookup for
+ * each of its leading directories and one for the path itself.
+ */
+static enum pattern_match_result cone_patterns_match(const char *pathname,
+						     int pathlen, int dtype,
+						     struct exclude_list *el)
+{
+	const char *p, *end = pathname + pathlen, *last_slash = NULL;
+
+	if (el->full_cone)
+		return MATCHED_RECURSIVE;
+
+	for (p = pathname; p < end; p++) {
+		if (*p != '/')
+			continue;
+		if (cone_dir_get(&el->recursive_hashmap, pathname, p - pathname))
+			return MATCHED_RECURSIVE;
+		last_slash = p;
+	}
+
+	if (dtype == DT_DIR) {
+		if (cone_dir_get(&el->recursive_hashmap, pathname, pathlen))
+			return MATCHED_RECURSIVE;
+		if (cone_dir_get(&el->parent_hashmap, pathname, pathlen))
+			return MATCHED;
+		return NOT_MATCHED;
+	}
+	if (!last_slash ||
+	    cone_dir_get(&el->parent_hashmap, pathname, last_slash - pathname))
+		return MATCHED;
+	return NOT_MATCHED;
+}
+
 /*
  * Scan the list and let the last match determine the fate.
- * Return 1 for exclude, 0 for include and -1 for undecided.
  */
-int is_excluded_from_list(const char *pathname,
-			  int pathlen, const char *basename, int *dtype,
-			  struct exclude_list *el, struct index_state *istate)
+enum pattern_match_result is_excluded_from_list(const char *pathname,
+		int pathlen, const char *basename, int *dtype,
+		struct exclude_list *el, struct index_state *istate)
 {
 	struct exclude *exclude;
+
+	if (el->use_cone_patterns) {
+		if (*dtype == DT_UNKNOWN)
+			*dtype = get_dtype(NULL, istate, pathname, pathlen);
+		return cone_patterns_match(pathname, pathlen, *dtype, el);
+	}
 	exclude = last_exclude_matching_from_list(pathname, pathlen, basename,
 						  dtype, el, istate);
 	if (exclude)
-		return exclude->flags & EXC_FLAG_NEGATIVE ? 0 : 1;
-	return -1; /* undecided */
+		return exclude->flags & EXC_FLAG_NEGATIVE ? NOT_MATCHED : MATCHED;
+	return UNDECIDED;
 }
 
 static struct exclude *last_exclude_matching_from_lists(struct dir_struct *dir,
@@ -1921,6 +2085,34 @@ static void close_cached_dir(struct cached_dir *cdir)
 	}
 }
 
+#ifndef NO_PTHREADS
+/*
+ * In a parallel read_directory(), every thread reads the top-level
+ * directory of the working tree, and only handles the entries that no
+ * other thread has claimed yet. A thread that is busy with a large
+ * directory does not claim any more, so that the others take the rest.
+ */
+struct parallel_read_dir {
+	pthread_mutex_t mutex;
+	struct string_list claimed;
+};
+
+static int claim_toplevel_entry(struct parallel_read_dir *p,
+				const char *name)
+{
+	int nr;
+
+	pthread_mutex_lock(&p->mutex);
+	nr = p->claimed.nr;
+	string_list_insert(&p->claimed, name);
+	nr = p->claimed.nr - nr;
+	pthread_mutex_unlock(&p->mutex);
+	return nr;
+}
+#else
+#define claim_toplevel_entry(p, name) 1
+#endif
+
 /*
  * Read a directory tree. We currently ignore anything but
  * directories, regular files and symlinks. That's because git
@@ -1958,6 +2150,10 @@ static enum path_treatment read_directory_recursive(struct dir_struct *dir,
 		untracked->check_only = !!check_only;
 
 	while (!read_cached_dir(&cdir)) {
+		if (!baselen && dir->parallel &&
+		    !claim_toplevel_entry(dir->parallel, cdir.de->d_name))
+			continue;
+
 		/* check how the file or directory should be treated */
 		state = treat_path(dir, untracked, &cdir, istate, &path,
 				   baselen, pathspec);
@@ -2264,6 +2460,124 @@ static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *d
 	return root;
 }
 
+/*
+ * Free the per-directory exclude lists and the other state of a
+ * traversal, but not the patterns that were given by the caller.
+ */
+static void clear_traversal_excludes(struct dir_struct *dir)
+{
+	struct exclude_list_group *group = &dir->exclude_list_group[EXC_DIRS];
+	struct exclude_stack *stk;
+	int i;
+
+	for (i = 0; i < group->nr; i++) {
+		free((char *)group->el[i].src);
+		clear_exclude_list(&group->el[i]);
+	}
+	FREE_AND_NULL(group->el);
+	group->nr = group->alloc = 0;
+
+	stk = dir->exclude_stack;
+	while (stk) {
+		struct exclude_stack *prev = stk->prev;
+		free(stk);
+		stk = prev;
+	}
+	dir->exclude_stack = NULL;
+	strbuf_release(&dir->basebuf);
+}
+
+#ifndef NO_PTHREADS
+struct read_directory_thread {
+	pthread_t pthread;
+	struct dir_struct dir;
+	struct index_state *istate;
+	const struct pathspec *pathspec;
+};
+
+static void *read_directory_thread_proc(void *data)
+{
+	struct read_directory_thread *t = data;
+
+	trace_event_thread_start("read_directory");
+	read_directory_recursive(&t->dir, t->istate, "", 0, NULL, 0, 0,
+				 t->pathspec);
+	trace_event_thread_exit();
+	return NULL;
+}
+
+/*
+ * Traverse the whole working tree with `nr` threads, each with its own
+ * copy of `dir` that shares the patterns given by the caller but has
+ * its own per-directory exclude lists and results, which are gathered
+ * into `dir` at the end.
+ */
+static void read_directory_parallel(struct dir_struct *dir,
+				    struct index_state *istate,
+				    const struct pathspec *pathspec, int nr)
+{
+	struct parallel_read_dir p;
+	struct read_directory_thread *threads;
+	int i, err;
+
+	/* the threads look up the index and read .gitignore blobs */
+	lazy_init_name_hash(istate);
+	enable_obj_read_lock();
+	pthread_mutex_init(&p.mutex, NULL);
+	string_list_init(&p.claimed, 1);
+
+	trace_event_region_enter("dir", "read_directory_parallel");
+	threads = xcalloc(nr, sizeof(*threads));
+	for (i = 0; i < nr; i++) {
+		struct read_directory_thread *t = &threads[i];
+
+		t->dir = *dir;
+		t->dir.entries = t->dir.ignored = NULL;
+		t->dir.nr = t->dir.alloc = 0;
+		t->dir.ignored_nr = t->dir.ignored_alloc = 0;
+		memset(&t->dir.exclude_list_group[EXC_DIRS], 0,
+		       sizeof(t->dir.exclude_list_group[EXC_DIRS]));
+		t->dir.exclude_stack = NULL;
+		t->dir.exclude = NULL;
+		strbuf_init(&t->dir.basebuf, 0);
+		t->dir.parallel = &p;
+		t->istate = istate;
+		t->pathspec = pathspec;
+
+		err = pthread_create(&t->pthread, NULL,
+				     read_directory_thread_proc, t);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+
+	for (i = 0; i < nr; i++) {
+		struct read_directory_thread *t = &threads[i];
+
+		if (pthread_join(t->pthread, NULL))
+			die(_("unable to join thread"));
+
+		ALLOC_GROW(dir->entries, dir->nr + t->dir.nr, dir->alloc);
+		COPY_ARRAY(dir->entries + dir->nr, t->dir.entries, t->dir.nr);
+		dir->nr += t->dir.nr;
+		ALLOC_GROW(dir->ignored, dir->ignored_nr + t->dir.ignored_nr,
+			   dir->ignored_alloc);
+		COPY_ARRAY(dir->ignored + dir->ignored_nr, t->dir.ignored,
+			   t->dir.ignored_nr);
+		dir->ignored_nr += t->dir.ignored_nr;
+
+		free(t->dir.entries);
+		free(t->dir.ignored);
+		clear_traversal_excludes(&t->dir);
+	}
+	free(threads);
+	trace_event_region_leave("dir", "read_directory_parallel");
+
+	string_list_clear(&p.claimed, 0);
+	pthread_mutex_destroy(&p.mutex);
+	disable_obj_read_lock();
+}
+#endif
+
 int read_directory(struct dir_struct *dir, struct index_state *istate,
 		   const char *path, int len, const struct pathspec *pathspec)
 {
@@ -2283,6 +2597,11 @@ int read_directory(struct dir_struct *dir, struct index_state *istate,
 		 * e.g. prep_exclude()
 		 */
 		dir->untracked = NULL;
+#ifndef NO_PTHREADS
+	if (!len && !untracked && dir->threads > 1)
+		read_directory_parallel(dir, istate, pathspec, dir->threads);
+	else
+#endif
 	if (!len || treat_leading_path(dir, istate, path, len, pathspec))
 		read_directory_recursive(dir, istate, path, len, untracked, 0, 0, pathspec);
 	QSORT(dir->entries, dir->nr, cmp_dir_entry);
@@ -2549,27 +2868,16 @@ void clear_directory(struct dir_struct *dir)
 {
 	int i, j;
 	struct exclude_list_group *group;
-	struct exclude_list *el;
-	struct exclude_stack *stk;
 
 	for (i = EXC_CMDL; i <= EXC_FILE; i++) {
+		if (i == EXC_DIRS)
+			continue;
 		group = &dir->exclude_list_group[i];
-		for (j = 0; j < group->nr; j++) {
-			el = &group->el[j];
-			if (i == EXC_DIRS)
-				free((char *)el->src);
-			clear_exclude_list(el);
-		}
+		for (j = 0; j < group->nr; j++)
+			clear_exclude_list(&group->el[j]);
 		free(group->el);
 	}
-
-	stk = dir->exclude_stack;
-	while (stk) {
-		struct exclude_stack *prev = stk->prev;
-		free(stk);
-		stk = prev;
-	}
-	strbuf_release(&dir->basebuf);
+	clear_traversal_excludes(dir);
 }
 
 struct ondisk_untracked_cache {
@@ -4,6 +4,7 @@
 /* See Documentation/technical/api-directory-listing.txt */
 
 #include "cache.h"
+#include "hashmap.h"
 #include "strbuf.h"
 
 struct dir_entry {
@@ -37,6 +38,13 @@ struct exclude {
 	int srcpos;
 };
 
+/* An entry of the hashsets of cone patterns */
+struct cone_dir_entry {
+	struct hashmap_entry ent;
+	size_t len;
+	char path[FLEX_ARRAY];
+};
+
 /*
  * Each excludes file will be parsed into a fresh exclude_list which
  * is appended to the relevant exclude_list_group (either EXC_DIRS or
@@ -55,6 +63,22 @@ struct exclude_list {
 	const char *src;
 
 	struct exclude **excludes;
+
+	/*
+	 * With "cone" patterns (see core.sparseCheckoutCone), the
+	 * patterns only name directories, which are also recorded
+	 * without their leading and trailing slashes in these sets:
+	 * all of the paths in a directory of recursive_hashmap are
+	 * matched, and only the files directly in a directory of
+	 * parent_hashmap are. The files at the top level always match.
+	 * If a pattern is not of this form, use_cone_patterns is
+	 * cleared and the patterns are matched as usual.
+	 */
+	unsigned use_cone_patterns : 1;
+	/* set when the top-level directories are not excluded */
+	unsigned full_cone : 1;
+	struct hashmap recursive_hashmap;
+	struct hashmap parent_hashmap;
 };
 
 /*
@@ -161,6 +185,14 @@ struct dir_struct {
 	struct dir_entry **entries;
 	struct dir_entry **ignored;
 
+	/*
+	 * If greater than 1, read_directory() may split the traversal of
+	 * the working tree between this many threads, which take the
+	 * top-level directories in turn. This is not done with a leading
+	 * path or with the untracked cache.
+	 */
+	int threads;
+
 	/* Exclude info */
 	const char *exclude_per_dir;
 
@@ -194,6 +226,9 @@ struct dir_struct {
 	struct exclude *exclude;
 	struct strbuf basebuf;
 
+	/* set in the threads of a parallel read_directory() */
+	struct parallel_read_dir *parallel;
+
 	/* Enable untracked file cache if set */
 	struct untracked_cache *untracked;
 	struct oid_stat ss_info_exclude;
@@ -230,7 +265,21 @@ extern int read_directory(struct dir_struct *, struct index_state *istate,
 			  const char *path, int len,
 			  const struct pathspec *pathspec);
 
-extern int is_excluded_from_list(const char *pathname, int pathlen,
+enum pattern_match_result {
+	UNDECIDED = -1,
+	NOT_MATCHED = 0,
+	MATCHED = 1,
+	MATCHED_RECURSIVE = 2,
+};
+
+/*
+ * Return MATCHED if the last pattern of `el` matching `pathname` is a
+ * positive one, NOT_MATCHED if it is a negative one and UNDECIDED if
+ * none matches. With cone patterns, there is no undecided case, and
+ * MATCHED_RECURSIVE is returned for a directory all of whose paths
+ * match.
+ */
+extern enum pattern_match_result is_excluded_from_list(const char *pathname, int pathlen,
 				 const char *basename, int *dtype,
 				 struct exclude_list *el,
 				 struct index_state *istate);
@@ -3,6 +3,9 @@
 #include "pkt-line.h"
 #include "strbuf.h"
 #include "transport.h"
+#include "sha1-array.h"
+#include "object-store.h"
+#include "trace-event.h"
 #include "fetch-object.h"
 
 static void fetch_refs(const char *remote_name, struct ref *ref)
@@ -38,3 +41,37 @@ void fetch_objects(const char *remote_name, const struct object_id *oids,
 	}
 	fetch_refs(remote_name, ref);
 }
+
+static int append_missing(const struct object_id *oid, void *data)
+{
+	struct oid_array *missing = data;
+
+	/*
+	 * The objects are not expected to show up in a pack behind our
+	 * back, so do not rescan the pack directory for each of them.
+	 */
+	if (!is_null_oid(oid) &&
+	    !has_object_file_with_flags(oid, OBJECT_INFO_QUICK))
+		oid_array_append(missing, oid);
+	return 0;
+}
+
+void prefetch_objects(struct oid_array *oids)
+{
+	struct oid_array missing = OID_ARRAY_INIT;
+
+	if (!repository_format_partial_clone || !fetch_if_missing)
+		return;
+
+	fetch_if_missing = 0;
+	oid_array_for_each_unique(oids, append_missing, &missing);
+	fetch_if_missing = 1;
+
+	if (missing.nr) {
+		trace_event_region_enter("promisor", "prefetch");
+		fetch_objects(repository_format_partial_clone,
+			      missing.oid, missing.nr);
+		trace_event_region_leave("promisor", "prefetch");
+	}
+	oid_array_clear(&missing);
+}
@@ -1,7 +1,21 @@
 #ifndef FETCH_OBJECT_H
 #define FETCH_OBJECT_H
 
+struct oid_array;
+
 void fetch_objects(const char *remote_name, const struct object_id *oids,
 		   int oid_nr);
 
+/*
+ * Fetch those of `oids` that are missing from the repository from the
+ * promisor remote, all in a single request. Callers that are about to
+ * read many objects one by one (a checkout, a diff, a grep) call this
+ * first, so that the lazy fetch of each missing object does not cost a
+ * round trip. `oids` may contain duplicates and null OIDs.
+ *
+ * This does nothing outside of a partial clone, or when
+ * fetch_if_missing is unset.
+ */
+void prefetch_objects(struct oid_array *oids);
+
 #endif
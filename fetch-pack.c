@@ -22,6 +22,7 @@
 #include "connected.h"
 #include "fetch-negotiator.h"
 #include "fsck.h"
+#include "tempfile.h"
 
 static int transfer_unpack_limit = -1;
 static int fetch_unpack_limit = -1;
@@ -38,6 +39,7 @@ static struct lock_file shallow_lock;
 static const char *alternate_shallow_file;
 static char *negotiation_algorithm;
 static struct strbuf fsck_msg_types = STRBUF_INIT;
+static struct string_list uri_protocols = STRING_LIST_INIT_DUP;
 
 /* Remember to update object flag allocation in object.h */
 #define COMPLETE	(1U << 0)
@@ -778,8 +780,32 @@ static int sideband_demux(int in, int out, void *data)
 	return ret;
 }
 
+static int fsck_fetched_objects(void)
+{
+	return fetch_fsck_objects >= 0
+	       ? fetch_fsck_objects
+	       : transfer_fsck_objects >= 0
+	       ? transfer_fsck_objects
+	       : 0;
+}
+
+static void add_keep_arg(struct argv_array *args, const char *prefix)
+{
+	char hostname[HOST_NAME_MAX + 1];
+
+	if (xgethostname(hostname, sizeof(hostname)))
+		xsnprintf(hostname, sizeof(hostname), "localhost");
+	argv_array_pushf(args, "%s--keep=fetch-pack %"PRIuMAX " on %s",
+			 prefix, (uintmax_t)getpid(), hostname);
+}
+
+/*
+ * Receive the pack from the server. With `uris_pending`, the pack may
+ * refer to objects of pre-built packs that are still being downloaded,
+ * so index-pack must not check links to objects outside of it.
+ */
 static int get_pack(struct fetch_pack_args *args,
-		    int xd[2], char **pack_lockfile)
+		    int xd[2], char **pack_lockfile, int uris_pending)
 {
 	struct async demux;
 	int do_keep = args->keep_pack;
@@ -831,14 +857,10 @@ static int get_pack(struct fetch_pack_args *args,
 			argv_array_push(&cmd.args, "-v");
 		if (args->use_thin_pack)
 			argv_array_push(&cmd.args, "--fix-thin");
-		if (do_keep && (args->lock_pack || unpack_limit)) {
-			char hostname[HOST_NAME_MAX + 1];
-			if (xgethostname(hostname, sizeof(hostname)))
-				xsnprintf(hostname, sizeof(hostname), "localhost");
-			argv_array_pushf(&cmd.args,
-					"--keep=fetch-pack %"PRIuMAX " on %s",
-					(uintmax_t)getpid(), hostname);
-		}
+		if (do_keep && (args->lock_pack || unpack_limit))
+			add_keep_arg(&cmd.args, "");
+		if (uris_pending)
+			args->check_self_contained_and_connected = 0;
 		if (args->check_self_contained_and_connected)
 			argv_array_push(&cmd.args, "--check-self-contained-and-connected");
 		if (args->from_promisor)
@@ -856,12 +878,8 @@ static int get_pack(struct fetch_pack_args *args,
 		argv_array_pushf(&cmd.args, "--pack_header=%"PRIu32",%"PRIu32,
 				 ntohl(header.hdr_version),
 				 ntohl(header.hdr_entries));
-	if (fetch_fsck_objects >= 0
-	    ? fetch_fsck_objects
-	    : transfer_fsck_objects >= 0
-	    ? transfer_fsck_objects
-	    : 0) {
-		if (args->from_promisor)
+	if (fsck_fetched_objects()) {
+		if (args->from_promisor || uris_pending)
 			/*
 			 * We cannot use --strict in index-pack because it
 			 * checks both broken objects and links, but we only
@@ -1012,7 +1030,7 @@ static struct ref *do_fetch_pack(struct fetch_pack_args *args,
 		alternate_shallow_file = setup_temporary_shallow(si->shallow);
 	else
 		alternate_shallow_file = NULL;
-	if (get_pack(args, fd, pack_lockfile))
+	if (get_pack(args, fd, pack_lockfile, 0))
 		die(_("git fetch-pack: fetch failed."));
 
  all_done:
@@ -1154,6 +1172,19 @@ static int send_fetch_request(struct fetch_negotiator *negotiator, int fd_out,
 		warning("filtering not recognized by server, ignoring");
 	}
 
+	/* Offer to download pre-built packs */
+	if (uri_protocols.nr &&
+	    server_supports_feature("fetch", "packfile-uris", 0)) {
+		struct strbuf protocols = STRBUF_INIT;
+		int i;
+
+		for (i = 0; i < uri_protocols.nr; i++)
+			strbuf_addf(&protocols, "%s%s", i ? "," : "",
+				    uri_protocols.items[i].string);
+		packet_buf_write(&req_buf, "packfile-uris %s", protocols.buf);
+		strbuf_release(&protocols);
+	}
+
 	/* add wants */
 	add_wants(wants, &req_buf);
 
@@ -1308,6 +1339,128 @@ static void receive_wanted_refs(struct packet_reader *reader,
 		die(_("error processing wanted refs: %d"), reader->status);
 }
 
+struct packfile_uri {
+	char *pack_hash;
+	char *uri;
+	struct child_process cmd;
+};
+
+static int uri_protocol_requested(const char *uri)
+{
+	const char *end = strstr(uri, "://");
+	struct string_list_item *item;
+
+	if (!end)
+		return 0;
+	for_each_string_list_item(item, &uri_protocols)
+		if (strlen(item->string) == end - uri &&
+		    !strncmp(item->string, uri, end - uri))
+			return 1;
+	return 0;
+}
+
+/*
+ * Read the "packfile-uris" section and start downloading the packs it
+ * lists, each with its own "git http-fetch", so that they are fetched
+ * and indexed while we receive the rest of the objects.
+ */
+static void receive_packfile_uris(struct fetch_pack_args *args,
+				  struct packet_reader *reader,
+				  struct packfile_uri **uris, int *nr)
+{
+	int alloc = 0, i;
+
+	process_section_header(reader, "packfile-uris", 0);
+	while (packet_reader_read(reader) == PACKET_READ_NORMAL) {
+		struct object_id oid;
+		const char *end;
+		struct packfile_uri *p;
+
+		if (parse_oid_hex(reader->line, &oid, &end) || *end++ != ' ' ||
+		    !uri_protocol_requested(end))
+			die(_("unexpected packfile-uri: '%s'"), reader->line);
+
+		ALLOC_GROW(*uris, *nr + 1, alloc);
+		p = &(*uris)[(*nr)++];
+		p->pack_hash = xstrdup(oid_to_hex(&oid));
+		p->uri = xstrdup(end);
+		child_process_init(&p->cmd);
+	}
+	if (reader->status != PACKET_READ_DELIM)
+		die(_("error processing packfile uris: %d"), reader->status);
+
+	for (i = 0; i < *nr; i++) {
+		struct packfile_uri *p = &(*uris)[i];
+
+		print_verbose(args, _("Downloading pack %s from %s"),
+			      p->pack_hash, p->uri);
+		argv_array_push(&p->cmd.args, "http-fetch");
+		argv_array_pushf(&p->cmd.args, "--packfile=%s", p->pack_hash);
+		add_keep_arg(&p->cmd.args, "--index-pack-arg=");
+		if (fsck_fetched_objects())
+			argv_array_pushf(&p->cmd.args,
+					 "--index-pack-arg=--strict%s",
+					 fsck_msg_types.buf);
+		if (args->from_promisor)
+			argv_array_push(&p->cmd.args,
+					"--index-pack-arg=--promisor");
+		argv_array_push(&p->cmd.args, p->uri);
+		p->cmd.git_cmd = 1;
+		p->cmd.no_stdin = 1;
+		p->cmd.out = -1;
+		if (start_command(&p->cmd))
+			die(_("fetch-pack: unable to fork off http-fetch"));
+	}
+}
+
+/*
+ * Wait for the downloads started by receive_packfile_uris(), and check
+ * that we got the packs the server announced.
+ */
+static void finish_packfile_uris(struct packfile_uri *uris, int nr)
+{
+	struct strbuf out = STRBUF_INIT;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct packfile_uri *p = &uris[i];
+		const char *hash;
+
+		strbuf_reset(&out);
+		if (strbuf_read(&out, p->cmd.out, 0) < 0)
+			die_errno(_("unable to read from http-fetch"));
+		close(p->cmd.out);
+		if (finish_command(&p->cmd))
+			die(_("unable to fetch packfile from '%s'"), p->uri);
+
+		strbuf_rtrim(&out);
+		/*
+		 * Protect the new pack from a concurrent repack until we
+		 * are done, by which time the refs pointing to its objects
+		 * have been updated if we are running inside "git fetch".
+		 */
+		if (skip_prefix(out.buf, "keep\t", &hash)) {
+			struct strbuf keep = STRBUF_INIT;
+			struct object_id oid;
+
+			if (!get_oid_hex(hash, &oid)) {
+				odb_pack_name(&keep, oid.hash, "keep");
+				register_tempfile(keep.buf);
+			}
+			strbuf_release(&keep);
+		} else if (!skip_prefix(out.buf, "pack\t", &hash)) {
+			hash = "";
+		}
+		if (strcmp(hash, p->pack_hash))
+			die(_("pack downloaded from '%s' does not match "
+			      "expected hash %s"), p->uri, p->pack_hash);
+
+		free(p->pack_hash);
+		free(p->uri);
+	}
+	strbuf_release(&out);
+}
+
 enum fetch_state {
 	FETCH_CHECK_LOCAL = 0,
 	FETCH_SEND_REQUEST,
@@ -1328,6 +1481,8 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 	struct packet_reader reader;
 	int in_vain = 0;
 	int haves_to_send = INITIAL_FLUSH;
+	struct packfile_uri *packfile_uris = NULL;
+	int packfile_uris_nr = 0;
 	struct fetch_negotiator negotiator;
 	fetch_negotiator_init(&negotiator, negotiation_algorithm);
 	packet_reader_init(&reader, fd[0], NULL, 0,
@@ -1387,10 +1542,18 @@ static struct ref *do_fetch_pack_v2(struct fetch_pack_args *args,
 			if (process_section_header(&reader, "wanted-refs", 1))
 				receive_wanted_refs(&reader, sought, nr_sought);
 
+			if (process_section_header(&reader, "packfile-uris", 1))
+				receive_packfile_uris(args, &reader,
+						      &packfile_uris,
+						      &packfile_uris_nr);
+
 			/* get the pack */
 			process_section_header(&reader, "packfile", 0);
-			if (get_pack(args, fd, pack_lockfile))
+			if (get_pack(args, fd, pack_lockfile,
+				     packfile_uris_nr))
 				die(_("git fetch-pack: fetch failed."));
+			finish_packfile_uris(packfile_uris, packfile_uris_nr);
+			free(packfile_uris);
 
 			state = FETCH_DONE;
 			break;
@@ -1431,6 +1594,8 @@ static int fetch_pack_config_cb(const char *var, const char *value, void *cb)
 
 static void fetch_pack_config(void)
 {
+	const char *str;
+
 	git_config_get_int("fetch.unpacklimit", &fetch_unpack_limit);
 	git_config_get_int("transfer.unpacklimit", &transfer_unpack_limit);
 	git_config_get_bool("repack.usedeltabaseoffset", &prefer_ofs_delta);
@@ -1438,6 +1603,8 @@ static void fetch_pack_config(void)
 	git_config_get_bool("transfer.fsckobjects", &transfer_fsck_objects);
 	git_config_get_string("fetch.negotiationalgorithm",
 			      &negotiation_algorithm);
+	if (!git_config_get_string_const("fetch.uriprotocols", &str))
+		string_list_split(&uri_protocols, str, ',', -1);
 
 	git_config(fetch_pack_config_cb, NULL);
 }
@@ -0,0 +1,482 @@
+#include "cache.h"
+#include "config.h"
+#include "fsmonitor.h"
+#include "parse-options.h"
+#include "tempfile.h"
+#include "unix-socket.h"
+#include <sys/inotify.h>
+
+/*
+ * The daemon behind "core.fsmonitor = true". It watches every directory
+ * of the working tree with inotify and keeps a journal of the paths that
+ * changed, together with the token (a timestamp of the daemon's clock)
+ * of their last change. Clients send the token of their previous query
+ * and get back the current token and the paths changed since then.
+ */
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | \
+		    IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+		    IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/*
+ * Past this many changed paths, the journal is thrown away; clients
+ * then have to check everything once, which is cheaper than answering
+ * with a list that long.
+ */
+#define MAX_JOURNAL_PATHS (256 * 1024)
+
+struct journal_entry {
+	struct hashmap_entry ent;
+	uint64_t token;
+	char path[FLEX_ARRAY];
+};
+
+static struct hashmap journal;
+
+/* Changes made before this token are not in the journal. */
+static uint64_t journal_start;
+
+/*
+ * The directory watched by each watch descriptor, relative to the top
+ * of the working tree and with a trailing slash ("" for the top).
+ */
+static char **watches;
+static int watches_nr, watches_alloc;
+
+/* The top of the working tree, with a trailing slash. */
+static struct strbuf worktree = STRBUF_INIT;
+
+static int inotify_fd = -1;
+static int debug;
+
+static int journal_entry_cmp(const void *unused_cmp_data,
+			     const void *entry, const void *entry_or_key,
+			     const void *keydata)
+{
+	const struct journal_entry *a = entry;
+	const struct journal_entry *b = entry_or_key;
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static void reset_journal(void)
+{
+	hashmap_free(&journal, 1);
+	hashmap_init(&journal, journal_entry_cmp, NULL, 0);
+	journal_start = getnanotime();
+}
+
+static void record_change(const char *path)
+{
+	struct journal_entry *e;
+	unsigned int hash = strhash(path);
+
+	e = hashmap_get_from_hash(&journal, hash, path);
+	if (!e) {
+		if (hashmap_get_size(&journal) >= MAX_JOURNAL_PATHS)
+			reset_journal();
+		FLEX_ALLOC_STR(e, path, path);
+		hashmap_entry_init(e, hash);
+		hashmap_add(&journal, e);
+	}
+	e->token = getnanotime();
+
+	if (debug)
+		fprintf(stderr, "changed: '%s'\n", path);
+}
+
+static int is_dot_git(const char *name)
+{
+	return !strcmp(name, ".git");
+}
+
+/*
+ * Watch the directory `path` (relative, with a trailing slash, or
+ * empty for the top of the working tree) and all directories below it.
+ * If `record` is set, everything found is recorded as changed: this is
+ * used for directories that appear while the daemon is running, whose
+ * contents may have been created before the watches were in place.
+ */
+static void add_watches(struct strbuf *path, int record)
+{
+	size_t baselen = path->len;
+	struct strbuf abspath = STRBUF_INIT;
+	size_t abslen;
+	DIR *dir;
+	struct dirent *de;
+	int wd;
+
+	strbuf_addbuf(&abspath, &worktree);
+	strbuf_addbuf(&abspath, path);
+	abslen = abspath.len;
+
+	wd = inotify_add_watch(inotify_fd, abspath.buf, WATCH_MASK);
+	if (wd < 0) {
+		if (errno == ENOSPC)
+			die(_("too many directories to watch; "
+			      "consider raising fs.inotify.max_user_watches"));
+		/* It is already gone again; its parent will tell us. */
+		strbuf_release(&abspath);
+		return;
+	}
+	if (wd >= watches_nr) {
+		ALLOC_GROW(watches, wd + 1, watches_alloc);
+		while (watches_nr <= wd)
+			watches[watches_nr++] = NULL;
+	}
+	free(watches[wd]);
+	watches[wd] = xstrdup(path->buf);
+
+	dir = opendir(abspath.buf);
+	if (!dir) {
+		strbuf_release(&abspath);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		int dtype = DTYPE(de);
+
+		if (is_dot_or_dotdot(de->d_name) || is_dot_git(de->d_name))
+			continue;
+
+		strbuf_setlen(path, baselen);
+		strbuf_addstr(path, de->d_name);
+
+		if (dtype == DT_UNKNOWN) {
+			struct stat st;
+
+			strbuf_setlen(&abspath, abslen);
+			strbuf_addstr(&abspath, de->d_name);
+			if (lstat(abspath.buf, &st))
+				continue;
+			dtype = S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+		}
+
+		if (dtype == DT_DIR) {
+			strbuf_addch(path, '/');
+			if (record)
+				record_change(path->buf);
+			add_watches(path, record);
+		} else if (record) {
+			record_change(path->buf);
+		}
+	}
+	closedir(dir);
+	strbuf_setlen(path, baselen);
+	strbuf_release(&abspath);
+}
+
+/* Stop watching the directory `path` (with a trailing slash) and below. */
+static void remove_watches(const char *path)
+{
+	int wd;
+
+	for (wd = 0; wd < watches_nr; wd++) {
+		if (!watches[wd] || !starts_with(watches[wd], path))
+			continue;
+		inotify_rm_watch(inotify_fd, wd);
+		FREE_AND_NULL(watches[wd]);
+	}
+}
+
+static void handle_event(const struct inotify_event *ev)
+{
+	struct strbuf path = STRBUF_INIT;
+	const char *dir;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		/* Events were lost, so the journal cannot be trusted. */
+		if (debug)
+			fprintf(stderr, "inotify queue overflow\n");
+		reset_journal();
+		return;
+	}
+
+	if (ev->wd < 0 || ev->wd >= watches_nr || !watches[ev->wd])
+		return;
+	dir = watches[ev->wd];
+
+	if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+		/*
+		 * Other directories are taken care of by the event in their
+		 * parent, but if the working tree itself went away, there is
+		 * nothing left to watch.
+		 */
+		if (!*dir)
+			exit(0);
+		if (ev->mask & IN_IGNORED)
+			FREE_AND_NULL(watches[ev->wd]);
+		return;
+	}
+
+	if (!ev->len)
+		return;
+
+	if (is_dot_git(ev->name)) {
+		/*
+		 * Our socket lives in the repository, and keeps the directories
+		 * above it busy, so the removal of the working tree is only
+		 * noticed through its ".git" going away.
+		 */
+		if (!*dir && (ev->mask & (IN_DELETE | IN_MOVED_FROM)))
+			exit(0);
+		return;
+	}
+
+	strbuf_addf(&path, "%s%s", dir, ev->name);
+
+	if (ev->mask & IN_ISDIR) {
+		if (!(ev->mask & (IN_CREATE | IN_DELETE |
+				  IN_MOVED_FROM | IN_MOVED_TO)))
+			goto out;
+		strbuf_addch(&path, '/');
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+			remove_watches(path.buf);
+		else
+			add_watches(&path, 1);
+	}
+	record_change(path.buf);
+
+out:
+	strbuf_release(&path);
+}
+
+/* Process all events that are queued, without blocking. */
+static void handle_events(void)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096 + sizeof(struct inotify_event) + NAME_MAX + 1];
+	} u;
+
+	for (;;) {
+		ssize_t len = read(inotify_fd, u.buf, sizeof(u.buf));
+		char *p;
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			die_errno("unable to read inotify events");
+		}
+
+		for (p = u.buf; p < u.buf + len; ) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+
+			handle_event(ev);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+static void answer_query(FILE *out, uint64_t since)
+{
+	struct hashmap_iter iter;
+	struct journal_entry *e;
+	uint64_t token;
+
+	/*
+	 * Anything the client did before asking is queued by now; make
+	 * sure it is in the journal before we hand out a new token.
+	 */
+	handle_events();
+	token = getnanotime();
+
+	fprintf(out, "%"PRIuMAX, (uintmax_t)token);
+	fputc('\0', out);
+
+	if (since < journal_start) {
+		/* We cannot tell; the client has to check everything. */
+		fputc('/', out);
+		return;
+	}
+
+	hashmap_iter_init(&journal, &iter);
+	while ((e = hashmap_iter_next(&iter))) {
+		if (e->token < since)
+			continue;
+		fputs(e->path, out);
+		fputc('\0', out);
+	}
+}
+
+static void serve_one_client(FILE *in, FILE *out)
+{
+	struct strbuf request = STRBUF_INIT;
+	const char *p;
+
+	if (strbuf_getline_lf(&request, in) == EOF)
+		; /* ignore */
+	else if (skip_prefix(request.buf, "query ", &p)) {
+		char *end;
+		uintmax_t since = strtoumax(p, &end, 10);
+
+		if (*end)
+			warning("fsmonitor client sent bogus token: %s", p);
+		else
+			answer_query(out, since);
+	}
+	else if (!strcmp(request.buf, "stop")) {
+		/*
+		 * Exiting removes our socket in the atexit() handler; the
+		 * client only sees EOF once that has happened.
+		 */
+		exit(0);
+	}
+	else
+		warning("fsmonitor client sent unknown request: %s",
+			request.buf);
+
+	strbuf_release(&request);
+}
+
+static void accept_client(int fd)
+{
+	int client, client2;
+	FILE *in, *out;
+
+	client = accept(fd, NULL, NULL);
+	if (client < 0) {
+		warning_errno("accept failed");
+		return;
+	}
+	client2 = dup(client);
+	if (client2 < 0) {
+		warning_errno("dup failed");
+		close(client);
+		return;
+	}
+
+	in = xfdopen(client, "r");
+	out = xfdopen(client2, "w");
+	serve_one_client(in, out);
+	fclose(in);
+	fclose(out);
+}
+
+static void serve_fsmonitor(const char *socket_path)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct pollfd pfd[2];
+	int fd;
+
+	/*
+	 * Do not keep the working tree busy as our cwd: we want to see
+	 * it go away, so that we can exit.
+	 */
+	strbuf_add_absolute_path(&worktree, get_git_work_tree());
+	strbuf_complete(&worktree, '/');
+	if (chdir("/"))
+		die_errno("unable to chdir to '/'");
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0)
+		die_errno("unable to initialize inotify");
+
+	reset_journal();
+	add_watches(&path, 0);
+	strbuf_release(&path);
+
+	fd = unix_stream_listen(socket_path);
+	if (fd < 0)
+		die_errno("unable to bind to '%s'", socket_path);
+
+	printf("ok\n");
+	fclose(stdout);
+	if (!debug) {
+		if (!freopen("/dev/null", "w", stderr))
+			die_errno("unable to point stderr to /dev/null");
+	}
+
+	pfd[0].fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = inotify_fd;
+	pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno != EINTR)
+				die_errno("poll failed");
+			continue;
+		}
+		if (pfd[1].revents & POLLIN)
+			handle_events();
+		if (pfd[0].revents & POLLIN)
+			accept_client(fd);
+	}
+}
+
+static int send_request(const char *socket_path, const char *request)
+{
+	int fd = unix_stream_connect(socket_path);
+	struct strbuf answer = STRBUF_INIT;
+	size_t i;
+
+	if (fd < 0)
+		return -1;
+	if (write_in_full(fd, request, strlen(request)) < 0)
+		die_errno("unable to write to fsmonitor daemon");
+	shutdown(fd, SHUT_WR);
+	if (strbuf_read(&answer, fd, 0) < 0)
+		die_errno("read error from fsmonitor daemon");
+	close(fd);
+
+	/* Show the answer with one token or path per line. */
+	for (i = 0; i < answer.len; i++)
+		putchar(answer.buf[i] ? answer.buf[i] : '\n');
+	strbuf_release(&answer);
+	return 0;
+}
+
+int cmd_main(int argc, const char **argv)
+{
+	struct tempfile *socket_file;
+	const char *socket_path;
+	static const char *usage[] = {
+		"git fsmonitor--daemon [--debug] run",
+		"git fsmonitor--daemon stop",
+		"git fsmonitor--daemon query <token>",
+		NULL
+	};
+	const struct option options[] = {
+		OPT_BOOL(0, "debug", &debug,
+			 N_("print debugging messages to stderr")),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, NULL, options, usage, 0);
+	if (!argc)
+		usage_with_options(usage, options);
+
+	setup_git_directory();
+	if (!is_inside_work_tree())
+		die("fsmonitor--daemon needs a working tree");
+	setup_work_tree();
+	socket_path = fsmonitor_daemon_socket_path();
+
+	if (!strcmp(argv[0], "stop") && argc == 1) {
+		if (send_request(socket_path, "stop\n") < 0)
+			die_errno("unable to connect to fsmonitor daemon");
+		return 0;
+	}
+	if (!strcmp(argv[0], "query") && argc == 2) {
+		struct strbuf request = STRBUF_INIT;
+
+		strbuf_addf(&request, "query %s\n", argv[1]);
+		if (send_request(socket_path, request.buf) < 0)
+			die_errno("unable to connect to fsmonitor daemon");
+		strbuf_release(&request);
+		return 0;
+	}
+	if (strcmp(argv[0], "run") || argc != 1)
+		usage_with_options(usage, options);
+
+	if (!send_request(socket_path, ""))
+		die("fsmonitor daemon is already running");
+
+	socket_file = register_tempfile(socket_path);
+	serve_fsmonitor(socket_path);
+	delete_tempfile(&socket_file);
+
+	return 0;
+}
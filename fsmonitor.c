@@ -5,6 +5,7 @@
 #include "fsmonitor.h"
 #include "run-command.h"
 #include "strbuf.h"
+#include "unix-socket.h"
 
 #define INDEX_EXTENSION_VERSION	(1)
 #define HOOK_INTERFACE_VERSION	(1)
@@ -110,10 +111,137 @@ static int query_fsmonitor(int version, uint64_t last_update, struct strbuf *que
 	return capture_command(&cp, query_result, 1024);
 }
 
+int fsmonitor_uses_daemon(void)
+{
+	return core_fsmonitor && git_parse_maybe_bool(core_fsmonitor) == 1;
+}
+
+const char *fsmonitor_daemon_socket_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = absolute_pathdup(git_path("fsmonitor--daemon.ipc"));
+	return path;
+}
+
+#ifndef NO_UNIX_SOCKETS
+static int spawn_fsmonitor_daemon(void)
+{
+	struct child_process daemon = CHILD_PROCESS_INIT;
+	char buf[128];
+	int r;
+
+	/*
+	 * Run the daemon directly rather than through "git", which would
+	 * wait for it and keep our end of the pipe open.
+	 */
+	argv_array_pushl(&daemon.args, "git-fsmonitor--daemon", "run", NULL);
+	daemon.no_stdin = 1;
+	daemon.out = -1;
+	daemon.dir = get_git_work_tree();
+
+	if (start_command(&daemon))
+		return error(_("unable to start fsmonitor daemon"));
+	r = read_in_full(daemon.out, buf, sizeof(buf));
+	close(daemon.out);
+	if (r != 3 || memcmp(buf, "ok\n", 3))
+		return error(_("fsmonitor daemon did not start"));
+	return 0;
+}
+
+static int send_fsmonitor_daemon_query(uint64_t last_update,
+				       struct strbuf *answer)
+{
+	struct strbuf request = STRBUF_INIT;
+	int fd = unix_stream_connect(fsmonitor_daemon_socket_path());
+
+	if (fd < 0)
+		return -1;
+
+	strbuf_addf(&request, "query %"PRIuMAX"\n", (uintmax_t)last_update);
+	if (write_in_full(fd, request.buf, request.len) < 0 ||
+	    shutdown(fd, SHUT_WR) < 0 ||
+	    strbuf_read(answer, fd, 1024) < 0) {
+		close(fd);
+		strbuf_release(&request);
+		return error_errno(_("unable to talk to fsmonitor daemon"));
+	}
+	close(fd);
+	strbuf_release(&request);
+	return 0;
+}
+
+/*
+ * Ask the built-in daemon for the paths changed since `last_update`,
+ * starting it if it is not running yet. The answer starts with the
+ * daemon's token for this query, which is stored in `token` and
+ * removed from `query_result`; the rest has the same format as the
+ * output of the hook.
+ */
+static int query_fsmonitor_daemon(uint64_t last_update, uint64_t *token,
+				  struct strbuf *query_result)
+{
+	size_t len;
+	char *end;
+
+	if (send_fsmonitor_daemon_query(last_update, query_result)) {
+		if (errno != ENOENT && errno != ECONNREFUSED)
+			return error_errno(_("unable to connect to fsmonitor daemon"));
+		/*
+		 * A new daemon knows nothing about earlier changes and will
+		 * answer "/", but it gives us a token for the next query.
+		 */
+		spawn_fsmonitor_daemon();
+		if (send_fsmonitor_daemon_query(last_update, query_result))
+			return -1;
+	}
+
+	len = strlen(query_result->buf);
+	*token = strtoumax(query_result->buf, &end, 10);
+	if (len == query_result->len || *end || !*token)
+		return error(_("fsmonitor daemon sent a bogus answer"));
+	strbuf_remove(query_result, 0, len + 1);
+	return 0;
+}
+#else
+static int query_fsmonitor_daemon(uint64_t last_update, uint64_t *token,
+				  struct strbuf *query_result)
+{
+	return error(_("the fsmonitor daemon is not supported on this system"));
+}
+#endif
+
 static void fsmonitor_refresh_callback(struct index_state *istate, const char *name)
 {
-	int pos = index_name_pos(istate, name, strlen(name));
+	int len = strlen(name);
+	int pos;
+
+	if (len && name[len - 1] == '/') {
+		/*
+		 * A directory appeared or went away; everything the index
+		 * has below it may have changed.
+		 */
+		char *dir = xmemdupz(name, len - 1);
+
+		pos = index_name_pos(istate, name, len);
+		if (pos < 0)
+			pos = -pos - 1;
+		for (; pos < istate->cache_nr; pos++) {
+			struct cache_entry *ce = istate->cache[pos];
+
+			if (strncmp(ce->name, name, len))
+				break;
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+		}
 
+		trace_printf_key(&trace_fsmonitor, "fsmonitor_refresh_callback '%s'", name);
+		untracked_cache_invalidate_path(istate, dir, 0);
+		free(dir);
+		return;
+	}
+
+	pos = index_name_pos(istate, name, len);
 	if (pos >= 0) {
 		struct cache_entry *ce = istate->cache[pos];
 		ce->ce_flags &= ~CE_FSMONITOR_VALID;
@@ -152,8 +280,22 @@ void refresh_fsmonitor(struct index_state *istate)
 	 * If we have a last update time, call query_fsmonitor for the set of
 	 * changes since that time, else assume everything is possibly dirty
 	 * and check it all.
+	 *
+	 * The daemon is always asked, with 0 when we have no token yet: it
+	 * then answers "/" together with a token of its own clock. Only its
+	 * tokens are ever stored, and 0 when it could not be reached, so
+	 * that it never compares its journal with our clock.
 	 */
-	if (istate->fsmonitor_last_update) {
+	if (fsmonitor_uses_daemon()) {
+		uint64_t token;
+
+		query_success = !query_fsmonitor_daemon(istate->fsmonitor_last_update,
+							&token, &query_result);
+		trace_performance_since(last_update, "fsmonitor daemon query");
+		trace_printf_key(&trace_fsmonitor, "fsmonitor daemon returned %s",
+			query_success ? "success" : "failure");
+		last_update = query_success ? token : 0;
+	} else if (istate->fsmonitor_last_update) {
 		query_success = !query_fsmonitor(HOOK_INTERFACE_VERSION,
 			istate->fsmonitor_last_update, &query_result);
 		trace_performance_since(last_update, "fsmonitor process '%s'", core_fsmonitor);
@@ -198,7 +340,9 @@ void add_fsmonitor(struct index_state *istate)
 	if (!istate->fsmonitor_last_update) {
 		trace_printf_key(&trace_fsmonitor, "add fsmonitor");
 		istate->cache_changed |= FSMONITOR_CHANGED;
-		istate->fsmonitor_last_update = getnanotime();
+		/* the daemon hands out its own token in refresh_fsmonitor() */
+		if (!fsmonitor_uses_daemon())
+			istate->fsmonitor_last_update = getnanotime();
 
 		/* reset the fsmonitor state */
 		for (i = 0; i < istate->cache_nr; i++)
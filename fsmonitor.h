@@ -37,13 +37,22 @@ extern void remove_fsmonitor(struct index_state *istate);
 extern void tweak_fsmonitor(struct index_state *istate);
 
 /*
- * Run the configured fsmonitor integration script and clear the
- * CE_FSMONITOR_VALID bit for any files returned as dirty.  Also invalidate
- * any corresponding untracked cache directory structures. Optimized to only
- * run the first time it is called.
+ * Run the configured fsmonitor integration script (or query the built-in
+ * daemon) and clear the CE_FSMONITOR_VALID bit for any files returned as
+ * dirty.  Also invalidate any corresponding untracked cache directory
+ * structures. Optimized to only run the first time it is called.
  */
 extern void refresh_fsmonitor(struct index_state *istate);
 
+/*
+ * Is core.fsmonitor set to "true", i.e. to the built-in
+ * "git fsmonitor--daemon" rather than to a hook?
+ */
+extern int fsmonitor_uses_daemon(void);
+
+/* The socket the built-in daemon listens on. */
+extern const char *fsmonitor_daemon_socket_path(void);
+
 /*
  * Set the given cache entries CE_FSMONITOR_VALID bit. This should be
  * called any time the cache entry has been updated to reflect the
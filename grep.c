@@ -1531,11 +1531,6 @@ static inline void grep_attr_unlock(void)
 		pthread_mutex_unlock(&grep_attr_mutex);
 }
 
-/*
- * Same as git_attr_mutex, but protecting the thread-unsafe object db access.
- */
-pthread_mutex_t grep_read_mutex;
-
 #else
 #define grep_attr_lock()
 #define grep_attr_unlock()
@@ -1738,11 +1733,12 @@ static int fill_textconv_grep(struct userdiff_driver *driver,
 	/*
 	 * fill_textconv is not remotely thread-safe; it may load objects
 	 * behind the scenes, and it modifies the global diff tempfile
-	 * structure.
+	 * structure. The object read lock is recursive, so we can hold it
+	 * across the object reads fill_textconv makes.
 	 */
-	grep_read_lock();
+	obj_read_lock();
 	size = fill_textconv(driver, df, &buf);
-	grep_read_unlock();
+	obj_read_unlock();
 	free_filespec(df);
 
 	/*
@@ -2107,9 +2103,7 @@ static int grep_source_load_oid(struct grep_source *gs)
 {
 	enum object_type type;
 
-	grep_read_lock();
 	gs->buf = read_object_file(gs->identifier, &type, &gs->size);
-	grep_read_unlock();
 
 	if (!gs->buf)
 		return error(_("'%s': unable to read %s"),
@@ -3,9 +3,71 @@
 #include "exec-cmd.h"
 #include "http.h"
 #include "walker.h"
+#include "bundle.h"
+#include "run-command.h"
+#include "transport.h"
 
 static const char http_fetch_usage[] = "git http-fetch "
-"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url";
+"[-c] [-t] [-a] [-v] [--recover] [-w ref] [--stdin] commit-id url\n"
+"   or: git http-fetch --packfile=<hash> [--index-pack-arg=<arg>...] url";
+
+/*
+ * Download the pack or bundle at `url` and index it with
+ * `git index-pack --stdin`, whose output goes to our stdout. Bundles must
+ * be self-contained, as the pack they hold is not fixed up.
+ */
+static void fetch_packfile(const char *pack_hash,
+			   const struct argv_array *index_pack_args,
+			   const char *url)
+{
+	struct child_process ip = CHILD_PROCESS_INIT;
+	struct strbuf tmpfile = STRBUF_INIT;
+	const char *path;
+	int fd;
+
+	if (skip_prefix(url, "file://", &path)) {
+		if (!is_transport_allowed("file", -1))
+			die("transport 'file' not allowed");
+	} else {
+		struct http_get_options options = { 0 };
+
+		http_init(NULL, url, 0);
+		strbuf_addf(&tmpfile, "%s/pack/tmp_uri_%s",
+			    get_object_directory(), pack_hash);
+		/* a leftover would be taken as the complete download */
+		unlink(tmpfile.buf);
+		if (http_get_file(url, tmpfile.buf, &options) != HTTP_OK)
+			die("unable to get pack file '%s'", url);
+		http_cleanup();
+		path = tmpfile.buf;
+	}
+
+	if (is_bundle(path, 1)) {
+		struct bundle_header header;
+
+		memset(&header, 0, sizeof(header));
+		fd = read_bundle_header(path, &header);
+		if (fd < 0)
+			die("unable to read bundle '%s'", url);
+		if (header.prerequisites.nr)
+			die("bundle '%s' is not self-contained", url);
+	} else {
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			die_errno("unable to open pack file '%s'", path);
+	}
+
+	ip.git_cmd = 1;
+	ip.in = fd;
+	argv_array_pushl(&ip.args, "index-pack", "--stdin", NULL);
+	argv_array_pushv(&ip.args, index_pack_args->argv);
+	if (run_command(&ip))
+		die("index-pack failed on pack file '%s'", url);
+
+	if (tmpfile.len)
+		unlink(tmpfile.buf);
+	strbuf_release(&tmpfile);
+}
 
 int cmd_main(int argc, const char **argv)
 {
@@ -19,6 +81,9 @@ int cmd_main(int argc, const char **argv)
 	int rc = 0;
 	int get_verbosely = 0;
 	int get_recover = 0;
+	const char *packfile = NULL;
+	struct argv_array index_pack_args = ARGV_ARRAY_INIT;
+	const char *p;
 
 	while (arg < argc && argv[arg][0] == '-') {
 		if (argv[arg][1] == 't') {
@@ -35,9 +100,26 @@ int cmd_main(int argc, const char **argv)
 			get_recover = 1;
 		} else if (!strcmp(argv[arg], "--stdin")) {
 			commits_on_stdin = 1;
+		} else if (skip_prefix(argv[arg], "--packfile=", &p)) {
+			packfile = p;
+		} else if (skip_prefix(argv[arg], "--index-pack-arg=", &p)) {
+			argv_array_push(&index_pack_args, p);
 		}
 		arg++;
 	}
+	if (packfile) {
+		struct object_id oid;
+
+		if (argc != arg + 1 || commits_on_stdin)
+			usage(http_fetch_usage);
+		setup_git_directory();
+		git_config(git_default_config, NULL);
+		if (get_oid_hex(packfile, &oid) || packfile[the_hash_algo->hexsz])
+			die("invalid pack hash '%s'", packfile);
+		fetch_packfile(packfile, &index_pack_args, argv[arg]);
+		argv_array_clear(&index_pack_args);
+		return 0;
+	}
 	if (argc != arg + 2 - commits_on_stdin)
 		usage(http_fetch_usage);
 	if (commits_on_stdin) {
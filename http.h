@@ -196,6 +196,13 @@ struct http_get_options {
  */
 int http_get_strbuf(const char *url, struct strbuf *result, struct http_get_options *options);
 
+/*
+ * Downloads a URL and stores the result in the given file, resuming an
+ * interrupted download if possible.
+ */
+int http_get_file(const char *url, const char *filename,
+		  struct http_get_options *options);
+
 extern int http_fetch_ref(const char *base, struct ref *ref);
 
 /* Helpers for fetching packs */
@@ -40,11 +40,15 @@ struct oidset;
  * but *may* be revisited (if the object appears again in the traversal).
  * Therefore, it will be omitted from the results *unless* a later
  * iteration causes it to be shown.
+ *
+ * _SKIP_TREE : Only meaningful for LOFS_BEGIN_TREE; do not descend into
+ *              the entries of the tree.
  */
 enum list_objects_filter_result {
 	LOFR_ZERO      = 0,
 	LOFR_MARK_SEEN = 1<<0,
 	LOFR_DO_SHOW   = 1<<1,
+	LOFR_SKIP_TREE = 1<<2,
 };
 
 enum list_objects_filter_situation {
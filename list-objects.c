@@ -98,13 +98,60 @@ static void process_tree(struct rev_info *revs,
 			 const char *name,
 			 void *cb_data,
 			 filter_object_fn filter_fn,
-			 void *filter_data)
+			 void *filter_data);
+
+static void process_tree_contents(struct rev_info *revs,
+				  struct tree *tree,
+				  show_object_fn show,
+				  struct strbuf *base,
+				  void *cb_data,
+				  filter_object_fn filter_fn,
+				  void *filter_data)
 {
-	struct object *obj = &tree->object;
 	struct tree_desc desc;
 	struct name_entry entry;
 	enum interesting match = revs->diffopt.pathspec.nr == 0 ?
 		all_entries_interesting: entry_not_interesting;
+
+	init_tree_desc(&desc, tree->buffer, tree->size);
+
+	while (tree_entry(&desc, &entry)) {
+		if (match != all_entries_interesting) {
+			match = tree_entry_interesting(&entry, base, 0,
+						       &revs->diffopt.pathspec);
+			if (match == all_entries_not_interesting)
+				break;
+			if (match == entry_not_interesting)
+				continue;
+		}
+
+		if (S_ISDIR(entry.mode))
+			process_tree(revs,
+				     lookup_tree(the_repository, entry.oid),
+				     show, base, entry.path,
+				     cb_data, filter_fn, filter_data);
+		else if (S_ISGITLINK(entry.mode))
+			process_gitlink(revs, entry.oid->hash,
+					show, base, entry.path,
+					cb_data);
+		else
+			process_blob(revs,
+				     lookup_blob(the_repository, entry.oid),
+				     show, base, entry.path,
+				     cb_data, filter_fn, filter_data);
+	}
+}
+
+static void process_tree(struct rev_info *revs,
+			 struct tree *tree,
+			 show_object_fn show,
+			 struct strbuf *base,
+			 const char *name,
+			 void *cb_data,
+			 filter_object_fn filter_fn,
+			 void *filter_data)
+{
+	struct object *obj = &tree->object;
 	int baselen = base->len;
 	enum list_objects_filter_result r = LOFR_MARK_SEEN | LOFR_DO_SHOW;
 	int gently = revs->ignore_missing_links ||
@@ -144,33 +191,9 @@ static void process_tree(struct rev_info *revs,
 	if (base->len)
 		strbuf_addch(base, '/');
 
-	init_tree_desc(&desc, tree->buffer, tree->size);
-
-	while (tree_entry(&desc, &entry)) {
-		if (match != all_entries_interesting) {
-			match = tree_entry_interesting(&entry, base, 0,
-						       &revs->diffopt.pathspec);
-			if (match == all_entries_not_interesting)
-				break;
-			if (match == entry_not_interesting)
-				continue;
-		}
-
-		if (S_ISDIR(entry.mode))
-			process_tree(revs,
-				     lookup_tree(the_repository, entry.oid),
-				     show, base, entry.path,
-				     cb_data, filter_fn, filter_data);
-		else if (S_ISGITLINK(entry.mode))
-			process_gitlink(revs, entry.oid->hash,
-					show, base, entry.path,
-					cb_data);
-		else
-			process_blob(revs,
-				     lookup_blob(the_repository, entry.oid),
-				     show, base, entry.path,
-				     cb_data, filter_fn, filter_data);
-	}
+	if (!(r & LOFR_SKIP_TREE))
+		process_tree_contents(revs, tree, show, base, cb_data,
+				      filter_fn, filter_data);
 
 	if (!(obj->flags & USER_GIVEN) && filter_fn) {
 		r = filter_fn(LOFS_END_TREE, obj,
@@ -239,7 +262,12 @@ void mark_edges_uninteresting(struct rev_info *revs, show_edge_fn show_edge)
 
 static void add_pending_tree(struct rev_info *revs, struct tree *tree)
 {
+	unsigned given = tree->object.flags & USER_GIVEN;
+
 	add_pending_object(revs, &tree->object, "");
+	/* the root tree of a commit is subject to the filter */
+	if (!given)
+		tree->object.flags &= ~USER_GIVEN;
 }
 
 static void traverse_trees_and_blobs(struct rev_info *revs,
@@ -0,0 +1,136 @@
+#include "cache.h"
+#include "config.h"
+#include "memory-budget.h"
+
+static struct trace_key trace_memory = TRACE_KEY_INIT(MEMORY);
+
+static struct memory_consumer *consumers;
+static size_t peak_total;
+
+#ifndef NO_PTHREADS
+/*
+ * Consumers are charged from threads which hold different locks (e.g.
+ * the delta cache of pack-objects and the object store), so the usage
+ * of all of them is only read and updated with this one held.
+ */
+static pthread_mutex_t budget_mutex;
+#define budget_lock()		pthread_mutex_lock(&budget_mutex)
+#define budget_unlock()		pthread_mutex_unlock(&budget_mutex)
+#else
+#define budget_lock()		(void)0
+#define budget_unlock()		(void)0
+#endif
+
+static size_t total_used(void)
+{
+	struct memory_consumer *c;
+	size_t total = 0;
+
+	for (c = consumers; c; c = c->next)
+		total += c->used;
+	return total;
+}
+
+static void report_memory_usage(void)
+{
+	struct memory_consumer *c;
+
+	for (c = consumers; c; c = c->next)
+		trace_printf_key(&trace_memory,
+				 "memory: %s: used %"PRIuMAX", peak %"PRIuMAX"\n",
+				 c->name, (uintmax_t)c->used,
+				 (uintmax_t)c->peak);
+	trace_printf_key(&trace_memory,
+			 "memory: total: peak %"PRIuMAX", budget %"PRIuMAX"\n",
+			 (uintmax_t)peak_total, (uintmax_t)memory_budget());
+}
+
+void register_memory_consumer(struct memory_consumer *c)
+{
+	struct memory_consumer **tail;
+
+	if (c->registered)
+		return;
+	if (!consumers) {
+#ifndef NO_PTHREADS
+		pthread_mutex_init(&budget_mutex, NULL);
+#endif
+		if (trace_want(&trace_memory))
+			atexit(report_memory_usage);
+	}
+	budget_lock();
+	/* keep the registration order, so that reports are stable */
+	for (tail = &consumers; *tail; tail = &(*tail)->next)
+		; /* nothing */
+	*tail = c;
+	c->registered = 1;
+	budget_unlock();
+
+	/* parse the budget now, as threads may be started next */
+	memory_budget();
+}
+
+void memory_charge(struct memory_consumer *c, size_t size)
+{
+	size_t total;
+
+	if (!c->registered)
+		register_memory_consumer(c);
+	budget_lock();
+	c->used += size;
+	if (c->used > c->peak)
+		c->peak = c->used;
+	total = total_used();
+	if (total > peak_total)
+		peak_total = total;
+	budget_unlock();
+}
+
+void memory_uncharge(struct memory_consumer *c, size_t size)
+{
+	budget_lock();
+	if (size > c->used)
+		BUG("memory consumer '%s' releases more than it holds",
+		    c->name);
+	c->used -= size;
+	budget_unlock();
+}
+
+size_t memory_budget(void)
+{
+	static int env_parsed, env_set;
+	static size_t env_budget;
+
+	if (!env_parsed) {
+		const char *value = getenv(GIT_MAX_MEMORY_ENVIRONMENT);
+		unsigned long budget;
+
+		if (value && *value) {
+			if (!git_parse_ulong(value, &budget))
+				die(_("invalid value for %s: '%s'"),
+				    GIT_MAX_MEMORY_ENVIRONMENT, value);
+			env_budget = budget;
+			env_set = 1;
+		}
+		env_parsed = 1;
+	}
+	return env_set ? env_budget : core_max_memory;
+}
+
+int memory_budget_exceeded(void)
+{
+	size_t budget = memory_budget();
+	int exceeded;
+
+	if (!budget || !consumers)
+		return 0;
+	budget_lock();
+	exceeded = total_used() > budget;
+	budget_unlock();
+	return exceeded;
+}
+
+int memory_accounting_enabled(void)
+{
+	return memory_budget() || trace_want(&trace_memory);
+}
@@ -0,0 +1,56 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+/*
+ * The memory budget bounds the memory held by git's caches as a whole.
+ * It is set with `git --max-memory=<size>` (which exports
+ * $GIT_MAX_MEMORY to subprocesses) or with `core.maxMemory`, and is
+ * unlimited by default.
+ *
+ * Each cache is a memory consumer, which reports the memory it acquires
+ * and releases with memory_charge() and memory_uncharge(). Caches that
+ * can give memory back call memory_budget_exceeded() after growing and
+ * evict entries for as long as it returns true; memory that cannot be
+ * released on demand (e.g. parsed objects) is accounted all the same,
+ * so that it leaves less room to the caches.
+ *
+ * A consumer is registered on its first charge. Consumers can be charged
+ * from any thread, as the accounting has its own lock, but a consumer
+ * that is charged from several threads must be registered with
+ * register_memory_consumer() before they are started (the first
+ * registration also sets up that lock).
+ *
+ * With GIT_TRACE_MEMORY, the current and peak usage of every consumer
+ * are reported at exit.
+ */
+
+struct memory_consumer {
+	const char *name;
+
+	/* internal */
+	size_t used, peak;
+	struct memory_consumer *next;
+	unsigned registered : 1;
+};
+
+#define MEMORY_CONSUMER_INIT(name) { (name) }
+
+void register_memory_consumer(struct memory_consumer *c);
+
+void memory_charge(struct memory_consumer *c, size_t size);
+void memory_uncharge(struct memory_consumer *c, size_t size);
+
+/* Return the budget in bytes, or 0 if it is unlimited. */
+size_t memory_budget(void);
+
+/* Return 1 if the consumers use more memory than the budget allows. */
+int memory_budget_exceeded(void);
+
+/*
+ * Return 1 if memory is being accounted at all, i.e. if a budget is
+ * set or GIT_TRACE_MEMORY is enabled. Callers that would need extra
+ * locking to charge can skip it otherwise.
+ */
+int memory_accounting_enabled(void);
+
+#endif /* MEMORY_BUDGET_H */
@@ -0,0 +1,947 @@
+/*
+ * An in-core merge of trees, see merge-ort.h.
+ */
+#include "cache.h"
+#include "merge-ort.h"
+#include "alloc.h"
+#include "blob.h"
+#include "commit.h"
+#include "commit-reach.h"
+#include "diff.h"
+#include "diffcore.h"
+#include "ll-merge.h"
+#include "object-store.h"
+#include "repository.h"
+#include "trace-event.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "xdiff-interface.h"
+
+struct version_info {
+	unsigned mode;
+	struct object_id oid;
+};
+
+struct merge_rename {
+	char *src, *dst;
+	struct version_info src_version, dst_version;
+};
+
+struct rename_cache_entry {
+	struct hashmap_entry ent;
+	struct object_id base, side;
+	int nr;
+	struct merge_rename *renames;
+};
+
+struct merge_rename_cache {
+	struct hashmap map;
+};
+
+/*
+ * A path which is a file in at least one of the trees and needs to be
+ * merged, which is done once the renames are known: a rename moves the
+ * versions of the source path that are to be merged to the destination.
+ */
+struct merge_path {
+	struct hashmap_entry ent;
+	/* the versions in the merge base, on side 1 and on side 2 */
+	struct version_info stages[3];
+	/* the path of the versions which come from another path */
+	const char *pathnames[3];
+	unsigned rename_delete:1, rename_rename:1;
+	/* the side which renamed the file, for rename_delete */
+	int rename_side;
+	char path[FLEX_ARRAY];
+};
+
+struct merge_state {
+	struct merge_options *opt;
+	struct merge_result *result;
+	struct object_id trees[3];
+	int detect_renames;
+
+	struct hashmap paths;
+	/* the same paths, in the order of the tree walk */
+	struct merge_path **order;
+	int order_nr, order_alloc;
+
+	/*
+	 * The entries of the merged tree, as a struct version_info, keyed
+	 * by their path, with a trailing slash for directories.
+	 */
+	struct string_list entries;
+};
+
+static int merge_path_cmp(const void *unused_cmp_data,
+			  const void *entry,
+			  const void *entry_or_key,
+			  const void *keydata)
+{
+	const struct merge_path *a = entry, *b = entry_or_key;
+
+	return strcmp(a->path, keydata ? keydata : b->path);
+}
+
+static struct merge_path *find_path(struct merge_state *ms, const char *path)
+{
+	struct hashmap_entry key;
+
+	hashmap_entry_init(&key, strhash(path));
+	return hashmap_get(&ms->paths, &key, path);
+}
+
+static void set_version(struct version_info *v, const struct name_entry *n)
+{
+	v->mode = n->mode;
+	if (n->mode)
+		oidcpy(&v->oid, n->oid);
+	else
+		oidclr(&v->oid);
+}
+
+static int same_version(const struct version_info *a,
+			const struct version_info *b)
+{
+	if (!a->mode || !b->mode)
+		return a->mode == b->mode;
+	return a->mode == b->mode && oideq(&a->oid, &b->oid);
+}
+
+static void add_entry(struct merge_state *ms, const char *path, int is_dir,
+		      const struct version_info *v)
+{
+	struct string_list_item *item;
+
+	if (is_dir)
+		item = string_list_append_nodup(&ms->entries,
+						xstrfmt("%s/", path));
+	else
+		item = string_list_append(&ms->entries, path);
+	item->util = xmemdupz(v, sizeof(*v));
+}
+
+static void record_file(struct merge_state *ms, const char *path,
+			struct version_info *v)
+{
+	struct merge_path *mp;
+
+	/* unchanged everywhere, which is never a rename source or target */
+	if (same_version(&v[0], &v[1]) && same_version(&v[0], &v[2])) {
+		add_entry(ms, path, 0, &v[0]);
+		return;
+	}
+
+	FLEX_ALLOC_STR(mp, path, path);
+	hashmap_entry_init(mp, strhash(path));
+	memcpy(mp->stages, v, sizeof(mp->stages));
+	hashmap_add(&ms->paths, mp);
+	ALLOC_GROW(ms->order, ms->order_nr + 1, ms->order_alloc);
+	ms->order[ms->order_nr++] = mp;
+}
+
+static int collect_merge_info_callback(int n, unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info);
+
+static int collect_dir(struct merge_state *ms, const char *path,
+		       struct name_entry *dirs, struct version_info *v,
+		       struct name_entry *p, struct traverse_info *info)
+{
+	struct traverse_info newinfo;
+	struct tree_desc t[3];
+	void *buf[3];
+	int i, ret;
+
+	/*
+	 * A directory can be taken as a whole when both sides agree. When
+	 * only one side changed it, its files can still be the source or
+	 * the target of a rename of the other side and must be walked.
+	 */
+	if (same_version(&v[1], &v[2])) {
+		if (v[1].mode)
+			add_entry(ms, path, 1, &v[1]);
+		return 0;
+	}
+	if (!ms->detect_renames && same_version(&v[0], &v[1])) {
+		if (v[2].mode)
+			add_entry(ms, path, 1, &v[2]);
+		return 0;
+	}
+	if (!ms->detect_renames && same_version(&v[0], &v[2])) {
+		if (v[1].mode)
+			add_entry(ms, path, 1, &v[1]);
+		return 0;
+	}
+
+	newinfo = *info;
+	newinfo.prev = info;
+	newinfo.name = *p;
+	newinfo.pathlen += tree_entry_len(p) + 1;
+
+	for (i = 0; i < 3; i++)
+		buf[i] = fill_tree_descriptor(t + i,
+					      dirs[i].mode ? dirs[i].oid : NULL);
+	ret = traverse_trees(3, t, &newinfo);
+	for (i = 0; i < 3; i++)
+		free(buf[i]);
+	return ret;
+}
+
+static int collect_merge_info_callback(int n, unsigned long mask,
+				       unsigned long dirmask,
+				       struct name_entry *names,
+				       struct traverse_info *info)
+{
+	struct merge_state *ms = info->data;
+	unsigned long filemask = mask & ~dirmask;
+	struct name_entry dirs[3], *p = names;
+	struct version_info files_v[3], dirs_v[3];
+	char *path;
+	int i, ret = 0;
+
+	while (!p->mode)
+		p++;
+	path = xmallocz(traverse_path_len(info, p));
+	make_traverse_path(path, info, p);
+
+	/* a path can be a file on a side and a directory on another one */
+	memset(dirs, 0, sizeof(dirs));
+	memset(files_v, 0, sizeof(files_v));
+	memset(dirs_v, 0, sizeof(dirs_v));
+	for (i = 0; i < 3; i++) {
+		if (filemask & (1ul << i))
+			set_version(&files_v[i], &names[i]);
+		if (dirmask & (1ul << i)) {
+			dirs[i] = names[i];
+			set_version(&dirs_v[i], &names[i]);
+		}
+	}
+
+	if (filemask)
+		record_file(ms, path, files_v);
+	if (dirmask)
+		ret = collect_dir(ms, path, dirs, dirs_v, p, info);
+
+	free(path);
+	return ret < 0 ? ret : mask;
+}
+
+static int collect_merge_info(struct merge_state *ms)
+{
+	struct traverse_info info;
+	struct tree_desc t[3];
+	void *buf[3];
+	int i, ret;
+
+	trace_event_region_enter("merge", "collect_merge_info");
+	setup_traverse_info(&info, "");
+	info.fn = collect_merge_info_callback;
+	info.data = ms;
+
+	for (i = 0; i < 3; i++)
+		buf[i] = fill_tree_descriptor(t + i, &ms->trees[i]);
+	ret = traverse_trees(3, t, &info);
+	for (i = 0; i < 3; i++)
+		free(buf[i]);
+	trace_event_region_leave("merge", "collect_merge_info");
+	return ret;
+}
+
+static unsigned int rename_cache_hash(const struct object_id *base,
+				      const struct object_id *side)
+{
+	return sha1hash(base->hash) ^ sha1hash(side->hash);
+}
+
+static int rename_cache_entry_cmp(const void *unused_cmp_data,
+				  const void *entry,
+				  const void *entry_or_key,
+				  const void *unused_keydata)
+{
+	const struct rename_cache_entry *a = entry, *b = entry_or_key;
+
+	return !oideq(&a->base, &b->base) || !oideq(&a->side, &b->side);
+}
+
+struct merge_rename_cache *merge_rename_cache_new(void)
+{
+	struct merge_rename_cache *cache = xmalloc(sizeof(*cache));
+
+	hashmap_init(&cache->map, rename_cache_entry_cmp, NULL, 0);
+	return cache;
+}
+
+void merge_rename_cache_free(struct merge_rename_cache *cache)
+{
+	struct hashmap_iter iter;
+	struct rename_cache_entry *e;
+
+	if (!cache)
+		return;
+	hashmap_iter_init(&cache->map, &iter);
+	while ((e = hashmap_iter_next(&iter))) {
+		int i;
+
+		for (i = 0; i < e->nr; i++) {
+			free(e->renames[i].src);
+			free(e->renames[i].dst);
+		}
+		free(e->renames);
+	}
+	hashmap_free(&cache->map, 1);
+	free(cache);
+}
+
+static void filespec_to_version(struct version_info *v,
+				const struct diff_filespec *spec)
+{
+	v->mode = spec->mode;
+	oidcpy(&v->oid, &spec->oid);
+}
+
+/* The renames from the merge base to `side`, detected or remembered. */
+static struct rename_cache_entry *get_renames(struct merge_state *ms, int side)
+{
+	struct merge_options *opt = ms->opt;
+	struct rename_cache_entry key, *e;
+	struct diff_options opts;
+	int i, alloc = 0;
+
+	hashmap_entry_init(&key, rename_cache_hash(&ms->trees[0],
+						   &ms->trees[side]));
+	oidcpy(&key.base, &ms->trees[0]);
+	oidcpy(&key.side, &ms->trees[side]);
+	e = hashmap_get(&opt->rename_cache->map, &key, NULL);
+	if (e)
+		return e;
+
+	trace_event_region_enter("merge", "detect_renames");
+	e = xcalloc(1, sizeof(*e));
+	hashmap_entry_init(e, key.ent.hash);
+	oidcpy(&e->base, &key.base);
+	oidcpy(&e->side, &key.side);
+
+	/* the same settings as get_diffpairs() in merge-recursive.c */
+	diff_setup(&opts);
+	opts.flags.recursive = 1;
+	opts.flags.rename_empty = 0;
+	opts.detect_rename = DIFF_DETECT_RENAME;
+	opts.rename_limit = opt->merge_rename_limit >= 0 ? opt->merge_rename_limit :
+			    opt->diff_rename_limit >= 0 ? opt->diff_rename_limit :
+			    1000;
+	opts.rename_score = opt->rename_score;
+	opts.show_rename_progress = opt->show_rename_progress;
+	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
+	diff_setup_done(&opts);
+	diff_tree_oid(&e->base, &e->side, "", &opts);
+	diffcore_std(&opts);
+	if (opts.needed_rename_limit > opt->needed_rename_limit)
+		opt->needed_rename_limit = opts.needed_rename_limit;
+
+	for (i = 0; i < diff_queued_diff.nr; i++) {
+		struct diff_filepair *pair = diff_queued_diff.queue[i];
+		struct merge_rename *r;
+
+		if (pair->status != DIFF_STATUS_RENAMED)
+			continue;
+		ALLOC_GROW(e->renames, e->nr + 1, alloc);
+		r = &e->renames[e->nr++];
+		r->src = xstrdup(pair->one->path);
+		r->dst = xstrdup(pair->two->path);
+		filespec_to_version(&r->src_version, pair->one);
+		filespec_to_version(&r->dst_version, pair->two);
+	}
+	diff_flush(&opts);
+
+	hashmap_add(&opt->rename_cache->map, e);
+	trace_event_region_leave("merge", "detect_renames");
+	return e;
+}
+
+/*
+ * Move the versions of the renamed paths to their destination, so that
+ * they are merged there.
+ */
+static void process_renames(struct merge_state *ms)
+{
+	struct rename_cache_entry *renames[3];
+	struct string_list by_src[3] = {
+		STRING_LIST_INIT_NODUP,
+		STRING_LIST_INIT_NODUP,
+		STRING_LIST_INIT_NODUP
+	};
+	int side, i;
+
+	for (side = 1; side <= 2; side++) {
+		renames[side] = get_renames(ms, side);
+		for (i = 0; i < renames[side]->nr; i++)
+			string_list_append(&by_src[side],
+					   renames[side]->renames[i].src)->util =
+				&renames[side]->renames[i];
+		string_list_sort(&by_src[side]);
+	}
+
+	for (side = 1; side <= 2; side++) {
+		int other = 3 - side;
+
+		for (i = 0; i < renames[side]->nr; i++) {
+			struct merge_rename *r = &renames[side]->renames[i];
+			struct string_list_item *item;
+			struct merge_rename *o = NULL;
+			struct merge_path *a, *b, *c;
+
+			item = string_list_lookup(&by_src[other], r->src);
+			if (item)
+				o = item->util;
+			/* both sides renamed it, seen from side 1 */
+			if (side == 2 && o)
+				continue;
+
+			/*
+			 * The destination is missing when both sides have it
+			 * in the same directory, which was taken as a whole.
+			 */
+			b = find_path(ms, r->dst);
+			if (!b || b->stages[0].mode)
+				continue;
+
+			if (o) {
+				c = find_path(ms, o->dst);
+				if (!c || c->stages[0].mode)
+					continue;
+				b->stages[0] = r->src_version;
+				b->pathnames[0] = r->src;
+				if (c == b)
+					continue;
+
+				/* renamed differently on each side */
+				c->stages[0] = r->src_version;
+				c->pathnames[0] = r->src;
+				b->stages[other] = o->dst_version;
+				b->pathnames[other] = o->dst;
+				c->stages[side] = r->dst_version;
+				c->pathnames[side] = r->dst;
+				b->rename_rename = c->rename_rename = 1;
+				continue;
+			}
+
+			/*
+			 * The source was not walked when its directory is the
+			 * same on both sides, so it is missing on the other side
+			 * as well.
+			 */
+			a = find_path(ms, r->src);
+			if (a && a->stages[other].mode) {
+				/* otherwise, the other side added the same path */
+				if (b->stages[other].mode)
+					continue;
+				b->stages[0] = r->src_version;
+				b->stages[other] = a->stages[other];
+				b->pathnames[0] = b->pathnames[other] = a->path;
+				memset(&a->stages[other], 0, sizeof(a->stages[other]));
+			} else {
+				b->stages[0] = r->src_version;
+				b->pathnames[0] = r->src;
+				b->rename_delete = 1;
+				b->rename_side = side;
+			}
+		}
+	}
+
+	string_list_clear(&by_src[1], 0);
+	string_list_clear(&by_src[2], 0);
+}
+
+static const char *branch_name(struct merge_state *ms, int side)
+{
+	return side == 1 ? ms->opt->branch1 : ms->opt->branch2;
+}
+
+static int merge_contents(struct merge_state *ms, struct merge_path *mp,
+			  struct object_id *result_oid)
+{
+	struct merge_options *opt = ms->opt;
+	struct ll_merge_options ll_opts = { 0 };
+	mmfile_t orig, src1, src2;
+	mmbuffer_t result_buf = { NULL, 0 };
+	char *labels[3];
+	int i, merge_status;
+
+	ll_opts.renormalize = opt->renormalize;
+	ll_opts.xdl_opts = opt->xdl_opts;
+	if (opt->call_depth) {
+		ll_opts.virtual_ancestor = 1;
+		ll_opts.variant = 0;
+	} else if (opt->recursive_variant == MERGE_RECURSIVE_OURS) {
+		ll_opts.variant = XDL_MERGE_FAVOR_OURS;
+	} else if (opt->recursive_variant == MERGE_RECURSIVE_THEIRS) {
+		ll_opts.variant = XDL_MERGE_FAVOR_THEIRS;
+	}
+
+	for (i = 0; i < 3; i++) {
+		const char *name = i ? branch_name(ms, i) : opt->ancestor;
+		const char *path = mp->pathnames[i] ? mp->pathnames[i] : mp->path;
+
+		if (!name)
+			labels[i] = NULL;
+		else if (strcmp(path, mp->path))
+			labels[i] = xstrfmt("%s:%s", name, path);
+		else
+			labels[i] = xstrdup(name);
+	}
+
+	read_mmblob(&orig, mp->stages[0].mode ? &mp->stages[0].oid : &null_oid);
+	read_mmblob(&src1, &mp->stages[1].oid);
+	read_mmblob(&src2, &mp->stages[2].oid);
+
+	merge_status = ll_merge(&result_buf, mp->path, &orig, labels[0],
+				&src1, labels[1], &src2, labels[2], &ll_opts);
+	if (merge_status >= 0 &&
+	    write_object_file(result_buf.ptr, result_buf.size, blob_type,
+			      result_oid))
+		merge_status = error(_("unable to add %s to database"),
+				     mp->path);
+
+	for (i = 0; i < 3; i++)
+		free(labels[i]);
+	free(orig.ptr);
+	free(src1.ptr);
+	free(src2.ptr);
+	free(result_buf.ptr);
+	return merge_status;
+}
+
+static void record_conflict(struct merge_state *ms, const char *path,
+			    struct version_info *stages)
+{
+	struct merge_conflict *conflict;
+	int i;
+
+	ms->result->clean = 0;
+	if (ms->opt->call_depth ||
+	    unsorted_string_list_has_string(&ms->result->conflicts, path))
+		return;
+
+	conflict = xcalloc(1, sizeof(*conflict));
+	for (i = 0; i < 3; i++) {
+		conflict->mode[i] = stages[i].mode;
+		oidcpy(&conflict->oid[i], &stages[i].oid);
+	}
+	string_list_append(&ms->result->conflicts, path)->util = conflict;
+}
+
+__attribute__((format (printf, 2, 3)))
+static void add_message(struct merge_state *ms, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (ms->opt->call_depth)
+		return;
+	va_start(ap, fmt);
+	strbuf_vaddf(&ms->result->messages, fmt, ap);
+	va_end(ap);
+	strbuf_addch(&ms->result->messages, '\n');
+}
+
+static int resolve_path(struct merge_state *ms, struct merge_path *mp)
+{
+	struct version_info *v = mp->stages;
+	struct version_info res = { 0 };
+	int clean = 1, status;
+
+	if (mp->rename_rename || mp->rename_delete) {
+		/* the renamed contents are kept, merged if possible */
+		int side = mp->rename_delete ? mp->rename_side : 0;
+
+		res = side ? v[side] : v[1];
+		if (!side && S_ISREG(v[1].mode) && S_ISREG(v[2].mode)) {
+			status = merge_contents(ms, mp, &res.oid);
+			if (status < 0)
+				return -1;
+		}
+		clean = 0;
+		if (mp->rename_delete)
+			add_message(ms, _("CONFLICT (rename/delete): %s renamed to %s in %s, but deleted in %s."),
+				    mp->pathnames[0], mp->path,
+				    branch_name(ms, side),
+				    branch_name(ms, 3 - side));
+		else if (mp->pathnames[2])
+			add_message(ms, _("CONFLICT (rename/rename): %s renamed to %s in %s and to %s in %s."),
+				    mp->pathnames[0], mp->path,
+				    branch_name(ms, 1), mp->pathnames[2],
+				    branch_name(ms, 2));
+	} else if (same_version(&v[1], &v[2])) {
+		res = v[1];
+	} else if (same_version(&v[0], &v[1])) {
+		res = v[2];
+	} else if (same_version(&v[0], &v[2])) {
+		res = v[1];
+	} else if (!v[1].mode || !v[2].mode) {
+		int side = v[1].mode ? 1 : 2;
+
+		/* a virtual merge base keeps the original version */
+		res = ms->opt->call_depth ? v[0] : v[side];
+		clean = 0;
+		add_message(ms, _("CONFLICT (modify/delete): %s deleted in %s and modified in %s. Version %s of %s left in tree."),
+			    mp->path, branch_name(ms, 3 - side),
+			    branch_name(ms, side), branch_name(ms, side),
+			    mp->path);
+	} else if (S_ISREG(v[1].mode) && S_ISREG(v[2].mode)) {
+		if (v[1].mode == v[2].mode || v[0].mode == v[2].mode) {
+			res.mode = v[1].mode;
+		} else if (v[0].mode == v[1].mode) {
+			res.mode = v[2].mode;
+		} else {
+			res.mode = v[1].mode;
+			clean = 0;
+			add_message(ms, _("CONFLICT (mode): %s has a different mode in %s and %s."),
+				    mp->path, branch_name(ms, 1),
+				    branch_name(ms, 2));
+		}
+
+		if (oideq(&v[1].oid, &v[2].oid) ||
+		    (v[0].mode && oideq(&v[0].oid, &v[2].oid))) {
+			oidcpy(&res.oid, &v[1].oid);
+		} else if (v[0].mode && oideq(&v[0].oid, &v[1].oid)) {
+			oidcpy(&res.oid, &v[2].oid);
+		} else {
+			status = merge_contents(ms, mp, &res.oid);
+			if (status < 0)
+				return -1;
+			if (status) {
+				clean = 0;
+				add_message(ms, _("CONFLICT (%s): Merge conflict in %s"),
+					    v[0].mode ? "content" : "add/add",
+					    mp->path);
+			}
+		}
+	} else {
+		/* symbolic links, submodules, or different types */
+		res = ms->opt->call_depth && v[0].mode ? v[0] : v[1];
+		clean = 0;
+		if ((v[1].mode ^ v[2].mode) & S_IFMT)
+			add_message(ms, _("CONFLICT (distinct types): %s had different types on each side."),
+				    mp->path);
+		else
+			add_message(ms, _("CONFLICT (%s): Merge conflict in %s"),
+				    S_ISGITLINK(v[1].mode) ? "submodule" : "content",
+				    mp->path);
+	}
+
+	if (res.mode)
+		add_entry(ms, mp->path, 0, &res);
+	if (!clean)
+		record_conflict(ms, mp->path, v);
+	return 0;
+}
+
+/*
+ * A file that is in the way of a directory of the merged tree is moved
+ * aside, to a path made unique with the name of the side it comes from.
+ */
+static void resolve_df_conflicts(struct merge_state *ms)
+{
+	struct string_list dirs = STRING_LIST_INIT_DUP;
+	struct strbuf path = STRBUF_INIT;
+	int i, moved = 0;
+
+	for (i = 0; i < ms->entries.nr; i++) {
+		const char *name = ms->entries.items[i].string;
+		const char *slash;
+
+		for (slash = strchr(name, '/'); slash;
+		     slash = strchr(slash + 1, '/')) {
+			strbuf_reset(&path);
+			strbuf_add(&path, name, slash - name);
+			string_list_append(&dirs, path.buf);
+		}
+	}
+	string_list_sort(&dirs);
+	string_list_remove_duplicates(&dirs, 0);
+
+	for (i = 0; i < ms->entries.nr; i++) {
+		struct string_list_item *item = &ms->entries.items[i];
+		struct version_info *v = item->util;
+		struct merge_path *mp;
+		const char *branch;
+		int side, suffix = 0;
+
+		if (!string_list_has_string(&dirs, item->string))
+			continue;
+
+		mp = find_path(ms, item->string);
+		side = mp && !same_version(&mp->stages[1], v) ? 2 : 1;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s~", item->string);
+		for (branch = branch_name(ms, side); *branch; branch++)
+			strbuf_addch(&path, *branch == '/' ? '_' : *branch);
+		while (string_list_has_string(&ms->entries, path.buf) ||
+		       string_list_has_string(&dirs, path.buf)) {
+			strbuf_setlen(&path, path.len - (suffix ? 1 + decimal_width(suffix) : 0));
+			strbuf_addf(&path, "_%d", ++suffix);
+		}
+
+		add_message(ms, _("CONFLICT (file/directory): directory in the way of %s from %s; moving it to %s instead."),
+			    item->string, branch_name(ms, side), path.buf);
+		if (mp)
+			record_conflict(ms, mp->path, mp->stages);
+		else
+			ms->result->clean = 0;
+		free(item->string);
+		item->string = strbuf_detach(&path, NULL);
+		moved = 1;
+	}
+	if (moved)
+		string_list_sort(&ms->entries);
+
+	string_list_clear(&dirs, 0);
+	strbuf_release(&path);
+}
+
+/*
+ * Write the tree of the entries starting at `*pos` under `prefix`, which
+ * is empty or ends with a slash.
+ */
+static int write_tree_rec(struct string_list *entries, int *pos,
+			  const char *prefix, size_t prefix_len,
+			  struct object_id *oid)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int ret;
+
+	while (*pos < entries->nr) {
+		struct string_list_item *item = &entries->items[*pos];
+		struct version_info *v = item->util;
+		const char *name = item->string + prefix_len;
+		const char *slash;
+		struct object_id subtree;
+
+		if (strncmp(item->string, prefix, prefix_len))
+			break;
+
+		slash = strchr(name, '/');
+		if (!slash) {
+			strbuf_addf(&buf, "%o %s%c", v->mode, name, '\0');
+			strbuf_add(&buf, v->oid.hash, the_hash_algo->rawsz);
+			(*pos)++;
+		} else if (!slash[1]) {
+			/* a directory taken as a whole */
+			strbuf_addf(&buf, "%o %.*s%c", v->mode,
+				    (int)(slash - name), name, '\0');
+			strbuf_add(&buf, v->oid.hash, the_hash_algo->rawsz);
+			(*pos)++;
+		} else {
+			if (write_tree_rec(entries, pos, item->string,
+					   slash + 1 - item->string, &subtree)) {
+				strbuf_release(&buf);
+				return -1;
+			}
+			strbuf_addf(&buf, "%o %.*s%c", S_IFDIR,
+				    (int)(slash - name), name, '\0');
+			strbuf_add(&buf, subtree.hash, the_hash_algo->rawsz);
+		}
+	}
+
+	ret = write_object_file(buf.buf, buf.len, tree_type, oid);
+	strbuf_release(&buf);
+	return ret;
+}
+
+static void merge_ort_nonrecursive_internal(struct merge_options *opt,
+					    struct tree *merge_base,
+					    struct tree *side1,
+					    struct tree *side2,
+					    struct merge_result *result)
+{
+	struct merge_state ms;
+	struct object_id oid;
+	int i, pos = 0;
+
+	memset(&ms, 0, sizeof(ms));
+	ms.opt = opt;
+	ms.result = result;
+	ms.detect_renames = merge_detect_rename(opt);
+	oidcpy(&ms.trees[0], &merge_base->object.oid);
+	oidcpy(&ms.trees[1], &side1->object.oid);
+	oidcpy(&ms.trees[2], &side2->object.oid);
+	hashmap_init(&ms.paths, merge_path_cmp, NULL, 0);
+	string_list_init(&ms.entries, 1);
+	result->clean = 1;
+	result->tree = NULL;
+
+	if (collect_merge_info(&ms) < 0) {
+		result->clean = error(_("unable to read the trees to merge"));
+		goto cleanup;
+	}
+
+	if (ms.detect_renames && ms.order_nr)
+		process_renames(&ms);
+
+	trace_event_region_enter("merge", "process_entries");
+	for (i = 0; i < ms.order_nr; i++)
+		if (resolve_path(&ms, ms.order[i]) < 0) {
+			result->clean = -1;
+			break;
+		}
+	trace_event_region_leave("merge", "process_entries");
+	if (result->clean < 0)
+		goto cleanup;
+
+	trace_event_region_enter("merge", "write_tree");
+	string_list_sort(&ms.entries);
+	resolve_df_conflicts(&ms);
+	if (write_tree_rec(&ms.entries, &pos, "", 0, &oid))
+		result->clean = error(_("unable to write the merged tree"));
+	else
+		result->tree = lookup_tree(the_repository, &oid);
+	trace_event_region_leave("merge", "write_tree");
+
+	string_list_sort(&result->conflicts);
+
+cleanup:
+	hashmap_free(&ms.paths, 1);
+	free(ms.order);
+	string_list_clear(&ms.entries, 1);
+}
+
+static struct commit *make_virtual_commit(struct tree *tree, const char *comment)
+{
+	struct commit *commit = alloc_commit_node(the_repository);
+
+	set_merge_remote_desc(commit, comment, (struct object *)commit);
+	commit->maybe_tree = tree;
+	commit->object.parsed = 1;
+	return commit;
+}
+
+static struct commit_list *reverse_commit_list(struct commit_list *list)
+{
+	struct commit_list *next = NULL, *current, *backup;
+
+	for (current = list; current; current = backup) {
+		backup = current->next;
+		current->next = next;
+		next = current;
+	}
+	return next;
+}
+
+static void merge_ort_internal(struct merge_options *opt,
+			       struct commit_list *merge_bases,
+			       struct commit *h1,
+			       struct commit *h2,
+			       struct merge_result *result)
+{
+	struct commit *merged_merge_bases;
+	struct commit_list *iter;
+	struct strbuf ancestor_name = STRBUF_INIT;
+	const char *saved_ancestor = opt->ancestor;
+
+	if (merge_bases) {
+		merge_bases = copy_commit_list(merge_bases);
+	} else {
+		merge_bases = get_merge_bases(h1, h2);
+		merge_bases = reverse_commit_list(merge_bases);
+	}
+
+	merged_merge_bases = pop_commit(&merge_bases);
+	if (!merged_merge_bases) {
+		/* if there is no common ancestor, use an empty tree */
+		struct tree *tree;
+
+		tree = lookup_tree(the_repository, the_repository->hash_algo->empty_tree);
+		merged_merge_bases = make_virtual_commit(tree, "ancestor");
+		strbuf_addstr(&ancestor_name, "empty tree");
+	} else if (merge_bases) {
+		strbuf_addstr(&ancestor_name, "merged common ancestors");
+	} else {
+		strbuf_add_unique_abbrev(&ancestor_name,
+					 &merged_merge_bases->object.oid,
+					 DEFAULT_ABBREV);
+	}
+
+	for (iter = merge_bases; iter; iter = iter->next) {
+		struct merge_result inner = MERGE_RESULT_INIT;
+		struct commit *prev = merged_merge_bases;
+		const char *saved_b1 = opt->branch1, *saved_b2 = opt->branch2;
+
+		/*
+		 * The conflicts of the merge of the merge bases are left
+		 * in the virtual merge base, with their conflict markers.
+		 */
+		opt->call_depth++;
+		opt->branch1 = "Temporary merge branch 1";
+		opt->branch2 = "Temporary merge branch 2";
+		merge_ort_internal(opt, NULL, prev, iter->item, &inner);
+		opt->branch1 = saved_b1;
+		opt->branch2 = saved_b2;
+		opt->call_depth--;
+
+		if (inner.clean < 0) {
+			result->clean = -1;
+			merge_result_release(&inner);
+			goto cleanup;
+		}
+		merged_merge_bases = make_virtual_commit(inner.tree, "merged tree");
+		commit_list_insert(prev, &merged_merge_bases->parents);
+		commit_list_insert(iter->item, &merged_merge_bases->parents->next);
+		merge_result_release(&inner);
+	}
+
+	opt->ancestor = ancestor_name.buf;
+	merge_ort_nonrecursive_internal(opt, get_commit_tree(merged_merge_bases),
+					get_commit_tree(h1), get_commit_tree(h2),
+					result);
+	opt->ancestor = saved_ancestor;
+
+cleanup:
+	free_commit_list(merge_bases);
+	strbuf_release(&ancestor_name);
+}
+
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result)
+{
+	struct merge_rename_cache *cache = NULL;
+
+	if (!opt->rename_cache)
+		opt->rename_cache = cache = merge_rename_cache_new();
+	trace_event_region_enter("merge", "merge_incore_nonrecursive");
+	merge_ort_nonrecursive_internal(opt, merge_base, side1, side2, result);
+	trace_event_region_leave("merge", "merge_incore_nonrecursive");
+	if (cache) {
+		merge_rename_cache_free(cache);
+		opt->rename_cache = NULL;
+	}
+}
+
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result)
+{
+	struct merge_rename_cache *cache = NULL;
+
+	if (!opt->rename_cache)
+		opt->rename_cache = cache = merge_rename_cache_new();
+	trace_event_region_enter("merge", "merge_incore_recursive");
+	merge_ort_internal(opt, merge_bases, side1, side2, result);
+	trace_event_region_leave("merge", "merge_incore_recursive");
+	if (cache) {
+		merge_rename_cache_free(cache);
+		opt->rename_cache = NULL;
+	}
+}
+
+void merge_result_release(struct merge_result *result)
+{
+	string_list_clear(&result->conflicts, 1);
+	strbuf_release(&result->messages);
+	result->tree = NULL;
+}
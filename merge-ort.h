@@ -0,0 +1,90 @@
+#ifndef MERGE_ORT_H
+#define MERGE_ORT_H
+
+#include "merge-recursive.h"
+
+struct commit;
+struct commit_list;
+struct tree;
+
+/*
+ * An in-core merge of trees, which never reads or writes the index or
+ * the working tree: the merged blobs and trees are written to the object
+ * store, and the outcome is described by a struct merge_result. This
+ * makes it usable in bare repositories, and cheap enough to test many
+ * merges in one process.
+ *
+ * The paths of the three trees are walked together, skipping over the
+ * directories that do not need a merge. Renames are detected (but not
+ * directory renames) between the merge base and each side, and these
+ * are remembered in `opt->rename_cache`, keyed by that pair of trees.
+ * The merges of several merge bases and the outer merge never compare
+ * the same pair, so this only pays off across the merges done by one
+ * process with the same cache, as `git merge-tree --stdin` does. The
+ * options used are those of struct merge_options which do not relate to
+ * the index or the working tree (branch names, rename detection and xdl
+ * options, the "ours" and "theirs" variants).
+ */
+
+struct merge_result {
+	/* 1 if the merge is clean, 0 if there are conflicts, -1 on error */
+	int clean;
+
+	/*
+	 * The merged tree, in which the conflicted files have conflict
+	 * markers, or the version of one side when their contents cannot
+	 * be merged.
+	 */
+	struct tree *tree;
+
+	/*
+	 * The conflicted paths, sorted, each with a struct merge_conflict
+	 * as util.
+	 */
+	struct string_list conflicts;
+
+	/* The messages describing the conflicts, one per line. */
+	struct strbuf messages;
+};
+
+#define MERGE_RESULT_INIT { 0, NULL, STRING_LIST_INIT_DUP, STRBUF_INIT }
+
+/*
+ * The versions of a conflicted path in the merge base, on side 1 and on
+ * side 2, with a mode of 0 when the path is missing.
+ */
+struct merge_conflict {
+	unsigned mode[3];
+	struct object_id oid[3];
+};
+
+/* Merge the trees `side1` and `side2`, with `merge_base` as the base. */
+void merge_incore_nonrecursive(struct merge_options *opt,
+			       struct tree *merge_base,
+			       struct tree *side1,
+			       struct tree *side2,
+			       struct merge_result *result);
+
+/*
+ * Merge the commits `side1` and `side2`. The merge bases are computed
+ * when `merge_bases` is NULL; several merge bases are merged together
+ * into a virtual merge base first.
+ */
+void merge_incore_recursive(struct merge_options *opt,
+			    struct commit_list *merge_bases,
+			    struct commit *side1,
+			    struct commit *side2,
+			    struct merge_result *result);
+
+void merge_result_release(struct merge_result *result);
+
+/*
+ * The renames detected between pairs of trees. A caller doing many
+ * merges keeps one cache in `opt->rename_cache` across them; when it is
+ * NULL, the merge functions above use a cache for the duration of the
+ * call.
+ */
+struct merge_rename_cache *merge_rename_cache_new(void);
+void merge_rename_cache_free(struct merge_rename_cache *cache);
+
+#endif
@@ -5,6 +5,7 @@
 #include "unpack-trees.h"
 
 struct commit;
+struct merge_rename_cache;
 
 struct merge_options {
 	const char *ancestor;
@@ -34,6 +35,8 @@ struct merge_options {
 	struct string_list df_conflict_file_set;
 	struct unpack_trees_options unpack_opts;
 	struct index_state orig_index;
+	/* renames remembered across merges, see merge-ort.h */
+	struct merge_rename_cache *rename_cache;
 };
 
 /*
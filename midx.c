@@ -7,6 +7,10 @@
 #include "object-store.h"
 #include "sha1-lookup.h"
 #include "midx.h"
+#include "refs.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "pack-bitmap.h"
 
 #define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
 #define MIDX_VERSION 1
@@ -37,6 +41,17 @@ static char *get_midx_filename(const char *object_dir)
 	return xstrfmt("%s/pack/multi-pack-index", object_dir);
 }
 
+const unsigned char *get_midx_checksum(struct multi_pack_index *m)
+{
+	return m->data + m->data_len - the_hash_algo->rawsz;
+}
+
+char *get_midx_bitmap_filename(struct multi_pack_index *m)
+{
+	return xstrfmt("%s/pack/multi-pack-index-%s.bitmap", m->object_dir,
+		       sha1_to_hex(get_midx_checksum(m)));
+}
+
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local)
 {
 	struct multi_pack_index *m = NULL;
@@ -190,11 +205,13 @@ static void close_midx(struct multi_pack_index *m)
 	for (i = 0; i < m->num_packs; i++) {
 		if (m->packs[i]) {
 			close_pack(m->packs[i]);
-			free(m->packs);
+			free(m->packs[i]);
 		}
 	}
 	FREE_AND_NULL(m->packs);
 	FREE_AND_NULL(m->pack_names);
+	FREE_AND_NULL(m->revindex);
+	FREE_AND_NULL(m->revindex_pos);
 }
 
 int prepare_midx_pack(struct multi_pack_index *m, uint32_t pack_int_id)
@@ -232,7 +249,7 @@ struct object_id *nth_midxed_object_oid(struct object_id *oid,
 	return oid;
 }
 
-static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 {
 	const unsigned char *offset_data;
 	uint32_t offset32;
@@ -251,7 +268,7 @@ static off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos)
 	return offset32;
 }
 
-static uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos)
 {
 	return get_be32(m->chunk_object_offsets + pos * MIDX_CHUNK_OFFSET_WIDTH);
 }
@@ -296,6 +313,58 @@ static int nth_midxed_pack_entry(struct multi_pack_index *m, struct pack_entry *
 	return 1;
 }
 
+struct midx_pack_order_entry {
+	uint32_t nr;
+	uint32_t pack_int_id;
+	off_t offset;
+};
+
+static int midx_pack_order_cmp(const void *_a, const void *_b)
+{
+	const struct midx_pack_order_entry *a = _a;
+	const struct midx_pack_order_entry *b = _b;
+
+	if (a->pack_int_id != b->pack_int_id)
+		return a->pack_int_id < b->pack_int_id ? -1 : 1;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * A multi-pack bitmap lays the objects out as if all the packs were
+ * concatenated in pack-int-id order, each object appearing only in the
+ * pack the multi-pack-index selected for it. This keeps objects of the
+ * same pack (and thus similar history) next to each other, which is
+ * what makes the EWAH compression of the bitmaps effective.
+ */
+void load_midx_revindex(struct multi_pack_index *m)
+{
+	struct midx_pack_order_entry *order;
+	uint32_t i;
+
+	if (m->revindex)
+		return;
+
+	ALLOC_ARRAY(order, m->num_objects);
+	for (i = 0; i < m->num_objects; i++) {
+		order[i].nr = i;
+		order[i].pack_int_id = nth_midxed_pack_int_id(m, i);
+		order[i].offset = nth_midxed_offset(m, i);
+	}
+
+	QSORT(order, m->num_objects, midx_pack_order_cmp);
+
+	ALLOC_ARRAY(m->revindex, m->num_objects);
+	ALLOC_ARRAY(m->revindex_pos, m->num_objects);
+	for (i = 0; i < m->num_objects; i++) {
+		m->revindex[i] = order[i].nr;
+		m->revindex_pos[order[i].nr] = i;
+	}
+
+	free(order);
+}
+
 int fill_midx_entry(const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m)
 {
 	uint32_t pos;
@@ -735,7 +804,183 @@ static size_t write_midx_large_offsets(struct hashfile *f, uint32_t nr_large_off
 	return written;
 }
 
-int write_midx_file(const char *object_dir)
+struct clear_midx_bitmap_data {
+	const char *keep;
+};
+
+static void clear_midx_bitmap(const char *full_path, size_t full_path_len,
+			      const char *file_name, void *_data)
+{
+	struct clear_midx_bitmap_data *data = _data;
+
+	if (!starts_with(file_name, "multi-pack-index-") ||
+	    !ends_with(file_name, ".bitmap"))
+		return;
+	if (data->keep && !strcmp(full_path, data->keep))
+		return;
+
+	if (unlink(full_path) && errno != ENOENT)
+		warning_errno(_("failed to remove %s"), full_path);
+}
+
+/*
+ * Remove the multi-pack bitmaps in 'object_dir', except 'keep' if it
+ * is not NULL. A bitmap belongs to a single multi-pack-index checksum,
+ * so any other one is stale.
+ */
+static void clear_midx_bitmaps(const char *object_dir, const char *keep)
+{
+	struct clear_midx_bitmap_data data;
+
+	data.keep = keep;
+	for_each_file_in_pack_dir(object_dir, clear_midx_bitmap, &data);
+}
+
+struct midx_bitmap_walk_data {
+	struct multi_pack_index *m;
+	struct rev_info *revs;
+	struct commit **commits;
+	uint32_t commits_nr, commits_alloc;
+	const struct object_id *missing;
+};
+
+static int add_ref_to_midx_bitmap_walk(const char *refname,
+				       const struct object_id *oid,
+				       int flags, void *cb_data)
+{
+	struct midx_bitmap_walk_data *data = cb_data;
+	struct object *object;
+	uint32_t pos;
+
+	/*
+	 * Refs pointing to objects outside of the multi-pack-index (e.g.
+	 * loose commits) cannot be bitmapped; readers fall back to a walk
+	 * for those.
+	 */
+	if (!bsearch_midx(oid, data->m, &pos))
+		return 0;
+
+	object = parse_object(the_repository, oid);
+	if (object)
+		add_pending_object(data->revs, object, "");
+	return 0;
+}
+
+static void midx_bitmap_check_object(struct midx_bitmap_walk_data *data,
+				     const struct object_id *oid)
+{
+	uint32_t pos;
+
+	if (!data->missing && !bsearch_midx(oid, data->m, &pos))
+		data->missing = oid;
+}
+
+static void midx_bitmap_show_commit(struct commit *commit, void *_data)
+{
+	struct midx_bitmap_walk_data *data = _data;
+
+	midx_bitmap_check_object(data, &commit->object.oid);
+
+	ALLOC_GROW(data->commits, data->commits_nr + 1, data->commits_alloc);
+	data->commits[data->commits_nr++] = commit;
+}
+
+static void midx_bitmap_show_object(struct object *object, const char *name,
+				    void *_data)
+{
+	midx_bitmap_check_object(_data, &object->oid);
+}
+
+/*
+ * Write a reachability bitmap for the multi-pack-index that was just
+ * written to 'object_dir', covering the history of all refs that point
+ * into it. Bit positions follow the order of load_midx_revindex().
+ */
+static int write_midx_bitmap(const char *object_dir)
+{
+	struct multi_pack_index *m;
+	struct midx_bitmap_walk_data data;
+	struct packing_data pdata;
+	struct pack_idx_entry **pack_order, **index;
+	unsigned char midx_hash[GIT_MAX_RAWSZ];
+	struct rev_info revs;
+	char *bitmap_name = NULL;
+	uint32_t i;
+	int ret = 0;
+
+	m = load_multi_pack_index(object_dir, 1);
+	if (!m)
+		return error(_("could not load multi-pack-index for bitmap"));
+	load_midx_revindex(m);
+
+	bitmap_name = get_midx_bitmap_filename(m);
+
+	init_revisions(&revs, NULL);
+	revs.tag_objects = 1;
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	memset(&data, 0, sizeof(data));
+	data.m = m;
+	data.revs = &revs;
+	for_each_ref(add_ref_to_midx_bitmap_walk, &data);
+
+	if (prepare_revision_walk(&revs))
+		die(_("revision walk setup failed"));
+	traverse_commit_list(&revs, midx_bitmap_show_commit,
+			     midx_bitmap_show_object, &data);
+
+	if (data.missing) {
+		ret = error(_("cannot write multi-pack bitmap: object %s is "
+			      "reachable but not in the multi-pack-index"),
+			    oid_to_hex(data.missing));
+		goto cleanup;
+	}
+
+	memset(&pdata, 0, sizeof(pdata));
+	prepare_packing_data(&pdata);
+	for (i = 0; i < m->num_objects; i++) {
+		struct object_id oid;
+		uint32_t index_pos;
+
+		nth_midxed_object_oid(&oid, m, m->revindex[i]);
+		packlist_find(&pdata, oid.hash, &index_pos);
+		packlist_alloc(&pdata, oid.hash, index_pos);
+	}
+
+	ALLOC_ARRAY(pack_order, m->num_objects);
+	ALLOC_ARRAY(index, m->num_objects);
+	for (i = 0; i < m->num_objects; i++) {
+		pack_order[i] = &pdata.objects[i].idx;
+		index[i] = &pdata.objects[m->revindex_pos[i]].idx;
+	}
+
+	hashcpy(midx_hash, get_midx_checksum(m));
+
+	bitmap_writer_build_type_index(&pdata, pack_order, m->num_objects);
+	bitmap_writer_select_commits(data.commits, data.commits_nr, -1);
+	bitmap_writer_build(&pdata);
+	bitmap_writer_set_checksum(midx_hash);
+	bitmap_writer_finish(index, m->num_objects, bitmap_name, 0);
+
+	free(pack_order);
+	free(index);
+	free(pdata.objects);
+	free(pdata.index);
+	free(pdata.in_pack);
+	free(pdata.in_pack_by_idx);
+	free(pdata.in_pack_pos);
+
+cleanup:
+	clear_midx_bitmaps(object_dir, ret ? NULL : bitmap_name);
+	free(bitmap_name);
+	free(data.commits);
+	close_midx(m);
+	free(m);
+	return ret;
+}
+
+int write_midx_file(const char *object_dir, unsigned flags)
 {
 	unsigned char cur_chunk, num_chunks = 0;
 	char *midx_name;
@@ -750,6 +995,7 @@ int write_midx_file(const char *object_dir)
 	uint32_t nr_entries, num_large_offsets = 0;
 	struct pack_midx_entry *entries = NULL;
 	int large_offsets_needed = 0;
+	int result = 0;
 
 	midx_name = get_midx_filename(object_dir);
 	if (safe_create_leading_directories(midx_name)) {
@@ -783,7 +1029,8 @@ int write_midx_file(const char *object_dir)
 
 	for_each_file_in_pack_dir(object_dir, add_pack_to_midx, &packs);
 
-	if (packs.m && packs.nr == packs.m->num_packs)
+	if (packs.m && packs.nr == packs.m->num_packs &&
+	    !(flags & MIDX_WRITE_BITMAP))
 		goto cleanup;
 
 	if (packs.pack_name_concat_len % MIDX_CHUNK_ALIGNMENT)
@@ -900,6 +1147,11 @@ int write_midx_file(const char *object_dir)
 	finalize_hashfile(f, NULL, CSUM_FSYNC | CSUM_HASH_IN_STREAM);
 	commit_lock_file(&lk);
 
+	if (flags & MIDX_WRITE_BITMAP)
+		result = write_midx_bitmap(object_dir);
+	else
+		clear_midx_bitmaps(object_dir, NULL);
+
 cleanup:
 	for (i = 0; i < packs.nr; i++) {
 		if (packs.list[i]) {
@@ -914,7 +1166,7 @@ int write_midx_file(const char *object_dir)
 	free(entries);
 	free(pack_perm);
 	free(midx_name);
-	return 0;
+	return result;
 }
 
 void clear_midx_file(const char *object_dir)
@@ -926,5 +1178,6 @@ void clear_midx_file(const char *object_dir)
 		die(_("failed to clear multi-pack-index at %s"), midx);
 	}
 
+	clear_midx_bitmaps(object_dir, NULL);
 	free(midx);
 }
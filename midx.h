@@ -28,20 +28,37 @@ struct multi_pack_index {
 
 	const char **pack_names;
 	struct packed_git **packs;
+
+	/*
+	 * Order of the objects in a multi-pack bitmap, filled on demand
+	 * by load_midx_revindex(): 'revindex' maps a bit position to a
+	 * position in the multi-pack-index, 'revindex_pos' is its inverse.
+	 */
+	uint32_t *revindex;
+	uint32_t *revindex_pos;
+
 	char object_dir[FLEX_ARRAY];
 };
 
+#define MIDX_WRITE_BITMAP (1 << 0)
+
 struct multi_pack_index *load_multi_pack_index(const char *object_dir, int local);
 int prepare_midx_pack(struct multi_pack_index *m, uint32_t pack_int_id);
 int bsearch_midx(const struct object_id *oid, struct multi_pack_index *m, uint32_t *result);
 struct object_id *nth_midxed_object_oid(struct object_id *oid,
 					struct multi_pack_index *m,
 					uint32_t n);
+off_t nth_midxed_offset(struct multi_pack_index *m, uint32_t pos);
+uint32_t nth_midxed_pack_int_id(struct multi_pack_index *m, uint32_t pos);
 int fill_midx_entry(const struct object_id *oid, struct pack_entry *e, struct multi_pack_index *m);
 int midx_contains_pack(struct multi_pack_index *m, const char *idx_name);
 int prepare_multi_pack_index_one(struct repository *r, const char *object_dir, int local);
 
-int write_midx_file(const char *object_dir);
+const unsigned char *get_midx_checksum(struct multi_pack_index *m);
+char *get_midx_bitmap_filename(struct multi_pack_index *m);
+void load_midx_revindex(struct multi_pack_index *m);
+
+int write_midx_file(const char *object_dir, unsigned flags);
 void clear_midx_file(const char *object_dir);
 
 #endif
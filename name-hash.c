@@ -576,7 +576,7 @@ static void threaded_lazy_init_name_hash(
 
 #endif
 
-static void lazy_init_name_hash(struct index_state *istate)
+void lazy_init_name_hash(struct index_state *istate)
 {
 
 	if (istate->name_hash_initialized)
@@ -6,6 +6,7 @@
 #include "list.h"
 #include "sha1-array.h"
 #include "strbuf.h"
+#include "thread-utils.h"
 
 struct alternate_object_database {
 	struct alternate_object_database *next;
@@ -81,15 +82,27 @@ struct packed_git {
 		 pack_keep_in_core:1,
 		 freshened:1,
 		 do_not_close:1,
-		 pack_promisor:1;
+		 pack_promisor:1,
+		 sizes_missing:1;
 	unsigned char sha1[20];
 	struct revindex_entry *revindex;
+	/* the sizes table, see pack-sizes.h */
+	const unsigned char *sizes_data;
+	size_t sizes_size;
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
 };
 
 struct multi_pack_index;
 
+/* The state of a pack directory when it was last scanned. */
+struct pack_dir_state {
+	const char *objdir;
+	int exists;
+	struct stat_data sd;
+	time_t scanned;
+};
+
 struct raw_object_store {
 	/*
 	 * Path to the repository's object store.
@@ -143,6 +156,13 @@ struct raw_object_store {
 	unsigned long approximate_object_count;
 	unsigned approximate_object_count_valid : 1;
 
+	/*
+	 * The pack directories, to know whether there can be new packs
+	 * since they were scanned, see packed_git_changed().
+	 */
+	struct pack_dir_state *pack_dirs;
+	int pack_dirs_nr, pack_dirs_alloc;
+
 	/*
 	 * Whether packed_git has already been populated with this repository's
 	 * packs.
@@ -278,6 +298,46 @@ int oid_object_info_extended(struct repository *r,
 			     const struct object_id *,
 			     struct object_info *, unsigned flags);
 
+/*
+ * Object reading is not thread-safe by itself. A multi-threaded caller
+ * calls enable_obj_read_lock() before starting its threads, after which
+ * oid_object_info_extended() and the functions built on it serialize on
+ * a global (recursive) mutex. The mutex is released while objects are
+ * inflated, so that threads reading different objects still inflate
+ * them in parallel. disable_obj_read_lock() is called once the threads
+ * are done.
+ *
+ * Code that reaches into the object store in other ways from several
+ * threads (e.g. to add an alternate) must hold the lock itself, with
+ * obj_read_lock() and obj_read_unlock(); so does resolve_gitlink_ref().
+ *
+ * The calls to enable_obj_read_lock() and disable_obj_read_lock() nest,
+ * so that a threaded operation can run within another one: the lock is
+ * used until the outermost one is done.
+ */
+#ifndef NO_PTHREADS
+extern int obj_read_use_lock;
+extern pthread_mutex_t obj_read_mutex;
+
+static inline void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+static inline void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#else
+#define obj_read_lock()
+#define obj_read_unlock()
+#endif
+
+void enable_obj_read_lock(void);
+void disable_obj_read_lock(void);
+
 /*
  * Iterate over the files in the loose-object parts of the object
  * directory "path", triggering the following callbacks:
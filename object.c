@@ -10,6 +10,7 @@
 #include "object-store.h"
 #include "packfile.h"
 #include "commit-graph.h"
+#include "trace-event.h"
 
 unsigned int get_max_object_index(void)
 {
@@ -191,6 +192,7 @@ struct object *parse_object_buffer(struct repository *r, const struct object_id
 	struct object *obj;
 	*eaten_p = 0;
 
+	trace_event_count(TRACE_COUNTER_OBJECTS_PARSED, 1);
 	obj = NULL;
 	if (type == OBJ_BLOB) {
 		struct blob *blob = lookup_blob(r, oid);
@@ -518,6 +520,9 @@ void raw_object_store_clear(struct raw_object_store *o)
 	INIT_LIST_HEAD(&o->packed_git_mru);
 	close_all_packs(o);
 	o->packed_git = NULL;
+
+	FREE_AND_NULL(o->pack_dirs);
+	o->pack_dirs_nr = o->pack_dirs_alloc = 0;
 }
 
 void parsed_object_pool_clear(struct parsed_object_pool *o)
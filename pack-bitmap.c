@@ -5,6 +5,7 @@
 #include "revision.h"
 #include "progress.h"
 #include "list-objects.h"
+#include "list-objects-filter-options.h"
 #include "pack.h"
 #include "pack-bitmap.h"
 #include "pack-revindex.h"
@@ -12,6 +13,8 @@
 #include "packfile.h"
 #include "repository.h"
 #include "object-store.h"
+#include "midx.h"
+#include "pack-sizes.h"
 
 /*
  * An entry on the bitmap index, representing the bitmap for a given
@@ -31,11 +34,21 @@ struct stored_bitmap {
  *
  * If there is more than one bitmap index available (e.g. because of alternates),
  * the active bitmap index is the largest one.
+ *
+ * A bitmap written for a multi-pack-index takes precedence over the
+ * per-pack ones: it covers the objects of all the packs it indexes.
  */
 struct bitmap_index {
 	/* Packfile to which this bitmap index belongs to */
 	struct packed_git *pack;
 
+	/*
+	 * Multi-pack-index to which this bitmap index belongs to, if any.
+	 * In that case `pack` is NULL and bit positions follow the order
+	 * given by `midx->revindex`.
+	 */
+	struct multi_pack_index *midx;
+
 	/*
 	 * Mark the first `reuse_objects` in the packfile as reused:
 	 * they will be sent as-is without using them for repacking
@@ -93,6 +106,13 @@ struct bitmap_index {
 	unsigned int version;
 };
 
+static uint32_t bitmap_num_objects(struct bitmap_index *index)
+{
+	if (index->midx)
+		return index->midx->num_objects;
+	return index->pack->num_objects;
+}
+
 static struct ewah_bitmap *lookup_stored_bitmap(struct stored_bitmap *st)
 {
 	struct ewah_bitmap *parent;
@@ -158,10 +178,14 @@ static int load_bitmap_header(struct bitmap_index *index)
 
 		if (flags & BITMAP_OPT_HASH_CACHE) {
 			unsigned char *end = index->map + index->map_size - 20;
-			index->hashes = ((uint32_t *)end) - index->pack->num_objects;
+			index->hashes = ((uint32_t *)end) - bitmap_num_objects(index);
 		}
 	}
 
+	if (index->midx &&
+	    !hasheq(header->checksum, get_midx_checksum(index->midx)))
+		return error("Bitmap index does not match its multi-pack-index");
+
 	index->entry_count = ntohl(header->entry_count);
 	index->map_pos += sizeof(*header);
 	return 0;
@@ -222,12 +246,19 @@ static int load_bitmap_entries_v1(struct bitmap_index *index)
 		struct stored_bitmap *xor_bitmap = NULL;
 		uint32_t commit_idx_pos;
 		const unsigned char *sha1;
+		struct object_id oid;
 
 		commit_idx_pos = read_be32(index->map, &index->map_pos);
 		xor_offset = read_u8(index->map, &index->map_pos);
 		flags = read_u8(index->map, &index->map_pos);
 
-		sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		if (index->midx) {
+			if (!nth_midxed_object_oid(&oid, index->midx, commit_idx_pos))
+				return error("Corrupted bitmap index (invalid commit position)");
+			sha1 = oid.hash;
+		} else {
+			sha1 = nth_packed_object_sha1(index->pack, commit_idx_pos);
+		}
 
 		bitmap = read_bitmap_1(index);
 		if (!bitmap)
@@ -302,13 +333,53 @@ static int open_pack_bitmap_1(struct bitmap_index *bitmap_git, struct packed_git
 	return 0;
 }
 
+static int open_midx_bitmap_1(struct bitmap_index *bitmap_git,
+			      struct multi_pack_index *midx)
+{
+	int fd;
+	struct stat st;
+	char *idx_name;
+
+	idx_name = get_midx_bitmap_filename(midx);
+	fd = git_open(idx_name);
+	free(idx_name);
+
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+
+	bitmap_git->midx = midx;
+	bitmap_git->map_size = xsize_t(st.st_size);
+	bitmap_git->map = xmmap(NULL, bitmap_git->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	bitmap_git->map_pos = 0;
+	close(fd);
+
+	if (load_bitmap_header(bitmap_git) < 0) {
+		munmap(bitmap_git->map, bitmap_git->map_size);
+		bitmap_git->midx = NULL;
+		bitmap_git->hashes = NULL;
+		bitmap_git->map = NULL;
+		bitmap_git->map_size = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
 static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 {
 	assert(bitmap_git->map);
 
 	bitmap_git->bitmaps = kh_init_sha1();
 	bitmap_git->ext_index.positions = kh_init_sha1_pos();
-	load_pack_revindex(bitmap_git->pack);
+	if (bitmap_git->midx)
+		load_midx_revindex(bitmap_git->midx);
+	else
+		load_pack_revindex(bitmap_git->pack);
 
 	if (!(bitmap_git->commits = read_bitmap_1(bitmap_git)) ||
 		!(bitmap_git->trees = read_bitmap_1(bitmap_git)) ||
@@ -330,11 +401,17 @@ static int load_pack_bitmap(struct bitmap_index *bitmap_git)
 
 static int open_pack_bitmap(struct bitmap_index *bitmap_git)
 {
+	struct multi_pack_index *m;
 	struct packed_git *p;
 	int ret = -1;
 
 	assert(!bitmap_git->map);
 
+	for (m = get_multi_pack_index(the_repository); m; m = m->next) {
+		if (!open_midx_bitmap_1(bitmap_git, m))
+			return 0;
+	}
+
 	for (p = get_all_packs(the_repository); p; p = p->next) {
 		if (open_pack_bitmap_1(bitmap_git, p) == 0)
 			ret = 0;
@@ -368,7 +445,7 @@ static inline int bitmap_position_extended(struct bitmap_index *bitmap_git,
 
 	if (pos < kh_end(positions)) {
 		int bitmap_pos = kh_value(positions, pos);
-		return bitmap_pos + bitmap_git->pack->num_objects;
+		return bitmap_pos + bitmap_num_objects(bitmap_git);
 	}
 
 	return -1;
@@ -384,10 +461,35 @@ static inline int bitmap_position_packfile(struct bitmap_index *bitmap_git,
 	return find_revindex_position(bitmap_git->pack, offset);
 }
 
+static inline int bitmap_position_midx(struct bitmap_index *bitmap_git,
+				       const unsigned char *sha1)
+{
+	struct object_id oid;
+	uint32_t pos;
+
+	hashcpy(oid.hash, sha1);
+	if (!bsearch_midx(&oid, bitmap_git->midx, &pos))
+		return -1;
+
+	return bitmap_git->midx->revindex_pos[pos];
+}
+
+/*
+ * Position of an object among the ones covered by the bitmap file,
+ * i.e. ignoring the extended index.
+ */
+static int bitmap_position_bitmapped(struct bitmap_index *bitmap_git,
+				     const unsigned char *sha1)
+{
+	if (bitmap_git->midx)
+		return bitmap_position_midx(bitmap_git, sha1);
+	return bitmap_position_packfile(bitmap_git, sha1);
+}
+
 static int bitmap_position(struct bitmap_index *bitmap_git,
 			   const unsigned char *sha1)
 {
-	int pos = bitmap_position_packfile(bitmap_git, sha1);
+	int pos = bitmap_position_bitmapped(bitmap_git, sha1);
 	return (pos >= 0) ? pos : bitmap_position_extended(bitmap_git, sha1);
 }
 
@@ -417,7 +519,7 @@ static int ext_index_add_object(struct bitmap_index *bitmap_git,
 		bitmap_pos = kh_value(eindex->positions, hash_pos);
 	}
 
-	return bitmap_pos + bitmap_git->pack->num_objects;
+	return bitmap_pos + bitmap_num_objects(bitmap_git);
 }
 
 struct bitmap_show_data {
@@ -606,7 +708,7 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	for (i = 0; i < eindex->count; ++i) {
 		struct object *obj;
 
-		if (!bitmap_get(objects, bitmap_git->pack->num_objects + i))
+		if (!bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			continue;
 
 		obj = eindex->objects[i];
@@ -614,6 +716,28 @@ static void show_extended_objects(struct bitmap_index *bitmap_git,
 	}
 }
 
+static void show_midx_object(struct bitmap_index *bitmap_git,
+			     uint32_t bitmap_pos,
+			     enum object_type object_type,
+			     show_reachable_fn show_reach)
+{
+	struct multi_pack_index *m = bitmap_git->midx;
+	uint32_t midx_pos = m->revindex[bitmap_pos];
+	uint32_t pack_int_id = nth_midxed_pack_int_id(m, midx_pos);
+	struct object_id oid;
+	uint32_t hash = 0;
+
+	if (prepare_midx_pack(m, pack_int_id))
+		die("failed to open pack %s", m->pack_names[pack_int_id]);
+
+	nth_midxed_object_oid(&oid, m, midx_pos);
+	if (bitmap_git->hashes)
+		hash = get_be32(bitmap_git->hashes + midx_pos);
+
+	show_reach(&oid, object_type, 0, hash, m->packs[pack_int_id],
+		   nth_midxed_offset(m, midx_pos));
+}
+
 static void show_objects_for_type(
 	struct bitmap_index *bitmap_git,
 	struct ewah_bitmap *type_filter,
@@ -628,7 +752,7 @@ static void show_objects_for_type(
 
 	struct bitmap *objects = bitmap_git->result;
 
-	if (bitmap_git->reuse_objects == bitmap_git->pack->num_objects)
+	if (bitmap_git->reuse_objects == bitmap_num_objects(bitmap_git))
 		return;
 
 	ewah_iterator_init(&it, type_filter);
@@ -649,6 +773,12 @@ static void show_objects_for_type(
 			if (pos + offset < bitmap_git->reuse_objects)
 				continue;
 
+			if (bitmap_git->midx) {
+				show_midx_object(bitmap_git, pos + offset,
+						 object_type, show_reach);
+				continue;
+			}
+
 			entry = &bitmap_git->pack->revindex[pos + offset];
 			nth_packed_object_oid(&oid, bitmap_git->pack, entry->nr);
 
@@ -670,14 +800,215 @@ static int in_bitmapped_pack(struct bitmap_index *bitmap_git,
 		struct object *object = roots->item;
 		roots = roots->next;
 
-		if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
+		if (bitmap_git->midx) {
+			uint32_t pos;
+
+			if (bsearch_midx(&object->oid, bitmap_git->midx, &pos))
+				return 1;
+		} else if (find_pack_entry_one(object->oid.hash, bitmap_git->pack) > 0)
 			return 1;
 	}
 
 	return 0;
 }
 
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
+static int can_filter_bitmap(struct list_objects_filter_options *filter)
+{
+	if (!filter)
+		return 1;
+
+	switch (filter->choice) {
+	case LOFC_DISABLED:
+	case LOFC_BLOB_NONE:
+	case LOFC_BLOB_LIMIT:
+	case LOFC_TREE_NONE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Return the positions of the objects of type `type` among `tips`: the
+ * filters do not apply to the objects that were explicitly asked for.
+ */
+static struct bitmap *find_tip_objects(struct bitmap_index *bitmap_git,
+				       struct object_list *tips,
+				       enum object_type type)
+{
+	struct bitmap *result = bitmap_new();
+
+	for (; tips; tips = tips->next) {
+		int pos;
+
+		if (tips->item->type != type)
+			continue;
+		pos = bitmap_position(bitmap_git, tips->item->oid.hash);
+		if (pos >= 0)
+			bitmap_set(result, pos);
+	}
+
+	return result;
+}
+
+static void filter_bitmap_exclude_type(struct bitmap_index *bitmap_git,
+				       struct object_list *tips,
+				       struct bitmap *to_filter,
+				       struct ewah_bitmap *type_filter,
+				       enum object_type type)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct bitmap *tip_objects = find_tip_objects(bitmap_git, tips, type);
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	ewah_iterator_init(&it, type_filter);
+	for (i = 0; i < to_filter->word_alloc &&
+		    ewah_iterator_next(&mask, &it); i++) {
+		if (i < tip_objects->word_alloc)
+			mask &= ~tip_objects->words[i];
+		to_filter->words[i] &= ~mask;
+	}
+
+	/* the type bitmaps do not cover the extended index */
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = bitmap_num_objects(bitmap_git) + i;
+
+		if (eindex->objects[i]->type == type &&
+		    !bitmap_get(tip_objects, pos))
+			bitmap_unset(to_filter, pos);
+	}
+
+	bitmap_free(tip_objects);
+}
+
+static unsigned long get_size_by_pos(struct bitmap_index *bitmap_git,
+				     uint32_t pos)
+{
+	struct object_info oi = OBJECT_INFO_INIT;
+	struct packed_git *pack;
+	struct object_id oid;
+	unsigned long size;
+	off_t offset;
+
+	oi.sizep = &size;
+
+	if (pos >= bitmap_num_objects(bitmap_git)) {
+		struct eindex *eindex = &bitmap_git->ext_index;
+		struct object *obj =
+			eindex->objects[pos - bitmap_num_objects(bitmap_git)];
+
+		if (oid_object_info_extended(the_repository, &obj->oid,
+					     &oi, 0) < 0)
+			die("unable to get size of %s", oid_to_hex(&obj->oid));
+		return size;
+	}
+
+	if (bitmap_git->midx) {
+		struct multi_pack_index *m = bitmap_git->midx;
+		uint32_t midx_pos = m->revindex[pos];
+		uint32_t pack_int_id = nth_midxed_pack_int_id(m, midx_pos);
+
+		if (prepare_midx_pack(m, pack_int_id))
+			die("failed to open pack %s", m->pack_names[pack_int_id]);
+		pack = m->packs[pack_int_id];
+		offset = nth_midxed_offset(m, midx_pos);
+		nth_midxed_object_oid(&oid, m, midx_pos);
+	} else {
+		struct revindex_entry *entry = &bitmap_git->pack->revindex[pos];
+
+		pack = bitmap_git->pack;
+		offset = entry->offset;
+		nth_packed_object_oid(&oid, pack, entry->nr);
+	}
+
+	/* the sizes table of the pack, if any, spares us the delta headers */
+	if (pack_sizes_object_info(pack, &oid, &oi) < 0 &&
+	    packed_object_info(the_repository, pack, offset, &oi) < 0)
+		die("unable to get size of %s", oid_to_hex(&oid));
+	return size;
+}
+
+static void filter_bitmap_blob_limit(struct bitmap_index *bitmap_git,
+				     struct object_list *tips,
+				     struct bitmap *to_filter,
+				     unsigned long limit)
+{
+	struct eindex *eindex = &bitmap_git->ext_index;
+	struct bitmap *tip_objects = find_tip_objects(bitmap_git, tips, OBJ_BLOB);
+	struct ewah_iterator it;
+	eword_t mask;
+	uint32_t i;
+
+	ewah_iterator_init(&it, bitmap_git->blobs);
+	for (i = 0; i < to_filter->word_alloc &&
+		    ewah_iterator_next(&mask, &it); i++) {
+		eword_t word = to_filter->words[i] & mask;
+		uint32_t offset;
+
+		for (offset = 0; offset < BITS_IN_EWORD; offset++) {
+			uint32_t pos;
+
+			if ((word >> offset) == 0)
+				break;
+
+			offset += ewah_bit_ctz64(word >> offset);
+			pos = i * BITS_IN_EWORD + offset;
+
+			if (!bitmap_get(tip_objects, pos) &&
+			    get_size_by_pos(bitmap_git, pos) >= limit)
+				bitmap_unset(to_filter, pos);
+		}
+	}
+
+	for (i = 0; i < eindex->count; i++) {
+		uint32_t pos = bitmap_num_objects(bitmap_git) + i;
+
+		if (eindex->objects[i]->type == OBJ_BLOB &&
+		    bitmap_get(to_filter, pos) &&
+		    !bitmap_get(tip_objects, pos) &&
+		    get_size_by_pos(bitmap_git, pos) >= limit)
+			bitmap_unset(to_filter, pos);
+	}
+
+	bitmap_free(tip_objects);
+}
+
+/*
+ * Remove from `to_filter` the objects that `filter` omits, as a regular
+ * traversal with list-objects-filter.c would.
+ */
+static void filter_bitmap(struct bitmap_index *bitmap_git,
+			  struct object_list *tips,
+			  struct bitmap *to_filter,
+			  struct list_objects_filter_options *filter)
+{
+	if (!filter)
+		return;
+
+	switch (filter->choice) {
+	case LOFC_BLOB_NONE:
+		filter_bitmap_exclude_type(bitmap_git, tips, to_filter,
+					   bitmap_git->blobs, OBJ_BLOB);
+		break;
+	case LOFC_BLOB_LIMIT:
+		filter_bitmap_blob_limit(bitmap_git, tips, to_filter,
+					 filter->blob_limit_value);
+		break;
+	case LOFC_TREE_NONE:
+		filter_bitmap_exclude_type(bitmap_git, tips, to_filter,
+					   bitmap_git->trees, OBJ_TREE);
+		filter_bitmap_exclude_type(bitmap_git, tips, to_filter,
+					   bitmap_git->blobs, OBJ_BLOB);
+		break;
+	default:
+		break;
+	}
+}
+
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter)
 {
 	unsigned int i;
 
@@ -687,7 +1018,12 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	struct bitmap *wants_bitmap = NULL;
 	struct bitmap *haves_bitmap = NULL;
 
-	struct bitmap_index *bitmap_git = xcalloc(1, sizeof(*bitmap_git));
+	struct bitmap_index *bitmap_git;
+
+	if (!can_filter_bitmap(filter))
+		return NULL;
+
+	bitmap_git = xcalloc(1, sizeof(*bitmap_git));
 	/* try to open a bitmapped pack, but don't parse it yet
 	 * because we may not need to use it */
 	if (open_pack_bitmap(bitmap_git) < 0)
@@ -758,6 +1094,8 @@ struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs)
 	if (haves_bitmap)
 		bitmap_and_not(wants_bitmap, haves_bitmap);
 
+	filter_bitmap(bitmap_git, wants, wants_bitmap, filter);
+
 	bitmap_git->result = wants_bitmap;
 	bitmap_git->haves = haves_bitmap;
 
@@ -785,6 +1123,13 @@ int reuse_partial_packfile_from_bitmap(struct bitmap_index *bitmap_git,
 
 	assert(result);
 
+	/*
+	 * The objects of a multi-pack bitmap are spread over several
+	 * packfiles, so there is no single pack to copy verbatim.
+	 */
+	if (bitmap_git->midx)
+		return -1;
+
 	for (i = 0; i < result->word_alloc; ++i) {
 		if (result->words[i] != (eword_t)~0) {
 			reuse_objects += ewah_bit_ctz64(~result->words[i]);
@@ -885,7 +1230,7 @@ static uint32_t count_object_type(struct bitmap_index *bitmap_git,
 
 	for (i = 0; i < eindex->count; ++i) {
 		if (eindex->objects[i]->type == type &&
-			bitmap_get(objects, bitmap_git->pack->num_objects + i))
+			bitmap_get(objects, bitmap_num_objects(bitmap_git) + i))
 			count++;
 	}
 
@@ -1051,17 +1396,26 @@ int rebuild_existing_bitmaps(struct bitmap_index *bitmap_git,
 	khiter_t hash_pos;
 	int hash_ret;
 
-	num_objects = bitmap_git->pack->num_objects;
+	num_objects = bitmap_num_objects(bitmap_git);
 	reposition = xcalloc(num_objects, sizeof(uint32_t));
 
 	for (i = 0; i < num_objects; ++i) {
-		const unsigned char *sha1;
-		struct revindex_entry *entry;
 		struct object_entry *oe;
 
-		entry = &bitmap_git->pack->revindex[i];
-		sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
-		oe = packlist_find(mapping, sha1, NULL);
+		if (bitmap_git->midx) {
+			struct object_id oid;
+
+			nth_midxed_object_oid(&oid, bitmap_git->midx,
+					      bitmap_git->midx->revindex[i]);
+			oe = packlist_find(mapping, oid.hash, NULL);
+		} else {
+			const unsigned char *sha1;
+			struct revindex_entry *entry;
+
+			entry = &bitmap_git->pack->revindex[i];
+			sha1 = nth_packed_object_sha1(bitmap_git->pack, entry->nr);
+			oe = packlist_find(mapping, sha1, NULL);
+		}
 
 		if (oe)
 			reposition[i] = oe_in_pack_pos(mapping, oe) + 1;
@@ -1125,7 +1479,7 @@ int bitmap_has_sha1_in_uninteresting(struct bitmap_index *bitmap_git,
 	if (!bitmap_git->haves)
 		return 0; /* walk had no "haves" */
 
-	pos = bitmap_position_packfile(bitmap_git, sha1);
+	pos = bitmap_position_bitmapped(bitmap_git, sha1);
 	if (pos < 0)
 		return 0;
 
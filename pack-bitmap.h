@@ -38,6 +38,7 @@ typedef int (*show_reachable_fn)(
 	off_t found_offset);
 
 struct bitmap_index;
+struct list_objects_filter_options;
 
 struct bitmap_index *prepare_bitmap_git(void);
 void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
@@ -45,7 +46,16 @@ void count_bitmap_commit_list(struct bitmap_index *, uint32_t *commits,
 void traverse_bitmap_commit_list(struct bitmap_index *,
 				 show_reachable_fn show_reachable);
 void test_bitmap_walk(struct rev_info *revs);
-struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs);
+/*
+ * Compute the objects reachable from the pending objects of `revs` (and
+ * not from the uninteresting ones), omitting those excluded by `filter`,
+ * if not NULL. Return NULL if the bitmaps cannot be used for this walk,
+ * e.g. because the filter is not one of blob:none, blob:limit=<n> or
+ * tree:0, in which case the caller should fall back to a regular
+ * traversal.
+ */
+struct bitmap_index *prepare_bitmap_walk(struct rev_info *revs,
+					 struct list_objects_filter_options *filter);
 int reuse_partial_packfile_from_bitmap(struct bitmap_index *,
 				       struct packed_git **packfile,
 				       uint32_t *entries, off_t *up_to);
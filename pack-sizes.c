@@ -0,0 +1,199 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "object.h"
+#include "object-store.h"
+#include "packfile.h"
+#include "pack-sizes.h"
+
+#define PACK_SIZES_SIGNATURE 0x5053495a /* "PSIZ" */
+#define PACK_SIZES_VERSION 1
+#define PACK_SIZES_HEADER_SIZE 8
+#define PACK_SIZES_TYPE_SHIFT 61
+#define PACK_SIZES_NO_BASE 0xffffffff
+
+static size_t pack_sizes_file_size(const struct packed_git *p)
+{
+	return PACK_SIZES_HEADER_SIZE + 2 * the_hash_algo->rawsz +
+	       st_mult(p->num_objects, sizeof(uint64_t) + sizeof(uint32_t));
+}
+
+/* the checksum of the pack, as recorded in its .idx file */
+static const unsigned char *pack_checksum(const struct packed_git *p)
+{
+	return (const unsigned char *)p->index_data + p->index_size -
+	       2 * the_hash_algo->rawsz;
+}
+
+void write_pack_sizes_file(struct repository *r, const char *idx_name)
+{
+	struct strbuf tmp_file = STRBUF_INIT;
+	struct strbuf filename = STRBUF_INIT;
+	struct packed_git *p;
+	struct hashfile *f;
+	uint32_t *bases;
+	uint32_t i;
+	int fd;
+
+	p = add_packed_git(idx_name, strlen(idx_name), 0);
+	if (!p || open_pack_index(p))
+		die(_("unable to open pack index '%s'"), idx_name);
+	strbuf_addstr(&filename, idx_name);
+	strbuf_strip_suffix(&filename, ".idx");
+	strbuf_addstr(&filename, ".sizes");
+
+	fd = odb_mkstemp(&tmp_file, "pack/tmp_sizes_XXXXXX");
+	f = hashfd(fd, tmp_file.buf);
+
+	hashwrite_be32(f, PACK_SIZES_SIGNATURE);
+	hashwrite_be32(f, PACK_SIZES_VERSION);
+	hashwrite(f, pack_checksum(p), the_hash_algo->rawsz);
+
+	ALLOC_ARRAY(bases, p->num_objects);
+	for (i = 0; i < p->num_objects; i++) {
+		struct object_info oi = OBJECT_INFO_INIT;
+		struct object_id base;
+		enum object_type type;
+		unsigned long size;
+		uint64_t value;
+		int rtype;
+
+		oi.typep = &type;
+		oi.sizep = &size;
+		oi.delta_base_sha1 = base.hash;
+		rtype = packed_object_info(r, p, nth_packed_object_offset(p, i),
+					   &oi);
+		if (rtype < 0 || type <= OBJ_NONE)
+			die(_("unable to get info of object %s in pack '%s'"),
+			    oid_to_hex(nth_packed_object_oid(&base, p, i)),
+			    p->pack_name);
+		if ((uint64_t)size >> PACK_SIZES_TYPE_SHIFT)
+			die(_("object too large for a sizes table in pack '%s'"),
+			    p->pack_name);
+		value = htonll(((uint64_t)type << PACK_SIZES_TYPE_SHIFT) | size);
+		hashwrite(f, &value, sizeof(value));
+
+		if (rtype != OBJ_OFS_DELTA && rtype != OBJ_REF_DELTA)
+			bases[i] = PACK_SIZES_NO_BASE;
+		else if (!bsearch_pack(&base, p, &bases[i]))
+			die(_("delta base %s is not in pack '%s'"),
+			    oid_to_hex(&base), p->pack_name);
+	}
+	for (i = 0; i < p->num_objects; i++)
+		hashwrite_be32(f, bases[i]);
+	free(bases);
+
+	finalize_hashfile(f, NULL, CSUM_HASH_IN_STREAM | CSUM_FSYNC | CSUM_CLOSE);
+
+	if (adjust_shared_perm(tmp_file.buf))
+		die_errno(_("unable to make temporary sizes file readable"));
+	if (rename(tmp_file.buf, filename.buf))
+		die_errno(_("unable to rename temporary sizes file to '%s'"),
+			  filename.buf);
+	strbuf_release(&tmp_file);
+	strbuf_release(&filename);
+
+	close_pack(p);
+	free(p->revindex);
+	free(p);
+}
+
+static int load_pack_sizes(struct packed_git *p)
+{
+	struct strbuf name = STRBUF_INIT;
+	const unsigned char *data;
+	struct stat st;
+	size_t size;
+	int fd;
+
+	if (p->sizes_data)
+		return 0;
+	if (p->sizes_missing || open_pack_index(p))
+		return -1;
+
+	strbuf_addstr(&name, p->pack_name);
+	strbuf_strip_suffix(&name, ".pack");
+	strbuf_addstr(&name, ".sizes");
+	fd = git_open(name.buf);
+	if (fd < 0)
+		goto missing;
+	if (fstat(fd, &st)) {
+		close(fd);
+		goto missing;
+	}
+	size = xsize_t(st.st_size);
+	if (size != pack_sizes_file_size(p)) {
+		warning(_("sizes file '%s' has the wrong size"), name.buf);
+		close(fd);
+		goto missing;
+	}
+	data = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(data) != PACK_SIZES_SIGNATURE ||
+	    get_be32(data + 4) != PACK_SIZES_VERSION) {
+		warning(_("sizes file '%s' has an unknown format"), name.buf);
+		goto unmap;
+	}
+	if (!hasheq(data + PACK_SIZES_HEADER_SIZE, pack_checksum(p))) {
+		warning(_("sizes file '%s' does not match its pack"), name.buf);
+		goto unmap;
+	}
+
+	p->sizes_data = data;
+	p->sizes_size = size;
+	strbuf_release(&name);
+	return 0;
+
+unmap:
+	munmap((void *)data, size);
+missing:
+	p->sizes_missing = 1;
+	strbuf_release(&name);
+	return -1;
+}
+
+int pack_sizes_object_info(struct packed_git *p, const struct object_id *oid,
+			   struct object_info *oi)
+{
+	const unsigned char *table;
+	enum object_type type;
+	uint64_t value;
+	uint32_t pos, base;
+
+	if (oi->contentp || oi->disk_sizep)
+		return -1;
+	if (load_pack_sizes(p) || !bsearch_pack(oid, p, &pos))
+		return -1;
+
+	table = p->sizes_data + PACK_SIZES_HEADER_SIZE + the_hash_algo->rawsz;
+	value = get_be64(table + st_mult(pos, sizeof(uint64_t)));
+	base = get_be32(table + st_mult(p->num_objects, sizeof(uint64_t)) +
+			st_mult(pos, sizeof(uint32_t)));
+	type = value >> PACK_SIZES_TYPE_SHIFT;
+
+	if (oi->typep)
+		*oi->typep = type;
+	if (oi->type_name)
+		strbuf_addstr(oi->type_name, type_name(type));
+	if (oi->sizep)
+		*oi->sizep = value & (((uint64_t)1 << PACK_SIZES_TYPE_SHIFT) - 1);
+	if (oi->delta_base_sha1) {
+		if (base == PACK_SIZES_NO_BASE)
+			hashclr(oi->delta_base_sha1);
+		else
+			hashcpy(oi->delta_base_sha1,
+				nth_packed_object_sha1(p, base));
+	}
+	oi->whence = OI_PACKED;
+
+	return base == PACK_SIZES_NO_BASE ? type : OBJ_REF_DELTA;
+}
+
+void close_pack_sizes(struct packed_git *p)
+{
+	if (p->sizes_data) {
+		munmap((void *)p->sizes_data, p->sizes_size);
+		p->sizes_data = NULL;
+	}
+	p->sizes_missing = 0;
+}
@@ -0,0 +1,49 @@
+#ifndef PACK_SIZES_H
+#define PACK_SIZES_H
+
+/*
+ * A pack may come with a sizes table, "pack-<hash>.sizes", which records
+ * the type and size of each object of the pack, and the delta base of
+ * those stored as deltas. It lets oid_object_info_extended() answer
+ * requests for these (e.g. from `git cat-file --batch-check`) without
+ * walking delta chains or inflating anything.
+ *
+ * The file consists of:
+ *
+ *   - the 4-byte signature "PSIZ"
+ *   - a 4-byte version number (network byte order), currently 1
+ *   - the checksum of the pack
+ *   - for each object, in the order of the .idx file, an 8-byte value
+ *     (network byte order) holding the type of the object in its 3 most
+ *     significant bits and its size in the other ones
+ *   - for each object, in the same order, a 4-byte value (network byte
+ *     order) holding the position in the .idx file of its delta base,
+ *     or 0xffffffff if it is not stored as a delta
+ *   - a checksum of all of the above
+ */
+
+struct object_id;
+struct object_info;
+struct packed_git;
+struct repository;
+
+/*
+ * Compute the sizes table of the pack whose index is `idx_name`, and
+ * write it next to it. This needs to look at the header of every object
+ * of the pack once.
+ */
+void write_pack_sizes_file(struct repository *r, const char *idx_name);
+
+/*
+ * Answer the request `oi` for the object `oid` of pack `p` from its sizes
+ * table. Return its representation type in the pack, with any delta
+ * reported as OBJ_REF_DELTA, or -1 if the pack has no (usable) table or
+ * `oi` asks for more than what it records.
+ */
+int pack_sizes_object_info(struct packed_git *p, const struct object_id *oid,
+			   struct object_info *oi);
+
+/* Release the table of `p`, if it was loaded. */
+void close_pack_sizes(struct packed_git *p);
+
+#endif /* PACK_SIZES_H */
@@ -16,6 +16,9 @@
 #include "tree.h"
 #include "object-store.h"
 #include "midx.h"
+#include "memory-budget.h"
+#include "pack-sizes.h"
+#include "trace-event.h"
 
 char *odb_pack_name(struct strbuf *buf,
 		    const unsigned char *sha1,
@@ -48,6 +51,13 @@ static unsigned int pack_max_fds;
 static size_t peak_pack_mapped;
 static size_t pack_mapped;
 
+static struct memory_consumer pack_window_memory =
+	MEMORY_CONSUMER_INIT("pack windows");
+static struct memory_consumer delta_base_memory =
+	MEMORY_CONSUMER_INIT("delta base cache");
+
+static void release_memory_over_budget(void);
+
 #define SZ_FMT PRIuMAX
 static inline uintmax_t sz_fmt(size_t s) { return s; }
 
@@ -269,6 +279,7 @@ static int unuse_one_window(struct packed_git *current)
 	if (lru_p) {
 		munmap(lru_w->base, lru_w->len);
 		pack_mapped -= lru_w->len;
+		memory_uncharge(&pack_window_memory, lru_w->len);
 		if (lru_l)
 			lru_l->next = lru_w->next;
 		else
@@ -297,6 +308,7 @@ void close_pack_windows(struct packed_git *p)
 			    p->pack_name);
 		munmap(w->base, w->len);
 		pack_mapped -= w->len;
+		memory_uncharge(&pack_window_memory, w->len);
 		pack_open_windows--;
 		p->windows = w->next;
 		free(w);
@@ -321,6 +333,7 @@ void close_pack_index(struct packed_git *p)
 		munmap((void *)p->index_data, p->index_size);
 		p->index_data = NULL;
 	}
+	close_pack_sizes(p);
 }
 
 void close_pack(struct packed_git *p)
@@ -557,8 +570,10 @@ static int open_packed_git_1(struct packed_git *p)
 
 static int open_packed_git(struct packed_git *p)
 {
-	if (!open_packed_git_1(p))
+	if (!open_packed_git_1(p)) {
+		trace_event_count(TRACE_COUNTER_PACKS_OPENED, 1);
 		return 0;
+	}
 	close_pack_fd(p);
 	return -1;
 }
@@ -616,9 +631,11 @@ unsigned char *use_pack(struct packed_git *p,
 				len = packed_git_window_size;
 			win->len = (size_t)len;
 			pack_mapped += win->len;
+			memory_charge(&pack_window_memory, win->len);
 			while (packed_git_limit < pack_mapped
 				&& unuse_one_window(p))
 				; /* nothing */
+			release_memory_over_budget();
 			win->base = xmmap(NULL, win->len,
 				PROT_READ, MAP_PRIVATE,
 				p->pack_fd, win->offset);
@@ -846,6 +863,7 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 	if (ends_with(file_name, ".idx") ||
 	    ends_with(file_name, ".pack") ||
 	    ends_with(file_name, ".bitmap") ||
+	    ends_with(file_name, ".sizes") ||
 	    ends_with(file_name, ".keep") ||
 	    ends_with(file_name, ".promisor"))
 		string_list_append(data->garbage, full_name);
@@ -853,11 +871,87 @@ static void prepare_pack(const char *full_name, size_t full_name_len,
 		report_garbage(PACKDIR_FILE_GARBAGE, full_name);
 }
 
+static void stat_pack_dir(struct pack_dir_state *state, struct stat *st)
+{
+	struct strbuf path = STRBUF_INIT;
+
+	strbuf_addf(&path, "%s/pack", state->objdir);
+	state->exists = !stat(path.buf, st);
+	strbuf_release(&path);
+}
+
+static struct pack_dir_state *find_pack_dir(struct raw_object_store *o,
+					     const char *objdir)
+{
+	int i;
+
+	for (i = 0; i < o->pack_dirs_nr; i++)
+		if (!strcmp(o->pack_dirs[i].objdir, objdir))
+			return &o->pack_dirs[i];
+	return NULL;
+}
+
+/* Record the state of the pack directory before reading it. */
+static void record_pack_dir(struct repository *r, const char *objdir)
+{
+	struct raw_object_store *o = r->objects;
+	struct pack_dir_state *state = find_pack_dir(o, objdir);
+	struct stat st;
+
+	if (!state) {
+		ALLOC_GROW(o->pack_dirs, o->pack_dirs_nr + 1, o->pack_dirs_alloc);
+		state = &o->pack_dirs[o->pack_dirs_nr++];
+		state->objdir = objdir;
+	}
+
+	stat_pack_dir(state, &st);
+	if (state->exists)
+		fill_stat_data(&state->sd, &st);
+	state->scanned = time(NULL);
+}
+
+int packed_git_changed(struct repository *r)
+{
+	struct raw_object_store *o = r->objects;
+	struct alternate_object_database *alt;
+	int i;
+
+	if (!o->packed_git_initialized)
+		return 1;
+	/*
+	 * An alternate added since the scan, e.g. by add_submodule_odb(),
+	 * has packs which were never looked at.
+	 */
+	for (alt = o->alt_odb_list; alt; alt = alt->next)
+		if (!find_pack_dir(o, alt->path))
+			return 1;
+	for (i = 0; i < o->pack_dirs_nr; i++) {
+		struct pack_dir_state state = o->pack_dirs[i];
+		int existed = state.exists;
+		struct stat st;
+
+		stat_pack_dir(&state, &st);
+		if (state.exists != existed)
+			return 1;
+		if (!state.exists)
+			continue;
+		/*
+		 * A change in the same second as the scan may not show in
+		 * the timestamps, as with racily clean index entries.
+		 */
+		if (match_stat_data(&state.sd, &st) ||
+		    st.st_mtime >= state.scanned)
+			return 1;
+	}
+	return 0;
+}
+
 static void prepare_packed_git_one(struct repository *r, char *objdir, int local)
 {
 	struct prepare_pack_data data;
 	struct string_list garbage = STRING_LIST_INIT_DUP;
 
+	record_pack_dir(r, objdir);
 	data.m = r->objects->multi_pack_index;
 
 	/* look for the multi-pack-index for this object directory */
@@ -981,6 +1075,7 @@ static void prepare_packed_git(struct repository *r)
 
 void reprepare_packed_git(struct repository *r)
 {
+	trace_event_count(TRACE_COUNTER_PACK_RESCANS, 1);
 	r->objects->approximate_object_count_valid = 0;
 	r->objects->packed_git_initialized = 0;
 	prepare_packed_git(r);
@@ -1070,7 +1165,14 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/*
+		 * The window stays mapped while we inflate without
+		 * holding the object read lock, as *w_curs keeps it in
+		 * use; other threads may only open more windows.
+		 */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		curpos += stream.next_in - in;
 	} while ((st == Z_OK || st == Z_BUF_ERROR) &&
 		 stream.total_out < sizeof(delta_head));
@@ -1379,6 +1481,7 @@ static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
 	hashmap_remove(&delta_base_cache, ent, &ent->key);
 	list_del(&ent->lru);
 	delta_base_cached -= ent->size;
+	memory_uncharge(&delta_base_memory, ent->size);
 	free(ent);
 }
 
@@ -1418,10 +1521,21 @@ void clear_delta_base_cache(void)
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	struct delta_base_cache_entry *ent = xmalloc(sizeof(*ent));
+	struct delta_base_cache_entry *ent;
 	struct list_head *lru, *tmp;
 
+	/*
+	 * Another thread may have unpacked and cached the same base while
+	 * we were inflating without the object read lock.
+	 */
+	if (get_delta_base_cache_entry(p, base_offset)) {
+		free(base);
+		return;
+	}
+
+	ent = xmalloc(sizeof(*ent));
 	delta_base_cached += base_size;
+	memory_charge(&delta_base_memory, base_size);
 
 	list_for_each_safe(lru, tmp, &delta_base_cache_lru) {
 		struct delta_base_cache_entry *f =
@@ -1442,6 +1556,26 @@ static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 		hashmap_init(&delta_base_cache, delta_base_cache_hash_cmp, NULL, 0);
 	hashmap_entry_init(ent, pack_entry_hash(p, base_offset));
 	hashmap_add(&delta_base_cache, ent);
+
+	release_memory_over_budget();
+}
+
+/*
+ * Give memory back while the caches use more than the memory budget
+ * allows: first the unused pack windows, which are cheap to map again,
+ * then the least recently used delta bases.
+ */
+static void release_memory_over_budget(void)
+{
+	while (memory_budget_exceeded()) {
+		if (unuse_one_window(NULL))
+			continue;
+		if (list_empty(&delta_base_cache_lru))
+			break;
+		release_delta_base_cache(list_first_entry(&delta_base_cache_lru,
+							  struct delta_base_cache_entry,
+							  lru));
+	}
 }
 
 int packed_object_info(struct repository *r, struct packed_git *p,
@@ -1550,7 +1684,10 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/* see the comment in get_size_from_delta() */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1706,13 +1843,11 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 		void *base = data;
 		void *external_base = NULL;
 		unsigned long delta_size, base_size = size;
+		off_t base_obj_offset = obj_offset;
 		int i;
 
 		data = NULL;
 
-		if (base)
-			add_delta_base_cache(p, obj_offset, base, base_size, type);
-
 		if (!base) {
 			/*
 			 * We're probably in deep shit, but let's try to fetch
@@ -1750,14 +1885,27 @@ void *unpack_entry(struct repository *r, struct packed_git *p, off_t obj_offset,
 			      "at offset %"PRIuMAX" from %s",
 			      (uintmax_t)curpos, p->pack_name);
 			data = NULL;
+		} else {
+			data = patch_delta(base, base_size,
+					   delta_data, delta_size,
+					   &size);
+		}
+
+		/*
+		 * The base is cached only now that we are done with it:
+		 * unpack_compressed_entry() drops the object read lock,
+		 * and another thread could have evicted (and freed) it
+		 * from the cache in the meantime.
+		 */
+		if (!external_base)
+			add_delta_base_cache(p, base_obj_offset, base,
+					     base_size, type);
+
+		if (!delta_data) {
 			free(external_base);
 			continue;
 		}
 
-		data = patch_delta(base, base_size,
-				   delta_data, delta_size,
-				   &size);
-
 		/*
 		 * We could not apply the delta; warn the user, but keep going.
 		 * Our failure will be noticed either in the next iteration of
@@ -46,6 +46,13 @@ void for_each_file_in_pack_dir(const char *objdir,
 extern void (*report_garbage)(unsigned seen_bits, const char *path);
 
 extern void reprepare_packed_git(struct repository *r);
+
+/*
+ * Return 1 if a pack directory may have changed since it was last
+ * scanned, so that reprepare_packed_git() could find new packs in it.
+ * This costs a stat() of each pack directory instead of reading them.
+ */
+extern int packed_git_changed(struct repository *r);
 extern void install_packed_git(struct repository *r, struct packed_git *pack);
 
 struct packed_git *get_packed_git(struct repository *r);
@@ -0,0 +1,468 @@
+#include "cache.h"
+#include "config.h"
+#include "parallel-checkout.h"
+#include "pkt-line.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "streaming.h"
+#include "thread-utils.h"
+
+enum pc_status {
+	PC_UNINITIALIZED = 0,
+	PC_ACCEPTING_ENTRIES,
+	PC_RUNNING,
+};
+
+static struct parallel_checkout {
+	enum pc_status status;
+	struct parallel_checkout_item *items;
+	size_t nr, alloc;
+} parallel_checkout;
+
+#define DEFAULT_THRESHOLD_FOR_PARALLELISM 100
+
+void get_parallel_checkout_configs(int *num_workers, int *threshold)
+{
+	const char *env_workers = getenv("GIT_TEST_CHECKOUT_WORKERS");
+
+	if (env_workers && *env_workers) {
+		*num_workers = atoi(env_workers);
+		if (*num_workers < 1)
+			*num_workers = online_cpus();
+		*threshold = 0;
+		return;
+	}
+
+	if (git_config_get_int("checkout.workers", num_workers))
+		*num_workers = 1;
+	else if (*num_workers < 1)
+		*num_workers = online_cpus();
+
+	if (git_config_get_int("checkout.thresholdforparallelism", threshold))
+		*threshold = DEFAULT_THRESHOLD_FOR_PARALLELISM;
+}
+
+int parallel_checkout_is_initialized(void)
+{
+	return parallel_checkout.status == PC_ACCEPTING_ENTRIES;
+}
+
+void init_parallel_checkout(void)
+{
+	if (parallel_checkout.status != PC_UNINITIALIZED)
+		BUG("parallel checkout already initialized");
+
+	parallel_checkout.status = PC_ACCEPTING_ENTRIES;
+}
+
+static void finish_parallel_checkout(void)
+{
+	if (parallel_checkout.status == PC_UNINITIALIZED)
+		BUG("cannot finish parallel checkout: not initialized yet");
+
+	free(parallel_checkout.items);
+	memset(&parallel_checkout, 0, sizeof(parallel_checkout));
+}
+
+static int is_eligible_for_parallel_checkout(const struct cache_entry *ce,
+					     const struct conv_attrs *ca)
+{
+	size_t packed_item_size;
+
+	if (!S_ISREG(ce->ce_mode))
+		return 0;
+
+	/*
+	 * Filter drivers run external commands (and may delay the
+	 * checkout), and the encoding conversion may need to report
+	 * errors tied to the attributes of the path; both are left to
+	 * the main process.
+	 */
+	if (ca->drv || ca->working_tree_encoding)
+		return 0;
+
+	packed_item_size = sizeof(struct pc_item_fixed_portion) + ce->ce_namelen;
+	if (packed_item_size > LARGE_PACKET_DATA_MAX)
+		return 0;
+
+	return 1;
+}
+
+int enqueue_checkout(struct cache_entry *ce, const struct conv_attrs *ca)
+{
+	struct parallel_checkout_item *pc_item;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES ||
+	    !is_eligible_for_parallel_checkout(ce, ca))
+		return -1;
+
+	ALLOC_GROW(parallel_checkout.items, parallel_checkout.nr + 1,
+		   parallel_checkout.alloc);
+
+	pc_item = &parallel_checkout.items[parallel_checkout.nr];
+	memset(pc_item, 0, sizeof(*pc_item));
+	pc_item->id = parallel_checkout.nr++;
+	pc_item->ce = ce;
+	pc_item->ca = *ca;
+	pc_item->status = PC_ITEM_PENDING;
+
+	return 0;
+}
+
+static int handle_results(struct checkout *state)
+{
+	int ret = 0;
+	size_t i;
+	int have_pending = 0, have_collisions = 0;
+
+	/*
+	 * Update the index for all written entries first: the collided
+	 * entries below compare against their stat data to tell which
+	 * paths of the index collided with each other.
+	 */
+	for (i = 0; i < parallel_checkout.nr; i++) {
+		struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+		switch (pc_item->status) {
+		case PC_ITEM_WRITTEN:
+			update_ce_after_write(state, pc_item->ce, &pc_item->st);
+			break;
+		case PC_ITEM_COLLIDED:
+			have_collisions = 1;
+			break;
+		case PC_ITEM_PENDING:
+			have_pending = 1;
+			/* fall through */
+		case PC_ITEM_FAILED:
+			ret = -1;
+			break;
+		default:
+			BUG("unknown checkout item status in parallel checkout");
+		}
+	}
+
+	if (have_collisions) {
+		/*
+		 * The queue is closed at this point, so these entries are
+		 * written sequentially by checkout_entry(), which removes
+		 * whatever is in the way just like a sequential checkout
+		 * would have done.
+		 */
+		for (i = 0; i < parallel_checkout.nr; i++) {
+			struct parallel_checkout_item *pc_item = &parallel_checkout.items[i];
+
+			if (pc_item->status == PC_ITEM_COLLIDED &&
+			    checkout_entry(pc_item->ce, state, NULL))
+				ret = -1;
+		}
+	}
+
+	if (have_pending)
+		error(_("parallel checkout finished with pending entries"));
+
+	return ret;
+}
+
+static int reset_fd(int fd, const char *path)
+{
+	if (lseek(fd, 0, SEEK_SET) != 0)
+		return error_errno("failed to rewind descriptor of '%s'", path);
+	if (ftruncate(fd, 0))
+		return error_errno("failed to truncate file '%s'", path);
+	return 0;
+}
+
+static int write_pc_item_to_fd(struct parallel_checkout_item *pc_item, int fd,
+			       const char *path)
+{
+	int ret;
+	struct stream_filter *filter;
+	struct strbuf buf = STRBUF_INIT;
+	char *new_blob;
+	unsigned long size;
+	size_t newsize = 0;
+	ssize_t wrote;
+
+	filter = get_stream_filter_ca(&pc_item->ca, &pc_item->ce->oid);
+	if (filter) {
+		if (!stream_blob_to_fd(fd, &pc_item->ce->oid, filter, 1))
+			return 0;
+		/* Retry without streaming, as write_entry() does. */
+		if (reset_fd(fd, path))
+			return -1;
+	}
+
+	new_blob = read_blob_entry(pc_item->ce, &size);
+	if (!new_blob)
+		return error("unable to read sha1 file of %s (%s)",
+			     path, oid_to_hex(&pc_item->ce->oid));
+
+	/*
+	 * Errors from the conversion are not fatal here, just like in
+	 * write_entry(): the only conversions left are crlf and ident.
+	 */
+	ret = convert_to_working_tree_ca(&pc_item->ca, pc_item->ce->name,
+					 new_blob, size, &buf);
+	if (ret) {
+		free(new_blob);
+		new_blob = strbuf_detach(&buf, &newsize);
+		size = newsize;
+	}
+
+	wrote = write_in_full(fd, new_blob, size);
+	free(new_blob);
+	if (wrote < 0)
+		return error("unable to write file %s", path);
+
+	return 0;
+}
+
+void write_pc_item(struct parallel_checkout_item *pc_item,
+		   struct checkout *state)
+{
+	unsigned int mode = (pc_item->ce->ce_mode & 0100) ? 0777 : 0666;
+	int fd, fstat_done = 0;
+	struct strbuf path = STRBUF_INIT;
+	const char *dir_sep;
+
+	strbuf_add(&path, state->base_dir, state->base_dir_len);
+	strbuf_add(&path, pc_item->ce->name, pc_item->ce->ce_namelen);
+
+	/*
+	 * The leading directories were created when the entry was queued,
+	 * but a colliding path may have replaced one of them with a file
+	 * or a symlink since.
+	 */
+	dir_sep = find_last_dir_sep(path.buf);
+	if (dir_sep && !has_dirs_only_path(path.buf, dir_sep - path.buf,
+					   state->base_dir_len)) {
+		pc_item->status = PC_ITEM_COLLIDED;
+		goto out;
+	}
+
+	fd = open(path.buf, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if (fd < 0) {
+		if (errno == EEXIST || errno == EISDIR) {
+			/* Another entry of the checkout is in the way. */
+			pc_item->status = PC_ITEM_COLLIDED;
+			goto out;
+		}
+		pc_item->status = PC_ITEM_FAILED;
+		error_errno("unable to create file %s", path.buf);
+		goto out;
+	}
+
+	if (write_pc_item_to_fd(pc_item, fd, path.buf)) {
+		/* The error was already reported. */
+		pc_item->status = PC_ITEM_FAILED;
+		close(fd);
+		unlink(path.buf);
+		goto out;
+	}
+
+	fstat_done = fstat_checkout_output(fd, state, &pc_item->st);
+
+	if (close(fd)) {
+		pc_item->status = PC_ITEM_FAILED;
+		error_errno("unable to close file %s", path.buf);
+		goto out;
+	}
+
+	if (state->refresh_cache && !fstat_done &&
+	    lstat(path.buf, &pc_item->st) < 0) {
+		pc_item->status = PC_ITEM_FAILED;
+		error_errno("unable to stat just-written file %s", path.buf);
+		goto out;
+	}
+
+	pc_item->status = PC_ITEM_WRITTEN;
+
+out:
+	strbuf_release(&path);
+}
+
+static void write_items_sequentially(struct checkout *state)
+{
+	size_t i;
+
+	for (i = 0; i < parallel_checkout.nr; i++)
+		write_pc_item(&parallel_checkout.items[i], state);
+}
+
+struct pc_worker {
+	struct child_process cp;
+	size_t next_item, nr_items;
+};
+
+static void setup_worker(struct pc_worker *worker, struct checkout *state)
+{
+	struct child_process *cp = &worker->cp;
+
+	child_process_init(cp);
+	cp->git_cmd = 1;
+	cp->in = -1;
+	cp->out = -1;
+	cp->clean_on_exit = 1;
+	argv_array_push(&cp->args, "checkout--worker");
+	if (state->base_dir_len)
+		argv_array_pushf(&cp->args, "--prefix=%s", state->base_dir);
+	if (start_command(cp))
+		die(_("failed to spawn checkout worker"));
+}
+
+static void send_one_item(struct strbuf *buf,
+			  struct parallel_checkout_item *pc_item)
+{
+	struct pc_item_fixed_portion fixed_portion;
+	const char *working_tree_encoding = pc_item->ca.working_tree_encoding;
+	size_t working_tree_encoding_len = working_tree_encoding ?
+					   strlen(working_tree_encoding) : 0;
+	size_t len_data;
+	char *data, *variant;
+
+	memset(&fixed_portion, 0, sizeof(fixed_portion));
+	fixed_portion.id = pc_item->id;
+	oidcpy(&fixed_portion.oid, &pc_item->ce->oid);
+	fixed_portion.ce_mode = pc_item->ce->ce_mode;
+	fixed_portion.crlf_action = pc_item->ca.crlf_action;
+	fixed_portion.ident = pc_item->ca.ident;
+	fixed_portion.working_tree_encoding_len = working_tree_encoding_len;
+	fixed_portion.name_len = pc_item->ce->ce_namelen;
+
+	len_data = sizeof(fixed_portion) + working_tree_encoding_len +
+		   pc_item->ce->ce_namelen;
+	data = xmalloc(len_data);
+	memcpy(data, &fixed_portion, sizeof(fixed_portion));
+	variant = data + sizeof(fixed_portion);
+	if (working_tree_encoding_len) {
+		memcpy(variant, working_tree_encoding, working_tree_encoding_len);
+		variant += working_tree_encoding_len;
+	}
+	memcpy(variant, pc_item->ce->name, pc_item->ce->ce_namelen);
+
+	packet_buf_write_len(buf, data, len_data);
+	free(data);
+}
+
+static void send_batch(struct pc_worker *worker)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t i;
+
+	for (i = 0; i < worker->nr_items; i++)
+		send_one_item(&buf, &parallel_checkout.items[worker->next_item + i]);
+	packet_buf_flush(&buf);
+
+	/*
+	 * A worker that dies early leaves its items pending, which is
+	 * reported by handle_results().
+	 */
+	if (write_in_full(worker->cp.in, buf.buf, buf.len) < 0)
+		error_errno(_("unable to send data to checkout worker"));
+	close(worker->cp.in);
+	worker->cp.in = -1;
+	strbuf_release(&buf);
+}
+
+static void receive_results(struct pc_worker *worker)
+{
+	static char buffer[LARGE_PACKET_MAX];
+
+	for (;;) {
+		struct pc_item_result res;
+		struct parallel_checkout_item *pc_item;
+		int len;
+		enum packet_read_status status;
+
+		status = packet_read_with_status(worker->cp.out, NULL, NULL,
+						 buffer, sizeof(buffer), &len,
+						 PACKET_READ_GENTLE_ON_EOF);
+		if (status != PACKET_READ_NORMAL)
+			break;
+
+		if (len != sizeof(res))
+			BUG("checkout worker sent a result of unexpected size (%d)",
+			    len);
+		memcpy(&res, buffer, sizeof(res));
+
+		if (res.id < worker->next_item ||
+		    res.id >= worker->next_item + worker->nr_items)
+			BUG("checkout worker sent a result for an unknown item");
+
+		pc_item = &parallel_checkout.items[res.id];
+		pc_item->status = res.status;
+		if (res.status == PC_ITEM_WRITTEN)
+			pc_item->st = res.st;
+	}
+
+	close(worker->cp.out);
+	worker->cp.out = -1;
+}
+
+static void write_items_in_workers(struct checkout *state, int num_workers)
+{
+	struct pc_worker *workers;
+	size_t base_nr, extra, next = 0;
+	int i;
+
+	ALLOC_ARRAY(workers, num_workers);
+	base_nr = parallel_checkout.nr / num_workers;
+	extra = parallel_checkout.nr % num_workers;
+
+	sigchain_push(SIGPIPE, SIG_IGN);
+
+	/*
+	 * Each worker gets a contiguous run of the queue, so that entries
+	 * of the same directory tend to be written by the same process.
+	 * A worker reads its whole batch before writing anything, so it
+	 * is busy while the batches of the next workers are being sent.
+	 */
+	for (i = 0; i < num_workers; i++) {
+		struct pc_worker *worker = &workers[i];
+
+		worker->next_item = next;
+		worker->nr_items = base_nr + (i < extra);
+		next += worker->nr_items;
+
+		setup_worker(worker, state);
+		send_batch(worker);
+	}
+
+	/*
+	 * Workers send their results only once their whole batch is
+	 * written, so reading them one after the other does not hold
+	 * up the others.
+	 */
+	for (i = 0; i < num_workers; i++) {
+		receive_results(&workers[i]);
+		if (finish_command(&workers[i].cp))
+			error(_("checkout worker %d finished with error"), i);
+	}
+
+	sigchain_pop(SIGPIPE);
+	free(workers);
+}
+
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold)
+{
+	int ret;
+
+	if (parallel_checkout.status != PC_ACCEPTING_ENTRIES)
+		BUG("cannot run parallel checkout: uninitialized or already running");
+
+	parallel_checkout.status = PC_RUNNING;
+
+	if (parallel_checkout.nr < num_workers)
+		num_workers = parallel_checkout.nr;
+
+	if (num_workers <= 1 || parallel_checkout.nr < threshold)
+		write_items_sequentially(state);
+	else
+		write_items_in_workers(state, num_workers);
+
+	ret = handle_results(state);
+
+	finish_parallel_checkout();
+	return ret;
+}
@@ -0,0 +1,104 @@
+#ifndef PARALLEL_CHECKOUT_H
+#define PARALLEL_CHECKOUT_H
+
+#include "convert.h"
+
+struct cache_entry;
+struct checkout;
+struct progress;
+
+/*
+ * Parallel checkout writes the regular files of a checkout from a pool
+ * of "git checkout--worker" processes, so that inflating the blobs and
+ * writing them out is spread over several cores. Only entries that need
+ * no external filters or encoding conversion are eligible; everything
+ * else is still written sequentially by checkout_entry().
+ */
+
+/* Read the checkout.workers and checkout.thresholdForParallelism config. */
+void get_parallel_checkout_configs(int *num_workers, int *threshold);
+
+/*
+ * While parallel checkout is initialized, checkout_entry() hands
+ * eligible entries to enqueue_checkout() instead of writing them.
+ * The queued entries are written by run_parallel_checkout().
+ */
+void init_parallel_checkout(void);
+int parallel_checkout_is_initialized(void);
+
+/*
+ * Queue `ce` to be written by run_parallel_checkout(). `ca` are the
+ * entry's conversion attributes. Return 0 if the entry was queued, or
+ * -1 if it must be written sequentially.
+ */
+int enqueue_checkout(struct cache_entry *ce, const struct conv_attrs *ca);
+
+/*
+ * Write all queued entries, using `num_workers` worker processes if
+ * there are at least `threshold` of them (and writing them in this
+ * process otherwise), and update their stat information in the index.
+ * Entries that collided with another path are then written
+ * sequentially. Return 0 on success and -1 if any entry failed.
+ */
+int run_parallel_checkout(struct checkout *state, int num_workers,
+			  int threshold);
+
+/****************************************************************
+ * Interface with the checkout--worker processes
+ ****************************************************************/
+
+enum pc_item_status {
+	PC_ITEM_PENDING = 0,
+	PC_ITEM_WRITTEN,
+	/*
+	 * The entry could not be written because another path (or a
+	 * leading directory of it) was in the way; this happens on
+	 * case-insensitive filesystems when two paths of the index
+	 * collide. It is retried sequentially.
+	 */
+	PC_ITEM_COLLIDED,
+	PC_ITEM_FAILED,
+};
+
+struct parallel_checkout_item {
+	/* Position of the item in the queue of the main process. */
+	size_t id;
+	struct cache_entry *ce;
+	struct conv_attrs ca;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * The fixed-size part of an item as it is sent to a worker; it is
+ * followed by `working_tree_encoding_len` bytes of encoding name and
+ * `name_len` bytes of path.
+ */
+struct pc_item_fixed_portion {
+	size_t id;
+	struct object_id oid;
+	unsigned int ce_mode;
+	enum crlf_action crlf_action;
+	int ident;
+	size_t working_tree_encoding_len;
+	size_t name_len;
+};
+
+/*
+ * The result a worker sends back for an item. The stat information is
+ * only meaningful if `status` is PC_ITEM_WRITTEN.
+ */
+struct pc_item_result {
+	size_t id;
+	enum pc_item_status status;
+	struct stat st;
+};
+
+/*
+ * Write `pc_item` to the working tree and record the outcome (and the
+ * stat information of the written file) in the item.
+ */
+void write_pc_item(struct parallel_checkout_item *pc_item,
+		   struct checkout *state);
+
+#endif /* PARALLEL_CHECKOUT_H */
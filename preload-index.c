@@ -5,6 +5,7 @@
 #include "pathspec.h"
 #include "dir.h"
 #include "fsmonitor.h"
+#include "trace-event.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index,
@@ -34,12 +35,13 @@ struct thread_data {
 
 static void *preload_thread(void *_data)
 {
-	int nr;
+	int nr, lstat_calls = 0;
 	struct thread_data *p = _data;
 	struct index_state *index = p->index;
 	struct cache_entry **cep = index->cache + p->offset;
 	struct cache_def cache = CACHE_DEF_INIT;
 
+	trace_event_thread_start("preload");
 	nr = p->nr;
 	if (nr + p->offset > index->cache_nr)
 		nr = index->cache_nr - p->offset;
@@ -62,6 +64,7 @@ static void *preload_thread(void *_data)
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
 			continue;
+		lstat_calls++;
 		if (lstat(ce->name, &st))
 			continue;
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY|CE_MATCH_IGNORE_FSMONITOR))
@@ -70,6 +73,9 @@ static void *preload_thread(void *_data)
 		mark_fsmonitor_valid(ce);
 	} while (--nr > 0);
 	cache_def_clear(&cache);
+	/* count once, rather than taking the lock for each lstat() */
+	trace_event_count(TRACE_COUNTER_LSTAT, lstat_calls);
+	trace_event_thread_exit();
 	return NULL;
 }
 
@@ -88,6 +94,7 @@ static void preload_index(struct index_state *index,
 	if (threads < 2)
 		return;
 	trace_performance_enter();
+	trace_event_region_enter("index", "preload");
 	if (threads > MAX_PARALLEL)
 		threads = MAX_PARALLEL;
 	offset = 0;
@@ -109,6 +116,7 @@ static void preload_index(struct index_state *index,
 		if (pthread_join(p->pthread, NULL))
 			die("unable to join threaded lstat");
 	}
+	trace_event_region_leave("index", "preload");
 	trace_performance_leave("preload index");
 }
 #endif
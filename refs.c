@@ -1598,17 +1598,21 @@ int resolve_gitlink_ref(const char *submodule, const char *refname,
 			struct object_id *oid)
 {
 	struct ref_store *refs;
-	int flags;
+	int flags, ret = 0;
 
+	/*
+	 * The submodule ref stores are shared, and git status looks
+	 * up submodules from several threads.
+	 */
+	obj_read_lock();
 	refs = get_submodule_ref_store(submodule);
 
-	if (!refs)
-		return -1;
-
-	if (!refs_resolve_ref_unsafe(refs, refname, 0, oid, &flags) ||
+	if (!refs ||
+	    !refs_resolve_ref_unsafe(refs, refname, 0, oid, &flags) ||
 	    is_null_oid(oid))
-		return -1;
-	return 0;
+		ret = -1;
+	obj_read_unlock();
+	return ret;
 }
 
 struct ref_store_hash_entry
@@ -1672,14 +1676,30 @@ static struct ref_store *lookup_ref_store_map(struct hashmap *map,
 static struct ref_store *ref_store_init(const char *gitdir,
 					unsigned int flags)
 {
-	const char *be_name = "files";
-	struct ref_storage_be *be = find_ref_storage_backend(be_name);
+	struct repository_format format;
+	struct strbuf config = STRBUF_INIT;
+	const char *be_name;
+	struct ref_storage_be *be;
 	struct ref_store *refs;
 
+	/*
+	 * The backend is a property of the repository, so a linked
+	 * worktree or a submodule uses whatever its common directory
+	 * has configured.
+	 */
+	get_common_dir_noenv(&config, gitdir);
+	strbuf_addstr(&config, "/config");
+	read_repository_format(&format, config.buf);
+	be_name = format.ref_storage ? format.ref_storage : "files";
+
+	be = find_ref_storage_backend(be_name);
 	if (!be)
-		BUG("reference backend %s is unknown", be_name);
+		die(_("unknown ref storage format '%s'"), be_name);
 
 	refs = be->init(gitdir, flags);
+
+	strbuf_release(&config);
+	clear_repository_format(&format);
 	return refs;
 }
 
@@ -3106,7 +3106,7 @@ static int files_init_db(struct ref_store *ref_store, struct strbuf *err)
 }
 
 struct ref_storage_be refs_be_files = {
-	NULL,
+	&refs_be_reftable,
 	"files",
 	files_ref_store_create,
 	files_init_db,
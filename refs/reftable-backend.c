@@ -0,0 +1,2741 @@
+#include "../cache.h"
+#include "../config.h"
+#include "../refs.h"
+#include "refs-internal.h"
+#include "../iterator.h"
+#include "../dir-iterator.h"
+#include "../lockfile.h"
+#include "../tempfile.h"
+#include "../object.h"
+#include "../varint.h"
+#include "../chdir-notify.h"
+#include "../dir.h"
+
+/*
+ * This backend stores references in a stack of immutable, sorted
+ * tables under `$GIT_DIR/reftable`. The file `tables.list` names the
+ * tables of the stack, oldest first. A table is made of blocks of
+ * prefix-compressed records with restart points, followed by an index
+ * of the ref blocks; see Documentation/technical/reftable.txt.
+ *
+ * Every transaction appends one small table, so updating a single
+ * reference never rewrites the others. After each append the newest
+ * tables are merged whenever that keeps the sizes of the stack
+ * growing geometrically, which bounds the number of tables (and
+ * therefore the cost of a lookup) by the logarithm of the number of
+ * references.
+ *
+ * Reflogs are not stored in tables; they are kept as files under
+ * `$GIT_DIR/logs`, exactly as the files backend lays them out.
+ */
+
+#define REFTABLE_SIGNATURE 0x52454654 /* "REFT" */
+#define REFTABLE_VERSION 1
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE (REFTABLE_HEADER_SIZE + 12)
+#define REFTABLE_BLOCK_SIZE 4096
+#define REFTABLE_RESTART_INTERVAL 16
+
+#define BLOCK_TYPE_REF 'r'
+#define BLOCK_TYPE_INDEX 'i'
+#define BLOCK_HEADER_SIZE 4
+
+enum reftable_value_type {
+	REFTABLE_DELETION = 0,
+	REFTABLE_OID = 1,
+	REFTABLE_OID_PEELED = 2,
+	REFTABLE_SYMREF = 3
+};
+
+/*
+ * This backend uses the following flags in `ref_update::flags` for
+ * internal bookkeeping purposes, with the same meaning as in the
+ * files backend. Their numerical values must not conflict with
+ * REF_NO_DEREF, REF_FORCE_CREATE_REFLOG, REF_HAVE_NEW or
+ * REF_HAVE_OLD.
+ */
+#define REF_DELETING (1 << 5)
+#define REF_NEEDS_COMMIT (1 << 6)
+#define REF_LOG_ONLY (1 << 7)
+#define REF_UPDATE_VIA_HEAD (1 << 8)
+
+/* Set in ref_iterator::flags when the peeled value is known. */
+#define REF_KNOWS_PEELED 0x40
+
+static inline uint32_t get_be24(const unsigned char *p)
+{
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+static inline void put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (v >> 16) & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = v & 0xff;
+}
+
+static void strbuf_add_be24(struct strbuf *sb, uint32_t v)
+{
+	unsigned char buf[3];
+
+	put_be24(buf, v);
+	strbuf_add(sb, buf, sizeof(buf));
+}
+
+static void strbuf_add_varint(struct strbuf *sb, uint64_t v)
+{
+	unsigned char buf[16];
+
+	strbuf_add(sb, buf, encode_varint(v, buf));
+}
+
+/*
+ * Like decode_varint(), but never reads at or past `end`. Return 0 on
+ * success and -1 if the encoding is truncated or overflows.
+ */
+static int read_varint(const unsigned char **bufp, const unsigned char *end,
+		       uint64_t *out)
+{
+	const unsigned char *buf = *bufp;
+	unsigned char c;
+	uint64_t val;
+
+	if (buf >= end)
+		return -1;
+	c = *buf++;
+	val = c & 127;
+	while (c & 128) {
+		if (buf >= end)
+			return -1;
+		val += 1;
+		if (!val || MSB(val, 7))
+			return -1; /* overflow */
+		c = *buf++;
+		val = (val << 7) + (c & 127);
+	}
+	*bufp = buf;
+	*out = val;
+	return 0;
+}
+
+/*
+ * One decoded record. Records read from an index block only carry a
+ * refname (the last refname of a ref block) and the offset of that
+ * block.
+ */
+struct reftable_record {
+	struct strbuf refname;
+	enum reftable_value_type type;
+	uint64_t update_index;
+	struct object_id oid;
+	struct object_id peeled;
+	struct strbuf target;
+	uint64_t block_offset;
+};
+
+static void record_init(struct reftable_record *rec)
+{
+	memset(rec, 0, sizeof(*rec));
+	strbuf_init(&rec->refname, 0);
+	strbuf_init(&rec->target, 0);
+}
+
+static void record_release(struct reftable_record *rec)
+{
+	strbuf_release(&rec->refname);
+	strbuf_release(&rec->target);
+}
+
+static void record_copy(struct reftable_record *dst,
+			const struct reftable_record *src)
+{
+	strbuf_reset(&dst->refname);
+	strbuf_addbuf(&dst->refname, &src->refname);
+	dst->type = src->type;
+	dst->update_index = src->update_index;
+	oidcpy(&dst->oid, &src->oid);
+	oidcpy(&dst->peeled, &src->peeled);
+	strbuf_reset(&dst->target);
+	strbuf_addbuf(&dst->target, &src->target);
+	dst->block_offset = src->block_offset;
+}
+
+/*
+ * Set `rec` to point at `oid`, recording the peeled value if `oid`
+ * names an annotated tag.
+ */
+static void record_set_oid(struct reftable_record *rec,
+			   const struct object_id *oid)
+{
+	oidcpy(&rec->oid, oid);
+	if (peel_object(oid, &rec->peeled) == PEEL_PEELED) {
+		rec->type = REFTABLE_OID_PEELED;
+	} else {
+		oidclr(&rec->peeled);
+		rec->type = REFTABLE_OID;
+	}
+}
+
+/* A single mmapped table. */
+struct reftable {
+	/* The basename of the table, as listed in `tables.list`. */
+	char *name;
+	char *path;
+
+	const unsigned char *map;
+	size_t size;
+
+	uint32_t block_size;
+	uint64_t min_update_index, max_update_index;
+
+	/* Offset of the index block, or 0 if the table has none. */
+	size_t index_offset;
+
+	/* Offset just past the last ref block. */
+	size_t data_end;
+};
+
+static NORETURN void die_corrupt_table(const struct reftable *t)
+{
+	die("reftable %s is corrupt", t->path);
+}
+
+/*
+ * Open and mmap `dir/name`. Return NULL (with errno set) if the table
+ * cannot be opened; die if it is not a valid table.
+ */
+static struct reftable *table_open(const char *dir, const char *name)
+{
+	struct reftable *t;
+	const unsigned char *footer;
+	struct stat st;
+	int fd;
+	char *path = xstrfmt("%s/%s", dir, name);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		int save_errno = errno;
+
+		free(path);
+		errno = save_errno;
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0)
+		die_errno("unable to stat %s", path);
+
+	t = xcalloc(1, sizeof(*t));
+	t->name = xstrdup(name);
+	t->path = path;
+	t->size = xsize_t(st.st_size);
+	if (t->size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE)
+		die_corrupt_table(t);
+	t->map = xmmap(NULL, t->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (get_be32(t->map) != REFTABLE_SIGNATURE)
+		die("reftable %s has a bad signature", path);
+	if (t->map[4] != REFTABLE_VERSION)
+		die("reftable %s has unknown version %d", path, t->map[4]);
+	t->block_size = get_be24(t->map + 5);
+	t->min_update_index = get_be64(t->map + 8);
+	t->max_update_index = get_be64(t->map + 16);
+
+	footer = t->map + t->size - REFTABLE_FOOTER_SIZE;
+	if (memcmp(footer, t->map, REFTABLE_HEADER_SIZE) ||
+	    get_be32(footer + REFTABLE_FOOTER_SIZE - 4) !=
+	    crc32(0, footer, REFTABLE_FOOTER_SIZE - 4))
+		die_corrupt_table(t);
+	t->index_offset = get_be64(footer + REFTABLE_HEADER_SIZE);
+	if (t->index_offset &&
+	    (t->index_offset < REFTABLE_HEADER_SIZE ||
+	     t->index_offset >= t->size - REFTABLE_FOOTER_SIZE))
+		die_corrupt_table(t);
+	t->data_end = t->index_offset ? t->index_offset :
+		t->size - REFTABLE_FOOTER_SIZE;
+
+	return t;
+}
+
+static void table_close(struct reftable *t)
+{
+	munmap((void *)t->map, t->size);
+	free(t->name);
+	free(t->path);
+	free(t);
+}
+
+/* A cursor over the records of one block. */
+struct block_iter {
+	const struct reftable *t;
+	char type;
+	size_t start;		/* offset of the block header */
+	size_t end;		/* offset just past the block */
+	size_t records_end;	/* offset of the restart table */
+	size_t restart_nr;
+	size_t pos;		/* offset of the next record */
+	struct strbuf last_key;
+};
+
+static void block_iter_init(struct block_iter *bi, const struct reftable *t,
+			    size_t offset, char type)
+{
+	size_t limit = t->size - REFTABLE_FOOTER_SIZE;
+	uint32_t len;
+
+	if (type == BLOCK_TYPE_REF)
+		limit = t->data_end;
+	if (offset + BLOCK_HEADER_SIZE > limit || t->map[offset] != type)
+		die_corrupt_table(t);
+	len = get_be24(t->map + offset + 1);
+	if (len < BLOCK_HEADER_SIZE + 2 || len > limit - offset)
+		die_corrupt_table(t);
+
+	bi->t = t;
+	bi->type = type;
+	bi->start = offset;
+	bi->end = offset + len;
+	bi->restart_nr = get_be16(t->map + bi->end - 2);
+	if (!bi->restart_nr ||
+	    3 * bi->restart_nr > len - BLOCK_HEADER_SIZE - 2)
+		die_corrupt_table(t);
+	bi->records_end = bi->end - 2 - 3 * bi->restart_nr;
+	bi->pos = offset + BLOCK_HEADER_SIZE;
+	strbuf_reset(&bi->last_key);
+}
+
+static size_t block_iter_restart(struct block_iter *bi, size_t i)
+{
+	size_t pos = bi->start +
+		get_be24(bi->t->map + bi->records_end + 3 * i);
+
+	if (pos < bi->start + BLOCK_HEADER_SIZE || pos >= bi->records_end)
+		die_corrupt_table(bi->t);
+	return pos;
+}
+
+/*
+ * Decode the next record of the block into `rec`. Return 0 on success
+ * and 1 at the end of the block.
+ */
+static int block_iter_next(struct block_iter *bi, struct reftable_record *rec)
+{
+	const struct reftable *t = bi->t;
+	const unsigned char *p = t->map + bi->pos;
+	const unsigned char *end = t->map + bi->records_end;
+	const unsigned rawsz = the_hash_algo->rawsz;
+	uint64_t prefix_len, suffix_type, suffix_len, v;
+
+	if (bi->pos >= bi->records_end)
+		return 1;
+
+	if (read_varint(&p, end, &prefix_len) ||
+	    read_varint(&p, end, &suffix_type))
+		die_corrupt_table(t);
+	suffix_len = suffix_type >> 3;
+	if (prefix_len > bi->last_key.len || suffix_len > end - p)
+		die_corrupt_table(t);
+	strbuf_setlen(&bi->last_key, prefix_len);
+	strbuf_add(&bi->last_key, p, suffix_len);
+	p += suffix_len;
+
+	strbuf_reset(&rec->refname);
+	strbuf_addbuf(&rec->refname, &bi->last_key);
+	rec->type = suffix_type & 7;
+
+	if (bi->type == BLOCK_TYPE_INDEX) {
+		if (read_varint(&p, end, &rec->block_offset))
+			die_corrupt_table(t);
+		goto done;
+	}
+
+	if (read_varint(&p, end, &v))
+		die_corrupt_table(t);
+	rec->update_index = t->min_update_index + v;
+
+	switch (rec->type) {
+	case REFTABLE_DELETION:
+		break;
+	case REFTABLE_OID:
+	case REFTABLE_OID_PEELED:
+		if (end - p < rawsz)
+			die_corrupt_table(t);
+		hashcpy(rec->oid.hash, p);
+		p += rawsz;
+		if (rec->type == REFTABLE_OID) {
+			oidclr(&rec->peeled);
+			break;
+		}
+		if (end - p < rawsz)
+			die_corrupt_table(t);
+		hashcpy(rec->peeled.hash, p);
+		p += rawsz;
+		break;
+	case REFTABLE_SYMREF:
+		if (read_varint(&p, end, &v) || v > end - p)
+			die_corrupt_table(t);
+		strbuf_reset(&rec->target);
+		strbuf_add(&rec->target, p, v);
+		p += v;
+		break;
+	default:
+		die_corrupt_table(t);
+	}
+
+done:
+	bi->pos = p - t->map;
+	return 0;
+}
+
+/*
+ * Position `bi` so that the next call to block_iter_next() returns the
+ * first record whose refname is not less than `key`.
+ */
+static void block_iter_seek(struct block_iter *bi, const char *key)
+{
+	struct reftable_record rec;
+	struct strbuf saved_key = STRBUF_INIT;
+	size_t lo = 0, hi = bi->restart_nr;
+
+	record_init(&rec);
+
+	/* Find the first restart point whose key is greater than `key`: */
+	while (lo < hi) {
+		size_t mi = lo + (hi - lo) / 2;
+
+		bi->pos = block_iter_restart(bi, mi);
+		strbuf_reset(&bi->last_key);
+		block_iter_next(bi, &rec);
+		if (strcmp(rec.refname.buf, key) > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+
+	/* ...then scan forward from the restart point before it: */
+	bi->pos = block_iter_restart(bi, lo ? lo - 1 : 0);
+	strbuf_reset(&bi->last_key);
+	while (1) {
+		size_t pos = bi->pos;
+
+		strbuf_reset(&saved_key);
+		strbuf_addbuf(&saved_key, &bi->last_key);
+		if (block_iter_next(bi, &rec))
+			break;
+		if (strcmp(rec.refname.buf, key) >= 0) {
+			bi->pos = pos;
+			strbuf_swap(&bi->last_key, &saved_key);
+			break;
+		}
+	}
+
+	strbuf_release(&saved_key);
+	record_release(&rec);
+}
+
+/* A cursor over the ref records of a whole table. */
+struct table_iter {
+	const struct reftable *t;
+	struct block_iter bi;
+	int done;
+};
+
+static void table_iter_init(struct table_iter *ti)
+{
+	memset(ti, 0, sizeof(*ti));
+	strbuf_init(&ti->bi.last_key, 0);
+	ti->done = 1;
+}
+
+static void table_iter_release(struct table_iter *ti)
+{
+	strbuf_release(&ti->bi.last_key);
+}
+
+static void table_iter_seek(struct table_iter *ti, const struct reftable *t,
+			    const char *key)
+{
+	ti->t = t;
+	ti->done = 0;
+
+	if (t->index_offset) {
+		struct reftable_record idx;
+		int found;
+
+		record_init(&idx);
+		block_iter_init(&ti->bi, t, t->index_offset, BLOCK_TYPE_INDEX);
+		block_iter_seek(&ti->bi, key);
+		found = !block_iter_next(&ti->bi, &idx);
+		if (found && (idx.block_offset < REFTABLE_HEADER_SIZE ||
+			      idx.block_offset >= t->data_end))
+			die_corrupt_table(t);
+		if (found)
+			block_iter_init(&ti->bi, t, idx.block_offset,
+					BLOCK_TYPE_REF);
+		record_release(&idx);
+		if (!found) {
+			ti->done = 1;
+			return;
+		}
+	} else if (t->data_end > REFTABLE_HEADER_SIZE) {
+		block_iter_init(&ti->bi, t, REFTABLE_HEADER_SIZE,
+				BLOCK_TYPE_REF);
+	} else {
+		/* An empty table. */
+		ti->done = 1;
+		return;
+	}
+
+	block_iter_seek(&ti->bi, key);
+}
+
+static int table_iter_next(struct table_iter *ti, struct reftable_record *rec)
+{
+	while (!ti->done) {
+		if (!block_iter_next(&ti->bi, rec))
+			return 0;
+		if (ti->bi.end >= ti->t->data_end)
+			ti->done = 1;
+		else
+			block_iter_init(&ti->bi, ti->t, ti->bi.end,
+					BLOCK_TYPE_REF);
+	}
+	return 1;
+}
+
+/*
+ * A `reftable_snapshot` is the set of tables named by one version of
+ * `tables.list`. Like the `packed-refs` snapshots, instances are
+ * reference counted so that an iterator can keep using its tables
+ * while the stack is reloaded underneath it.
+ */
+struct reftable_snapshot {
+	struct reftable **tables; /* oldest first */
+	size_t nr, alloc;
+
+	unsigned int referrers;
+
+	/* The metadata of the `tables.list` this snapshot was read from. */
+	struct stat_validity validity;
+};
+
+static void acquire_snapshot(struct reftable_snapshot *snapshot)
+{
+	snapshot->referrers++;
+}
+
+static void release_snapshot(struct reftable_snapshot *snapshot)
+{
+	size_t i;
+
+	if (--snapshot->referrers)
+		return;
+	for (i = 0; i < snapshot->nr; i++)
+		table_close(snapshot->tables[i]);
+	free(snapshot->tables);
+	stat_validity_clear(&snapshot->validity);
+	free(snapshot);
+}
+
+static uint64_t snapshot_max_update_index(struct reftable_snapshot *snapshot)
+{
+	if (!snapshot->nr)
+		return 0;
+	return snapshot->tables[snapshot->nr - 1]->max_update_index;
+}
+
+struct reftable_stack {
+	/* The directory holding the tables and `tables.list`. */
+	char *dir;
+	char *list_path;
+
+	/* The most recently read snapshot, if it might still be current. */
+	struct reftable_snapshot *snapshot;
+
+	/*
+	 * Lock on `tables.list`, held while a new version of the list
+	 * is being prepared. It must not be freed.
+	 */
+	struct lock_file lock;
+};
+
+static void stack_init(struct reftable_stack *st, const char *dir)
+{
+	st->dir = xstrfmt("%s/reftable", dir);
+	st->list_path = xstrfmt("%s/tables.list", st->dir);
+	chdir_notify_reparent("reftable-backend stack", &st->dir);
+	chdir_notify_reparent("reftable-backend list", &st->list_path);
+}
+
+static void clear_stack_snapshot(struct reftable_stack *st)
+{
+	if (st->snapshot) {
+		struct reftable_snapshot *snapshot = st->snapshot;
+
+		st->snapshot = NULL;
+		release_snapshot(snapshot);
+	}
+}
+
+/*
+ * Read `tables.list` and open every table it names. A concurrent
+ * compaction may remove a table between our reading the list and
+ * opening the table; in that case the list has been replaced, too,
+ * so simply start over.
+ */
+static struct reftable_snapshot *read_snapshot(struct reftable_stack *st)
+{
+	struct strbuf buf = STRBUF_INIT;
+	int tries;
+
+	for (tries = 0; tries < 32; tries++) {
+		struct reftable_snapshot *snapshot = xcalloc(1, sizeof(*snapshot));
+		struct string_list names = STRING_LIST_INIT_NODUP;
+		struct string_list_item *item;
+		int fd, retry = 0;
+
+		acquire_snapshot(snapshot);
+
+		fd = open(st->list_path, O_RDONLY);
+		if (fd < 0) {
+			if (errno != ENOENT)
+				die_errno("unable to open %s", st->list_path);
+			stat_validity_clear(&snapshot->validity);
+			strbuf_release(&buf);
+			return snapshot;
+		}
+		stat_validity_update(&snapshot->validity, fd);
+		strbuf_reset(&buf);
+		if (strbuf_read(&buf, fd, 0) < 0)
+			die_errno("unable to read %s", st->list_path);
+		close(fd);
+
+		string_list_split_in_place(&names, buf.buf, '\n', -1);
+		for_each_string_list_item(item, &names) {
+			struct reftable *t;
+
+			if (!*item->string)
+				continue;
+			t = table_open(st->dir, item->string);
+			if (!t) {
+				if (errno != ENOENT)
+					die_errno("unable to open reftable %s/%s",
+						  st->dir, item->string);
+				retry = 1;
+				break;
+			}
+			ALLOC_GROW(snapshot->tables, snapshot->nr + 1,
+				   snapshot->alloc);
+			snapshot->tables[snapshot->nr++] = t;
+		}
+		string_list_clear(&names, 0);
+
+		if (!retry) {
+			strbuf_release(&buf);
+			return snapshot;
+		}
+		release_snapshot(snapshot);
+	}
+
+	die("unable to read a consistent view of %s", st->list_path);
+}
+
+static struct reftable_snapshot *get_snapshot(struct reftable_stack *st)
+{
+	if (st->snapshot &&
+	    !stat_validity_check(&st->snapshot->validity, st->list_path))
+		clear_stack_snapshot(st);
+	if (!st->snapshot)
+		st->snapshot = read_snapshot(st);
+	return st->snapshot;
+}
+
+/*
+ * Look up `refname` in the stack. Return 0 and fill in `rec` if it is
+ * found, -1 if its newest record is a deletion, and 1 if no table
+ * mentions it at all.
+ */
+static int stack_read_ref(struct reftable_stack *st, const char *refname,
+			  struct reftable_record *rec)
+{
+	struct reftable_snapshot *snapshot = get_snapshot(st);
+	struct table_iter ti;
+	size_t i;
+	int ret = 1;
+
+	table_iter_init(&ti);
+	for (i = snapshot->nr; i--; ) {
+		table_iter_seek(&ti, snapshot->tables[i], refname);
+		if (!table_iter_next(&ti, rec) &&
+		    !strcmp(rec->refname.buf, refname)) {
+			ret = rec->type == REFTABLE_DELETION ? -1 : 0;
+			break;
+		}
+	}
+	table_iter_release(&ti);
+	return ret;
+}
+
+static int stack_lock(struct reftable_stack *st, struct strbuf *err)
+{
+	static int timeout_configured = 0;
+	static int timeout_value = 1000;
+
+	if (!timeout_configured) {
+		git_config_get_int("core.packedrefstimeout", &timeout_value);
+		timeout_configured = 1;
+	}
+
+	if (safe_create_leading_directories_const(st->list_path)) {
+		strbuf_addf(err, "unable to create directory for '%s'",
+			    st->list_path);
+		return -1;
+	}
+	if (hold_lock_file_for_update_timeout(&st->lock, st->list_path,
+					      0, timeout_value) < 0) {
+		unable_to_lock_message(st->list_path, errno, err);
+		return -1;
+	}
+
+	/*
+	 * The list might have changed the moment before we locked it;
+	 * make sure that we work from the version we now hold.
+	 */
+	clear_stack_snapshot(st);
+	get_snapshot(st);
+	return 0;
+}
+
+static void stack_unlock(struct reftable_stack *st)
+{
+	if (is_lock_file_locked(&st->lock))
+		rollback_lock_file(&st->lock);
+}
+
+/* Writes one table to a temporary file in the stack directory. */
+struct table_writer {
+	struct tempfile *tempfile;
+	size_t offset;
+
+	uint64_t min_update_index;
+	uint32_t block_size;
+
+	struct strbuf block;
+	char block_type;
+	size_t block_nr;
+	uint32_t *restarts;
+	size_t restarts_nr, restarts_alloc;
+	struct strbuf last_key;
+	struct strbuf scratch;
+
+	/* The last refname and offset of each ref block written. */
+	struct writer_index_entry {
+		char *last_key;
+		uint64_t offset;
+	} *index;
+	size_t index_nr, index_alloc;
+};
+
+static void writer_start_block(struct table_writer *w, char type)
+{
+	strbuf_reset(&w->block);
+	strbuf_addch(&w->block, type);
+	strbuf_add_be24(&w->block, 0);
+	w->block_type = type;
+	w->block_nr = 0;
+	w->restarts_nr = 0;
+	strbuf_reset(&w->last_key);
+}
+
+static int writer_init(struct table_writer *w, struct reftable_stack *st,
+		       uint64_t min_update_index, uint64_t max_update_index,
+		       struct strbuf *err)
+{
+	unsigned char header[REFTABLE_HEADER_SIZE];
+	char *template = xstrfmt("%s/tmp_XXXXXX", st->dir);
+
+	memset(w, 0, sizeof(*w));
+	strbuf_init(&w->block, 0);
+	strbuf_init(&w->last_key, 0);
+	strbuf_init(&w->scratch, 0);
+	w->min_update_index = min_update_index;
+	w->block_size = REFTABLE_BLOCK_SIZE;
+
+	w->tempfile = mks_tempfile(template);
+	if (!w->tempfile) {
+		strbuf_addf(err, "unable to create temporary file '%s': %s",
+			    template, strerror(errno));
+		free(template);
+		return -1;
+	}
+	free(template);
+
+	put_be32(header, REFTABLE_SIGNATURE);
+	header[4] = REFTABLE_VERSION;
+	put_be24(header + 5, w->block_size);
+	put_be64(header + 8, min_update_index);
+	put_be64(header + 16, max_update_index);
+	if (write_in_full(w->tempfile->fd, header, sizeof(header)) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    get_tempfile_path(w->tempfile), strerror(errno));
+		return -1;
+	}
+	w->offset = sizeof(header);
+
+	writer_start_block(w, BLOCK_TYPE_REF);
+	return 0;
+}
+
+static void writer_release(struct table_writer *w)
+{
+	size_t i;
+
+	if (w->tempfile)
+		delete_tempfile(&w->tempfile);
+	strbuf_release(&w->block);
+	strbuf_release(&w->last_key);
+	strbuf_release(&w->scratch);
+	free(w->restarts);
+	for (i = 0; i < w->index_nr; i++)
+		free(w->index[i].last_key);
+	free(w->index);
+}
+
+static void encode_record(struct table_writer *w,
+			  const struct reftable_record *rec,
+			  struct strbuf *out, int restart)
+{
+	const unsigned rawsz = the_hash_algo->rawsz;
+	size_t prefix_len = 0;
+
+	if (!restart) {
+		while (prefix_len < w->last_key.len &&
+		       prefix_len < rec->refname.len &&
+		       w->last_key.buf[prefix_len] ==
+		       rec->refname.buf[prefix_len])
+			prefix_len++;
+	}
+
+	strbuf_add_varint(out, prefix_len);
+	strbuf_add_varint(out, (rec->refname.len - prefix_len) << 3 | rec->type);
+	strbuf_add(out, rec->refname.buf + prefix_len,
+		   rec->refname.len - prefix_len);
+
+	if (w->block_type == BLOCK_TYPE_INDEX) {
+		strbuf_add_varint(out, rec->block_offset);
+		return;
+	}
+
+	strbuf_add_varint(out, rec->update_index - w->min_update_index);
+	switch (rec->type) {
+	case REFTABLE_DELETION:
+		break;
+	case REFTABLE_OID:
+		strbuf_add(out, rec->oid.hash, rawsz);
+		break;
+	case REFTABLE_OID_PEELED:
+		strbuf_add(out, rec->oid.hash, rawsz);
+		strbuf_add(out, rec->peeled.hash, rawsz);
+		break;
+	case REFTABLE_SYMREF:
+		strbuf_add_varint(out, rec->target.len);
+		strbuf_addbuf(out, &rec->target);
+		break;
+	}
+}
+
+static int writer_flush_block(struct table_writer *w, struct strbuf *err)
+{
+	size_t i;
+
+	if (!w->block_nr)
+		return 0;
+
+	for (i = 0; i < w->restarts_nr; i++)
+		strbuf_add_be24(&w->block, w->restarts[i]);
+	strbuf_addch(&w->block, (w->restarts_nr >> 8) & 0xff);
+	strbuf_addch(&w->block, w->restarts_nr & 0xff);
+	if (w->block.len >= 1 << 24 || w->restarts_nr > 0xffff)
+		die("reftable block too large");
+	put_be24((unsigned char *)w->block.buf + 1, w->block.len);
+
+	if (w->block_type == BLOCK_TYPE_REF) {
+		ALLOC_GROW(w->index, w->index_nr + 1, w->index_alloc);
+		w->index[w->index_nr].last_key = xstrdup(w->last_key.buf);
+		w->index[w->index_nr].offset = w->offset;
+		w->index_nr++;
+	}
+
+	if (write_in_full(w->tempfile->fd, w->block.buf, w->block.len) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    get_tempfile_path(w->tempfile), strerror(errno));
+		return -1;
+	}
+	w->offset += w->block.len;
+	writer_start_block(w, w->block_type);
+	return 0;
+}
+
+/* Records must be added in strictly increasing refname order. */
+static int writer_add(struct table_writer *w, const struct reftable_record *rec,
+		      struct strbuf *err)
+{
+	int restart = !(w->block_nr % REFTABLE_RESTART_INTERVAL);
+
+	if (w->block_nr && strcmp(w->last_key.buf, rec->refname.buf) >= 0)
+		BUG("reftable records out of order: '%s' after '%s'",
+		    rec->refname.buf, w->last_key.buf);
+	strbuf_reset(&w->scratch);
+	encode_record(w, rec, &w->scratch, restart);
+
+	/*
+	 * Start a new ref block if this record would not fit. The
+	 * index block is written in one piece regardless of its size.
+	 */
+	if (w->block_type == BLOCK_TYPE_REF && w->block_nr &&
+	    w->block.len + w->scratch.len + 3 * (w->restarts_nr + 1) + 2 >
+	    w->block_size) {
+		if (writer_flush_block(w, err))
+			return -1;
+		restart = 1;
+		strbuf_reset(&w->scratch);
+		encode_record(w, rec, &w->scratch, restart);
+	}
+
+	if (restart) {
+		ALLOC_GROW(w->restarts, w->restarts_nr + 1, w->restarts_alloc);
+		w->restarts[w->restarts_nr++] = w->block.len;
+	}
+	strbuf_addbuf(&w->block, &w->scratch);
+	strbuf_reset(&w->last_key);
+	strbuf_addbuf(&w->last_key, &rec->refname);
+	w->block_nr++;
+	return 0;
+}
+
+/*
+ * Write the index and footer, and move the table to its final name
+ * in the stack directory, which is stored in `name`.
+ */
+static int writer_finish(struct table_writer *w, struct reftable_stack *st,
+			 struct strbuf *name, struct strbuf *err)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	uint64_t index_offset = 0;
+	struct strbuf path = STRBUF_INIT;
+	int ret = -1;
+
+	if (writer_flush_block(w, err))
+		goto out;
+
+	/* A table with a single ref block needs no index. */
+	if (w->index_nr > 1) {
+		struct reftable_record rec;
+		size_t i;
+
+		record_init(&rec);
+		writer_start_block(w, BLOCK_TYPE_INDEX);
+		for (i = 0; i < w->index_nr; i++) {
+			strbuf_reset(&rec.refname);
+			strbuf_addstr(&rec.refname, w->index[i].last_key);
+			rec.block_offset = w->index[i].offset;
+			writer_add(w, &rec, err);
+		}
+		record_release(&rec);
+		index_offset = w->offset;
+		if (writer_flush_block(w, err))
+			goto out;
+	}
+
+	if (lseek(w->tempfile->fd, 0, SEEK_SET) < 0 ||
+	    read_in_full(w->tempfile->fd, footer, REFTABLE_HEADER_SIZE) !=
+	    REFTABLE_HEADER_SIZE || lseek(w->tempfile->fd, 0, SEEK_END) < 0) {
+		strbuf_addf(err, "unable to reread '%s': %s",
+			    get_tempfile_path(w->tempfile), strerror(errno));
+		goto out;
+	}
+	put_be64(footer + REFTABLE_HEADER_SIZE, index_offset);
+	put_be32(footer + REFTABLE_FOOTER_SIZE - 4,
+		 crc32(0, footer, REFTABLE_FOOTER_SIZE - 4));
+	if (write_in_full(w->tempfile->fd, footer, sizeof(footer)) < 0 ||
+	    close_tempfile_gently(w->tempfile) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    get_tempfile_path(w->tempfile), strerror(errno));
+		goto out;
+	}
+
+	strbuf_reset(name);
+	strbuf_addf(name, "%012"PRIx64"-%012"PRIx64".ref",
+		    get_be64(footer + 8), get_be64(footer + 16));
+	strbuf_addf(&path, "%s/%s", st->dir, name->buf);
+	if (rename_tempfile(&w->tempfile, path.buf) < 0) {
+		strbuf_addf(err, "unable to rename reftable to '%s': %s",
+			    path.buf, strerror(errno));
+		goto out;
+	}
+	adjust_shared_perm(path.buf);
+	ret = 0;
+
+out:
+	strbuf_release(&path);
+	return ret;
+}
+
+/* A k-way merge over the tables of one or two stacks. */
+struct merged_sub {
+	struct table_iter ti;
+	struct reftable_record rec;
+	int valid;
+	/* Which stack of the ref store the table belongs to. */
+	int stack;
+};
+
+struct merged_iter {
+	/*
+	 * If set, records are filtered so that per-worktree refs are
+	 * only taken from the worktree stack and shared refs only from
+	 * the common one.
+	 */
+	int split_worktree;
+	int include_deletions;
+	struct merged_sub *subs;
+	size_t nr, alloc;
+};
+
+static void merged_sub_advance(struct merged_iter *mi, struct merged_sub *sub)
+{
+	while (!table_iter_next(&sub->ti, &sub->rec)) {
+		int per_worktree;
+
+		if (!mi->split_worktree)
+			goto found;
+		per_worktree = ref_type(sub->rec.refname.buf) ==
+			REF_TYPE_PER_WORKTREE;
+		if (per_worktree == !!sub->stack)
+			goto found;
+	}
+	sub->valid = 0;
+	return;
+
+found:
+	sub->valid = 1;
+}
+
+/*
+ * Add the tables of `snapshot`, oldest first, to the merge and seek
+ * them to `key`.
+ */
+static void merged_iter_add(struct merged_iter *mi,
+			    struct reftable_snapshot *snapshot, int stack,
+			    const char *key)
+{
+	size_t i;
+
+	for (i = 0; i < snapshot->nr; i++) {
+		struct merged_sub *sub;
+
+		ALLOC_GROW(mi->subs, mi->nr + 1, mi->alloc);
+		sub = &mi->subs[mi->nr++];
+		table_iter_init(&sub->ti);
+		record_init(&sub->rec);
+		sub->stack = stack;
+		table_iter_seek(&sub->ti, snapshot->tables[i], key);
+		merged_sub_advance(mi, sub);
+	}
+}
+
+static void merged_iter_release(struct merged_iter *mi)
+{
+	size_t i;
+
+	for (i = 0; i < mi->nr; i++) {
+		table_iter_release(&mi->subs[i].ti);
+		record_release(&mi->subs[i].rec);
+	}
+	FREE_AND_NULL(mi->subs);
+	mi->nr = mi->alloc = 0;
+}
+
+/*
+ * Store the next reference in `rec`. For a refname present in several
+ * tables, the record from the newest table wins. Return 0 on success
+ * and 1 when all tables are exhausted.
+ */
+static int merged_iter_next(struct merged_iter *mi, struct reftable_record *rec)
+{
+	while (1) {
+		struct merged_sub *best = NULL;
+		size_t i;
+
+		/*
+		 * The subs of each stack are ordered oldest first, and
+		 * the two stacks never hold the same refname, so on a
+		 * tie the later sub is the newer one.
+		 */
+		for (i = 0; i < mi->nr; i++) {
+			struct merged_sub *sub = &mi->subs[i];
+
+			if (sub->valid &&
+			    (!best || strcmp(sub->rec.refname.buf,
+					     best->rec.refname.buf) <= 0))
+				best = sub;
+		}
+		if (!best)
+			return 1;
+
+		record_copy(rec, &best->rec);
+		for (i = 0; i < mi->nr; i++) {
+			struct merged_sub *sub = &mi->subs[i];
+
+			if (sub->valid &&
+			    !strcmp(sub->rec.refname.buf, rec->refname.buf))
+				merged_sub_advance(mi, sub);
+		}
+
+		if (rec->type != REFTABLE_DELETION || mi->include_deletions)
+			return 0;
+	}
+}
+
+/*
+ * Merge `tables[0..nr)` into a single new table, whose name is stored
+ * in `name`. Deletions are dropped if `tables[0]` is the bottom of the
+ * stack, since there is nothing left for them to hide.
+ */
+static int compact_tables(struct reftable_stack *st, struct reftable **tables,
+			  size_t nr, int bottom, struct strbuf *name,
+			  struct strbuf *err)
+{
+	struct reftable_snapshot range;
+	struct merged_iter mi = { 0 };
+	struct reftable_record rec;
+	struct table_writer w;
+	int ret = -1;
+
+	memset(&range, 0, sizeof(range));
+	range.tables = tables;
+	range.nr = nr;
+
+	if (writer_init(&w, st, tables[0]->min_update_index,
+			tables[nr - 1]->max_update_index, err))
+		goto out;
+
+	record_init(&rec);
+	mi.include_deletions = !bottom;
+	merged_iter_add(&mi, &range, 0, "");
+	while (!merged_iter_next(&mi, &rec))
+		if (writer_add(&w, &rec, err))
+			break;
+	if (!err->len)
+		ret = writer_finish(&w, st, name, err);
+	merged_iter_release(&mi);
+	record_release(&rec);
+
+out:
+	writer_release(&w);
+	return ret;
+}
+
+/*
+ * Return the index of the oldest table to compact together with the
+ * newest one. We extend the range downwards while the next older table
+ * is less than twice the size of the range, so that the table sizes
+ * of the stack stay (at least) geometric with a factor of two.
+ */
+static size_t compaction_start(struct reftable **tables, size_t nr)
+{
+	size_t i, total;
+
+	if (nr < 2)
+		return nr;
+
+	i = nr - 1;
+	total = tables[i]->size;
+	while (i > 0 && tables[i - 1]->size < 2 * total) {
+		i--;
+		total += tables[i]->size;
+	}
+	return i;
+}
+
+/*
+ * Replace the locked `tables.list` with the tables of the current
+ * snapshot, followed by the table `added` (if non-NULL). Before doing
+ * so, compact the newest tables as described by compaction_start(),
+ * or all of the tables if `full` is set. The lock is released in any
+ * case.
+ */
+static int stack_commit(struct reftable_stack *st, const char *added,
+			int full, struct strbuf *err)
+{
+	struct reftable_snapshot *snapshot = st->snapshot;
+	struct reftable **tables;
+	struct reftable *added_table = NULL;
+	struct strbuf compacted = STRBUF_INIT;
+	struct strbuf list = STRBUF_INIT;
+	size_t i, nr, start;
+	int ret = -1;
+
+	if (!is_lock_file_locked(&st->lock) || !snapshot)
+		BUG("stack_commit() called without holding the lock");
+
+	ALLOC_ARRAY(tables, snapshot->nr + 1);
+	COPY_ARRAY(tables, snapshot->tables, snapshot->nr);
+	nr = snapshot->nr;
+	if (added) {
+		added_table = table_open(st->dir, added);
+		if (!added_table) {
+			strbuf_addf(err, "unable to open new reftable '%s/%s': %s",
+				    st->dir, added, strerror(errno));
+			goto out;
+		}
+		tables[nr++] = added_table;
+	}
+
+	start = full ? 0 : compaction_start(tables, nr);
+	if (nr - start >= 2 &&
+	    compact_tables(st, tables + start, nr - start, !start,
+			   &compacted, err))
+		goto out;
+	if (!compacted.len)
+		start = nr;
+
+	for (i = 0; i < start; i++)
+		strbuf_addf(&list, "%s\n", tables[i]->name);
+	if (compacted.len)
+		strbuf_addf(&list, "%s\n", compacted.buf);
+
+	if (write_in_full(get_lock_file_fd(&st->lock), list.buf, list.len) < 0 ||
+	    commit_lock_file(&st->lock) < 0) {
+		strbuf_addf(err, "unable to write '%s': %s",
+			    st->list_path, strerror(errno));
+		goto out;
+	}
+	adjust_shared_perm(st->list_path);
+
+	/* The tables we compacted are not referenced anymore: */
+	if (compacted.len)
+		for (i = start; i < nr; i++)
+			unlink_or_warn(tables[i]->path);
+	ret = 0;
+
+out:
+	stack_unlock(st);
+	clear_stack_snapshot(st);
+	if (added_table)
+		table_close(added_table);
+	free(tables);
+	strbuf_release(&compacted);
+	strbuf_release(&list);
+	return ret;
+}
+
+/*
+ * Write `records` (sorted by refname) as a new table on top of the
+ * locked stack `st`, and commit the new list of tables.
+ */
+static int stack_add_records(struct reftable_stack *st,
+			     struct reftable_record **records, size_t nr,
+			     struct strbuf *err)
+{
+	struct reftable_snapshot *snapshot = get_snapshot(st);
+	uint64_t update_index = snapshot_max_update_index(snapshot) + 1;
+	struct strbuf name = STRBUF_INIT;
+	struct table_writer w;
+	size_t i;
+	int ret = -1;
+
+	if (writer_init(&w, st, update_index, update_index, err))
+		goto out;
+	for (i = 0; i < nr; i++) {
+		records[i]->update_index = update_index;
+		if (writer_add(&w, records[i], err))
+			goto out;
+	}
+	if (writer_finish(&w, st, &name, err))
+		goto out;
+	ret = stack_commit(st, name.buf, 0, err);
+
+out:
+	stack_unlock(st);
+	writer_release(&w);
+	strbuf_release(&name);
+	return ret;
+}
+
+struct reftable_ref_store {
+	struct ref_store base;
+
+	unsigned int store_flags;
+
+	char *gitdir;
+	char *gitcommondir;
+
+	/*
+	 * stacks[0] holds the shared references under the common
+	 * directory. A linked worktree has a second stack, under its
+	 * own gitdir, for its per-worktree references.
+	 */
+	struct reftable_stack stacks[2];
+	int stacks_nr;
+
+	/*
+	 * A files backend for the same gitdir. It is used to read
+	 * pseudorefs like FETCH_HEAD, which are always written as
+	 * plain files, and for reflogs.
+	 */
+	struct ref_store *files;
+};
+
+static struct ref_store *reftable_ref_store_create(const char *gitdir,
+						   unsigned int flags)
+{
+	struct reftable_ref_store *refs = xcalloc(1, sizeof(*refs));
+	struct ref_store *ref_store = (struct ref_store *)refs;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_store_init(ref_store, &refs_be_reftable);
+	refs->store_flags = flags;
+
+	refs->gitdir = xstrdup(gitdir);
+	get_common_dir_noenv(&sb, gitdir);
+	refs->gitcommondir = strbuf_detach(&sb, NULL);
+	chdir_notify_reparent("reftable-backend $GIT_DIR", &refs->gitdir);
+	chdir_notify_reparent("reftable-backend $GIT_COMMONDIR",
+			      &refs->gitcommondir);
+
+	stack_init(&refs->stacks[0], refs->gitcommondir);
+	refs->stacks_nr = 1;
+	if (strcmp(refs->gitdir, refs->gitcommondir))
+		stack_init(&refs->stacks[refs->stacks_nr++], refs->gitdir);
+
+	refs->files = refs_be_files.init(gitdir, flags);
+
+	return ref_store;
+}
+
+/*
+ * Downcast `ref_store` to `reftable_ref_store`. Die if `ref_store` is
+ * not a `reftable_ref_store` or if it doesn't support at least the
+ * flags specified in `required_flags`. `caller` is used in any
+ * necessary error messages.
+ */
+static struct reftable_ref_store *reftable_downcast(struct ref_store *ref_store,
+						    unsigned int required_flags,
+						    const char *caller)
+{
+	struct reftable_ref_store *refs;
+
+	if (ref_store->be != &refs_be_reftable)
+		BUG("ref_store is type \"%s\" not \"reftable\" in %s",
+		    ref_store->be->name, caller);
+
+	refs = (struct reftable_ref_store *)ref_store;
+
+	if ((refs->store_flags & required_flags) != required_flags)
+		BUG("operation %s requires abilities 0x%x, but only have 0x%x",
+		    caller, required_flags, refs->store_flags);
+
+	return refs;
+}
+
+static struct reftable_stack *stack_for_ref(struct reftable_ref_store *refs,
+					    const char *refname)
+{
+	if (refs->stacks_nr > 1 &&
+	    ref_type(refname) == REF_TYPE_PER_WORKTREE)
+		return &refs->stacks[1];
+	return &refs->stacks[0];
+}
+
+static int reftable_init_db(struct ref_store *ref_store, struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "init_db");
+	struct reftable_stack *st = &refs->stacks[0];
+	struct strbuf sb = STRBUF_INIT;
+
+	safe_create_dir(st->dir, 1);
+	if (!file_exists(st->list_path))
+		write_file_buf(st->list_path, "", 0);
+	adjust_shared_perm(st->list_path);
+
+	/*
+	 * HEAD is stored in the tables like any other reference, but
+	 * repository discovery still wants to find a HEAD file. Point
+	 * it at a branch name that can never exist.
+	 */
+	strbuf_addf(&sb, "%s/HEAD", refs->gitdir);
+	if (!file_exists(sb.buf))
+		write_file(sb.buf, "ref: refs/heads/.invalid");
+	strbuf_release(&sb);
+	return 0;
+}
+
+static int reftable_read_raw_ref(struct ref_store *ref_store,
+				 const char *refname, struct object_id *oid,
+				 struct strbuf *referent, unsigned int *type)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "read_raw_ref");
+	struct reftable_record rec;
+	int ret;
+
+	*type = 0;
+	record_init(&rec);
+	ret = stack_read_ref(stack_for_ref(refs, refname), refname, &rec);
+	if (!ret) {
+		if (rec.type == REFTABLE_SYMREF) {
+			*type |= REF_ISSYMREF;
+			strbuf_reset(referent);
+			strbuf_addbuf(referent, &rec.target);
+		} else {
+			oidcpy(oid, &rec.oid);
+		}
+	}
+	record_release(&rec);
+
+	if (ret > 0 && ref_type(refname) == REF_TYPE_PSEUDOREF)
+		return refs_read_raw_ref(refs->files, refname, oid,
+					 referent, type);
+	if (ret) {
+		errno = ENOENT;
+		return -1;
+	}
+	return 0;
+}
+
+struct reftable_ref_iterator {
+	struct ref_iterator base;
+
+	struct reftable_ref_store *refs;
+	struct reftable_snapshot *snapshots[2];
+	size_t snapshots_nr;
+	struct merged_iter mi;
+	struct reftable_record rec;
+
+	char *prefix;
+	unsigned int flags;
+
+	struct object_id oid, peeled;
+};
+
+static int reftable_ref_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	while (!merged_iter_next(&iter->mi, &iter->rec)) {
+		const char *refname = iter->rec.refname.buf;
+
+		if (!starts_with(refname, iter->prefix)) {
+			if (strcmp(refname, iter->prefix) > 0)
+				break;
+			continue;
+		}
+		if (!starts_with(refname, "refs/"))
+			continue;
+		if (iter->flags & DO_FOR_EACH_PER_WORKTREE_ONLY &&
+		    ref_type(refname) != REF_TYPE_PER_WORKTREE)
+			continue;
+
+		iter->base.flags = 0;
+		if (iter->rec.type == REFTABLE_SYMREF) {
+			int flags;
+
+			if (!refs_resolve_ref_unsafe(&iter->refs->base, refname,
+						     RESOLVE_REF_READING,
+						     &iter->oid, &flags)) {
+				oidclr(&iter->oid);
+				iter->base.flags |= REF_ISBROKEN;
+			} else if (is_null_oid(&iter->oid)) {
+				iter->base.flags |= REF_ISBROKEN;
+			}
+			iter->base.flags |= REF_ISSYMREF;
+		} else {
+			oidcpy(&iter->oid, &iter->rec.oid);
+			oidcpy(&iter->peeled, &iter->rec.peeled);
+			iter->base.flags |= REF_KNOWS_PEELED;
+		}
+
+		if (!(iter->flags & DO_FOR_EACH_INCLUDE_BROKEN) &&
+		    !ref_resolves_to_object(refname, &iter->oid,
+					    iter->base.flags))
+			continue;
+
+		iter->base.refname = refname;
+		iter->base.oid = &iter->oid;
+		return ITER_OK;
+	}
+
+	if (ref_iterator_abort(ref_iterator) != ITER_DONE)
+		return ITER_ERROR;
+	return ITER_DONE;
+}
+
+static int reftable_ref_iterator_peel(struct ref_iterator *ref_iterator,
+				      struct object_id *peeled)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+
+	if ((iter->base.flags & REF_KNOWS_PEELED)) {
+		oidcpy(peeled, &iter->peeled);
+		return is_null_oid(&iter->peeled) ? -1 : 0;
+	} else if ((iter->base.flags & (REF_ISBROKEN | REF_ISSYMREF))) {
+		return -1;
+	} else {
+		return !!peel_object(&iter->oid, peeled);
+	}
+}
+
+static int reftable_ref_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_ref_iterator *iter =
+		(struct reftable_ref_iterator *)ref_iterator;
+	size_t i;
+
+	merged_iter_release(&iter->mi);
+	for (i = 0; i < iter->snapshots_nr; i++)
+		release_snapshot(iter->snapshots[i]);
+	record_release(&iter->rec);
+	free(iter->prefix);
+	base_ref_iterator_free(ref_iterator);
+	return ITER_DONE;
+}
+
+static struct ref_iterator_vtable reftable_ref_iterator_vtable = {
+	reftable_ref_iterator_advance,
+	reftable_ref_iterator_peel,
+	reftable_ref_iterator_abort
+};
+
+static struct ref_iterator *reftable_ref_iterator_begin(
+		struct ref_store *ref_store,
+		const char *prefix, unsigned int flags)
+{
+	struct reftable_ref_store *refs;
+	struct reftable_ref_iterator *iter;
+	struct ref_iterator *ref_iterator;
+	unsigned int required_flags = REF_STORE_READ;
+	const char *seek;
+	int i;
+
+	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN))
+		required_flags |= REF_STORE_ODB;
+
+	refs = reftable_downcast(ref_store, required_flags,
+				 "ref_iterator_begin");
+
+	iter = xcalloc(1, sizeof(*iter));
+	ref_iterator = &iter->base;
+	base_ref_iterator_init(ref_iterator, &reftable_ref_iterator_vtable, 1);
+
+	iter->refs = refs;
+	iter->prefix = xstrdup(prefix ? prefix : "");
+	iter->flags = flags;
+	record_init(&iter->rec);
+
+	/* Only references under "refs/" are ever iterated over. */
+	seek = strcmp(iter->prefix, "refs/") < 0 ? "refs/" : iter->prefix;
+	iter->mi.split_worktree = refs->stacks_nr > 1;
+	for (i = 0; i < refs->stacks_nr; i++) {
+		struct reftable_snapshot *snapshot =
+			get_snapshot(&refs->stacks[i]);
+
+		acquire_snapshot(snapshot);
+		iter->snapshots[iter->snapshots_nr++] = snapshot;
+		merged_iter_add(&iter->mi, snapshot, i, seek);
+	}
+
+	return ref_iterator;
+}
+
+/*
+ * Check whether the REF_HAVE_OLD and old_oid values stored in update
+ * are consistent with oid, which is the reference's current value. If
+ * everything is OK, return 0; otherwise, write an error message to
+ * err and return -1.
+ */
+static const char *original_update_refname(struct ref_update *update)
+{
+	while (update->parent_update)
+		update = update->parent_update;
+
+	return update->refname;
+}
+
+static int check_old_oid(struct ref_update *update, struct object_id *oid,
+			 struct strbuf *err)
+{
+	if (!(update->flags & REF_HAVE_OLD) ||
+		   oideq(oid, &update->old_oid))
+		return 0;
+
+	if (is_null_oid(&update->old_oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference already exists",
+			    original_update_refname(update));
+	else if (is_null_oid(oid))
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "reference is missing but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(&update->old_oid));
+	else
+		strbuf_addf(err, "cannot lock ref '%s': "
+			    "is at %s but expected %s",
+			    original_update_refname(update),
+			    oid_to_hex(oid),
+			    oid_to_hex(&update->old_oid));
+
+	return -1;
+}
+
+/*
+ * If update is for the branch HEAD points at, add a REF_LOG_ONLY
+ * update for HEAD so that HEAD's reflog records the change, too.
+ */
+static int split_head_update(struct ref_update *update,
+			     struct ref_transaction *transaction,
+			     const char *head_ref,
+			     struct string_list *affected_refnames,
+			     struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+
+	if ((update->flags & REF_LOG_ONLY) ||
+	    (update->flags & REF_UPDATE_VIA_HEAD))
+		return 0;
+
+	if (strcmp(update->refname, head_ref))
+		return 0;
+
+	if (string_list_has_string(affected_refnames, "HEAD")) {
+		strbuf_addf(err,
+			    "multiple updates for 'HEAD' (including one "
+			    "via its referent '%s') are not allowed",
+			    update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_update = ref_transaction_add_update(
+			transaction, "HEAD",
+			update->flags | REF_LOG_ONLY | REF_NO_DEREF,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+/*
+ * update is for a symref that points at referent and doesn't have
+ * REF_NO_DEREF set. Split it, as the files backend does, into a
+ * REF_LOG_ONLY update of the symref and a new update of the referent.
+ */
+static int split_symref_update(struct ref_update *update,
+			       const char *referent,
+			       struct ref_transaction *transaction,
+			       struct string_list *affected_refnames,
+			       struct strbuf *err)
+{
+	struct string_list_item *item;
+	struct ref_update *new_update;
+	unsigned int new_flags;
+
+	if (string_list_has_string(affected_refnames, referent)) {
+		strbuf_addf(err,
+			    "multiple updates for '%s' (including one "
+			    "via symref '%s') are not allowed",
+			    referent, update->refname);
+		return TRANSACTION_NAME_CONFLICT;
+	}
+
+	new_flags = update->flags;
+	if (!strcmp(update->refname, "HEAD"))
+		new_flags |= REF_UPDATE_VIA_HEAD;
+
+	new_update = ref_transaction_add_update(
+			transaction, referent, new_flags,
+			&update->new_oid, &update->old_oid,
+			update->msg);
+
+	new_update->parent_update = update;
+
+	update->flags |= REF_LOG_ONLY | REF_NO_DEREF;
+	update->flags &= ~REF_HAVE_OLD;
+
+	item = string_list_insert(affected_refnames, new_update->refname);
+	if (item->util)
+		BUG("%s unexpectedly found in affected_refnames",
+		    new_update->refname);
+	item->util = new_update;
+
+	return 0;
+}
+
+static int check_new_object(const char *refname, const struct object_id *oid,
+			    struct strbuf *err)
+{
+	struct object *o = parse_object(the_repository, oid);
+
+	if (!o) {
+		strbuf_addf(err,
+			    "trying to write ref '%s' with nonexistent object %s",
+			    refname, oid_to_hex(oid));
+		return -1;
+	}
+	if (o->type != OBJ_COMMIT && is_branch(refname)) {
+		strbuf_addf(err,
+			    "trying to write non-commit object %s to branch '%s'",
+			    oid_to_hex(oid), refname);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Prepare update, which must be made while holding the lock on its
+ * stack: read the current value of the reference into
+ * update->backend_data, check it against the expected old value,
+ * split symref and HEAD updates, and mark the update with
+ * REF_NEEDS_COMMIT if a record has to be written for it.
+ */
+static int prepare_update(struct reftable_ref_store *refs,
+			  struct ref_update *update,
+			  struct ref_transaction *transaction,
+			  const char *head_ref,
+			  struct string_list *affected_refnames,
+			  struct strbuf *err)
+{
+	struct strbuf referent = STRBUF_INIT;
+	struct object_id *old_oid = xcalloc(1, sizeof(*old_oid));
+	int mustexist = (update->flags & REF_HAVE_OLD) &&
+		!is_null_oid(&update->old_oid);
+	int exists;
+	int ret = 0;
+
+	update->backend_data = old_oid;
+
+	if ((update->flags & REF_HAVE_NEW) && is_null_oid(&update->new_oid))
+		update->flags |= REF_DELETING;
+
+	if (head_ref) {
+		ret = split_head_update(update, transaction, head_ref,
+					affected_refnames, err);
+		if (ret)
+			goto out;
+	}
+
+	exists = !refs_read_raw_ref(&refs->base, update->refname, old_oid,
+				    &referent, &update->type);
+	if (!exists) {
+		oidclr(old_oid);
+		update->type = 0;
+		if (mustexist) {
+			strbuf_addf(err, "cannot lock ref '%s': "
+				    "unable to resolve reference '%s'",
+				    original_update_refname(update),
+				    update->refname);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+		if ((update->flags & REF_HAVE_NEW) &&
+		    !(update->flags & REF_DELETING) &&
+		    !(update->flags & REF_LOG_ONLY) &&
+		    refs_verify_refname_available(&refs->base, update->refname,
+						  affected_refnames, NULL,
+						  err)) {
+			char *reason = strbuf_detach(err, NULL);
+
+			strbuf_addf(err, "cannot lock ref '%s': %s",
+				    original_update_refname(update), reason);
+			free(reason);
+			ret = TRANSACTION_NAME_CONFLICT;
+			goto out;
+		}
+	}
+
+	if (update->type & REF_ISSYMREF) {
+		if (update->flags & REF_NO_DEREF) {
+			if (refs_read_ref_full(&refs->base, referent.buf, 0,
+					       old_oid, NULL)) {
+				oidclr(old_oid);
+				if (update->flags & REF_HAVE_OLD) {
+					strbuf_addf(err, "cannot lock ref '%s': "
+						    "error reading reference",
+						    original_update_refname(update));
+					ret = TRANSACTION_GENERIC_ERROR;
+					goto out;
+				}
+			} else if (check_old_oid(update, old_oid, err)) {
+				ret = TRANSACTION_GENERIC_ERROR;
+				goto out;
+			}
+		} else {
+			ret = split_symref_update(update, referent.buf,
+						  transaction,
+						  affected_refnames, err);
+			goto out;
+		}
+	} else {
+		struct ref_update *parent_update;
+
+		if (check_old_oid(update, old_oid, err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		}
+
+		/*
+		 * If this update is happening indirectly because of a
+		 * symref update, record the old OID in the parent
+		 * update:
+		 */
+		for (parent_update = update->parent_update;
+		     parent_update;
+		     parent_update = parent_update->parent_update)
+			oidcpy(parent_update->backend_data, old_oid);
+	}
+
+	if (update->flags & REF_LOG_ONLY)
+		goto out;
+
+	if (update->flags & REF_DELETING) {
+		if (exists)
+			update->flags |= REF_NEEDS_COMMIT;
+	} else if (update->flags & REF_HAVE_NEW) {
+		if (!(update->type & REF_ISSYMREF) &&
+		    oideq(old_oid, &update->new_oid)) {
+			/*
+			 * The reference already has the desired
+			 * value, so we don't need to write it.
+			 */
+		} else if (check_new_object(update->refname,
+					    &update->new_oid, err)) {
+			char *reason = strbuf_detach(err, NULL);
+
+			strbuf_addf(err, "cannot update ref '%s': %s",
+				    update->refname, reason);
+			free(reason);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto out;
+		} else {
+			update->flags |= REF_NEEDS_COMMIT;
+		}
+	}
+
+out:
+	strbuf_release(&referent);
+	return ret;
+}
+
+struct reftable_transaction_backend_data {
+	/* All refnames affected by the transaction, util is the update. */
+	struct string_list affected_refnames;
+};
+
+static void reftable_transaction_cleanup(struct reftable_ref_store *refs,
+					 struct ref_transaction *transaction)
+{
+	struct reftable_transaction_backend_data *data =
+		transaction->backend_data;
+	size_t i;
+	int j;
+
+	for (i = 0; i < transaction->nr; i++)
+		FREE_AND_NULL(transaction->updates[i]->backend_data);
+
+	for (j = 0; j < refs->stacks_nr; j++)
+		stack_unlock(&refs->stacks[j]);
+
+	if (data) {
+		string_list_clear(&data->affected_refnames, 0);
+		free(data);
+		transaction->backend_data = NULL;
+	}
+
+	transaction->state = REF_TRANSACTION_CLOSED;
+}
+
+static int reftable_transaction_prepare(struct ref_store *ref_store,
+					struct ref_transaction *transaction,
+					struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE,
+				  "ref_transaction_prepare");
+	struct reftable_transaction_backend_data *data;
+	char *head_ref = NULL;
+	int head_type;
+	size_t i;
+	int j, ret = 0;
+
+	assert(err);
+
+	data = xcalloc(1, sizeof(*data));
+	string_list_init(&data->affected_refnames, 0);
+	transaction->backend_data = data;
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+		struct string_list_item *item =
+			string_list_append(&data->affected_refnames,
+					   update->refname);
+
+		item->util = update;
+	}
+	string_list_sort(&data->affected_refnames);
+	if (ref_update_reject_duplicates(&data->affected_refnames, err)) {
+		ret = TRANSACTION_GENERIC_ERROR;
+		goto cleanup;
+	}
+
+	/*
+	 * Lock all of our stacks up front; updates might be added to
+	 * the transaction for either one while we prepare it.
+	 */
+	for (j = 0; j < refs->stacks_nr; j++) {
+		if (stack_lock(&refs->stacks[j], err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+	head_ref = refs_resolve_refdup(ref_store, "HEAD",
+				       RESOLVE_REF_NO_RECURSE,
+				       NULL, &head_type);
+	if (head_ref && !(head_type & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/*
+	 * Note that transaction->nr may grow while we iterate, as
+	 * symref and HEAD updates are split.
+	 */
+	for (i = 0; i < transaction->nr; i++) {
+		ret = prepare_update(refs, transaction->updates[i],
+				     transaction, head_ref,
+				     &data->affected_refnames, err);
+		if (ret)
+			goto cleanup;
+	}
+
+cleanup:
+	free(head_ref);
+	if (ret) {
+		reftable_transaction_cleanup(refs, transaction);
+		return ret;
+	}
+	transaction->state = REF_TRANSACTION_PREPARED;
+	return 0;
+}
+
+static int reftable_transaction_abort(struct ref_store *ref_store,
+				      struct ref_transaction *transaction,
+				      struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, 0, "ref_transaction_abort");
+
+	reftable_transaction_cleanup(refs, transaction);
+	return 0;
+}
+
+static void reftable_reflog_path(struct reftable_ref_store *refs,
+				 struct strbuf *sb, const char *refname)
+{
+	if (ref_type(refname) == REF_TYPE_NORMAL)
+		strbuf_addf(sb, "%s/logs/%s", refs->gitcommondir, refname);
+	else
+		strbuf_addf(sb, "%s/logs/%s", refs->gitdir, refname);
+}
+
+/*
+ * Append an entry to the reflog of refname, creating the reflog if
+ * appropriate, just like the files backend would.
+ */
+static int log_ref_write(struct reftable_ref_store *refs, const char *refname,
+			 const struct object_id *old_oid,
+			 const struct object_id *new_oid,
+			 const char *msg, int flags, struct strbuf *err)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct strbuf sb = STRBUF_INIT;
+	int fd, ret = 0;
+
+	if (log_all_ref_updates == LOG_REFS_UNSET)
+		log_all_ref_updates = is_bare_repository() ? LOG_REFS_NONE : LOG_REFS_NORMAL;
+
+	if (refs_create_reflog(refs->files, refname,
+			       flags & REF_FORCE_CREATE_REFLOG, err))
+		return -1;
+
+	reftable_reflog_path(refs, &path, refname);
+	fd = open(path.buf, O_APPEND | O_WRONLY);
+	if (fd < 0) {
+		if (errno != ENOENT && errno != EISDIR) {
+			strbuf_addf(err, "unable to append to '%s': %s",
+				    path.buf, strerror(errno));
+			ret = -1;
+		}
+		goto out;
+	}
+
+	strbuf_addf(&sb, "%s %s %s", oid_to_hex(old_oid), oid_to_hex(new_oid),
+		    git_committer_info(0));
+	if (msg && *msg)
+		copy_reflog_msg(&sb, msg);
+	strbuf_addch(&sb, '\n');
+	if (write_in_full(fd, sb.buf, sb.len) < 0 || close(fd) < 0) {
+		strbuf_addf(err, "unable to append to '%s': %s",
+			    path.buf, strerror(errno));
+		ret = -1;
+	}
+
+out:
+	strbuf_release(&path);
+	strbuf_release(&sb);
+	return ret;
+}
+
+static int reftable_transaction_finish(struct ref_store *ref_store,
+				       struct ref_transaction *transaction,
+				       struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, 0, "ref_transaction_finish");
+	struct reftable_transaction_backend_data *data =
+		transaction->backend_data;
+	struct reftable_record *records = NULL;
+	struct reftable_record **sorted[2] = { NULL, NULL };
+	size_t sorted_nr[2] = { 0, 0 };
+	size_t i, records_nr = 0;
+	int j, ret = 0;
+
+	if (!transaction->nr)
+		goto cleanup;
+
+	/* Write the reflogs first, like the files backend does. */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+
+		if (!(update->flags & REF_LOG_ONLY) &&
+		    (!(update->flags & REF_NEEDS_COMMIT) ||
+		     (update->flags & REF_DELETING)))
+			continue;
+		if (log_ref_write(refs, update->refname,
+				  update->backend_data, &update->new_oid,
+				  update->msg, update->flags, err)) {
+			char *old_msg = strbuf_detach(err, NULL);
+
+			strbuf_addf(err, "cannot update the ref '%s': %s",
+				    update->refname, old_msg);
+			free(old_msg);
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+	/*
+	 * Collect the records to write for each stack. The affected
+	 * refnames are sorted, which is the order the records need to
+	 * be written in.
+	 */
+	ALLOC_ARRAY(records, data->affected_refnames.nr);
+	for (j = 0; j < refs->stacks_nr; j++)
+		ALLOC_ARRAY(sorted[j], data->affected_refnames.nr);
+	for (i = 0; i < data->affected_refnames.nr; i++) {
+		struct ref_update *update = data->affected_refnames.items[i].util;
+		struct reftable_record *rec;
+		int stack;
+
+		if (!(update->flags & REF_NEEDS_COMMIT))
+			continue;
+		rec = &records[records_nr++];
+		record_init(rec);
+		strbuf_addstr(&rec->refname, update->refname);
+		if (update->flags & REF_DELETING)
+			rec->type = REFTABLE_DELETION;
+		else
+			record_set_oid(rec, &update->new_oid);
+
+		stack = stack_for_ref(refs, update->refname) != &refs->stacks[0];
+		sorted[stack][sorted_nr[stack]++] = rec;
+	}
+
+	for (j = 0; j < refs->stacks_nr; j++) {
+		if (!sorted_nr[j])
+			continue;
+		if (stack_add_records(&refs->stacks[j], sorted[j],
+				      sorted_nr[j], err)) {
+			ret = TRANSACTION_GENERIC_ERROR;
+			goto cleanup;
+		}
+	}
+
+	/* Drop the reflogs of deleted references. */
+	for (i = 0; i < transaction->nr; i++) {
+		struct ref_update *update = transaction->updates[i];
+
+		if (update->flags & REF_DELETING &&
+		    !(update->flags & REF_LOG_ONLY))
+			refs_delete_reflog(refs->files, update->refname);
+	}
+
+cleanup:
+	for (i = 0; i < records_nr; i++)
+		record_release(&records[i]);
+	free(records);
+	for (j = 0; j < 2; j++)
+		free(sorted[j]);
+	reftable_transaction_cleanup(refs, transaction);
+	return ret;
+}
+
+static int reftable_initial_transaction_commit(struct ref_store *ref_store,
+					       struct ref_transaction *transaction,
+					       struct strbuf *err)
+{
+	return ref_transaction_commit(transaction, err);
+}
+
+static int reftable_pack_refs(struct ref_store *ref_store, unsigned int flags)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE | REF_STORE_ODB,
+				  "pack_refs");
+	struct strbuf err = STRBUF_INIT;
+	int i, ret = 0;
+
+	/* Packing references means compacting each stack into one table. */
+	for (i = 0; i < refs->stacks_nr; i++) {
+		struct reftable_stack *st = &refs->stacks[i];
+
+		if (!file_exists(st->list_path))
+			continue;
+		if (stack_lock(st, &err) ||
+		    stack_commit(st, NULL, 1, &err)) {
+			ret = error("%s", err.buf);
+			strbuf_reset(&err);
+		}
+	}
+
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_create_symref(struct ref_store *ref_store,
+				  const char *refname, const char *target,
+				  const char *logmsg)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_symref");
+	struct reftable_stack *st = stack_for_ref(refs, refname);
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_record rec, *recp = &rec;
+	struct object_id old_oid, new_oid;
+	unsigned int type;
+	int ret = 0;
+
+	record_init(&rec);
+	if (stack_lock(st, &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+
+	if (!refs_resolve_ref_unsafe(&refs->base, refname, 0, &old_oid, NULL))
+		oidclr(&old_oid);
+
+	if (refs_read_raw_ref(&refs->base, refname, &new_oid, &rec.target,
+			      &type) &&
+	    refs_verify_refname_available(&refs->base, refname, NULL, NULL,
+					  &err)) {
+		ret = error("%s", err.buf);
+		goto out;
+	}
+	strbuf_reset(&rec.target);
+
+	strbuf_addstr(&rec.refname, refname);
+	rec.type = REFTABLE_SYMREF;
+	strbuf_addstr(&rec.target, target);
+	if (stack_add_records(st, &recp, 1, &err)) {
+		ret = error("unable to write symref for %s: %s", refname,
+			    err.buf);
+		goto out;
+	}
+
+	if (logmsg &&
+	    !refs_read_ref_full(&refs->base, target, RESOLVE_REF_READING,
+				&new_oid, NULL) &&
+	    log_ref_write(refs, refname, &old_oid, &new_oid, logmsg, 0, &err))
+		error("%s", err.buf);
+
+out:
+	record_release(&rec);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_delete_refs(struct ref_store *ref_store, const char *msg,
+				struct string_list *refnames, unsigned int flags)
+{
+	struct strbuf err = STRBUF_INIT;
+	struct ref_transaction *transaction;
+	struct string_list_item *item;
+	int ret;
+
+	reftable_downcast(ref_store, REF_STORE_WRITE, "delete_refs");
+
+	if (!refnames->nr)
+		return 0;
+
+	/*
+	 * Since we don't check the references' old_oids, the
+	 * individual updates can't fail, so we can pack all of the
+	 * updates into a single transaction, and thus a single table.
+	 */
+	transaction = ref_store_transaction_begin(ref_store, &err);
+	if (!transaction)
+		return -1;
+
+	for_each_string_list_item(item, refnames) {
+		if (ref_transaction_delete(transaction, item->string, NULL,
+					   flags, msg, &err)) {
+			warning(_("could not delete reference %s: %s"),
+				item->string, err.buf);
+			strbuf_reset(&err);
+		}
+	}
+
+	ret = ref_transaction_commit(transaction, &err);
+
+	if (ret) {
+		if (refnames->nr == 1)
+			error(_("could not delete reference %s: %s"),
+			      refnames->items[0].string, err.buf);
+		else
+			error(_("could not delete references: %s"), err.buf);
+	}
+
+	ref_transaction_free(transaction);
+	strbuf_release(&err);
+	return ret;
+}
+
+/* Move or copy the reflog of oldrefname to newrefname, if it exists. */
+static int copy_or_rename_reflog(struct reftable_ref_store *refs,
+				 const char *oldrefname, const char *newrefname,
+				 int copy)
+{
+	struct strbuf oldpath = STRBUF_INIT, newpath = STRBUF_INIT;
+	struct strbuf tmp = STRBUF_INIT;
+	int ret = 0;
+
+	reftable_reflog_path(refs, &oldpath, oldrefname);
+	reftable_reflog_path(refs, &newpath, newrefname);
+	if (!file_exists(oldpath.buf))
+		goto out;
+
+	if (copy) {
+		if (safe_create_leading_directories(newpath.buf) ||
+		    (unlink(newpath.buf) && errno != ENOENT) ||
+		    copy_file(newpath.buf, oldpath.buf, 0644))
+			ret = error("unable to copy logfile %s to %s",
+				    oldpath.buf, newpath.buf);
+		goto out;
+	}
+
+	/*
+	 * Go through a temporary name, in case newrefname lives inside
+	 * a directory that is named like oldrefname.
+	 */
+	reftable_reflog_path(refs, &tmp, ".tmp-renamed-log");
+	if (safe_create_leading_directories(tmp.buf) ||
+	    rename(oldpath.buf, tmp.buf)) {
+		ret = error_errno("unable to move logfile %s to %s",
+				  oldpath.buf, tmp.buf);
+		goto out;
+	}
+	refs_delete_reflog(refs->files, oldrefname);
+	if (safe_create_leading_directories(newpath.buf) ||
+	    rename(tmp.buf, newpath.buf))
+		ret = error_errno("unable to move logfile %s to %s",
+				  tmp.buf, newpath.buf);
+
+out:
+	strbuf_release(&oldpath);
+	strbuf_release(&newpath);
+	strbuf_release(&tmp);
+	return ret;
+}
+
+static int reftable_copy_or_rename_ref(struct ref_store *ref_store,
+				       const char *oldrefname,
+				       const char *newrefname,
+				       const char *logmsg, int copy)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "rename_ref");
+	struct reftable_stack *st = stack_for_ref(refs, oldrefname);
+	struct string_list skip = STRING_LIST_INIT_NODUP;
+	struct strbuf err = STRBUF_INIT;
+	struct reftable_record old_rec, new_rec, *records[2];
+	struct object_id orig_oid;
+	char *head_ref = NULL;
+	size_t nr = 0;
+	int flag, head_flag, ret = -1;
+
+	record_init(&old_rec);
+	record_init(&new_rec);
+
+	if (st != stack_for_ref(refs, newrefname)) {
+		error("cannot %s '%s' to '%s': only one of them is per-worktree",
+		      copy ? "copy" : "rename", oldrefname, newrefname);
+		goto out;
+	}
+
+	if (stack_lock(st, &err)) {
+		error("%s", err.buf);
+		goto out;
+	}
+
+	if (!refs_resolve_ref_unsafe(&refs->base, oldrefname,
+				     RESOLVE_REF_READING | RESOLVE_REF_NO_RECURSE,
+				     &orig_oid, &flag)) {
+		error("refname %s not found", oldrefname);
+		goto out;
+	}
+	if (flag & REF_ISSYMREF) {
+		if (copy)
+			error("refname %s is a symbolic ref, copying it is not supported",
+			      oldrefname);
+		else
+			error("refname %s is a symbolic ref, renaming it is not supported",
+			      oldrefname);
+		goto out;
+	}
+
+	if (!copy)
+		string_list_insert(&skip, oldrefname);
+	if (refs_verify_refname_available(&refs->base, newrefname,
+					  NULL, &skip, &err)) {
+		error("%s", err.buf);
+		goto out;
+	}
+
+	if (strcmp(oldrefname, newrefname) &&
+	    copy_or_rename_reflog(refs, oldrefname, newrefname, copy))
+		goto out;
+
+	head_ref = refs_resolve_refdup(&refs->base, "HEAD",
+				       RESOLVE_REF_NO_RECURSE, NULL, &head_flag);
+	if (head_ref && !(head_flag & REF_ISSYMREF))
+		FREE_AND_NULL(head_ref);
+
+	/* Delete the old name and write the new one in the same table. */
+	strbuf_addstr(&old_rec.refname, oldrefname);
+	old_rec.type = REFTABLE_DELETION;
+	strbuf_addstr(&new_rec.refname, newrefname);
+	record_set_oid(&new_rec, &orig_oid);
+	records[nr++] = &new_rec;
+	if (!copy && strcmp(oldrefname, newrefname)) {
+		records[nr++] = &old_rec;
+		if (strcmp(oldrefname, newrefname) < 0)
+			SWAP(records[0], records[1]);
+	}
+
+	if (stack_add_records(st, records, nr, &err)) {
+		error("unable to write %s: %s", newrefname, err.buf);
+		goto out;
+	}
+
+	/*
+	 * Record the move the same way the files backend does: HEAD's
+	 * reflog sees the old branch go away, if HEAD pointed at it,
+	 * and the new branch's reflog gets an entry for the rename.
+	 */
+	if (!copy && head_ref && !strcmp(head_ref, oldrefname) &&
+	    log_ref_write(refs, "HEAD", &orig_oid, &null_oid, logmsg, 0, &err)) {
+		error("%s", err.buf);
+		strbuf_reset(&err);
+	}
+	if (log_ref_write(refs, newrefname, &orig_oid, &orig_oid,
+			  logmsg, 0, &err))
+		error("%s", err.buf);
+	ret = 0;
+
+out:
+	stack_unlock(st);
+	free(head_ref);
+	record_release(&old_rec);
+	record_release(&new_rec);
+	string_list_clear(&skip, 0);
+	strbuf_release(&err);
+	return ret;
+}
+
+static int reftable_rename_ref(struct ref_store *ref_store,
+			       const char *oldrefname, const char *newrefname,
+			       const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 0);
+}
+
+static int reftable_copy_ref(struct ref_store *ref_store,
+			     const char *oldrefname, const char *newrefname,
+			     const char *logmsg)
+{
+	return reftable_copy_or_rename_ref(ref_store, oldrefname, newrefname,
+					   logmsg, 1);
+}
+
+/*
+ * The reflogs themselves are files, so iterate over them the same way
+ * the files backend does, but resolve the references through the
+ * tables.
+ */
+struct reftable_reflog_iterator {
+	struct ref_iterator base;
+
+	struct ref_store *ref_store;
+	struct dir_iterator *dir_iterator;
+	struct object_id oid;
+};
+
+static int reftable_reflog_iterator_advance(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	struct dir_iterator *diter = iter->dir_iterator;
+	int ok;
+
+	while ((ok = dir_iterator_advance(diter)) == ITER_OK) {
+		int flags;
+
+		if (!S_ISREG(diter->st.st_mode))
+			continue;
+		if (diter->basename[0] == '.')
+			continue;
+		if (ends_with(diter->basename, ".lock"))
+			continue;
+
+		if (refs_read_ref_full(iter->ref_store,
+				       diter->relative_path, 0,
+				       &iter->oid, &flags)) {
+			error("bad ref for %s", diter->path.buf);
+			continue;
+		}
+
+		iter->base.refname = diter->relative_path;
+		iter->base.oid = &iter->oid;
+		iter->base.flags = flags;
+		return ITER_OK;
+	}
+
+	iter->dir_iterator = NULL;
+	if (ref_iterator_abort(ref_iterator) == ITER_ERROR)
+		ok = ITER_ERROR;
+	return ok;
+}
+
+static int reftable_reflog_iterator_peel(struct ref_iterator *ref_iterator,
+					 struct object_id *peeled)
+{
+	BUG("ref_iterator_peel() called for reflog_iterator");
+}
+
+static int reftable_reflog_iterator_abort(struct ref_iterator *ref_iterator)
+{
+	struct reftable_reflog_iterator *iter =
+		(struct reftable_reflog_iterator *)ref_iterator;
+	int ok = ITER_DONE;
+
+	if (iter->dir_iterator)
+		ok = dir_iterator_abort(iter->dir_iterator);
+
+	base_ref_iterator_free(ref_iterator);
+	return ok;
+}
+
+static struct ref_iterator_vtable reftable_reflog_iterator_vtable = {
+	reftable_reflog_iterator_advance,
+	reftable_reflog_iterator_peel,
+	reftable_reflog_iterator_abort
+};
+
+static struct ref_iterator *reflog_iterator_begin(struct ref_store *ref_store,
+						  const char *gitdir)
+{
+	struct reftable_reflog_iterator *iter = xcalloc(1, sizeof(*iter));
+	struct ref_iterator *ref_iterator = &iter->base;
+	struct strbuf sb = STRBUF_INIT;
+
+	base_ref_iterator_init(ref_iterator, &reftable_reflog_iterator_vtable, 0);
+	strbuf_addf(&sb, "%s/logs", gitdir);
+	iter->dir_iterator = dir_iterator_begin(sb.buf);
+	iter->ref_store = ref_store;
+	strbuf_release(&sb);
+
+	return ref_iterator;
+}
+
+static enum iterator_selection reflog_iterator_select(
+	struct ref_iterator *iter_worktree,
+	struct ref_iterator *iter_common,
+	void *cb_data)
+{
+	if (iter_worktree)
+		return ITER_SELECT_0;
+	else if (iter_common)
+		return ref_type(iter_common->refname) == REF_TYPE_NORMAL ?
+			ITER_SELECT_1 : ITER_SKIP_1;
+	else
+		return ITER_DONE;
+}
+
+static struct ref_iterator *reftable_reflog_iterator_begin(struct ref_store *ref_store)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "reflog_iterator_begin");
+
+	if (refs->stacks_nr == 1)
+		return reflog_iterator_begin(ref_store, refs->gitcommondir);
+	return merge_ref_iterator_begin(
+		0,
+		reflog_iterator_begin(ref_store, refs->gitdir),
+		reflog_iterator_begin(ref_store, refs->gitcommondir),
+		reflog_iterator_select, refs);
+}
+
+static int reftable_for_each_reflog_ent(struct ref_store *ref_store,
+					const char *refname,
+					each_reflog_ent_fn fn, void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent");
+
+	return refs_for_each_reflog_ent(refs->files, refname, fn, cb_data);
+}
+
+static int reftable_for_each_reflog_ent_reverse(struct ref_store *ref_store,
+						const char *refname,
+						each_reflog_ent_fn fn,
+						void *cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ,
+				  "for_each_reflog_ent_reverse");
+
+	return refs_for_each_reflog_ent_reverse(refs->files, refname,
+						fn, cb_data);
+}
+
+static int reftable_reflog_exists(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_READ, "reflog_exists");
+
+	return refs_reflog_exists(refs->files, refname);
+}
+
+static int reftable_create_reflog(struct ref_store *ref_store,
+				  const char *refname, int force_create,
+				  struct strbuf *err)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "create_reflog");
+
+	return refs_create_reflog(refs->files, refname, force_create, err);
+}
+
+static int reftable_delete_reflog(struct ref_store *ref_store,
+				  const char *refname)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "delete_reflog");
+
+	return refs_delete_reflog(refs->files, refname);
+}
+
+struct expire_reflog_cb {
+	unsigned int flags;
+	reflog_expiry_should_prune_fn *should_prune_fn;
+	void *policy_cb;
+	FILE *newlog;
+	struct object_id last_kept_oid;
+};
+
+static int expire_reflog_ent(struct object_id *ooid, struct object_id *noid,
+			     const char *email, timestamp_t timestamp, int tz,
+			     const char *message, void *cb_data)
+{
+	struct expire_reflog_cb *cb = cb_data;
+
+	if (cb->flags & EXPIRE_REFLOGS_REWRITE)
+		ooid = &cb->last_kept_oid;
+
+	if ((*cb->should_prune_fn)(ooid, noid, email, timestamp, tz,
+				   message, cb->policy_cb)) {
+		if (!cb->newlog)
+			printf("would prune %s", message);
+		else if (cb->flags & EXPIRE_REFLOGS_VERBOSE)
+			printf("prune %s", message);
+	} else {
+		if (cb->newlog) {
+			fprintf(cb->newlog, "%s %s %s %"PRItime" %+05d\t%s",
+				oid_to_hex(ooid), oid_to_hex(noid),
+				email, timestamp, tz, message);
+			oidcpy(&cb->last_kept_oid, noid);
+		}
+		if (cb->flags & EXPIRE_REFLOGS_VERBOSE)
+			printf("keep %s", message);
+	}
+	return 0;
+}
+
+static int reftable_reflog_expire(struct ref_store *ref_store,
+				  const char *refname, const struct object_id *oid,
+				  unsigned int flags,
+				  reflog_expiry_prepare_fn prepare_fn,
+				  reflog_expiry_should_prune_fn should_prune_fn,
+				  reflog_expiry_cleanup_fn cleanup_fn,
+				  void *policy_cb_data)
+{
+	struct reftable_ref_store *refs =
+		reftable_downcast(ref_store, REF_STORE_WRITE, "reflog_expire");
+	struct reftable_stack *st = stack_for_ref(refs, refname);
+	struct lock_file reflog_lock = LOCK_INIT;
+	struct expire_reflog_cb cb;
+	struct strbuf log_file = STRBUF_INIT;
+	struct strbuf referent = STRBUF_INIT;
+	struct strbuf err = STRBUF_INIT;
+	struct object_id current;
+	unsigned int type = 0;
+	int status = 0;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.flags = flags;
+	cb.policy_cb = policy_cb_data;
+	cb.should_prune_fn = should_prune_fn;
+
+	/*
+	 * Holding the lock on the stack keeps the reference from
+	 * changing under us, and lets us update it if --updateref
+	 * was specified.
+	 */
+	if (stack_lock(st, &err)) {
+		error("cannot lock ref '%s': %s", refname, err.buf);
+		strbuf_release(&err);
+		return -1;
+	}
+	if (!refs_read_raw_ref(ref_store, refname, &current, &referent, &type) &&
+	    oid && !(type & REF_ISSYMREF) && !oideq(oid, &current)) {
+		error("cannot lock ref '%s': is at %s but expected %s",
+		      refname, oid_to_hex(&current), oid_to_hex(oid));
+		goto failure;
+	}
+	if (!refs_reflog_exists(ref_store, refname))
+		goto done;
+
+	reftable_reflog_path(refs, &log_file, refname);
+	if (!(flags & EXPIRE_REFLOGS_DRY_RUN)) {
+		if (hold_lock_file_for_update(&reflog_lock, log_file.buf, 0) < 0) {
+			unable_to_lock_message(log_file.buf, errno, &err);
+			error("%s", err.buf);
+			goto failure;
+		}
+		cb.newlog = fdopen_lock_file(&reflog_lock, "w");
+		if (!cb.newlog) {
+			error("cannot fdopen %s (%s)",
+			      get_lock_file_path(&reflog_lock), strerror(errno));
+			goto failure;
+		}
+	}
+
+	(*prepare_fn)(refname, oid, cb.policy_cb);
+	refs_for_each_reflog_ent(ref_store, refname, expire_reflog_ent, &cb);
+	(*cleanup_fn)(cb.policy_cb);
+
+	if (!(flags & EXPIRE_REFLOGS_DRY_RUN)) {
+		/*
+		 * It doesn't make sense to adjust a reference pointed
+		 * to by a symbolic ref based on expiring entries in
+		 * the symbolic reference's reflog. Nor can we update
+		 * a reference if there are no remaining reflog
+		 * entries.
+		 */
+		int update = (flags & EXPIRE_REFLOGS_UPDATE_REF) &&
+			!(type & REF_ISSYMREF) &&
+			!is_null_oid(&cb.last_kept_oid);
+
+		if (close_lock_file_gently(&reflog_lock)) {
+			status |= error("couldn't write %s: %s", log_file.buf,
+					strerror(errno));
+			rollback_lock_file(&reflog_lock);
+		} else if (commit_lock_file(&reflog_lock)) {
+			status |= error("unable to write reflog '%s' (%s)",
+					log_file.buf, strerror(errno));
+		} else if (update) {
+			struct reftable_record rec, *recp = &rec;
+
+			record_init(&rec);
+			strbuf_addstr(&rec.refname, refname);
+			record_set_oid(&rec, &cb.last_kept_oid);
+			if (stack_add_records(st, &recp, 1, &err))
+				status |= error("couldn't set %s: %s",
+						refname, err.buf);
+			record_release(&rec);
+		}
+	}
+
+done:
+	stack_unlock(st);
+	strbuf_release(&log_file);
+	strbuf_release(&referent);
+	strbuf_release(&err);
+	return status;
+
+failure:
+	rollback_lock_file(&reflog_lock);
+	stack_unlock(st);
+	strbuf_release(&log_file);
+	strbuf_release(&referent);
+	strbuf_release(&err);
+	return -1;
+}
+
+struct ref_storage_be refs_be_reftable = {
+	NULL,
+	"reftable",
+	reftable_ref_store_create,
+	reftable_init_db,
+	reftable_transaction_prepare,
+	reftable_transaction_finish,
+	reftable_transaction_abort,
+	reftable_initial_transaction_commit,
+
+	reftable_pack_refs,
+	reftable_create_symref,
+	reftable_delete_refs,
+	reftable_rename_ref,
+	reftable_copy_ref,
+
+	reftable_ref_iterator_begin,
+	reftable_read_raw_ref,
+
+	reftable_reflog_iterator_begin,
+	reftable_for_each_reflog_ent,
+	reftable_for_each_reflog_ent_reverse,
+	reftable_reflog_exists,
+	reftable_create_reflog,
+	reftable_delete_reflog,
+	reftable_reflog_expire
+};
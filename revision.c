@@ -25,6 +25,8 @@
 #include "worktree.h"
 #include "argv-array.h"
 #include "commit-reach.h"
+#include "commit-graph.h"
+#include "bloom.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -461,9 +463,114 @@ static void file_change(struct diff_options *options,
 	options->flags.has_changes = 1;
 }
 
+static int bloom_filter_atexit_registered;
+static unsigned int count_bloom_filter_maybe;
+static unsigned int count_bloom_filter_definitely_not;
+static unsigned int count_bloom_filter_false_positive;
+static unsigned int count_bloom_filter_not_present;
+static struct trace_key trace_bloom_stats = TRACE_KEY_INIT(BLOOM_STATS);
+
+static void trace_bloom_filter_statistics_atexit(void)
+{
+	trace_printf_key(&trace_bloom_stats,
+			 "filter not present: %u\n"
+			 "maybe: %u\n"
+			 "definitely not: %u\n"
+			 "false positive: %u\n",
+			 count_bloom_filter_not_present,
+			 count_bloom_filter_maybe,
+			 count_bloom_filter_definitely_not,
+			 count_bloom_filter_false_positive);
+}
+
+static int forbid_bloom_filters(struct rev_info *revs)
+{
+	struct pathspec *spec = &revs->prune_data;
+
+	if (spec->nr != 1 || spec->has_wildcard)
+		return 1;
+	if (spec->magic & ~PATHSPEC_LITERAL)
+		return 1;
+	if (spec->items[0].magic & ~PATHSPEC_LITERAL)
+		return 1;
+	if (!spec->items[0].len)
+		return 1;
+	if (revs->diffopt.flags.follow_renames || revs->line_level_traverse)
+		return 1;
+	if (revs->reflog_info)
+		return 1;
+
+	return 0;
+}
+
+static void prepare_to_use_bloom_filter(struct rev_info *revs)
+{
+	struct pathspec_item *pi;
+	struct strbuf path = STRBUF_INIT;
+
+	if (!revs->prune || forbid_bloom_filters(revs))
+		return;
+
+	if (!prepare_commit_graph(the_repository))
+		return;
+
+	revs->bloom_filter_settings = the_repository->objects->commit_graph->bloom_filter_settings;
+	if (!revs->bloom_filter_settings)
+		return;
+
+	pi = &revs->prune_data.items[0];
+	strbuf_add(&path, pi->match, pi->len);
+
+	/* remove single trailing slash from path, if needed */
+	if (path.len && path.buf[path.len - 1] == '/')
+		strbuf_setlen(&path, path.len - 1);
+
+	revs->bloom_key = xmalloc(sizeof(struct bloom_key));
+	fill_bloom_key(path.buf, path.len, revs->bloom_key,
+		       revs->bloom_filter_settings);
+	strbuf_release(&path);
+
+	if (trace_want(&trace_bloom_stats) && !bloom_filter_atexit_registered) {
+		atexit(trace_bloom_filter_statistics_atexit);
+		bloom_filter_atexit_registered = 1;
+	}
+}
+
+/*
+ * Return 0 if the Bloom filter of 'commit' says its first parent
+ * definitely has the same content at the path we are limited to,
+ * 1 if it may differ and -1 if there is no usable filter.
+ */
+static int check_maybe_different_in_bloom_filter(struct rev_info *revs,
+						 struct commit *commit)
+{
+	struct bloom_filter *filter;
+	int result;
+
+	filter = get_bloom_filter(the_repository, commit, 0);
+	if (!filter) {
+		count_bloom_filter_not_present++;
+		return -1;
+	}
+
+	result = bloom_filter_contains(filter,
+				       revs->bloom_key,
+				       revs->bloom_filter_settings);
+
+	if (result > 0)
+		count_bloom_filter_maybe++;
+	else if (!result)
+		count_bloom_filter_definitely_not++;
+
+	return result;
+}
+
 static int rev_compare_tree(struct rev_info *revs,
-			    struct commit *parent, struct commit *commit)
+			    struct commit *parent, struct commit *commit,
+			    int nth_parent)
 {
+	int bloom_ret = -1;
+
 	struct tree *t1 = get_commit_tree(parent);
 	struct tree *t2 = get_commit_tree(commit);
 
@@ -490,11 +597,23 @@ static int rev_compare_tree(struct rev_info *revs,
 			return REV_TREE_SAME;
 	}
 
+	/* Filters are only computed against the first parent. */
+	if (revs->bloom_key && !nth_parent) {
+		bloom_ret = check_maybe_different_in_bloom_filter(revs, commit);
+
+		if (bloom_ret == 0)
+			return REV_TREE_SAME;
+	}
+
 	tree_difference = REV_TREE_SAME;
 	revs->pruning.flags.has_changes = 0;
 	if (diff_tree_oid(&t1->object.oid, &t2->object.oid, "",
 			   &revs->pruning) < 0)
 		return REV_TREE_DIFFERENT;
+
+	if (bloom_ret == 1 && tree_difference == REV_TREE_SAME)
+		count_bloom_filter_false_positive++;
+
 	return tree_difference;
 }
 
@@ -692,7 +811,7 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 			die("cannot simplify commit %s (because of %s)",
 			    oid_to_hex(&commit->object.oid),
 			    oid_to_hex(&p->object.oid));
-		switch (rev_compare_tree(revs, p, commit)) {
+		switch (rev_compare_tree(revs, p, commit, nth_parent)) {
 		case REV_TREE_SAME:
 			if (!revs->simplify_history || !relevant_commit(p)) {
 				/* Even if a merge with an uninteresting
@@ -2928,6 +3047,7 @@ int prepare_revision_walk(struct rev_info *revs)
 		commit_list_sort_by_date(&revs->commits);
 	if (revs->no_walk)
 		return 0;
+	prepare_to_use_bloom_filter(revs);
 	if (revs->limited)
 		if (limit_list(revs) < 0)
 			return -1;
@@ -32,6 +32,8 @@ struct rev_info;
 struct log_info;
 struct string_list;
 struct saved_parents;
+struct bloom_key;
+struct bloom_filter_settings;
 define_shared_commit_slab(revision_sources, char *);
 
 struct rev_cmdline_info {
@@ -245,6 +247,14 @@ struct rev_info {
 	const char *break_bar;
 
 	struct revision_sources *sources;
+
+	/*
+	 * Key and settings used to consult the changed-path Bloom
+	 * filters of the commit-graph, when the walk is limited to a
+	 * single literal path; NULL otherwise.
+	 */
+	struct bloom_key *bloom_key;
+	struct bloom_filter_settings *bloom_filter_settings;
 };
 
 int ref_excluded(struct string_list *, const char *path);
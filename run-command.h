@@ -68,6 +68,16 @@ LAST_ARG_MUST_BE_NULL
 extern int run_hook_le(const char *const *env, const char *name, ...);
 extern int run_hook_ve(const char *const *env, const char *name, va_list args);
 
+/*
+ * Prepare `maint` to run "git maintenance run --auto", which commands
+ * that add objects or update references run when they are done. Return
+ * 0 if this is disabled by the maintenance.auto configuration.
+ */
+int prepare_auto_maintenance(int quiet, struct child_process *maint);
+
+/* Run "git maintenance run --auto", unless disabled. */
+int run_auto_maintenance(int quiet);
+
 #define RUN_COMMAND_NO_STDIN 1
 #define RUN_GIT_CMD	     2	/*If this is to be git sub-command */
 #define RUN_COMMAND_STDOUT_TO_STDERR 4
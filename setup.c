@@ -423,6 +423,11 @@ static int check_repo_format(const char *var, const char *value, void *vdata)
 			if (!value)
 				return config_error_nonbool(var);
 			data->partial_clone = xstrdup(value);
+		} else if (!strcmp(ext, "refstorage")) {
+			if (!value)
+				return config_error_nonbool(var);
+			free(data->ref_storage);
+			data->ref_storage = xstrdup(value);
 		} else
 			string_list_append(&data->unknown_extensions, ext);
 	} else if (strcmp(var, "core.bare") == 0) {
@@ -496,6 +501,14 @@ int read_repository_format(struct repository_format *format, const char *path)
 	return format->version;
 }
 
+void clear_repository_format(struct repository_format *format)
+{
+	string_list_clear(&format->unknown_extensions, 0);
+	FREE_AND_NULL(format->work_tree);
+	FREE_AND_NULL(format->partial_clone);
+	FREE_AND_NULL(format->ref_storage);
+}
+
 int verify_repository_format(const struct repository_format *format,
 			     struct strbuf *err)
 {
@@ -32,6 +32,7 @@
 #include "packfile.h"
 #include "fetch-object.h"
 #include "object-store.h"
+#include "pack-sizes.h"
 
 /* The maximum size for an object header. */
 #define MAX_HEADER_LEN 32
@@ -1231,8 +1232,11 @@ static int sha1_loose_object_info(struct repository *r,
 		status = error(_("unable to parse %s header"), sha1_to_hex(sha1));
 
 	if (status >= 0 && oi->contentp) {
+		/* the mapping is ours alone; inflate it without the lock */
+		obj_read_unlock();
 		*oi->contentp = unpack_sha1_rest(&stream, hdr,
 						 *oi->sizep, sha1);
+		obj_read_lock();
 		if (!*oi->contentp) {
 			git_inflate_end(&stream);
 			status = -1;
@@ -1252,8 +1256,32 @@ static int sha1_loose_object_info(struct repository *r,
 
 int fetch_if_missing = 1;
 
-int oid_object_info_extended(struct repository *r, const struct object_id *oid,
-			     struct object_info *oi, unsigned flags)
+#ifndef NO_PTHREADS
+int obj_read_use_lock;
+pthread_mutex_t obj_read_mutex;
+#endif
+
+void enable_obj_read_lock(void)
+{
+#ifndef NO_PTHREADS
+	if (obj_read_use_lock++)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+#endif
+}
+
+void disable_obj_read_lock(void)
+{
+#ifndef NO_PTHREADS
+	if (!obj_read_use_lock || --obj_read_use_lock)
+		return;
+	pthread_mutex_destroy(&obj_read_mutex);
+#endif
+}
+
+static int do_oid_object_info_extended(struct repository *r,
+				       const struct object_id *oid,
+				       struct object_info *oi, unsigned flags)
 {
 	static struct object_info blank_oi = OBJECT_INFO_INIT;
 	struct pack_entry e;
@@ -1301,8 +1329,12 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 		if (!sha1_loose_object_info(r, real->hash, oi, flags))
 			return 0;
 
-		/* Not a loose object; someone else may have just packed it. */
-		if (!(flags & OBJECT_INFO_QUICK)) {
+		/*
+		 * Not a loose object; someone else may have just packed it,
+		 * unless the pack directories did not change.
+		 */
+		if (!(flags & OBJECT_INFO_QUICK) &&
+		    (already_retried || packed_git_changed(r))) {
 			reprepare_packed_git(r);
 			if (find_pack_entry(r, real, &e))
 				break;
@@ -1331,10 +1363,12 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 		 * information below, so return early.
 		 */
 		return 0;
-	rtype = packed_object_info(r, e.p, e.offset, oi);
+	rtype = pack_sizes_object_info(e.p, real, oi);
+	if (rtype < 0)
+		rtype = packed_object_info(r, e.p, e.offset, oi);
 	if (rtype < 0) {
 		mark_bad_packed_object(e.p, real->hash);
-		return oid_object_info_extended(r, real, oi, 0);
+		return do_oid_object_info_extended(r, real, oi, 0);
 	} else if (oi->whence == OI_PACKED) {
 		oi->u.packed.offset = e.offset;
 		oi->u.packed.pack = e.p;
@@ -1345,6 +1379,17 @@ int oid_object_info_extended(struct repository *r, const struct object_id *oid,
 	return 0;
 }
 
+int oid_object_info_extended(struct repository *r, const struct object_id *oid,
+			     struct object_info *oi, unsigned flags)
+{
+	int ret;
+
+	obj_read_lock();
+	ret = do_oid_object_info_extended(r, oid, oi, flags);
+	obj_read_unlock();
+	return ret;
+}
+
 /* returns enum object_type or negative */
 int oid_object_info(struct repository *r,
 		    const struct object_id *oid,
@@ -1410,8 +1455,12 @@ void *read_object_file_extended(const struct object_id *oid,
 	const struct packed_git *p;
 	const char *path;
 	struct stat st;
-	const struct object_id *repl = lookup_replace ?
+	const struct object_id *repl;
+
+	obj_read_lock();
+	repl = lookup_replace ?
 		lookup_replace_object(the_repository, oid) : oid;
+	obj_read_unlock();
 
 	errno = 0;
 	data = read_object(repl->hash, type, size);
@@ -1426,6 +1475,7 @@ void *read_object_file_extended(const struct object_id *oid,
 		die(_("replacement %s not found for %s"),
 		    oid_to_hex(repl), oid_to_hex(oid));
 
+	obj_read_lock();
 	if (!stat_sha1_file(the_repository, repl->hash, &st, &path))
 		die(_("loose object %s (stored in %s) is corrupt"),
 		    oid_to_hex(repl), path);
@@ -1433,6 +1483,7 @@ void *read_object_file_extended(const struct object_id *oid,
 	if ((p = has_packed_and_bad(repl->hash)) != NULL)
 		die(_("packed object %s (stored in %s) is corrupt"),
 		    oid_to_hex(repl), p->pack_name);
+	obj_read_unlock();
 
 	return NULL;
 }
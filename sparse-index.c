@@ -0,0 +1,268 @@
+#include "cache.h"
+#include "config.h"
+#include "repository.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "pathspec.h"
+#include "cache-tree.h"
+#include "trace-event.h"
+#include "sparse-index.h"
+
+int command_requires_full_index = 1;
+
+static int sparse_index_enabled(struct index_state *istate)
+{
+	int enabled;
+
+	if (!core_apply_sparse_checkout || istate->split_index ||
+	    istate != the_repository->index)
+		return 0;
+	if (git_config_get_bool("index.sparse", &enabled))
+		return 0;
+	return enabled;
+}
+
+static struct cache_entry *construct_sparse_dir_entry(struct index_state *istate,
+						      const char *path,
+						      size_t len,
+						      const struct object_id *oid)
+{
+	struct cache_entry *ce = make_empty_cache_entry(istate, len);
+
+	memcpy(ce->name, path, len);
+	ce->ce_namelen = len;
+	ce->ce_mode = S_IFDIR;
+	ce->ce_flags = create_ce_flags(0) | CE_SKIP_WORKTREE;
+	oidcpy(&ce->oid, oid);
+	return ce;
+}
+
+/*
+ * Collapse the entries [start, end) of the index, which are those of
+ * the directory `path` (with a trailing slash, empty at the root)
+ * described by `it`, into `istate->cache` starting at `num_converted`.
+ * Return the number of resulting entries.
+ */
+static int convert_to_sparse_rec(struct index_state *istate,
+				 int num_converted, int start, int end,
+				 struct strbuf *path, struct cache_tree *it)
+{
+	int i, can_convert = path->len && it->entry_count >= 0;
+	int start_converted = num_converted;
+
+	for (i = start; can_convert && i < end; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (!ce_skip_worktree(ce) || S_ISGITLINK(ce->ce_mode) ||
+		    ce_intent_to_add(ce))
+			can_convert = 0;
+	}
+
+	if (can_convert) {
+		struct cache_entry *se;
+
+		se = construct_sparse_dir_entry(istate, path->buf, path->len,
+						&it->oid);
+		for (i = start; i < end; i++)
+			discard_cache_entry(istate->cache[i]);
+		istate->cache[num_converted] = se;
+		istate->sparse_index = 1;
+		return 1;
+	}
+
+	for (i = start; i < end; ) {
+		struct cache_entry *ce = istate->cache[i];
+		const char *base = ce->name + path->len;
+		const char *slash = strchr(base, '/');
+		struct cache_tree *sub;
+		int pos, span, len = path->len;
+
+		pos = slash ? cache_tree_subtree_pos(it, base, slash - base) : -1;
+		sub = pos < 0 ? NULL : it->down[pos]->cache_tree;
+		if (!sub || sub->entry_count < 0) {
+			istate->cache[num_converted++] = ce;
+			i++;
+			continue;
+		}
+
+		span = sub->entry_count;
+		strbuf_add(path, base, slash - base + 1);
+		num_converted += convert_to_sparse_rec(istate, num_converted,
+						       i, i + span, path, sub);
+		strbuf_setlen(path, len);
+		i += span;
+	}
+
+	return num_converted - start_converted;
+}
+
+void convert_to_sparse(struct index_state *istate)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i;
+
+	if (!sparse_index_enabled(istate)) {
+		ensure_full_index(istate);
+		return;
+	}
+	if (istate->sparse_index || !istate->cache_nr)
+		return;
+
+	/*
+	 * The cache-tree gives the spans and the trees of the directories,
+	 * and must count the entries exactly as they are in the array.
+	 */
+	for (i = 0; i < istate->cache_nr; i++)
+		if (ce_stage(istate->cache[i]) ||
+		    istate->cache[i]->ce_flags & CE_REMOVE)
+			return;
+	if (!istate->cache_tree)
+		istate->cache_tree = cache_tree();
+	if (cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK))
+		return;
+
+	trace_event_region_enter("index", "convert_to_sparse");
+	istate->cache_nr = convert_to_sparse_rec(istate, 0, 0, istate->cache_nr,
+						 &path, istate->cache_tree);
+	strbuf_release(&path);
+
+	if (istate->sparse_index) {
+		free_name_hash(istate);
+		cache_tree_free(&istate->cache_tree);
+		istate->cache_tree = cache_tree();
+		cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_MISSING_OK);
+		istate->cache_changed |= SOMETHING_CHANGED;
+	}
+	trace_event_region_leave("index", "convert_to_sparse");
+}
+
+struct expand_context {
+	struct index_state *istate;
+	struct cache_entry **cache;
+	unsigned int nr, alloc;
+};
+
+static int add_path_to_index(const struct object_id *oid,
+			     struct strbuf *base, const char *path,
+			     unsigned int mode, int stage, void *context)
+{
+	struct expand_context *ctx = context;
+	size_t len = base->len + strlen(path);
+	struct cache_entry *ce;
+
+	if (S_ISDIR(mode))
+		return READ_TREE_RECURSIVE;
+
+	ce = make_empty_cache_entry(ctx->istate, len);
+	memcpy(ce->name, base->buf, base->len);
+	memcpy(ce->name + base->len, path, len - base->len);
+	ce->ce_namelen = len;
+	ce->ce_mode = create_ce_mode(mode);
+	ce->ce_flags = create_ce_flags(stage) | CE_SKIP_WORKTREE;
+	oidcpy(&ce->oid, oid);
+
+	ALLOC_GROW(ctx->cache, ctx->nr + 1, ctx->alloc);
+	ctx->cache[ctx->nr++] = ce;
+	return 0;
+}
+
+void ensure_full_index(struct index_state *istate)
+{
+	struct expand_context ctx = { istate };
+	struct pathspec ps;
+	int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	trace_event_region_enter("index", "ensure_full_index");
+	memset(&ps, 0, sizeof(ps));
+	ps.recursive = 1;
+	ps.max_depth = -1;
+
+	ALLOC_GROW(ctx.cache, istate->cache_nr, ctx.alloc);
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		struct tree *tree;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode)) {
+			ALLOC_GROW(ctx.cache, ctx.nr + 1, ctx.alloc);
+			ctx.cache[ctx.nr++] = ce;
+			continue;
+		}
+
+		tree = lookup_tree(the_repository, &ce->oid);
+		if (!tree || parse_tree(tree) ||
+		    read_tree_recursive(tree, ce->name, ce_namelen(ce), 0, &ps,
+					add_path_to_index, &ctx))
+			die(_("unable to expand sparse directory '%s'"),
+			    ce->name);
+		discard_cache_entry(ce);
+	}
+
+	free(istate->cache);
+	istate->cache = ctx.cache;
+	istate->cache_nr = ctx.nr;
+	istate->cache_alloc = ctx.alloc;
+	istate->sparse_index = 0;
+	free_name_hash(istate);
+
+	/*
+	 * Recompute the cache-tree, which counted each sparse directory
+	 * as a single entry, without writing any tree object.
+	 */
+	cache_tree_free(&istate->cache_tree);
+	istate->cache_tree = cache_tree();
+	cache_tree_update(istate, WRITE_TREE_SILENT | WRITE_TREE_REPAIR |
+			  WRITE_TREE_MISSING_OK);
+	trace_event_region_leave("index", "ensure_full_index");
+}
+
+int sparse_dirs_match_tree(struct index_state *istate,
+			   const struct object_id *tree_oid)
+{
+	struct strbuf path = STRBUF_INIT;
+	int i, ret = 1;
+
+	for (i = 0; ret && i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		struct cache_tree *it;
+		struct object_id oid;
+		unsigned mode;
+
+		if (!S_ISSPARSEDIR(ce->ce_mode))
+			continue;
+
+		strbuf_reset(&path);
+		strbuf_add(&path, ce->name, ce_namelen(ce) - 1);
+		if (get_tree_entry(tree_oid, path.buf, &oid, &mode) ||
+		    !S_ISDIR(mode) || !oideq(&oid, &ce->oid))
+			ret = 0;
+
+		/* the comparison skips over the trees using the cache-tree */
+		it = cache_tree_find(istate->cache_tree, path.buf);
+		if (!it || it->entry_count != 1 || !oideq(&it->oid, &ce->oid))
+			ret = 0;
+	}
+
+	strbuf_release(&path);
+	return ret;
+}
+
+void ensure_full_index_for_worktree(struct index_state *istate)
+{
+	int i;
+
+	if (!istate->sparse_index)
+		return;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		const struct cache_entry *ce = istate->cache[i];
+		struct stat st;
+
+		if (S_ISSPARSEDIR(ce->ce_mode) && !lstat(ce->name, &st)) {
+			ensure_full_index(istate);
+			return;
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef SPARSE_INDEX_H
+#define SPARSE_INDEX_H
+
+struct index_state;
+struct object_id;
+
+/*
+ * With sparse checkout and the `index.sparse` config, the index does
+ * not list the paths of the directories that are entirely outside of
+ * the sparse checkout. Each of these directories is instead recorded
+ * as a single "sparse directory entry": its name is the path of the
+ * directory with a trailing slash, its mode is S_IFDIR, its object name
+ * is the one of the tree, and it has the skip-worktree bit. Such an
+ * index has the "sdir" extension, which older versions of Git refuse.
+ *
+ * Most code expects an index of files, so reading a sparse index
+ * expands it to a full index, unless the command declared that it
+ * knows how to deal with sparse directory entries by clearing
+ * command_requires_full_index before reading the index. Such a
+ * command calls ensure_full_index() before any operation that needs
+ * the full list of paths.
+ */
+
+extern int command_requires_full_index;
+
+/*
+ * Replace the sparse directory entries of `istate`, if any, by the
+ * entries of their trees.
+ */
+void ensure_full_index(struct index_state *istate);
+
+/*
+ * Collapse the directories whose entries are all outside of the sparse
+ * checkout into sparse directory entries, if the sparse index is
+ * enabled. Otherwise, expand a sparse `istate` to a full index. This
+ * is done before writing the index.
+ */
+void convert_to_sparse(struct index_state *istate);
+
+/*
+ * Return 1 if every sparse directory entry of `istate` records the
+ * same tree as the corresponding directory in `tree_oid`, so that a
+ * comparison of the index with that tree can skip over them.
+ */
+int sparse_dirs_match_tree(struct index_state *istate,
+			   const struct object_id *tree_oid);
+
+/*
+ * Expand `istate` if any of its sparse directories exists in the
+ * working tree: the files in it can then only be told apart from the
+ * untracked files with the full index.
+ */
+void ensure_full_index_for_worktree(struct index_state *istate);
+
+#endif /* SPARSE_INDEX_H */
@@ -11,4 +11,16 @@ test_perf "read_cache/discard_cache $count times" "
 	test-tool read-cache $count
 "
 
+for threads in 1 true
+do
+	test_expect_success "setup index.threads=$threads" "
+		git config index.threads $threads &&
+		git update-index --force-write-index
+	"
+
+	test_perf "read_cache/discard_cache $count times (index.threads=$threads)" "
+		test-tool read-cache $count
+	"
+done
+
 test_done
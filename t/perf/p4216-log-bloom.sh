@@ -0,0 +1,52 @@
+#!/bin/sh
+
+test_description='Tests log -- <path> and blame performance with changed-path Bloom filters'
+. ./perf-lib.sh
+
+test_perf_large_repo
+
+# Pick a file to log pseudo-randomly.  The sort key is the blob hash,
+# so it is stable.
+test_expect_success 'select a file and a directory' '
+	git ls-tree -r HEAD | grep ^100644 |
+	sort -k 3 | head -1 | cut -f 2 >filelist &&
+	dirname "$(cat filelist)" >dirlist
+'
+
+file=$(cat filelist)
+dir=$(cat dirlist)
+export file dir
+
+test_expect_success 'write commit-graph without Bloom filters' '
+	git commit-graph write --reachable
+'
+
+test_perf 'git log -- <file> (without Bloom filters)' '
+	git -c core.commitGraph=true log --oneline -- "$file" >/dev/null
+'
+
+test_perf 'git log -- <dir> (without Bloom filters)' '
+	git -c core.commitGraph=true log --oneline -- "$dir" >/dev/null
+'
+
+test_perf 'git blame <file> (without Bloom filters)' '
+	git -c core.commitGraph=true blame -- "$file" >/dev/null
+'
+
+test_perf 'git commit-graph write --changed-paths' '
+	git commit-graph write --reachable --changed-paths
+'
+
+test_perf 'git log -- <file> (with Bloom filters)' '
+	git -c core.commitGraph=true log --oneline -- "$file" >/dev/null
+'
+
+test_perf 'git log -- <dir> (with Bloom filters)' '
+	git -c core.commitGraph=true log --oneline -- "$dir" >/dev/null
+'
+
+test_perf 'git blame <file> (with Bloom filters)' '
+	git -c core.commitGraph=true blame -- "$file" >/dev/null
+'
+
+test_done
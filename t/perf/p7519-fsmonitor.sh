@@ -30,6 +30,9 @@ test_description="Test core.fsmonitor"
 #
 # GIT_PERF_7519_DROP_CACHE: if set, the OS caches are dropped between tests
 #
+# Where it is available, the built-in fsmonitor daemon (core.fsmonitor=true)
+# is measured as well.
+#
 
 test_perf_large_repo
 test_checkout_worktree
@@ -43,6 +46,11 @@ test_lazy_prereq WATCHMAN '
 	command -v watchman
 '
 
+if test -z "$NO_UNIX_SOCKETS" && test -n "$HAVE_INOTIFY"
+then
+	test_set_prereq FSMONITOR_DAEMON
+fi
+
 if test_have_prereq WATCHMAN
 then
 	# Convert unix style paths to escaped Windows style paths for Watchman
@@ -141,6 +149,41 @@ test_perf "status -uall (fsmonitor=$INTEGRATION_SCRIPT)" '
 	git status -uall
 '
 
+test_expect_success FSMONITOR_DAEMON "setup for fsmonitor daemon" '
+	git config core.fsmonitor true &&
+	git update-index --fsmonitor &&
+	# start the daemon and get a token from it
+	git status >/dev/null
+'
+
+if test -n "$GIT_PERF_7519_DROP_CACHE"; then
+	test-tool drop-caches
+fi
+
+test_perf FSMONITOR_DAEMON "status (fsmonitor=daemon)" '
+	git status
+'
+
+if test -n "$GIT_PERF_7519_DROP_CACHE"; then
+	test-tool drop-caches
+fi
+
+test_perf FSMONITOR_DAEMON "status -uno (fsmonitor=daemon)" '
+	git status -uno
+'
+
+if test -n "$GIT_PERF_7519_DROP_CACHE"; then
+	test-tool drop-caches
+fi
+
+test_perf FSMONITOR_DAEMON "status -uall (fsmonitor=daemon)" '
+	git status -uall
+'
+
+test_expect_success FSMONITOR_DAEMON "stop fsmonitor daemon" '
+	git fsmonitor--daemon stop
+'
+
 test_expect_success "setup without fsmonitor" '
 	unset INTEGRATION_SCRIPT &&
 	git config --unset core.fsmonitor &&
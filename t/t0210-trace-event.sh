@@ -0,0 +1,96 @@
+#!/bin/sh
+
+test_description='structured trace events'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git repack -ad
+'
+
+test_expect_success 'start and exit events' '
+	GIT_TRACE_EVENT="$(pwd)/trace" git rev-parse HEAD &&
+	grep "\"event\":\"start\",.*\"argv\":\\[\"[^\"]*\",\"rev-parse\",\"HEAD\"\\]" trace &&
+	grep "\"event\":\"exit\",\"pid\":[0-9]*,\"thread\":\"main\",\"t_abs\":[0-9.]*,\"code\":0}" trace
+'
+
+test_expect_success 'exit code of die()' '
+	rm -f trace &&
+	test_must_fail env GIT_TRACE_EVENT="$(pwd)/trace" \
+		git rev-parse --verify does-not-exist &&
+	grep "\"event\":\"exit\",.*\"code\":128}" trace
+'
+
+test_expect_success 'regions are nested and timed' '
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git checkout HEAD^ &&
+	grep "\"event\":\"region_enter\",.*\"nesting\":1,\"category\":\"unpack_trees\",\"label\":\"unpack_trees\"}" trace &&
+	grep "\"event\":\"region_enter\",.*\"nesting\":2,\"category\":\"unpack_trees\",\"label\":\"check_updates\"}" trace &&
+	grep "\"event\":\"region_leave\",.*\"label\":\"unpack_trees\",\"t_rel\":[0-9.]*}" trace &&
+	grep "\"event\":\"region_enter\"" trace >enter &&
+	grep "\"event\":\"region_leave\"" trace >leave &&
+	test_line_count = $(wc -l <enter) leave
+'
+
+test_expect_success 'counters' '
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git log -p >/dev/null &&
+	grep "\"name\":\"objects_parsed\",\"value\":[1-9]" trace &&
+	grep "\"name\":\"packs_opened\",\"value\":1}" trace &&
+	grep "\"name\":\"bytes_inflated\",\"value\":[1-9]" trace &&
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git status &&
+	grep "\"name\":\"lstat_calls\",\"value\":[1-9]" trace
+'
+
+test_expect_success 'events of other threads' '
+	git checkout master &&
+	rm -f trace &&
+	GIT_FORCE_PRELOAD_TEST=1 GIT_TRACE_EVENT="$(pwd)/trace" \
+		git -c core.preloadIndex=true status &&
+	grep "\"event\":\"thread_start\",.*\"thread\":\"th01:preload\"" trace &&
+	grep "\"event\":\"thread_exit\",.*\"thread\":\"th02:preload\",.*\"t_rel\":" trace
+'
+
+test_expect_success 'each process of a command reports its events' '
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git repack -adf &&
+	grep "\"event\":\"start\",.*\"argv\":\\[\"[^\"]*\",\"pack-objects\"" trace &&
+	grep "\"category\":\"pack-objects\",\"label\":\"write-pack-file\"" trace &&
+	grep "\"event\":\"exit\"" trace >exits &&
+	test_line_count = 2 exits
+'
+
+test_expect_success PERL 'trace events to a unix socket' '
+	test_when_finished "rm -f socket ready" &&
+	{
+		"$PERL_PATH" -MIO::Socket::UNIX -e "
+			my \$s = IO::Socket::UNIX->new(Type => SOCK_STREAM(),
+						       Local => \"socket\",
+						       Listen => 1) or die;
+			open(my \$ready, \">\", \"ready\") or die;
+			close(\$ready);
+			my \$c = \$s->accept() or die;
+			print while <\$c>;
+		" >received &
+	} &&
+	listener=$! &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test -f ready && break
+		sleep 1
+	done &&
+	test_path_is_file ready &&
+	GIT_TRACE_EVENT="af_unix:$(pwd)/socket" git rev-parse HEAD &&
+	wait $listener &&
+	grep "\"event\":\"start\"" received &&
+	grep "\"event\":\"exit\"" received
+'
+
+test_expect_success 'unreachable socket' '
+	GIT_TRACE_EVENT="af_unix:$(pwd)/no-socket" git rev-parse HEAD 2>err &&
+	test_i18ngrep "could not connect to" err
+'
+
+test_done
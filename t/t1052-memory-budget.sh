@@ -0,0 +1,64 @@
+#!/bin/sh
+
+test_description='memory budget of the object store caches'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8
+	do
+		test_seq 1 $((100 * $i)) >file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -adf --depth=10 --window=10 &&
+	git log -p >expect
+'
+
+test_expect_success 'GIT_TRACE_MEMORY reports the usage of each cache' '
+	GIT_TRACE_MEMORY="$(pwd)/trace" git log -p >actual &&
+	test_cmp expect actual &&
+	grep "memory: pack windows: used [0-9]*, peak [1-9]" trace &&
+	grep "memory: delta base cache: used [0-9]*, peak [1-9]" trace &&
+	grep "memory: parsed objects: used [0-9]*, peak [1-9]" trace &&
+	grep "memory: total: peak [1-9][0-9]*, budget 0" trace
+'
+
+test_expect_success '--max-memory evicts cached delta bases' '
+	rm -f trace &&
+	GIT_TRACE_MEMORY="$(pwd)/trace" git --max-memory=1 log -p >actual &&
+	test_cmp expect actual &&
+	grep "memory: delta base cache: used 0," trace &&
+	grep "memory: total: peak [0-9]*, budget 1$" trace
+'
+
+test_expect_success 'core.maxMemory sets the budget' '
+	rm -f trace &&
+	GIT_TRACE_MEMORY="$(pwd)/trace" git -c core.maxMemory=2k log -p >actual &&
+	test_cmp expect actual &&
+	grep "memory: total: peak [0-9]*, budget 2048$" trace
+'
+
+test_expect_success 'GIT_MAX_MEMORY overrides core.maxMemory' '
+	rm -f trace &&
+	GIT_TRACE_MEMORY="$(pwd)/trace" GIT_MAX_MEMORY=0 \
+		git -c core.maxMemory=2k log -p >actual &&
+	test_cmp expect actual &&
+	grep "memory: total: peak [0-9]*, budget 0$" trace
+'
+
+test_expect_success 'pack-objects and index-pack work within a tiny budget' '
+	git --max-memory=1 pack-objects --all --no-reuse-delta \
+		--stdout </dev/null >tight.pack &&
+	git --max-memory=1 index-pack tight.pack &&
+	git verify-pack tight.idx
+'
+
+test_expect_success 'invalid budgets are rejected' '
+	test_expect_code 129 git --max-memory=foo log -1 2>err &&
+	test_i18ngrep "invalid value for --max-memory" err &&
+	test_must_fail env GIT_MAX_MEMORY=foo git log -p 2>err &&
+	test_i18ngrep "invalid value for GIT_MAX_MEMORY" err
+'
+
+test_done
@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='sparse index with sparse checkout'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	git init original &&
+	(
+		cd original &&
+		echo a >a &&
+		mkdir -p deep/deeper folder1 folder2/sub &&
+		echo a >deep/a &&
+		echo a >deep/deeper/a &&
+		echo a >folder1/a &&
+		echo a >folder2/a &&
+		echo a >folder2/sub/a &&
+		git add . &&
+		git commit -m initial &&
+		echo b >folder1/a &&
+		git commit -am "change folder1"
+	) &&
+	for repo in full-checkout sparse-checkout
+	do
+		git clone --no-checkout original $repo &&
+		git -C $repo config core.sparseCheckout true &&
+		printf "/*\n!/*/\n/deep/\n" >$repo/.git/info/sparse-checkout &&
+		git -C $repo read-tree -mu HEAD || return 1
+	done &&
+	git -C sparse-checkout config index.sparse true &&
+	git -C sparse-checkout update-index --force-write-index
+'
+
+test_sparse_match () {
+	(cd full-checkout && "$@") >full-out 2>full-err &&
+	(cd sparse-checkout && "$@") >sparse-out 2>sparse-err &&
+	test_cmp full-out sparse-out &&
+	test_cmp full-err sparse-err
+}
+
+test_expect_success 'directories outside of the sparse checkout are collapsed' '
+	git -C sparse-checkout ls-files --sparse -s >actual &&
+	cat >expect <<-EOF &&
+	100644 $(git -C original rev-parse HEAD:a) 0	a
+	100644 $(git -C original rev-parse HEAD:deep/a) 0	deep/a
+	100644 $(git -C original rev-parse HEAD:deep/deeper/a) 0	deep/deeper/a
+	040000 $(git -C original rev-parse HEAD:folder1) 0	folder1/
+	040000 $(git -C original rev-parse HEAD:folder2) 0	folder2/
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'the index is expanded for other commands' '
+	test_sparse_match git ls-files -s -t &&
+	test_sparse_match git diff-index --cached HEAD~1 &&
+	test_sparse_match git ls-files -t folder2/sub
+'
+
+test_expect_success 'status does not expand the index' '
+	test_sparse_match git status --porcelain=v2 &&
+	echo c >>full-checkout/deep/a &&
+	echo c >>sparse-checkout/deep/a &&
+	echo new >full-checkout/deep/new &&
+	echo new >sparse-checkout/deep/new &&
+	test_sparse_match git status --porcelain=v2 &&
+	test_sparse_match git add deep/a &&
+	test_sparse_match git status --porcelain=v2 &&
+	(
+		cd sparse-checkout &&
+		GIT_TRACE_EVENT="$(pwd)/../trace" git status >/dev/null
+	) &&
+	grep "\"label\":\"refresh\"" trace &&
+	! grep "\"label\":\"ensure_full_index\"" trace
+'
+
+test_expect_success 'the index stays sparse when written by other commands' '
+	git -C sparse-checkout ls-files --sparse >actual &&
+	grep "^folder1/$" actual &&
+	test_tick &&
+	test_sparse_match git commit -m "change deep" &&
+	git -C full-checkout rev-parse HEAD^{tree} >expect &&
+	git -C sparse-checkout rev-parse HEAD^{tree} >actual &&
+	test_cmp expect actual &&
+	git -C sparse-checkout ls-files --sparse >actual &&
+	grep "^folder1/$" actual
+'
+
+test_expect_success 'status against a changed sparse directory' '
+	test_sparse_match git reset --soft HEAD~2 &&
+	test_sparse_match git status --porcelain=v2 &&
+	test_sparse_match git reset --soft ORIG_HEAD &&
+	test_sparse_match git status --porcelain=v2
+'
+
+test_expect_success 'a sparse directory present in the working tree' '
+	test_when_finished "rm -rf full-checkout/folder1 sparse-checkout/folder1" &&
+	mkdir full-checkout/folder1 sparse-checkout/folder1 &&
+	echo new >full-checkout/folder1/new &&
+	echo new >sparse-checkout/folder1/new &&
+	test_sparse_match git status --porcelain=v2 &&
+	test_sparse_match git status --porcelain=v2 --untracked-files=all
+'
+
+test_expect_success 'disabling the sparse index expands it on write' '
+	git -C sparse-checkout -c index.sparse=false \
+		update-index --force-write-index &&
+	git -C sparse-checkout ls-files --sparse >actual &&
+	! grep "/$" actual &&
+	git -C sparse-checkout update-index --force-write-index &&
+	git -C sparse-checkout ls-files --sparse >actual &&
+	grep "^folder1/$" actual
+'
+
+test_done
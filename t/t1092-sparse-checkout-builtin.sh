@@ -0,0 +1,149 @@
+#!/bin/sh
+
+test_description='sparse-checkout builtin and cone mode'
+
+. ./test-lib.sh
+
+list_files () {
+	(cd "$1" && find . -path ./.git -prune -o -type f -print |
+		sed "s|^\./||" | sort)
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	(
+		cd repo &&
+		echo a >a &&
+		mkdir -p deep/deeper1/deepest deep/deeper2 folder1 folder2 &&
+		for f in deep/a deep/deeper1/a deep/deeper1/deepest/a \
+			 deep/deeper2/a folder1/a folder2/a
+		do
+			echo a >$f || return 1
+		done &&
+		git add . &&
+		git commit -m initial
+	)
+'
+
+test_expect_success 'list fails without a sparse-checkout file' '
+	test_must_fail git -C repo sparse-checkout list
+'
+
+test_expect_success 'init checks out the top-level files' '
+	git -C repo sparse-checkout init &&
+	test "$(git -C repo config core.sparseCheckout)" = true &&
+	cat >expect <<-\EOF &&
+	/*
+	!/*/
+	EOF
+	test_cmp expect repo/.git/info/sparse-checkout &&
+	git -C repo sparse-checkout list >actual &&
+	test_cmp expect actual &&
+	echo a >expect &&
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'set with arbitrary patterns' '
+	git -C repo sparse-checkout set "/*" "!/*/" "*deeper1*" &&
+	cat >expect <<-\EOF &&
+	a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'set in cone mode' '
+	git -C repo sparse-checkout init --cone &&
+	test "$(git -C repo config core.sparseCheckoutCone)" = true &&
+	git -C repo sparse-checkout set deep/deeper1 &&
+	cat >expect <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	!/deep/*/
+	/deep/deeper1/
+	EOF
+	test_cmp expect repo/.git/info/sparse-checkout &&
+	cat >expect <<-\EOF &&
+	a
+	deep/a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual &&
+	echo deep/deeper1 >expect &&
+	git -C repo sparse-checkout list >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'set --stdin in cone mode drops nested directories' '
+	printf "deep/deeper1/\n/folder1\ndeep\n" |
+		git -C repo sparse-checkout set --stdin &&
+	cat >expect <<-\EOF &&
+	/*
+	!/*/
+	/deep/
+	/folder1/
+	EOF
+	test_cmp expect repo/.git/info/sparse-checkout &&
+	cat >expect <<-\EOF &&
+	a
+	deep/a
+	deep/deeper1/a
+	deep/deeper1/deepest/a
+	deep/deeper2/a
+	folder1/a
+	EOF
+	list_files repo >actual &&
+	test_cmp expect actual &&
+	test_must_fail git -C repo sparse-checkout set "deep/*"
+'
+
+test_expect_success 'cone mode matches like the patterns do' '
+	git -C repo sparse-checkout set deep/deeper1/deepest folder2 &&
+	git -C repo ls-files -t >cone &&
+	git -C repo -c core.sparseCheckoutCone=false read-tree -mu HEAD &&
+	git -C repo ls-files -t >patterns &&
+	test_cmp cone patterns &&
+	grep "^H deep/deeper1/deepest/a" cone &&
+	grep "^H deep/deeper1/a" cone &&
+	grep "^S deep/deeper2/a" cone &&
+	grep "^S folder1/a" cone &&
+	grep "^H folder2/a" cone
+'
+
+test_expect_success 'other patterns disable cone mode' '
+	test_when_finished "git -C repo sparse-checkout set folder1" &&
+	cat >repo/.git/info/sparse-checkout <<-\EOF &&
+	/*
+	!/*/
+	/folder*/
+	EOF
+	git -C repo read-tree -mu HEAD 2>err &&
+	test_i18ngrep "disabling cone pattern matching" err &&
+	test_path_is_file repo/folder2/a
+'
+
+test_expect_success 'set keeps the patterns when the update fails' '
+	cp repo/.git/info/sparse-checkout expect &&
+	echo changed >repo/folder1/a &&
+	test_must_fail git -C repo sparse-checkout set deep &&
+	test_cmp expect repo/.git/info/sparse-checkout &&
+	git -C repo checkout folder1/a
+'
+
+test_expect_success 'disable checks out all of the files' '
+	git -C repo sparse-checkout disable &&
+	test_path_is_missing repo/.git/info/sparse-checkout &&
+	test "$(git -C repo config core.sparseCheckout)" = false &&
+	test_must_fail git -C repo config core.sparseCheckoutCone &&
+	git -C repo ls-files >expect &&
+	list_files repo >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,268 @@
+#!/bin/sh
+
+test_description='reftable ref storage backend'
+. ./test-lib.sh
+
+tables () {
+	cat "${1:-.}/.git/reftable/tables.list"
+}
+
+test_expect_success 'init with --ref-storage=reftable' '
+	git init --ref-storage=reftable repo &&
+	echo reftable >expect &&
+	git -C repo config extensions.refstorage >actual &&
+	test_cmp expect actual &&
+	echo 1 >expect &&
+	git -C repo config core.repositoryformatversion >actual &&
+	test_cmp expect actual &&
+	test_path_is_file repo/.git/reftable/tables.list &&
+	test_must_fail git -C repo rev-parse --verify HEAD &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'init rejects unknown or mismatching formats' '
+	test_must_fail git init --ref-storage=bogus bogus &&
+	test_must_fail git init --ref-storage=files repo &&
+	git init --ref-storage=reftable repo &&
+	git init repo
+'
+
+test_expect_success 'commit and branch' '
+	(
+		cd repo &&
+		test_commit one &&
+		test_commit two &&
+		git branch side HEAD^ &&
+		git tag -a -m annotated annotated one &&
+		git rev-parse one >expect &&
+		git rev-parse side >actual &&
+		test_cmp expect actual &&
+		test_path_is_missing .git/refs/heads/side &&
+		git for-each-ref --format="%(refname)" >actual &&
+		cat >expect <<-\EOF &&
+		refs/heads/master
+		refs/heads/side
+		refs/tags/annotated
+		refs/tags/one
+		refs/tags/two
+		EOF
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'show-ref peels annotated tags' '
+	(
+		cd repo &&
+		echo "$(git rev-parse one) refs/tags/annotated^{}" >expect &&
+		git show-ref -d annotated >actual &&
+		tail -n 1 actual >actual.peeled &&
+		test_cmp expect actual.peeled
+	)
+'
+
+test_expect_success 'symbolic refs' '
+	(
+		cd repo &&
+		git symbolic-ref refs/heads/alias refs/heads/side &&
+		git rev-parse side >expect &&
+		git rev-parse alias >actual &&
+		test_cmp expect actual &&
+		git update-ref refs/heads/alias HEAD &&
+		git rev-parse HEAD >expect &&
+		git rev-parse side >actual &&
+		test_cmp expect actual &&
+		git update-ref --no-deref -d refs/heads/alias &&
+		test_must_fail git rev-parse --verify alias
+	)
+'
+
+test_expect_success 'update-ref checks the old value' '
+	(
+		cd repo &&
+		test_must_fail git update-ref refs/heads/side one one 2>err &&
+		test_i18ngrep "is at .* but expected" err &&
+		test_must_fail git update-ref refs/heads/new HEAD HEAD 2>err &&
+		test_i18ngrep "unable to resolve reference" err &&
+		git rev-parse two >expect &&
+		git rev-parse side >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'transactions are atomic' '
+	(
+		cd repo &&
+		git rev-parse master >expect &&
+		cat >stdin <<-EOF &&
+		create refs/heads/atomic-1 HEAD
+		update refs/heads/master $(git rev-parse one) $(git rev-parse one)
+		EOF
+		test_must_fail git update-ref --stdin <stdin &&
+		test_must_fail git rev-parse --verify atomic-1 &&
+		git rev-parse master >actual &&
+		test_cmp expect actual &&
+		cat >stdin <<-EOF &&
+		create refs/heads/atomic-1 HEAD
+		create refs/heads/atomic-2 HEAD
+		delete refs/heads/side
+		EOF
+		git update-ref --stdin <stdin &&
+		git rev-parse --verify atomic-1 &&
+		git rev-parse --verify atomic-2 &&
+		test_must_fail git rev-parse --verify side
+	)
+'
+
+test_expect_success 'directory/file conflicts are detected' '
+	(
+		cd repo &&
+		test_must_fail git branch atomic-1/sub 2>err &&
+		test_i18ngrep "exists; cannot create" err &&
+		test_must_fail git branch atomic-2/sub &&
+		test_must_fail git symbolic-ref refs/heads/atomic-2/sym \
+			refs/heads/master &&
+		git branch -d atomic-2 &&
+		git branch atomic-2/sub &&
+		test_must_fail git branch atomic-2
+	)
+'
+
+test_expect_success 'rename and copy branches with their reflogs' '
+	(
+		cd repo &&
+		git branch -m atomic-1 renamed &&
+		test_must_fail git rev-parse --verify atomic-1 &&
+		git reflog show renamed >log &&
+		test_i18ngrep "renamed refs/heads/atomic-1 to refs/heads/renamed" log &&
+		git branch -c renamed copied &&
+		git rev-parse renamed >expect &&
+		git rev-parse copied >actual &&
+		test_cmp expect actual &&
+		test_must_fail git branch -m renamed copied/sub &&
+		git branch -D copied &&
+		git branch -m renamed renamed/sub &&
+		git rev-parse --verify renamed/sub
+	)
+'
+
+test_expect_success 'reflogs record updates through HEAD' '
+	(
+		cd repo &&
+		test_commit three &&
+		git reflog -1 --format=%gs HEAD >actual &&
+		echo "commit: three" >expect &&
+		test_cmp expect actual &&
+		git reflog -1 --format=%gs master >actual &&
+		test_cmp expect actual &&
+		git reflog expire --expire=now --all &&
+		git reflog HEAD >actual &&
+		test_must_be_empty actual
+	)
+'
+
+test_expect_success 'pseudorefs are stored as files' '
+	(
+		cd repo &&
+		git update-ref ORIG_HEAD HEAD^ &&
+		test_path_is_file .git/ORIG_HEAD &&
+		git rev-parse HEAD^ >expect &&
+		git rev-parse ORIG_HEAD >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'the stack of tables is compacted geometrically' '
+	(
+		cd repo &&
+		for i in $(test_seq 1 64)
+		do
+			git branch branch-$i || return 1
+		done &&
+		tables >list &&
+		test $(wc -l <list) -le 7
+	)
+'
+
+test_expect_success 'pack-refs compacts all tables into one' '
+	(
+		cd repo &&
+		git for-each-ref >expect &&
+		git pack-refs --all &&
+		tables >list &&
+		test_line_count = 1 list &&
+		git for-each-ref >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'many refs span several blocks' '
+	(
+		cd repo &&
+		for i in $(test_seq 1000)
+		do
+			echo "create refs/heads/many/$i HEAD" || return 1
+		done >stdin &&
+		git update-ref --stdin <stdin &&
+		git for-each-ref refs/heads/many/ >refs &&
+		test_line_count = 1000 refs &&
+		git rev-parse HEAD >expect &&
+		for i in 1 500 999 1000
+		do
+			git rev-parse refs/heads/many/$i || return 1
+		done >actual &&
+		test_line_count = 4 actual &&
+		sort -u actual >actual.uniq &&
+		test_cmp expect actual.uniq &&
+		cat >stdin <<-\EOF &&
+		delete refs/heads/many/1
+		delete refs/heads/many/500
+		EOF
+		git update-ref --stdin <stdin &&
+		git pack-refs --all &&
+		git for-each-ref refs/heads/many/ >refs &&
+		test_line_count = 998 refs &&
+		test_must_fail git rev-parse --verify refs/heads/many/500
+	)
+'
+
+test_expect_success 'gc and fsck' '
+	(
+		cd repo &&
+		git gc &&
+		git fsck &&
+		tables >list &&
+		test_line_count = 1 list
+	)
+'
+
+test_expect_success 'worktrees keep their HEAD in a separate stack' '
+	git -C repo worktree add ../wt &&
+	(
+		cd wt &&
+		test_commit in-worktree &&
+		test_path_is_file ../repo/.git/worktrees/wt/reftable/tables.list &&
+		echo refs/heads/wt >expect &&
+		git symbolic-ref HEAD >actual &&
+		test_cmp expect actual &&
+		git rev-parse HEAD >expect &&
+		git rev-parse wt >actual &&
+		test_cmp expect actual
+	) &&
+	echo refs/heads/master >expect &&
+	git -C repo symbolic-ref HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from a reftable repository' '
+	git clone repo clone &&
+	git -C repo for-each-ref --format="%(objectname) %(refname:lstrip=2)" \
+		refs/heads/ >expect &&
+	git -C clone for-each-ref --format="%(objectname) %(refname:lstrip=3)" \
+		refs/remotes/origin/ >refs &&
+	grep -v " HEAD$" refs >actual &&
+	test_cmp expect actual
+'
+
+test_done
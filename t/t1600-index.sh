@@ -72,4 +72,60 @@ test_expect_success 'GIT_INDEX_VERSION takes precedence over config' '
 	)
 '
 
+test_expect_success 'setup index with many entries' '
+	sane_unset GIT_INDEX_VERSION &&
+	sane_unset GIT_TEST_INDEX_THREADS &&
+	git config --unset-all index.version &&
+	rm -f .git/index &&
+	for d in 1 2 3 4 5 6 7 8
+	do
+		mkdir -p dir$d &&
+		for f in a b c d e f g h
+		do
+			echo "$d$f" >dir$d/file$f || return 1
+		done
+	done &&
+	git add a dir* &&
+	git -c index.threads=1 ls-files -s >expect
+'
+
+for version in 2 3 4
+do
+	test_expect_success "index.threads loads v$version index with offset table" '
+		git -c index.threads=4 update-index --force-write-index \
+			--index-version $version &&
+		grep -q EOIE .git/index &&
+		grep -q IEOT .git/index &&
+		git -c index.threads=1 ls-files -s >actual.serial &&
+		test_cmp expect actual.serial &&
+		git -c index.threads=4 ls-files -s >actual.threaded &&
+		test_cmp expect actual.threaded
+	'
+done
+
+test_expect_success 'index.threads=false does not write offset table' '
+	git -c index.threads=false update-index --force-write-index &&
+	grep -q EOIE .git/index &&
+	! grep -q IEOT .git/index &&
+	git -c index.threads=4 ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index.recordEndOfIndexEntries=false skips EOIE' '
+	git -c index.threads=4 -c index.recordEndOfIndexEntries=false \
+		update-index --force-write-index --index-version 3 &&
+	! grep -q EOIE .git/index &&
+	git -c index.threads=4 ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index.recordOffsetTable=false skips IEOT' '
+	git -c index.threads=4 -c index.recordOffsetTable=false \
+		update-index --force-write-index --index-version 3 &&
+	grep -q EOIE .git/index &&
+	! grep -q IEOT .git/index &&
+	git -c index.threads=4 ls-files -s >actual &&
+	test_cmp expect actual
+'
+
 test_done
@@ -0,0 +1,131 @@
+#!/bin/sh
+
+test_description='parallel checkout'
+
+. ./test-lib.sh
+
+# The tests below choose their own number of workers.
+sane_unset GIT_TEST_CHECKOUT_WORKERS
+
+# Runs "git <args>" with checkout.workers=<workers> and checks via the
+# trace output that the expected number of workers was spawned.
+test_checkout_workers () {
+	workers=$1 &&
+	expected=$2 &&
+	shift 2 &&
+	trace="$TRASH_DIRECTORY/trace" &&
+	rm -f "$trace" &&
+	GIT_TRACE="$trace" git -c checkout.workers=$workers \
+		-c checkout.thresholdForParallelism=0 "$@" &&
+	grep "run_command: .*checkout--worker" "$trace" >"$trace.workers" &&
+	test_line_count = $expected "$trace.workers"
+}
+
+# Compares the working tree and the index of two repositories.
+test_cmp_worktrees () {
+	(cd "$1" && git ls-files -s && git status --porcelain) >expect.index &&
+	(cd "$2" && git ls-files -s && git status --porcelain) >actual.index &&
+	test_cmp expect.index actual.index &&
+	(cd "$1" && find . -name .git -prune -o -type f -print |
+		sort | xargs cat) >expect.files &&
+	(cd "$2" && find . -name .git -prune -o -type f -print |
+		sort | xargs cat) >actual.files &&
+	test_cmp expect.files actual.files
+}
+
+test_expect_success 'setup' '
+	git init src &&
+	(
+		cd src &&
+		for i in $(test_seq 1 20)
+		do
+			mkdir -p dir$i/sub &&
+			echo "file $i" >dir$i/file &&
+			echo "sub $i" >dir$i/sub/file &&
+			printf "line1\nline2\n" >dir$i/crlf.txt || return 1
+		done &&
+		echo "#!/bin/sh" >script.sh &&
+		chmod +x script.sh &&
+		printf "\$Id\$\n" >ident &&
+		test_ln_s_add dir1/file link &&
+		cat >.gitattributes <<-\EOF &&
+		*.txt eol=crlf
+		ident ident
+		EOF
+		git add . &&
+		git commit -m base &&
+		git checkout -b other &&
+		for i in $(test_seq 1 20)
+		do
+			echo "other $i" >dir$i/file || return 1
+		done &&
+		git commit -a -m other &&
+		git checkout master
+	)
+'
+
+test_expect_success 'sequential clone' '
+	git -c checkout.workers=1 clone src sequential
+'
+
+test_expect_success 'parallel clone' '
+	test_checkout_workers 2 2 clone src parallel &&
+	test_cmp_worktrees sequential parallel &&
+	test -x parallel/script.sh
+'
+
+test_expect_success 'parallel checkout of another branch' '
+	git -C sequential checkout other &&
+	(
+		cd parallel &&
+		test_checkout_workers 3 3 checkout other
+	) &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'threshold keeps small checkouts sequential' '
+	git -C sequential checkout master &&
+	(
+		cd parallel &&
+		rm -f "$TRASH_DIRECTORY/trace" &&
+		GIT_TRACE="$TRASH_DIRECTORY/trace" git -c checkout.workers=2 \
+			-c checkout.thresholdForParallelism=1000 checkout master &&
+		! grep checkout--worker "$TRASH_DIRECTORY/trace"
+	) &&
+	test_cmp_worktrees sequential parallel
+'
+
+test_expect_success 'entries with a filter driver are written sequentially' '
+	git clone --no-checkout src filtered &&
+	(
+		cd filtered &&
+		git config filter.rot13.smudge "tr a-zA-Z n-za-mA-M" &&
+		git config filter.rot13.clean "tr a-zA-Z n-za-mA-M" &&
+		echo "dir1/file filter=rot13" >.git/info/attributes &&
+		test_checkout_workers 2 2 reset --hard &&
+		echo "svyr 1" >expect &&
+		test_cmp expect dir1/file &&
+		echo "file 2" >expect &&
+		test_cmp expect dir2/file &&
+		git diff --exit-code
+	)
+'
+
+test_expect_success CASE_INSENSITIVE_FS 'colliding paths are written sequentially' '
+	git init colliding &&
+	(
+		cd colliding &&
+		for i in $(test_seq 1 10)
+		do
+			echo "file $i" >file$i || return 1
+		done &&
+		git add . &&
+		blob=$(echo upper | git hash-object -w --stdin) &&
+		git update-index --add --cacheinfo 100644,$blob,FILE1 &&
+		git commit -m colliding
+	) &&
+	test_checkout_workers 2 2 clone colliding colliding-clone 2>err &&
+	test_i18ngrep "FILE1" err
+'
+
+test_done
@@ -262,4 +262,88 @@ test_expect_success 'diff-tree -l0 defaults to a big rename limit, not zero' '
 	grep "myotherfile.*myfile" actual
 '
 
+test_expect_success 'files with a unique basename are paired despite rename limit' '
+	mkdir old &&
+	test_write_lines alpha1 alpha2 alpha3 alpha4 alpha5 >old/alpha.c &&
+	test_write_lines beta1 beta2 beta3 beta4 beta5 >old/beta.c &&
+	git add old &&
+	git commit -m "add old/" &&
+
+	mkdir new &&
+	test_write_lines alpha1 alpha2 alpha3 alpha4 alpha6 >new/alpha.c &&
+	test_write_lines beta1 beta2 beta3 beta4 beta6 >new/beta.c &&
+	git rm -r old &&
+	git add new &&
+	git commit -m "old/ -> new/ with edits" &&
+
+	git diff --name-status -M -l1 HEAD^ HEAD >out &&
+	sed "s/^R[0-9]*/R/" out >actual &&
+	cat >expect <<-\EOF &&
+	R	old/alpha.c	new/alpha.c
+	R	old/beta.c	new/beta.c
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'directory renames pair files with a common basename' '
+	git reset --hard HEAD^ &&
+	mkdir old/sub lib &&
+	test_write_lines old1 old2 old3 old4 old5 >old/Makefile &&
+	test_write_lines sub1 sub2 sub3 sub4 sub5 >old/sub/Makefile &&
+	test_write_lines lib1 lib2 lib3 lib4 lib5 >lib/Makefile &&
+	git add old lib &&
+	git commit -m "add Makefiles" &&
+
+	mkdir new new/sub lib2 &&
+	test_write_lines alpha1 alpha2 alpha3 alpha4 alpha6 >new/alpha.c &&
+	test_write_lines beta1 beta2 beta3 beta4 beta6 >new/beta.c &&
+	test_write_lines old1 old2 old3 old4 old6 >new/Makefile &&
+	test_write_lines sub1 sub2 sub3 sub4 sub6 >new/sub/Makefile &&
+	test_write_lines lib1 lib2 lib3 lib4 lib6 >lib2/Makefile &&
+	git rm -r old lib &&
+	git add new lib2 &&
+	git commit -m "move Makefiles along with their directories" &&
+
+	git diff --name-status -M -l1 HEAD^ HEAD >out &&
+	sed "s/^R[0-9]*/R/" out >actual &&
+	cat >expect <<-\EOF &&
+	R	lib/Makefile	lib2/Makefile
+	R	old/Makefile	new/Makefile
+	R	old/alpha.c	new/alpha.c
+	R	old/beta.c	new/beta.c
+	R	old/sub/Makefile	new/sub/Makefile
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a better match with another basename wins' '
+	git init best &&
+	(
+		cd best &&
+		mkdir a &&
+		test_seq 10 29 >a/foo.txt &&
+		git add a &&
+		git commit -m "add a/foo.txt" &&
+
+		git rm a/foo.txt &&
+		mkdir b c &&
+		{
+			test_seq 10 23 &&
+			test_write_lines x1 x2 x3 x4 x5 x6
+		} >b/foo.txt &&
+		{
+			test_seq 10 28 &&
+			echo x
+		} >c/bar.txt &&
+		git add b c &&
+		git diff --cached --name-status -M >out &&
+		sed "s/^R[0-9]*/R/" out >actual &&
+		cat >expect <<-\EOF &&
+		A	b/foo.txt
+		R	a/foo.txt	c/bar.txt
+		EOF
+		test_cmp expect actual
+	)
+'
+
 test_done
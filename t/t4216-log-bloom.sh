@@ -0,0 +1,149 @@
+#!/bin/sh
+
+test_description='git log for a path with Bloom filters'
+. ./test-lib.sh
+
+GIT_TEST_COMMIT_GRAPH=0
+GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+
+test_expect_success 'setup test - repo, commits, commit graph, log outputs' '
+	git init &&
+	mkdir A A/B A/B/C &&
+	test_commit c1 A/file1 &&
+	test_commit c2 A/B/file2 &&
+	test_commit c3 A/B/C/file3 &&
+	test_commit c4 A/file1 &&
+	test_commit c5 A/B/file2 &&
+	test_commit c6 A/B/C/file3 &&
+	test_commit c7 A/file1 &&
+	test_commit c8 A/B/file2 &&
+	test_commit c9 A/B/C/file3 &&
+	test_commit c10 file_to_be_deleted &&
+	git checkout -b side HEAD~4 &&
+	test_commit side-1 file4 &&
+	git checkout master &&
+	git merge side &&
+	test_commit c11 file5 &&
+	mv file5 file5_renamed &&
+	git add file5_renamed &&
+	git commit -m "rename" &&
+	rm file_to_be_deleted &&
+	git add . &&
+	git commit -m "file removed" &&
+	git commit-graph write --reachable --changed-paths
+'
+
+graph_read_expect () {
+	NUM_CHUNKS=5
+	cat >expect <<- EOF
+	header: 43475048 1 1 $NUM_CHUNKS 0
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata bloom_indexes bloom_data
+	EOF
+	git commit-graph read >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'commit-graph write wrote out the bloom chunks' '
+	graph_read_expect 15
+'
+
+setup () {
+	rm -f "$TRASH_DIRECTORY/trace.perf" &&
+	git -c core.commitGraph=false log --pretty="format:%s" $1 >log_wo_bloom &&
+	GIT_TRACE_BLOOM_STATS="$TRASH_DIRECTORY/trace.perf" \
+		git -c core.commitGraph=true log --pretty="format:%s" $1 >log_w_bloom
+}
+
+test_bloom_filters_used () {
+	log_args=$1
+	setup "$log_args" &&
+	grep -q "definitely not: [1-9]" "$TRASH_DIRECTORY/trace.perf" &&
+	test_cmp log_wo_bloom log_w_bloom
+}
+
+test_bloom_filters_not_used () {
+	log_args=$1
+	setup "$log_args" &&
+	! test -s "$TRASH_DIRECTORY/trace.perf" &&
+	test_cmp log_wo_bloom log_w_bloom
+}
+
+for path in A A/B A/B/C A/file1 A/B/file2 A/B/C/file3 file4 file5 file5_renamed file_to_be_deleted
+do
+	for option in "" \
+		      "--all" \
+		      "--full-history" \
+		      "--full-history --simplify-merges" \
+		      "--simplify-merges" \
+		      "--simplify-by-decoration" \
+		      "--topo-order" \
+		      "--date-order" \
+		      "--author-date-order" \
+		      "--ancestry-path side..master"
+	do
+		test_expect_success "git log option: $option for path: $path" '
+			test_bloom_filters_used "$option -- $path"
+		'
+	done
+done
+
+test_expect_success 'git log -- folder works with and without the trailing slash' '
+	test_bloom_filters_used "-- A" &&
+	test_bloom_filters_used "-- A/"
+'
+
+test_expect_success 'git log for path that does not exist' '
+	test_bloom_filters_used "-- path_does_not_exist"
+'
+
+test_expect_success 'git log with --walk-reflogs does not use Bloom filters' '
+	test_bloom_filters_not_used "--walk-reflogs -- A"
+'
+
+test_expect_success 'git log -- multiple path specs does not use Bloom filters' '
+	test_bloom_filters_not_used "-- file4 A/file1"
+'
+
+test_expect_success 'git log with wildcard that resolves to a single path does not use Bloom filters' '
+	test_bloom_filters_not_used "-- :(glob)*4" &&
+	test_bloom_filters_not_used "-- :(glob)*renamed"
+'
+
+test_expect_success 'git log with --follow does not use Bloom filters' '
+	test_bloom_filters_not_used "--follow -- file5_renamed"
+'
+
+test_expect_success 'git log -L does not use Bloom filters' '
+	test_bloom_filters_not_used "-L 1,1:A/file1"
+'
+
+test_expect_success 'git log with no path does not use Bloom filters' '
+	test_bloom_filters_not_used ""
+'
+
+test_expect_success 'git blame gives the same output with Bloom filters' '
+	git -c core.commitGraph=false blame A/B/file2 >blame_wo_bloom &&
+	git -c core.commitGraph=true blame A/B/file2 >blame_w_bloom &&
+	test_cmp blame_wo_bloom blame_w_bloom
+'
+
+test_expect_success 'Bloom filters are not written without --changed-paths' '
+	git commit-graph write --reachable &&
+	cat >expect <<-\EOF &&
+	header: 43475048 1 1 3 0
+	num_commits: 15
+	chunks: oid_fanout oid_lookup commit_metadata
+	EOF
+	git commit-graph read >actual &&
+	test_cmp expect actual &&
+	test_bloom_filters_not_used "-- A"
+'
+
+test_expect_success 'GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS writes Bloom filters' '
+	GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=1 git commit-graph write --reachable &&
+	graph_read_expect 15 &&
+	test_bloom_filters_used "-- A"
+'
+
+test_done
@@ -0,0 +1,269 @@
+#!/bin/sh
+
+test_description='git merge-tree --write-tree'
+. ./test-lib.sh
+
+test_expect_success setup '
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 >numbers &&
+	test_write_lines a b c d e f g h i j k l m n >letters &&
+	echo hello >greeting &&
+	echo gone >to-delete &&
+	mkdir dir &&
+	echo a >dir/a &&
+	echo b >dir/b &&
+	git add . &&
+	test_tick &&
+	git commit -m base &&
+	git branch side1 &&
+	git branch side2 &&
+
+	git checkout side1 &&
+	test_write_lines one 2 3 4 5 6 7 8 9 10 >numbers &&
+	git mv letters renamed-letters &&
+	test_tick &&
+	git commit -am side1 &&
+
+	git checkout side2 &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 ten >numbers &&
+	test_write_lines a b c d e f g h i j k l m N >letters &&
+	echo c >dir/c &&
+	git add dir/c &&
+	test_tick &&
+	git commit -am side2 &&
+	git checkout master
+'
+
+test_expect_success 'clean merge with a rename' '
+	git merge-tree --write-tree side1 side2 >out &&
+	test_line_count = 1 out &&
+	git ls-tree -r --name-only $(cat out) >paths &&
+	test_write_lines dir/a dir/b dir/c greeting numbers renamed-letters \
+		to-delete >expect &&
+	test_cmp expect paths &&
+	git cat-file -p $(cat out):numbers >actual &&
+	test_write_lines one 2 3 4 5 6 7 8 9 ten >expect &&
+	test_cmp expect actual &&
+	git cat-file -p $(cat out):renamed-letters >actual &&
+	test_write_lines a b c d e f g h i j k l m N >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'same tree as the recursive merge' '
+	git checkout -b check side1 &&
+	git merge side2 &&
+	git rev-parse HEAD^{tree} >expect &&
+	git checkout master &&
+	git merge-tree --write-tree side1 side2 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the index and the working tree are left alone' '
+	git checkout master &&
+	echo dirty >greeting &&
+	git ls-files -s >index.before &&
+	git status --porcelain -uno >status.before &&
+	git merge-tree --write-tree side1 side2 &&
+	git ls-files -s >index.after &&
+	git status --porcelain -uno >status.after &&
+	test_cmp index.before index.after &&
+	test_cmp status.before status.after &&
+	echo dirty >expect &&
+	test_cmp expect greeting &&
+	git checkout greeting
+'
+
+test_expect_success 'content conflict' '
+	git checkout -b conflict1 master &&
+	echo hi >greeting &&
+	test_tick &&
+	git commit -am conflict1 &&
+	git checkout -b conflict2 master &&
+	echo salut >greeting &&
+	test_tick &&
+	git commit -am conflict2 &&
+	git checkout master &&
+
+	test_expect_code 1 git merge-tree --write-tree conflict1 conflict2 >out &&
+	cat >expect <<-EOF &&
+	100644 $(git rev-parse master:greeting) 1	greeting
+	100644 $(git rev-parse conflict1:greeting) 2	greeting
+	100644 $(git rev-parse conflict2:greeting) 3	greeting
+
+	CONFLICT (content): Merge conflict in greeting
+	EOF
+	sed 1d out >actual &&
+	test_cmp expect actual &&
+	git cat-file -p $(head -n 1 out):greeting >actual &&
+	cat >expect <<-EOF &&
+	<<<<<<< conflict1
+	hi
+	=======
+	salut
+	>>>>>>> conflict2
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'modify/delete and rename/delete conflicts' '
+	git checkout -b modify master &&
+	echo changed >to-delete &&
+	git mv letters moved-letters &&
+	test_tick &&
+	git commit -am modify &&
+	git checkout -b delete master &&
+	git rm to-delete letters &&
+	test_tick &&
+	git commit -m delete &&
+	git checkout master &&
+
+	test_expect_code 1 git merge-tree --write-tree modify delete >out &&
+	grep "^CONFLICT (modify/delete): to-delete deleted in delete and modified in modify" out &&
+	grep "^CONFLICT (rename/delete): letters renamed to moved-letters in modify, but deleted in delete" out &&
+	git ls-tree -r --name-only $(head -n 1 out) >paths &&
+	grep "^to-delete$" paths &&
+	grep "^moved-letters$" paths &&
+	! grep "^letters$" paths
+'
+
+test_expect_success 'rename/rename conflict' '
+	git checkout -b rename1 master &&
+	git mv letters letters1 &&
+	test_tick &&
+	git commit -m rename1 &&
+	git checkout -b rename2 master &&
+	git mv letters letters2 &&
+	test_tick &&
+	git commit -m rename2 &&
+	git checkout master &&
+
+	test_expect_code 1 git merge-tree --write-tree rename1 rename2 >out &&
+	grep "^CONFLICT (rename/rename): letters renamed to letters1 in rename1 and to letters2 in rename2" out &&
+	git ls-tree -r --name-only $(head -n 1 out) >paths &&
+	grep "^letters1$" paths &&
+	grep "^letters2$" paths
+'
+
+test_expect_success 'file/directory conflict' '
+	git checkout -b file master &&
+	echo file >df &&
+	git add df &&
+	test_tick &&
+	git commit -m file &&
+	git checkout -b directory master &&
+	mkdir df &&
+	echo sub >df/sub &&
+	git add df &&
+	test_tick &&
+	git commit -m directory &&
+	git checkout master &&
+
+	test_expect_code 1 git merge-tree --write-tree file directory >out &&
+	grep "^CONFLICT (file/directory): directory in the way of df from file; moving it to df~file instead" out &&
+	git ls-tree -r --name-only $(head -n 1 out) >paths &&
+	grep "^df~file$" paths &&
+	grep "^df/sub$" paths
+'
+
+test_expect_success 'criss-cross merge with a virtual merge base' '
+	git checkout -b cross-base master &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 11 12 >numbers &&
+	test_tick &&
+	git commit -am cross-base &&
+	git checkout -b cross1 &&
+	test_write_lines 1 2 3 4 5 6 7 8 9 10 11 twelve >numbers &&
+	test_tick &&
+	git commit -am cross1 &&
+	git checkout -b cross2 cross-base &&
+	test_write_lines one 2 3 4 5 6 7 8 9 10 11 12 >numbers &&
+	test_tick &&
+	git commit -am cross2 &&
+	git checkout -b cross1-merge cross1 &&
+	test_tick &&
+	git merge -m merge1 cross2 &&
+	git checkout -b cross2-merge cross2 &&
+	test_tick &&
+	git merge -m merge2 cross1 &&
+	git mv letters cross-letters &&
+	test_tick &&
+	git commit -m rename &&
+	git checkout cross1-merge &&
+	test_write_lines 1 2 3 4 5 6 seven 8 9 10 11 twelve >numbers &&
+	test_write_lines a b c d e f g h i j k l m N >letters &&
+	test_tick &&
+	git commit -am change &&
+	git merge-base --all cross1-merge cross2-merge >bases &&
+	test_line_count = 2 bases &&
+
+	git merge-tree --write-tree cross1-merge cross2-merge >actual &&
+	git checkout -b cross-check cross1-merge &&
+	git merge cross2-merge &&
+	git rev-parse HEAD^{tree} >expect &&
+	test_cmp expect actual &&
+	git checkout master
+'
+
+test_expect_success 'explicit merge base, with trees' '
+	git merge-tree --write-tree --merge-base=master^{tree} \
+		side1^{tree} side2^{tree} >actual &&
+	git merge-tree --write-tree side1 side2 >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'works in a bare repository' '
+	git clone --bare . bare.git &&
+	git -C bare.git merge-tree --write-tree side1 side2 >actual &&
+	git merge-tree --write-tree side1 side2 >expect &&
+	test_cmp expect actual &&
+	test_path_is_missing bare.git/index
+'
+
+test_expect_success 'trace regions of the merge' '
+	GIT_TRACE_EVENT="$(pwd)/trace" git merge-tree --write-tree side1 side2 &&
+	grep "\"category\":\"merge\",\"label\":\"collect_merge_info\"" trace &&
+	grep "\"category\":\"merge\",\"label\":\"detect_renames\"" trace &&
+	grep "\"category\":\"merge\",\"label\":\"write_tree\"" trace
+'
+
+test_expect_success '--stdin merges each line' '
+	cat >input <<-EOF &&
+	side1 side2
+	conflict1 conflict2
+	master^{tree} side1^{tree} side2^{tree}
+	does-not-exist side2
+	side1
+
+	modify delete
+	EOF
+	git merge-tree --write-tree --stdin <input >actual 2>err &&
+	cat >expect <<-EOF &&
+	$(git merge-tree --write-tree side1 side2) clean
+	$(git merge-tree --write-tree conflict1 conflict2 | head -n 1) conflicted	greeting
+	$(git merge-tree --write-tree side1 side2) clean
+	$ZERO_OID error
+	$ZERO_OID error
+	$ZERO_OID error
+	$(git merge-tree --write-tree modify delete | head -n 1) conflicted	moved-letters	to-delete
+	EOF
+	test_cmp expect actual &&
+	test_i18ngrep "could not parse as commit .does-not-exist." err
+'
+
+test_expect_success '--stdin remembers the renames across merges' '
+	cat >input <<-EOF &&
+	side1 side2
+	side1 side2
+	EOF
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" \
+		git merge-tree --write-tree --stdin <input >actual &&
+	test_line_count = 2 actual &&
+	grep "\"region_enter\".*\"label\":\"detect_renames\"" trace >renames &&
+	test_line_count = 2 renames
+'
+
+test_expect_success '--stdin requires --write-tree' '
+	test_must_fail git merge-tree --stdin </dev/null &&
+	test_must_fail git merge-tree --write-tree --stdin side1 side2 </dev/null
+'
+
+test_done
@@ -65,6 +65,16 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success 'index-pack hashes objects in threads' '
+	git index-pack --threads=4 --index-version=2 --strict \
+		-o threaded.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" threaded.idx &&
+	rm -f stdin.pack stdin.idx &&
+	git index-pack --threads=4 --index-version=2 --stdin \
+		-o stdin.idx stdin.pack <"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" stdin.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
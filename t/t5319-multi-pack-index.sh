@@ -187,6 +187,76 @@ test_expect_success 'multi-pack-index in an alternate' '
 
 compare_results_with_midx "with alternate (remote midx)"
 
+test_expect_success 'missing objects do not rescan unchanged pack directories' '
+	test_when_finished "rm -rf missing" &&
+	git init missing &&
+	(
+		cd missing &&
+		test_commit one &&
+		git repack -ad &&
+		git multi-pack-index write &&
+		echo two | git hash-object --stdin >input &&
+		echo three | git hash-object --stdin >>input &&
+		sed "s/$/ missing/" input >expect &&
+		test-tool chmtime =-10 .git/objects/pack &&
+		GIT_TRACE_EVENT="$(pwd)/trace" \
+			git cat-file --batch-check <input >actual &&
+		test_cmp expect actual &&
+		grep "\"name\":\"pack_rescans\",\"value\":0}" trace
+	)
+'
+
+test_expect_success PIPE 'missing objects are found in a new pack' '
+	test_when_finished "rm -rf missing" &&
+	git init missing &&
+	(
+		cd missing &&
+		test_commit one &&
+		git repack -ad &&
+		git multi-pack-index write &&
+		test-tool chmtime =-10 .git/objects/pack &&
+		echo two >two &&
+		oid=$(git hash-object two) &&
+		# another process packs the object between the lookups
+		mkfifo in out &&
+		{
+			git cat-file --batch-check <in >out &
+		} &&
+		exec 8>in 9<out &&
+		echo $oid >&8 &&
+		read first <&9 &&
+		git hash-object -w two &&
+		echo $oid | git pack-objects .git/objects/pack/pack &&
+		git prune-packed &&
+		test_path_is_missing .git/objects/$(echo $oid | sed "s|^..|&/|") &&
+		echo $oid >&8 &&
+		read second <&9 &&
+		exec 8>&- 9<&- &&
+		wait &&
+		test "$first" = "$oid missing" &&
+		test "$second" = "$oid blob 4"
+	)
+'
+
+test_expect_success 'packed objects of a submodule odb added later are found' '
+	test_when_finished "rm -rf super sub" &&
+	git init sub &&
+	test_commit -C sub one &&
+	git init super &&
+	(
+		cd super &&
+		git submodule add ../sub sub &&
+		git commit -m "add sub" &&
+		test_commit -C sub two &&
+		git repack -adq &&
+		git -C sub repack -adq &&
+		test-tool chmtime =-10 .git/objects/pack \
+			.git/modules/sub/objects/pack &&
+		git diff --submodule=log >actual &&
+		test_i18ngrep "^Submodule sub [0-9a-f]*\.\.[0-9a-f]*:$" actual &&
+		grep "> two" actual
+	)
+'
 
 # usage: corrupt_data <file> <pos> [<data>]
 corrupt_data () {
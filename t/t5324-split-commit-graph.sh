@@ -0,0 +1,330 @@
+#!/bin/sh
+
+test_description='split commit graph'
+. ./test-lib.sh
+
+GIT_TEST_COMMIT_GRAPH=0
+GIT_TEST_COMMIT_GRAPH_CHANGED_PATHS=0
+
+test_expect_success 'setup repo' '
+	git init &&
+	git config core.commitGraph true &&
+	infodir=".git/objects/info" &&
+	graphdir="$infodir/commit-graphs"
+'
+
+graph_read_expect() {
+	NUM_BASE=0
+	NUM_CHUNKS=3
+	OPTIONAL=""
+	if test ! -z $2
+	then
+		NUM_BASE=$2
+		NUM_CHUNKS=4
+		OPTIONAL=" base_graphs"
+	fi
+	cat >expect <<- EOF
+	header: 43475048 1 1 $NUM_CHUNKS $NUM_BASE
+	num_commits: $1
+	chunks: oid_fanout oid_lookup commit_metadata$OPTIONAL
+	EOF
+	git commit-graph read >output &&
+	test_cmp expect output
+}
+
+test_expect_success 'create commits and write commit-graph' '
+	for i in $(test_seq 3)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git commit-graph write --reachable &&
+	test_path_is_file $infodir/commit-graph &&
+	graph_read_expect 3
+'
+
+graph_git_two_modes() {
+	git -c core.commitGraph=true $1 >output
+	git -c core.commitGraph=false $1 >expect
+	test_cmp expect output
+}
+
+graph_git_behavior() {
+	MSG=$1
+	BRANCH=$2
+	COMPARE=$3
+	test_expect_success "check normal git operations: $MSG" '
+		graph_git_two_modes "log --oneline $BRANCH" &&
+		graph_git_two_modes "log --topo-order $BRANCH" &&
+		graph_git_two_modes "log --graph $COMPARE..$BRANCH" &&
+		graph_git_two_modes "branch -vv" &&
+		graph_git_two_modes "merge-base -a $BRANCH $COMPARE"
+	'
+}
+
+graph_git_behavior 'graph exists' commits/3 commits/1
+
+verify_chain_files_exist() {
+	for hash in $(cat $1/commit-graph-chain)
+	do
+		test_path_is_file $1/graph-$hash.graph || return 1
+	done
+}
+
+test_expect_success 'add more commits, and write a new base graph' '
+	git reset --hard commits/1 &&
+	for i in $(test_seq 4 5)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git reset --hard commits/2 &&
+	for i in $(test_seq 6 10)
+	do
+		test_commit $i &&
+		git branch commits/$i || return 1
+	done &&
+	git reset --hard commits/2 &&
+	git merge commits/4 &&
+	git branch merge/1 &&
+	git reset --hard commits/4 &&
+	git merge commits/6 &&
+	git branch merge/2 &&
+	git commit-graph write --reachable &&
+	graph_read_expect 12
+'
+
+test_expect_success 'fork and fail to base a chain on a commit-graph file' '
+	test_when_finished rm -rf fork &&
+	git clone . fork &&
+	(
+		cd fork &&
+		rm .git/objects/info/commit-graph &&
+		echo "$(pwd)/../.git/objects" >.git/objects/info/alternates &&
+		test_commit new-commit &&
+		git commit-graph write --reachable --split &&
+		test_path_is_file $graphdir/commit-graph-chain &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		verify_chain_files_exist $graphdir
+	)
+'
+
+test_expect_success 'add three more commits, write a tip graph' '
+	git reset --hard commits/3 &&
+	git merge merge/1 &&
+	git merge commits/5 &&
+	git merge merge/2 &&
+	git branch merge/3 &&
+	git commit-graph write --reachable --split &&
+	test_path_is_missing $infodir/commit-graph &&
+	test_path_is_file $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 2 graph-files &&
+	verify_chain_files_exist $graphdir
+'
+
+graph_git_behavior 'split commit-graph: merge 3 vs 2' merge/3 merge/2
+
+test_expect_success 'add one commit, write a tip graph' '
+	test_commit 11 &&
+	git branch commits/11 &&
+	git commit-graph write --reachable --split &&
+	test_path_is_missing $infodir/commit-graph &&
+	test_path_is_file $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 3 graph-files &&
+	verify_chain_files_exist $graphdir &&
+	graph_read_expect 1 2
+'
+
+graph_git_behavior 'three-layer commit-graph: commit 11 vs 6' commits/11 commits/6
+
+test_expect_success 'writing without new commits leaves the chain alone' '
+	cp $graphdir/commit-graph-chain chain-before &&
+	git commit-graph write --reachable --split &&
+	test_cmp chain-before $graphdir/commit-graph-chain
+'
+
+test_expect_success 'add one commit, write a merged graph' '
+	test_commit 12 &&
+	git branch commits/12 &&
+	git commit-graph write --reachable --split &&
+	test_path_is_file $graphdir/commit-graph-chain &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 2 graph-files &&
+	verify_chain_files_exist $graphdir
+'
+
+graph_git_behavior 'merged commit-graph: commit 12 vs 6' commits/12 commits/6
+
+test_expect_success 'create fork and chain across alternate' '
+	git clone . fork &&
+	(
+		cd fork &&
+		git config core.commitGraph true &&
+		rm -rf $graphdir &&
+		echo "$(pwd)/../.git/objects" >.git/objects/info/alternates &&
+		test_commit 13 &&
+		git branch commits/13 &&
+		git commit-graph write --reachable --split &&
+		test_path_is_file $graphdir/commit-graph-chain &&
+		test_line_count = 1 $graphdir/commit-graph-chain &&
+		git -c core.commitGraph=true rev-list HEAD >expect &&
+		git -c core.commitGraph=false rev-list HEAD >actual &&
+		test_cmp expect actual &&
+		git commit-graph verify
+	)
+'
+
+test_expect_success '--size-multiple merges more layers' '
+	test_commit 14 &&
+	git commit-graph write --reachable --split --size-multiple=2 &&
+	test_line_count = 3 $graphdir/commit-graph-chain &&
+	test_commit 15 &&
+	git commit-graph write --reachable --split --size-multiple=100 &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	verify_chain_files_exist $graphdir &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'after --size-multiple' HEAD commits/6
+
+test_expect_success '--max-commits forces a merge' '
+	for i in $(test_seq 16 19)
+	do
+		test_commit $i || return 1
+	done &&
+	git commit-graph write --reachable --split --size-multiple=1 &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	for i in $(test_seq 20 23)
+	do
+		test_commit $i || return 1
+	done &&
+	git commit-graph write --reachable --split --size-multiple=1 --max-commits=2 &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	git commit-graph verify
+'
+
+test_expect_success '--expire-time keeps recent unreferenced layers' '
+	test_commit 24 &&
+	git commit-graph write --reachable --split &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	tip=$(tail -n 1 $graphdir/commit-graph-chain) &&
+	test_commit 25 &&
+	git commit-graph write --reachable --split --size-multiple=100 \
+		--expire-time="1 day ago" &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	test_path_is_file $graphdir/graph-$tip.graph &&
+	test-tool chmtime =-172800 $graphdir/graph-$tip.graph &&
+	test_commit 26 &&
+	git commit-graph write --reachable --split --size-multiple=100 \
+		--expire-time="1 day ago" &&
+	test_path_is_missing $graphdir/graph-$tip.graph &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 3 graph-files &&
+	test_commit 27 &&
+	git commit-graph write --reachable --split --size-multiple=100 &&
+	ls $graphdir/graph-*.graph >graph-files &&
+	test_line_count = 1 graph-files
+'
+
+test_expect_success 'octopus merges across layers' '
+	for b in a b c
+	do
+		git checkout -b side/$b commits/1 &&
+		test_commit octopus-$b || return 1
+	done &&
+	git commit-graph write --reachable --split --size-multiple=100 &&
+	test_line_count = 1 $graphdir/commit-graph-chain &&
+	git checkout -b octopus side/a &&
+	git merge side/b side/c -m octopus &&
+	git commit-graph write --reachable --split --size-multiple=1 &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	git commit-graph read >output &&
+	grep "large_edges" output &&
+	git commit-graph verify
+'
+
+graph_git_behavior 'octopus merge in tip layer' octopus commits/6
+
+test_expect_success 'verify reports a corrupt layer' '
+	test_when_finished "rm -rf corrupt" &&
+	git clone --no-hardlinks . corrupt &&
+	(
+		cd corrupt &&
+		cp ../$graphdir/* $graphdir/ &&
+		tip=$(tail -n 1 $graphdir/commit-graph-chain) &&
+		chmod u+w $graphdir/graph-$tip.graph &&
+		printf "\377" |
+		dd of=$graphdir/graph-$tip.graph bs=1 seek=1200 conv=notrunc &&
+		test_must_fail git commit-graph verify 2>err &&
+		test_i18ngrep "incorrect checksum" err
+	)
+'
+
+test_expect_success 'a chain with a missing layer uses the valid base' '
+	test_when_finished "rm -rf missing" &&
+	git clone --no-hardlinks . missing &&
+	(
+		cd missing &&
+		mkdir -p $graphdir &&
+		cp ../$graphdir/* $graphdir/ &&
+		tip=$(tail -n 1 $graphdir/commit-graph-chain) &&
+		rm $graphdir/graph-$tip.graph &&
+		git -c core.commitGraph=true rev-list --all >actual 2>err &&
+		test_i18ngrep "unable to find all commit-graph files" err &&
+		git -c core.commitGraph=false rev-list --all >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'a chain with a bad line is ignored past that line' '
+	test_when_finished "rm -rf badline" &&
+	git clone --no-hardlinks . badline &&
+	(
+		cd badline &&
+		mkdir -p $graphdir &&
+		cp ../$graphdir/* $graphdir/ &&
+		echo "not-a-hash" >>$graphdir/commit-graph-chain &&
+		git -c core.commitGraph=true rev-list --all >actual 2>err &&
+		test_i18ngrep "not a hash" err &&
+		git -c core.commitGraph=false rev-list --all >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'changed-path Bloom filters are read from every layer' '
+	git commit-graph write --reachable --changed-paths &&
+	test_commit 28 &&
+	git commit-graph write --reachable --split --changed-paths &&
+	test_line_count = 2 $graphdir/commit-graph-chain &&
+	git -c core.commitGraph=false log --oneline -- 5.t >expect &&
+	GIT_TRACE_BLOOM_STATS="$(pwd)/trace" \
+		git -c core.commitGraph=true log --oneline -- 5.t >actual &&
+	test_cmp expect actual &&
+	grep "definitely not: [1-9]" trace
+'
+
+test_expect_success 'non-split write replaces the chain' '
+	git commit-graph write --reachable &&
+	test_path_is_file $infodir/commit-graph &&
+	test_path_is_missing $graphdir/commit-graph-chain &&
+	ls $graphdir >graph-files &&
+	test_must_be_empty graph-files &&
+	git commit-graph verify
+'
+
+test_expect_success 'non-split write respects the lock of the chain' '
+	test_commit 29 &&
+	git commit-graph write --reachable --split &&
+	cp $graphdir/commit-graph-chain chain-before &&
+	>$graphdir/commit-graph-chain.lock &&
+	test_must_fail git commit-graph write --reachable &&
+	rm $graphdir/commit-graph-chain.lock &&
+	test_path_is_missing $infodir/commit-graph &&
+	test_cmp chain-before $graphdir/commit-graph-chain &&
+	git commit-graph verify
+'
+
+test_done
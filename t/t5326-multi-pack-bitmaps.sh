@@ -0,0 +1,146 @@
+#!/bin/sh
+
+test_description='exercise reachability bitmaps over a multi-pack-index'
+. ./test-lib.sh
+
+midx_bitmaps () {
+	ls .git/objects/pack/ | sed -n "/^multi-pack-index-.*\.bitmap$/p"
+}
+
+test_expect_success 'setup history spread over several packs' '
+	git config core.multiPackIndex true &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit $i
+	done &&
+	git repack -d &&
+	git checkout -b other HEAD~3 &&
+	for i in $(test_seq 1 5)
+	do
+		test_commit side-$i
+	done &&
+	git repack -d &&
+	git checkout master &&
+	for i in $(test_seq 6 10)
+	do
+		test_commit $i
+	done &&
+	blob=$(echo tagged-blob | git hash-object -w --stdin) &&
+	git tag tagged-blob $blob &&
+	git repack -d &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 3 packs
+'
+
+test_expect_success 'write a multi-pack bitmap' '
+	git multi-pack-index write --bitmap &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	! ls .git/objects/pack/pack-*.bitmap
+'
+
+test_expect_success 'rev-list --test-bitmap verifies the multi-pack bitmap' '
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "^OK!" err
+'
+
+rev_list_tests () {
+	state=$1
+
+	test_expect_success "counting commits via bitmap ($state)" '
+		git rev-list --count HEAD >expect &&
+		git rev-list --use-bitmap-index --count HEAD >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "counting non-linear history ($state)" '
+		git rev-list --count other...master >expect &&
+		git rev-list --use-bitmap-index --count other...master >actual &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD >tmp &&
+		cut -d" " -f1 <tmp | sort >actual &&
+		git rev-list --objects HEAD >tmp &&
+		cut -d" " -f1 <tmp | sort >expect &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "enumerate --objects with haves ($state)" '
+		git rev-list --objects --use-bitmap-index other..HEAD >tmp &&
+		cut -d" " -f1 <tmp | sort >actual &&
+		git rev-list --objects other..HEAD >tmp &&
+		cut -d" " -f1 <tmp | sort >expect &&
+		test_cmp expect actual
+	'
+
+	test_expect_success "bitmap --objects handles non-commit objects ($state)" '
+		git rev-list --objects --use-bitmap-index HEAD tagged-blob >actual &&
+		grep $blob actual
+	'
+}
+
+rev_list_tests 'full bitmap'
+
+test_expect_success 'clone from a repository with a multi-pack bitmap' '
+	git clone --no-local --bare . clone.git &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'setup further commits outside of the multi-pack-index' '
+	for i in $(test_seq 1 5)
+	do
+		test_commit further-$i
+	done
+'
+
+rev_list_tests 'partial bitmap'
+
+test_expect_success 'fetch (partial bitmap)' '
+	git --git-dir=clone.git fetch origin master:master &&
+	git rev-parse HEAD >expect &&
+	git --git-dir=clone.git rev-parse HEAD >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'refs outside of the multi-pack-index are not bitmapped' '
+	git multi-pack-index write --bitmap &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	git rev-list --test-bitmap master~5 2>err &&
+	grep "^OK!" err &&
+	test_must_fail git rev-list --test-bitmap master 2>err &&
+	test_i18ngrep "doesn.t have an indexed bitmap" err
+'
+
+test_expect_success 'new packs get a new multi-pack bitmap' '
+	old=$(midx_bitmaps) &&
+	git repack -d &&
+	git multi-pack-index write --bitmap &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 1 bitmaps &&
+	! grep "$old" bitmaps &&
+	git rev-list --test-bitmap master 2>err &&
+	grep "^OK!" err
+'
+
+test_expect_success 'writing without --bitmap removes the stale bitmap' '
+	test_commit stale &&
+	git repack -d &&
+	git multi-pack-index write &&
+	midx_bitmaps >bitmaps &&
+	test_line_count = 0 bitmaps
+'
+
+test_expect_success 'single-pack bitmaps are still used without a multi-pack bitmap' '
+	git repack -adb &&
+	git rev-list --test-bitmap HEAD 2>err &&
+	grep "^OK!" err
+'
+
+test_done
@@ -0,0 +1,91 @@
+#!/bin/sh
+
+test_description='pack sizes tables'
+. ./test-lib.sh
+
+batch_check () {
+	git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize) %(deltabase)"
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		test_seq 1 $((50 * $i)) >file &&
+		git add file &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -adf &&
+	batch_check >expect &&
+	grep -v " $ZERO_OID\$" expect &&
+	find .git/objects/pack -name "*.sizes" >sizes &&
+	test_line_count = 0 sizes
+'
+
+test_expect_success 'repack writes a sizes table with pack.writeSizes' '
+	git -c pack.writeSizes=true repack -adf &&
+	find .git/objects/pack -name "*.sizes" >sizes &&
+	test_line_count = 1 sizes &&
+	batch_check >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the table is not reported as garbage' '
+	git count-objects -v >counts &&
+	grep "^garbage: 0" counts
+'
+
+test_expect_success 'index-pack writes a sizes table with pack.writeSizes' '
+	git -c pack.writeSizes=true clone --no-local --bare . clone.git &&
+	find clone.git/objects/pack -name "*.sizes" >sizes &&
+	test_line_count = 1 sizes &&
+	batch_check >expect &&
+	git -C clone.git cat-file --batch-all-objects \
+		--batch-check="%(objectname) %(objecttype) %(objectsize)" >actual &&
+	cut -d" " -f1-3 expect >expect.nobase &&
+	test_cmp expect.nobase actual
+'
+
+test_expect_success 'object info is answered without reading the objects' '
+	(
+		cd clone.git &&
+		git cat-file --batch-all-objects \
+			--batch-check="%(objectname) %(objecttype) %(objectsize) %(deltabase)" >../expect.clone &&
+		pack=$(ls objects/pack/*.pack) &&
+		blob=$(git rev-parse HEAD:file) &&
+		ofs=$(git show-index <${pack%.pack}.idx | grep $blob | cut -d" " -f1) &&
+		chmod +w $pack &&
+		printf "\0\0\0\0" | dd of=$pack bs=1 conv=notrunc seek=$ofs &&
+		test_must_fail git cat-file -p $blob &&
+		git cat-file --batch-all-objects \
+			--batch-check="%(objectname) %(objecttype) %(objectsize) %(deltabase)" >../actual
+	) &&
+	test_cmp expect.clone actual
+'
+
+test_expect_success 'repack removes the tables of redundant packs' '
+	test_commit more &&
+	git -c pack.writeSizes=true repack -ad &&
+	find .git/objects/pack -name "*.sizes" >sizes &&
+	test_line_count = 1 sizes &&
+	git repack -adf &&
+	find .git/objects/pack -name "*.sizes" >sizes &&
+	test_line_count = 0 sizes
+'
+
+test_expect_success 'a table that does not match its pack is ignored' '
+	batch_check >expect &&
+	git -c pack.writeSizes=true repack -adf &&
+	mv .git/objects/pack/*.sizes stale &&
+	git repack -adf --window=0 &&
+	pack=$(ls .git/objects/pack/*.pack) &&
+	mv stale ${pack%.pack}.sizes &&
+	batch_check >actual 2>err &&
+	cut -d" " -f1-3 expect >expect.nobase &&
+	cut -d" " -f1-3 actual >actual.nobase &&
+	test_cmp expect.nobase actual.nobase &&
+	test_i18ngrep "does not match its pack" err
+'
+
+test_done
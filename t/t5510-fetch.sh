@@ -522,6 +522,14 @@ test_expect_success 'fetch --dry-run' '
 	! test -f .git/FETCH_HEAD
 '
 
+test_expect_success 'fetch --no-write-fetch-head updates the refs only' '
+	rm -f .git/FETCH_HEAD &&
+	git update-ref -d refs/heads/fetched &&
+	git fetch --no-write-fetch-head . master:fetched &&
+	! test -f .git/FETCH_HEAD &&
+	test_cmp_rev master fetched
+'
+
 test_expect_success "should be able to fetch with duplicate refspecs" '
 	mkdir dups &&
 	(
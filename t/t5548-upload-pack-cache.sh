@@ -0,0 +1,176 @@
+#!/bin/sh
+
+test_description='upload-pack packfile cache'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git config uploadpack.packCache true
+'
+
+clone_traced () {
+	rm -rf "$1" trace &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" git clone --no-local --bare . "$1"
+}
+
+test_expect_success 'first clone stores its pack' '
+	clone_traced first.git &&
+	grep "pack-cache: miss" trace &&
+	grep "pack-cache: stored" trace &&
+	ls .git/upload-pack-cache/*.pack >cached &&
+	test_line_count = 1 cached
+'
+
+test_expect_success 'identical clone is served from the cache' '
+	clone_traced second.git &&
+	grep "pack-cache: hit" trace &&
+	! grep "pack-cache: stored" trace &&
+	git -C first.git rev-list --objects --all >expect &&
+	git -C second.git rev-list --objects --all >actual &&
+	test_cmp expect actual &&
+	git -C second.git fsck
+'
+
+test_expect_success 'cached packs are shared by both protocol versions' '
+	rm -rf v2.git trace &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" \
+		git -c protocol.version=2 clone --no-local --bare . v2.git &&
+	grep "pack-cache: hit" trace &&
+	git -C v2.git fsck
+'
+
+test_expect_success 'updating a ref invalidates the cache' '
+	git tag extra one &&
+	clone_traced third.git &&
+	grep "pack-cache: miss" trace &&
+	grep "pack-cache: stored" trace &&
+	git -C third.git rev-parse --verify refs/tags/extra
+'
+
+fetch_traced () {
+	rm -f trace &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" git -C "$1" fetch --no-tags .. "$2"
+}
+
+test_expect_success 'fetches are cached by their wants and haves' '
+	test_commit three &&
+	git init --bare a.git &&
+	fetch_traced a.git two:refs/heads/old &&
+	grep "pack-cache: stored" trace &&
+	fetch_traced a.git master:refs/heads/new &&
+	grep "pack-cache: stored" trace &&
+	git init --bare b.git &&
+	fetch_traced b.git two:refs/heads/old &&
+	grep "pack-cache: hit" trace &&
+	fetch_traced b.git master:refs/heads/new &&
+	grep "pack-cache: hit" trace &&
+	git -C b.git fsck
+'
+
+# Send a protocol v2 fetch request with the given lines after the
+# delimiter, and report in "trace" what the pack cache did.
+fetch_request () {
+	{
+		echo command=fetch &&
+		echo 0001 &&
+		echo no-progress &&
+		cat &&
+		echo done &&
+		echo 0000
+	} | test-pkt-line pack >request &&
+	rm -f trace &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" \
+		git serve --stateless-rpc <request >response
+}
+
+test_expect_success 'the order of wants and haves does not matter' '
+	rm -rf .git/upload-pack-cache &&
+	fetch_request <<-EOF &&
+	want $(git rev-parse three)
+	want $(git rev-parse two)
+	have $(git rev-parse one)
+	have $(git rev-parse two)
+	EOF
+	grep "pack-cache: stored" trace &&
+	fetch_request <<-EOF &&
+	want $(git rev-parse two)
+	want $(git rev-parse three)
+	want $(git rev-parse three)
+	have $(git rev-parse two)
+	have $(git rev-parse one)
+	EOF
+	grep "pack-cache: hit" trace
+'
+
+test_expect_success 'equivalent filters share a cached pack' '
+	test_config uploadpack.allowFilter true &&
+	fetch_request <<-EOF &&
+	want $(git rev-parse three)
+	filter blob:limit=1k
+	EOF
+	grep "pack-cache: stored" trace &&
+	fetch_request <<-EOF &&
+	want $(git rev-parse three)
+	filter blob:limit=1024
+	EOF
+	grep "pack-cache: hit" trace &&
+	fetch_request <<-EOF &&
+	want $(git rev-parse three)
+	filter blob:none
+	EOF
+	grep "pack-cache: stored" trace
+'
+
+test_expect_success 'expired packs are not used and get pruned' '
+	clone_traced fourth.git &&
+	test-tool chmtime =-7200 .git/upload-pack-cache/*.pack &&
+	clone_traced fifth.git &&
+	grep "pack-cache: expired" trace &&
+	grep "pack-cache: stored" trace &&
+	ls .git/upload-pack-cache/*.pack >cached &&
+	test_line_count = 1 cached
+'
+
+test_expect_success 'packCacheMaxAge=0 keeps packs forever' '
+	test-tool chmtime =-7200 .git/upload-pack-cache/*.pack &&
+	rm -rf sixth.git trace &&
+	GIT_TRACE_PACK_CACHE="$(pwd)/trace" \
+		git -c uploadpack.packCacheMaxAge=0 \
+		clone -u "git -c uploadpack.packCacheMaxAge=0 upload-pack" \
+		--no-local --bare . sixth.git &&
+	grep "pack-cache: hit" trace
+'
+
+test_expect_success 'packs larger than packCacheMaxSize are not cached' '
+	rm -rf .git/upload-pack-cache &&
+	test_config uploadpack.packCacheMaxSize 10 &&
+	clone_traced seventh.git &&
+	! grep "pack-cache: stored" trace &&
+	ls .git/upload-pack-cache >cached &&
+	test_must_be_empty cached
+'
+
+test_expect_success 'oldest packs are pruned above packCacheMaxSize' '
+	rm -rf .git/upload-pack-cache &&
+	clone_traced eighth.git &&
+	test-tool chmtime =-60 .git/upload-pack-cache/*.pack &&
+	size=$(cat .git/upload-pack-cache/*.pack | wc -c) &&
+	git tag another two &&
+	test_config uploadpack.packCacheMaxSize $(($size + 10)) &&
+	clone_traced ninth.git &&
+	grep "pack-cache: stored" trace &&
+	grep "pack-cache: pruned" trace &&
+	ls .git/upload-pack-cache/*.pack >cached &&
+	test_line_count = 1 cached
+'
+
+test_expect_success 'cache is not used unless enabled' '
+	rm -rf .git/upload-pack-cache &&
+	test_config uploadpack.packCache false &&
+	clone_traced tenth.git &&
+	test_path_is_missing trace &&
+	test_path_is_missing .git/upload-pack-cache
+'
+
+test_done
@@ -700,6 +700,41 @@ test_expect_success 'batch missing blob request during checkout' '
 	test_line_count = 1 done_lines
 '
 
+test_expect_success 'batch missing blob request during diff' '
+	rm -rf client trace &&
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --no-checkout --filter=blob:limit=0 "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client diff HEAD^ HEAD >diff &&
+	grep "^+aa" diff &&
+	grep "^+bb" diff &&
+	grep "git> done" trace >done_lines &&
+	test_line_count = 1 done_lines
+'
+
+test_expect_success 'no missing blob request for a diff without contents' '
+	rm -rf client trace &&
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --no-checkout --filter=blob:limit=0 "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client diff --name-only HEAD^ HEAD &&
+	test_path_is_missing trace
+'
+
+test_expect_success 'batch missing blob request during grep' '
+	rm -rf client trace &&
+	test_config -C server uploadpack.allowfilter 1 &&
+	test_config -C server uploadpack.allowanysha1inwant 1 &&
+	git clone --no-checkout --filter=blob:limit=0 "file://$(pwd)/server" client &&
+
+	GIT_TRACE_PACKET="$(pwd)/trace" git -C client grep -e a -e b HEAD^ >out &&
+	test_line_count = 2 out &&
+	grep "git> done" trace >done_lines &&
+	test_line_count = 1 done_lines
+'
+
 test_expect_success 'batch missing blob request does not inadvertently try to fetch gitlinks' '
 	rm -rf server client &&
 
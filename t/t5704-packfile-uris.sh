@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='fetching pre-built packs advertised by protocol v2'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git bundle create base.bundle master &&
+	git rev-list --objects master >base.objects &&
+	base_tip=$(git rev-parse master) &&
+	base_hash=$(tail -c 20 base.bundle | od -An -tx1 | tr -d " \n") &&
+	test_commit three &&
+	git config uploadpack.packfileURI \
+		"$base_tip $base_hash file://$(pwd)/base.bundle"
+'
+
+test_expect_success 'server advertises packfile-uris' '
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 ls-remote --heads . >/dev/null &&
+	grep "fetch=.*packfile-uris" trace
+'
+
+test_expect_success 'clone downloads the pre-built pack' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 -c fetch.uriProtocols=file \
+		clone --no-local . clone &&
+	grep "packfile-uris file" trace &&
+	grep "$base_hash file://" trace &&
+	test_path_is_file clone/.git/objects/pack/pack-$base_hash.pack &&
+	test_path_is_missing clone/.git/objects/pack/pack-$base_hash.keep &&
+	git -C clone fsck &&
+	git -C clone rev-parse master >actual &&
+	git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'the generated pack leaves out the pre-built objects' '
+	git -C clone verify-pack -v .git/objects/pack/pack-$base_hash.idx \
+		>/dev/null &&
+	for pack in clone/.git/objects/pack/pack-*.idx
+	do
+		case "$pack" in
+		*$base_hash*)
+			;;
+		*)
+			git verify-pack -v $pack | grep -E "^[0-9a-f]{40} " |
+			cut -d" " -f1 >>generated || return 1
+			;;
+		esac
+	done &&
+	cut -d" " -f1 base.objects | sort >base &&
+	sort generated | comm -12 base - >overlap &&
+	test_must_be_empty overlap
+'
+
+test_expect_success 'clients that do not ask for URIs get a full pack' '
+	rm -rf trace plain &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 clone --no-local . plain &&
+	! grep "packfile-uris" trace | grep -v "fetch=" &&
+	test_path_is_missing plain/.git/objects/pack/pack-$base_hash.pack &&
+	git -C plain fsck
+'
+
+test_expect_success 'fetch does not download packs the client already has' '
+	test_commit four &&
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -C clone -c protocol.version=2 -c fetch.uriProtocols=file \
+		fetch origin &&
+	! grep "$base_hash file://" trace &&
+	git -C clone fsck
+'
+
+test_expect_success 'shallow clones get no URIs' '
+	rm -f trace &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 -c fetch.uriProtocols=file \
+		clone --depth=1 --no-local . shallow &&
+	! grep "$base_hash file://" trace &&
+	git -C shallow fsck
+'
+
+test_expect_success 'URIs with an unrequested protocol are not sent' '
+	rm -rf trace other &&
+	GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c protocol.version=2 -c fetch.uriProtocols=https \
+		clone --no-local . other &&
+	! grep "$base_hash file://" trace &&
+	git -C other fsck
+'
+
+test_expect_success 'a pack not matching the advertised hash is rejected' '
+	test_when_finished "git config uploadpack.packfileURI \"$base_tip $base_hash file://$(pwd)/base.bundle\"" &&
+	git config uploadpack.packfileURI \
+		"$base_tip $ZERO_OID file://$(pwd)/base.bundle" &&
+	test_must_fail git -c protocol.version=2 -c fetch.uriProtocols=file \
+		clone --no-local . mismatch 2>err &&
+	test_i18ngrep "does not match expected hash" err
+'
+
+test_expect_success 'a bundle with prerequisites is rejected' '
+	git bundle create incremental.bundle one..two &&
+	inc_hash=$(tail -c 20 incremental.bundle | od -An -tx1 | tr -d " \n") &&
+	git config uploadpack.packfileURI \
+		"$(git rev-parse two) $inc_hash file://$(pwd)/incremental.bundle" &&
+	test_must_fail git -c protocol.version=2 -c fetch.uriProtocols=file \
+		clone --no-local . incremental 2>err &&
+	test_i18ngrep "is not self-contained" err
+'
+
+test_done
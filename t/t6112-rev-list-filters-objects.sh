@@ -195,6 +195,35 @@ test_expect_success 'verify sparse:oid=oid-ish omits top-level files' '
 	test_cmp observed expected
 '
 
+# Test tree:0 filter.
+
+test_expect_success 'verify tree:0 omits all trees and blobs' '
+	git -C r3 rev-list HEAD --objects --filter=tree:0 \
+		| awk -f print_1.awk \
+		| sort >observed &&
+	git -C r3 rev-list HEAD \
+		| sort >expected &&
+	test_cmp observed expected
+'
+
+test_expect_success 'verify tree:0 emitted+omitted == all' '
+	git -C r3 rev-list HEAD --objects \
+		| awk -f print_1.awk \
+		| sort >expected &&
+	git -C r3 rev-list HEAD --objects --filter-print-omitted --filter=tree:0 \
+		| awk -f print_1.awk \
+		| sed "s/~//" \
+		| sort >observed &&
+	test_cmp observed expected
+'
+
+test_expect_success 'verify tree:0 keeps explicitly given trees' '
+	git -C r3 rev-list --objects --filter=tree:0 HEAD^{tree} \
+		| awk -f print_1.awk >observed &&
+	git -C r3 rev-parse HEAD^{tree} >expected &&
+	test_cmp observed expected
+'
+
 # Delete some loose objects and use rev-list, but WITHOUT any filtering.
 # This models previously omitted objects that we did not receive.
 
@@ -0,0 +1,70 @@
+#!/bin/sh
+
+test_description='rev-list combining bitmaps and filters'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir dir &&
+	for i in 1 2 3 4 5
+	do
+		test_seq 1 $((100 * $i)) >dir/file &&
+		echo "small $i" >small &&
+		git add dir/file small &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -adb &&
+	test_commit loose-commit
+'
+
+# The bitmap walk does not list the objects in the same order, nor
+# with their path, so only compare the sorted object names.
+compare_filter () {
+	git rev-list --objects --filter="$1" "$2" >expect.raw &&
+	cut -d" " -f1 expect.raw | sort >expect &&
+	git rev-list --objects --use-bitmap-index --filter="$1" "$2" >actual.raw &&
+	cut -d" " -f1 actual.raw | sort >actual &&
+	test_cmp expect actual
+}
+
+for filter in blob:none blob:limit=0 blob:limit=10 blob:limit=1k tree:0
+do
+	test_expect_success "bitmap walk with $filter" '
+		compare_filter $filter HEAD &&
+		compare_filter $filter "HEAD~2..HEAD"
+	'
+done
+
+test_expect_success 'filters do not apply to the requested objects' '
+	compare_filter blob:none HEAD:small &&
+	compare_filter tree:0 HEAD^{tree} &&
+	git rev-parse HEAD:small >expect &&
+	git rev-list --objects --use-bitmap-index --filter=blob:none \
+		HEAD:small >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'sizes come from the sizes table when there is one' '
+	git -c pack.writeSizes=true repack -adb &&
+	find .git/objects/pack -name "*.sizes" >sizes &&
+	test_line_count = 1 sizes &&
+	compare_filter blob:limit=1k HEAD
+'
+
+test_expect_success 'unsupported filters fall back to a regular walk' '
+	echo small >pattern &&
+	git hash-object -w -t blob pattern >pattern.oid &&
+	compare_filter sparse:oid=$(cat pattern.oid) HEAD
+'
+
+test_expect_success 'partial clone from a bitmapped repository' '
+	git config uploadpack.allowFilter true &&
+	git repack -adb &&
+	git clone --no-local --bare --filter=blob:none . partial.git &&
+	git -C partial.git cat-file --batch-check="%(objecttype)" \
+		--batch-all-objects >partial-types &&
+	! grep blob partial-types &&
+	grep tree partial-types
+'
+
+test_done
@@ -0,0 +1,91 @@
+#!/bin/sh
+
+test_description='git status looking for untracked files in threads'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	cat >.gitignore <<-\EOF &&
+	*.ign
+	/expect*
+	/actual*
+	/trace
+	/main-trace
+	EOF
+	for d in a b c d e f g h
+	do
+		mkdir -p $d/sub/deeper &&
+		echo $d >$d/tracked &&
+		echo $d >$d/sub/tracked &&
+		echo "*.local" >$d/.gitignore || return 1
+	done &&
+	git add . &&
+	git commit -m initial &&
+	for d in a b c d e f g h
+	do
+		echo untracked >$d/untracked &&
+		echo ignored >$d/sub/file.ign &&
+		echo ignored >$d/sub/deeper/file.local &&
+		echo untracked >$d/sub/deeper/untracked &&
+		mkdir $d/only-untracked &&
+		echo untracked >$d/only-untracked/file || return 1
+	done &&
+	echo changed >>b/tracked &&
+	echo changed >>c/sub/tracked &&
+	git add c/sub/tracked &&
+	git rm -q --cached d/tracked &&
+	mkdir top-untracked &&
+	echo untracked >top-untracked/file &&
+	echo untracked >top-file &&
+	git init nested &&
+	test_commit -C nested nested
+'
+
+for opts in "" "-uall" "-uno" "--ignored" "--ignored=matching -uall" \
+	    "--ignored=no" "-- b c/sub"
+do
+	test_expect_success "status $opts is the same with threads" '
+		git -c status.threads=1 status --porcelain=v2 $opts >expect &&
+		git -c status.threads=4 status --porcelain=v2 $opts >actual &&
+		test_cmp expect actual
+	'
+done
+
+test_expect_success 'status reads the working tree in threads' '
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git -c status.threads=3 status >/dev/null &&
+	grep "\"event\":\"thread_start\",.*\"thread\":\"th[0-9]*:untracked\"" trace &&
+	grep "\"event\":\"thread_start\",.*\"thread\":\"th[0-9]*:read_directory\"" trace >threads &&
+	test_line_count = 3 threads &&
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" git -c status.threads=false status >/dev/null &&
+	! grep "\"event\":\"thread_start\"" trace
+'
+
+test_expect_success 'status with the untracked cache and threads' '
+	test_config core.untrackedCache true &&
+	git -c status.threads=1 status --porcelain=v2 >expect &&
+	git -c status.threads=4 status --porcelain=v2 >actual &&
+	test_cmp expect actual &&
+	git -c status.threads=4 status --porcelain=v2 >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'untracked files are not looked for alongside submodules' '
+	git init sub-repo &&
+	test_commit -C sub-repo sub &&
+	git submodule add ./sub-repo sub &&
+	echo changed >sub/sub.t &&
+	git -c status.threads=1 status --porcelain=v2 >expect &&
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" \
+		git -c status.threads=3 status --porcelain=v2 >actual &&
+	test_cmp expect actual &&
+	# leave out the "git status" run in the submodule
+	pid=$(sed -n "1s/.*\"pid\":\([0-9]*\).*/\1/p" trace) &&
+	grep "\"pid\":$pid," trace >main-trace &&
+	grep "\"argv\":.*\"status\"" main-trace &&
+	! grep "\"thread\":\"th[0-9]*:untracked\"" main-trace
+'
+
+test_done
@@ -0,0 +1,102 @@
+#!/bin/sh
+
+test_description='git status with the built-in fsmonitor daemon'
+
+. ./test-lib.sh
+
+test -z "$NO_UNIX_SOCKETS" && test -n "$HAVE_INOTIFY" || {
+	skip_all='skipping fsmonitor daemon tests, inotify or unix sockets not available'
+	test_done
+}
+
+# don't leave a stale daemon running
+trap 'code=$?; git -C "$TRASH_DIRECTORY" fsmonitor--daemon stop 2>/dev/null; (exit $code); die' EXIT
+
+# Check that "git status" gives the same answer with and without the daemon.
+test_status_matches () {
+	git -c core.fsmonitor= status --porcelain "$@" >expect &&
+	git status --porcelain "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	mkdir -p dir1/sub dir2 &&
+	for f in file dir1/file dir1/sub/file dir2/file
+	do
+		echo "$f" >$f || return 1
+	done &&
+	cat >.gitignore <<-\EOF &&
+	.gitignore
+	expect*
+	actual*
+	trace
+	EOF
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git config core.fsmonitor true &&
+	git update-index --fsmonitor &&
+	test -S .git/fsmonitor--daemon.ipc
+'
+
+test_expect_success 'status sees modified, new and deleted files' '
+	echo changed >dir1/file &&
+	echo new >dir2/new &&
+	rm dir1/sub/file &&
+	test_status_matches &&
+	test_status_matches -uall
+'
+
+test_expect_success 'only changed paths are reported' '
+	git status >/dev/null &&
+	echo changed-again >file &&
+	GIT_TRACE_FSMONITOR="$(pwd)/trace" git status >/dev/null &&
+	grep "fsmonitor_refresh_callback .file." trace &&
+	! grep "fsmonitor_refresh_callback .dir2/file." trace
+'
+
+test_expect_success 'renamed and removed directories' '
+	git status >/dev/null &&
+	mv dir1 renamed &&
+	test_status_matches -uall &&
+	rm -r renamed &&
+	test_status_matches -uall &&
+	mkdir -p dir1/sub &&
+	echo new >dir1/sub/new &&
+	test_status_matches -uall
+'
+
+test_expect_success 'status with the untracked cache' '
+	git config core.untrackedCache true &&
+	git status >/dev/null &&
+	echo untracked >dir2/untracked &&
+	test_status_matches &&
+	rm dir2/untracked &&
+	test_status_matches
+'
+
+test_expect_success 'the daemon is restarted if it was stopped' '
+	git fsmonitor--daemon stop &&
+	test_path_is_missing .git/fsmonitor--daemon.ipc &&
+	echo restart >dir2/file &&
+	test_status_matches &&
+	test -S .git/fsmonitor--daemon.ipc &&
+	echo again >dir2/file &&
+	test_status_matches
+'
+
+test_expect_success 'nothing is stored when the daemon cannot be reached' '
+	git fsmonitor--daemon stop &&
+	# a directory in the way of the socket keeps a new daemon from starting
+	mkdir .git/fsmonitor--daemon.ipc &&
+	echo unreachable >dir2/file &&
+	git status >/dev/null 2>err &&
+	test-dump-fsmonitor >out &&
+	grep "no fsmonitor" out &&
+	rmdir .git/fsmonitor--daemon.ipc &&
+	test_status_matches &&
+	test-dump-fsmonitor >out &&
+	grep "fsmonitor last update" out
+'
+
+test_done
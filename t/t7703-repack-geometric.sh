@@ -0,0 +1,151 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+objdir=.git/objects
+packdir=$objdir/pack
+
+# Make <n> commits, and pack their new objects in a pack of their own,
+# with 3 objects per commit.
+make_pack () {
+	for i in $(test_seq 1 $1)
+	do
+		test_commit "$2-$i" >/dev/null || return 1
+	done &&
+	git repack -d -q
+}
+
+test_expect_success '--geometric with no packs' '
+	git init none &&
+	git -C none repack --geometric 2 -d >out &&
+	test_i18ngrep "Nothing new to pack" out
+'
+
+test_expect_success '--geometric with an intact progression' '
+	git init intact &&
+	(
+		cd intact &&
+		make_pack 1 small &&
+		make_pack 3 medium &&
+		make_pack 6 large &&
+
+		ls $packdir/*.pack | sort >expect &&
+		git repack --geometric 2 -d &&
+		ls $packdir/*.pack | sort >actual &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success '--geometric with small packs' '
+	git init small &&
+	(
+		cd small &&
+		make_pack 1 one &&
+		make_pack 1 two &&
+		make_pack 1 three &&
+
+		git repack --geometric 2 -d &&
+		ls $packdir/*.idx >idx &&
+		test_line_count = 1 idx &&
+		git show-index <$(cat idx) >objects &&
+		test_line_count = 9 objects
+	)
+'
+
+test_expect_success '--geometric leaves the largest pack alone' '
+	git init large &&
+	(
+		cd large &&
+		make_pack 10 large &&
+		ls $packdir/*.pack >large &&
+		make_pack 1 one &&
+		make_pack 1 two &&
+		test_commit loose &&
+
+		git repack --geometric 2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep "$(cat large)" packs &&
+		for idx in $packdir/*.idx
+		do
+			git show-index <$idx | wc -l || return 1
+		done | sort -n >counts &&
+		test_write_lines 9 30 >expect &&
+		test_cmp expect counts &&
+		git count-objects -v >count &&
+		grep "^count: 0" count
+	)
+'
+
+test_expect_success '--geometric rolls up the larger packs that violate the progression' '
+	git init violate &&
+	(
+		cd violate &&
+		make_pack 3 medium &&
+		make_pack 1 one &&
+		make_pack 1 two &&
+
+		git repack --geometric 2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 1 packs
+	)
+'
+
+test_expect_success '--geometric keeps the unreachable objects of the rolled up packs' '
+	git init unreachable &&
+	(
+		cd unreachable &&
+		make_pack 1 one &&
+		blob=$(echo unreachable | git hash-object -w --stdin) &&
+		echo $blob | git pack-objects -q $packdir/pack &&
+		git prune-packed &&
+		make_pack 1 two &&
+
+		git repack --geometric 2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git cat-file -e $blob
+	)
+'
+
+test_expect_success '--geometric leaves the kept packs alone' '
+	git init kept &&
+	(
+		cd kept &&
+		make_pack 1 one &&
+		pack=$(ls $packdir/*.pack) &&
+		touch ${pack%.pack}.keep &&
+		make_pack 1 two &&
+		make_pack 1 three &&
+
+		git repack --geometric 2 -d &&
+		ls $packdir/*.pack >packs &&
+		test_line_count = 2 packs &&
+		grep "$pack" packs &&
+		git rev-list --objects --all >objects &&
+		test_line_count = 9 objects
+	)
+'
+
+test_expect_success '--geometric writes a multi-pack-index' '
+	(
+		cd large &&
+		test_path_is_file $packdir/multi-pack-index &&
+		test-tool read-midx $objdir >midx &&
+		grep "^num_objects: 39$" midx &&
+		grep "^pack-.*\.idx$" midx >midx-packs &&
+		test_line_count = 2 midx-packs &&
+		git -c core.multiPackIndex rev-list --objects --all >objects &&
+		test_line_count = 39 objects
+	)
+'
+
+test_expect_success '--geometric is incompatible with -a' '
+	test_must_fail git -C small repack --geometric 2 -a -d 2>err &&
+	test_i18ngrep "incompatible" err &&
+	test_must_fail git -C small repack --geometric 1 -d
+'
+
+test_done
@@ -919,6 +919,16 @@ do
 	"
 done
 
+test_expect_success 'grep --threads=N in revisions' '
+	git grep --threads=1 -n -C1 e HEAD HEAD: >expect &&
+	test_line_count -gt 10 expect &&
+	git grep --threads=8 -n -C1 e HEAD HEAD: >actual &&
+	test_cmp expect actual &&
+	git grep --threads=8 -c e HEAD >actual &&
+	git grep --threads=1 -c e HEAD >expect &&
+	test_cmp expect actual
+'
+
 test_expect_success !PTHREADS,C_LOCALE_OUTPUT 'grep --threads=N or pack.threads=N warns when no pthreads' '
 	git grep --threads=2 Hello hello_world 2>err &&
 	grep ^warning: err >warnings &&
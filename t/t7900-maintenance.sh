@@ -0,0 +1,315 @@
+#!/bin/sh
+
+test_description='git maintenance builtin'
+
+. ./test-lib.sh
+
+# The "git" commands run by the maintenance tasks, from a GIT_TRACE file,
+# together with those which they run themselves.
+subcommands () {
+	sed -n "s/.*run_command: git //p" "$1"
+}
+
+test_expect_success 'help text' '
+	test_expect_code 129 git maintenance -h >err 2>&1 &&
+	test_i18ngrep "usage: git maintenance run" err &&
+	test_expect_code 129 git maintenance barf >err 2>&1 &&
+	test_i18ngrep "usage: git maintenance run" err &&
+	test_expect_code 129 git maintenance run -h >err 2>&1 &&
+	test_i18ngrep "usage: git maintenance run" err
+'
+
+test_expect_success 'run [--auto|--quiet]' '
+	GIT_TRACE="$(pwd)/run-no-auto.txt" git maintenance run 2>/dev/null &&
+	GIT_TRACE="$(pwd)/run-auto.txt" git maintenance run --auto 2>/dev/null &&
+	GIT_TRACE="$(pwd)/run-no-quiet.txt" git maintenance run --no-quiet 2>/dev/null &&
+	subcommands run-no-auto.txt >actual &&
+	grep "^gc --quiet$" actual &&
+	subcommands run-auto.txt >actual &&
+	test_must_be_empty actual &&
+	subcommands run-no-quiet.txt >actual &&
+	grep "^gc$" actual
+'
+
+test_expect_success 'gc task runs with --auto only when gc is needed' '
+	rm -rf .git/objects/maintenance &&
+	GIT_TRACE="$(pwd)/gc-not-needed.txt" git maintenance run --auto &&
+	subcommands gc-not-needed.txt >actual &&
+	test_must_be_empty actual &&
+	test_path_is_missing .git/objects/maintenance/gc &&
+
+	for i in 1 2
+	do
+		echo $i | git hash-object -w --stdin |
+		git pack-objects -q .git/objects/pack/pack || return 1
+	done &&
+	GIT_TRACE="$(pwd)/gc-needed.txt" git -c gc.autoPackLimit=1 \
+		-c gc.autoDetach=false maintenance run --auto &&
+	subcommands gc-needed.txt >actual &&
+	grep "^gc --auto --quiet$" actual &&
+	test_path_is_file .git/objects/maintenance/gc
+'
+
+test_expect_success 'commands run maintenance instead of gc --auto' '
+	GIT_TRACE="$(pwd)/commit.txt" test_commit first &&
+	grep "run_command: git maintenance run --auto --no-quiet" commit.txt &&
+	GIT_TRACE="$(pwd)/no-gc.txt" git -c maintenance.gc.enabled=false \
+		commit --allow-empty -m "no gc" &&
+	grep "run_command: git maintenance run --auto" no-gc.txt &&
+	! grep "run_command: git gc" no-gc.txt &&
+	GIT_TRACE="$(pwd)/no-auto.txt" \
+		git -c maintenance.auto=false commit --allow-empty -m empty &&
+	! grep "run_command: git maintenance" no-auto.txt
+'
+
+test_expect_success 'maintenance.<task>.enabled' '
+	git config maintenance.gc.enabled false &&
+	git config maintenance.commit-graph.enabled true &&
+	GIT_TRACE="$(pwd)/run-config.txt" git maintenance run 2>err &&
+	subcommands run-config.txt >actual &&
+	echo "commit-graph write --split --reachable" >expect &&
+	test_cmp expect actual &&
+	git config --unset maintenance.gc.enabled &&
+	git config --unset maintenance.commit-graph.enabled
+'
+
+test_expect_success 'run --task=<task>' '
+	GIT_TRACE="$(pwd)/run-commit-graph.txt" \
+		git maintenance run --task=commit-graph 2>/dev/null &&
+	GIT_TRACE="$(pwd)/run-both.txt" \
+		git maintenance run --task=commit-graph --task=gc 2>/dev/null &&
+	subcommands run-commit-graph.txt >actual &&
+	echo "commit-graph write --split --reachable" >expect &&
+	test_cmp expect actual &&
+	subcommands run-both.txt |
+		grep -e "^commit-graph" -e "^gc" >actual &&
+	cat >expect <<-\EOF &&
+	commit-graph write --split --reachable
+	gc --quiet
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'run --task=bogus' '
+	test_must_fail git maintenance run --task=bogus 2>err &&
+	test_i18ngrep "is not a valid task" err
+'
+
+test_expect_success 'run --task duplicate' '
+	test_must_fail git maintenance run --task=gc --task=gc 2>err &&
+	test_i18ngrep "cannot be selected multiple times" err
+'
+
+test_expect_success 'a task which is already running is skipped' '
+	mkdir -p .git/objects/maintenance &&
+	>.git/objects/maintenance/commit-graph.lock &&
+	GIT_TRACE="$(pwd)/locked.txt" git maintenance run --no-quiet \
+		--task=commit-graph --task=gc 2>err &&
+	test_i18ngrep "skipping task .commit-graph." err &&
+	subcommands locked.txt >actual &&
+	grep "^gc$" actual &&
+	! grep "^commit-graph" actual &&
+	rm .git/objects/maintenance/commit-graph.lock
+'
+
+test_expect_success 'commit-graph auto condition' '
+	COMMAND="maintenance run --task=commit-graph --auto --quiet" &&
+
+	GIT_TRACE="$(pwd)/cg-zero-means-no.txt" \
+		git -c maintenance.commit-graph.auto=0 $COMMAND &&
+	GIT_TRACE="$(pwd)/cg-negative-means-yes.txt" \
+		git -c maintenance.commit-graph.auto=-1 $COMMAND &&
+
+	git commit --allow-empty -m "one more" &&
+	GIT_TRACE="$(pwd)/cg-two-not-satisfied.txt" \
+		git -c core.commitGraph=true \
+		-c maintenance.commit-graph.auto=2 $COMMAND &&
+
+	git commit --allow-empty -m "two more" &&
+	GIT_TRACE="$(pwd)/cg-two-satisfied.txt" \
+		git -c core.commitGraph=true \
+		-c maintenance.commit-graph.auto=2 $COMMAND &&
+
+	subcommands cg-zero-means-no.txt >actual &&
+	test_must_be_empty actual &&
+	subcommands cg-negative-means-yes.txt >actual &&
+	grep "^commit-graph write" actual &&
+	subcommands cg-two-not-satisfied.txt >actual &&
+	test_must_be_empty actual &&
+	subcommands cg-two-satisfied.txt >actual &&
+	grep "^commit-graph write" actual
+'
+
+test_expect_success 'loose-objects task' '
+	git init loose &&
+	(
+		cd loose &&
+		test_commit one &&
+		git count-objects -v >count &&
+		grep "^count: 3$" count &&
+
+		GIT_TRACE="$(pwd)/loose-first.txt" \
+			git maintenance run --task=loose-objects &&
+		ls .git/objects/pack/loose-*.pack >packs &&
+		test_line_count = 1 packs &&
+		git count-objects -v >count &&
+		grep "^count: 3$" count &&
+
+		git maintenance run --task=loose-objects &&
+		git count-objects -v >count &&
+		grep "^count: 0$" count &&
+		ls .git/objects/pack/loose-*.pack >packs &&
+		test_line_count = 1 packs &&
+		git cat-file -p HEAD:one.t
+	)
+'
+
+test_expect_success 'loose-objects auto condition' '
+	(
+		cd loose &&
+		COMMAND="maintenance run --task=loose-objects --auto --quiet" &&
+
+		test_commit two &&
+		GIT_TRACE="$(pwd)/loose-no.txt" \
+			git -c maintenance.loose-objects.auto=4 $COMMAND &&
+		test_commit three &&
+		GIT_TRACE="$(pwd)/loose-yes.txt" \
+			git -c maintenance.loose-objects.auto=4 $COMMAND &&
+
+		subcommands loose-no.txt >actual &&
+		test_must_be_empty actual &&
+		subcommands loose-yes.txt >actual &&
+		grep "^prune-packed" actual &&
+		grep "^pack-objects" actual
+	)
+'
+
+test_expect_success 'incremental-repack task' '
+	git init repack &&
+	(
+		cd repack &&
+		for i in 1 2 3
+		do
+			test_commit $i &&
+			git repack -d -q || return 1
+		done &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 3 packs &&
+
+		COMMAND="maintenance run --task=incremental-repack --auto" &&
+		GIT_TRACE="$(pwd)/repack-no.txt" \
+			git -c maintenance.incremental-repack.auto=4 $COMMAND &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 3 packs &&
+
+		GIT_TRACE="$(pwd)/repack-yes.txt" \
+			git -c maintenance.incremental-repack.auto=3 $COMMAND &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 1 packs &&
+		test_path_is_file .git/objects/pack/multi-pack-index &&
+
+		subcommands repack-no.txt >actual &&
+		test_must_be_empty actual &&
+		subcommands repack-yes.txt >actual &&
+		grep "^repack --geometric=2 -d" actual
+	)
+'
+
+test_expect_success 'pack-refs task' '
+	(
+		cd repack &&
+		git pack-refs --all &&
+		git branch one &&
+		git branch two &&
+		COMMAND="maintenance run --task=pack-refs --auto" &&
+		git -c maintenance.pack-refs.auto=3 $COMMAND &&
+		test_path_is_file .git/refs/heads/two &&
+		git branch three &&
+		git -c maintenance.pack-refs.auto=3 $COMMAND &&
+		test_path_is_missing .git/refs/heads/two &&
+		git rev-parse two
+	)
+'
+
+test_expect_success 'prefetch task' '
+	git clone . clone &&
+	test_commit after-clone &&
+	(
+		cd clone &&
+		git rev-parse origin/master >before &&
+		test_might_fail git rev-parse --verify -q FETCH_HEAD >fetch-head-before &&
+
+		GIT_TRACE="$(pwd)/prefetch.txt" \
+			git maintenance run --task=prefetch &&
+		subcommands prefetch.txt >actual &&
+		grep "^fetch origin --prune --no-tags --no-write-fetch-head --no-auto-maintenance --recurse-submodules=no --refmap= " actual &&
+		grep "+refs/heads/\\*:refs/prefetch/remotes/origin/\\*" actual &&
+
+		git rev-parse refs/prefetch/remotes/origin/master >actual &&
+		git -C .. rev-parse master >expect &&
+		test_cmp expect actual &&
+		git rev-parse origin/master >after &&
+		test_cmp before after &&
+		test_might_fail git rev-parse --verify -q FETCH_HEAD >fetch-head-after &&
+		test_cmp fetch-head-before fetch-head-after &&
+
+		git maintenance run --task=prefetch --auto &&
+		git -c maintenance.strategy=incremental maintenance run --auto
+	)
+'
+
+test_expect_success 'run --schedule' '
+	(
+		cd clone &&
+		git config maintenance.strategy incremental &&
+		rm -rf .git/objects/maintenance &&
+
+		GIT_TRACE="$(pwd)/schedule-first.txt" \
+			git maintenance run --schedule &&
+		subcommands schedule-first.txt >actual &&
+		grep "^fetch origin" actual &&
+		grep "^commit-graph write" actual &&
+		grep "^prune-packed" actual &&
+		grep "^repack --geometric=2" actual &&
+		grep "^pack-refs" actual &&
+		! grep "^gc" actual &&
+
+		GIT_TRACE="$(pwd)/schedule-again.txt" \
+			git maintenance run --schedule &&
+		subcommands schedule-again.txt >actual &&
+		test_must_be_empty actual &&
+
+		# an hour later, only the hourly tasks are due
+		for task in prefetch commit-graph loose-objects \
+			    incremental-repack pack-refs
+		do
+			echo $(($(cat .git/objects/maintenance/$task) - 4000)) \
+				>.git/objects/maintenance/$task || return 1
+		done &&
+		GIT_TRACE="$(pwd)/schedule-hourly.txt" \
+			git maintenance run --schedule &&
+		subcommands schedule-hourly.txt >actual &&
+		grep "^fetch origin" actual &&
+		grep "^commit-graph write" actual &&
+		! grep "^prune-packed" actual &&
+		! grep "^pack-refs" actual
+	)
+'
+
+test_expect_success 'trace regions of the tasks' '
+	rm -f trace &&
+	GIT_TRACE_EVENT="$(pwd)/trace" \
+		git maintenance run --task=commit-graph --task=gc &&
+	grep "\"category\":\"maintenance\",\"label\":\"commit-graph\"" trace &&
+	grep "\"category\":\"maintenance\",\"label\":\"gc\"" trace
+'
+
+test_expect_success 'invalid configuration' '
+	test_must_fail git -c maintenance.strategy=bogus maintenance run 2>err &&
+	test_i18ngrep "unknown maintenance strategy" err &&
+	test_must_fail git -c maintenance.gc.schedule=often maintenance run 2>err &&
+	test_i18ngrep "unknown schedule" err &&
+	test_must_fail git maintenance run --auto --schedule
+'
+
+test_done
@@ -0,0 +1,243 @@
+#include "cache.h"
+#include "json-writer.h"
+#include "thread-utils.h"
+#include "trace-event.h"
+
+static struct trace_key trace_event_key = TRACE_KEY_INIT(EVENT);
+
+int trace_event_enabled;
+
+static uint64_t start_nanos;
+static int exit_code, exit_code_known;
+
+static const char *counter_names[TRACE_COUNTER__NR] = {
+	"objects_parsed",
+	"packs_opened",
+	"bytes_inflated",
+	"lstat_calls",
+	"pack_rescans",
+};
+static uint64_t counters[TRACE_COUNTER__NR];
+
+struct thread_context {
+	char *name;
+	uint64_t start;
+	/* the start times of the regions the thread is in */
+	uint64_t *regions;
+	size_t nr, alloc;
+};
+
+static struct thread_context main_thread;
+
+#ifndef NO_PTHREADS
+static pthread_mutex_t trace_event_mutex;
+static pthread_key_t thread_key;
+static int nr_threads;
+
+#define trace_event_lock() pthread_mutex_lock(&trace_event_mutex)
+#define trace_event_unlock() pthread_mutex_unlock(&trace_event_mutex)
+
+static void free_thread_context(void *data)
+{
+	struct thread_context *ctx = data;
+
+	free(ctx->name);
+	free(ctx->regions);
+	free(ctx);
+}
+
+static struct thread_context *new_thread_context(const char *name)
+{
+	struct thread_context *ctx = xcalloc(1, sizeof(*ctx));
+
+	trace_event_lock();
+	nr_threads++;
+	if (name)
+		ctx->name = xstrfmt("th%02d:%s", nr_threads, name);
+	else
+		ctx->name = xstrfmt("th%02d", nr_threads);
+	trace_event_unlock();
+	ctx->start = getnanotime();
+	pthread_setspecific(thread_key, ctx);
+	return ctx;
+}
+
+static struct thread_context *get_thread_context(void)
+{
+	struct thread_context *ctx = pthread_getspecific(thread_key);
+
+	return ctx ? ctx : new_thread_context(NULL);
+}
+#else
+#define trace_event_lock() (void)0
+#define trace_event_unlock() (void)0
+
+static struct thread_context *get_thread_context(void)
+{
+	return &main_thread;
+}
+#endif
+
+static void begin_event(struct json_writer *jw, const char *event,
+			const struct thread_context *ctx, uint64_t now)
+{
+	jw_object_begin(jw, 0);
+	jw_object_string(jw, "event", event);
+	jw_object_intmax(jw, "pid", getpid());
+	jw_object_string(jw, "thread", ctx->name);
+	jw_object_double(jw, "t_abs", 6,
+			 (double)(now - start_nanos) / 1000000000);
+}
+
+static void emit_event(struct json_writer *jw)
+{
+	jw_end(jw);
+	strbuf_addch(&jw->json, '\n');
+	/* events of different threads must not be interleaved */
+	trace_event_lock();
+	trace_verbatim(&trace_event_key, jw->json.buf, jw->json.len);
+	trace_event_unlock();
+	jw_release(jw);
+}
+
+static void trace_event_atexit(void)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+	uint64_t now = getnanotime();
+	int i;
+
+	for (i = 0; i < TRACE_COUNTER__NR; i++) {
+		begin_event(&jw, "counter", &main_thread, now);
+		jw_object_string(&jw, "name", counter_names[i]);
+		jw_object_intmax(&jw, "value", counters[i]);
+		emit_event(&jw);
+	}
+
+	begin_event(&jw, "exit", &main_thread, now);
+	if (exit_code_known)
+		jw_object_intmax(&jw, "code", exit_code);
+	emit_event(&jw);
+}
+
+void trace_event_start(const char **argv)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+
+	if (!trace_want(&trace_event_key))
+		return;
+
+	start_nanos = getnanotime();
+	main_thread.name = xstrdup("main");
+	main_thread.start = start_nanos;
+#ifndef NO_PTHREADS
+	pthread_mutex_init(&trace_event_mutex, NULL);
+	pthread_key_create(&thread_key, free_thread_context);
+	pthread_setspecific(thread_key, &main_thread);
+#endif
+	trace_event_enabled = 1;
+	atexit(trace_event_atexit);
+
+	begin_event(&jw, "start", &main_thread, start_nanos);
+	jw_object_inline_begin_array(&jw, "argv");
+	jw_array_argv(&jw, argv);
+	jw_end(&jw);
+	emit_event(&jw);
+}
+
+int trace_event_exit(int code)
+{
+	exit_code = code;
+	exit_code_known = 1;
+	return code;
+}
+
+void trace_event_region_enter(const char *category, const char *label)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+	struct thread_context *ctx;
+	uint64_t now;
+
+	if (!trace_event_enabled)
+		return;
+
+	ctx = get_thread_context();
+	now = getnanotime();
+	ALLOC_GROW(ctx->regions, ctx->nr + 1, ctx->alloc);
+	ctx->regions[ctx->nr++] = now;
+
+	begin_event(&jw, "region_enter", ctx, now);
+	jw_object_intmax(&jw, "nesting", ctx->nr);
+	jw_object_string(&jw, "category", category);
+	jw_object_string(&jw, "label", label);
+	emit_event(&jw);
+}
+
+void trace_event_region_leave(const char *category, const char *label)
+{
+	struct json_writer jw = JSON_WRITER_INIT;
+	struct thread_context *ctx;
+	uint64_t now;
+
+	if (!trace_event_enabled)
+		return;
+
+	ctx = get_thread_context();
+	if (!ctx->nr)
+		BUG("leaving region '%s/%s' that was not entered",
+		    category, label);
+	now = getnanotime();
+
+	begin_event(&jw, "region_leave", ctx, now);
+	jw_object_intmax(&jw, "nesting", ctx->nr);
+	jw_object_string(&jw, "category", category);
+	jw_object_string(&jw, "label", label);
+	jw_object_double(&jw, "t_rel", 6,
+			 (double)(now - ctx->regions[--ctx->nr]) / 1000000000);
+	emit_event(&jw);
+}
+
+void trace_event_thread_start(const char *name)
+{
+#ifndef NO_PTHREADS
+	struct json_writer jw = JSON_WRITER_INIT;
+	struct thread_context *ctx;
+
+	if (!trace_event_enabled)
+		return;
+
+	ctx = new_thread_context(name);
+	begin_event(&jw, "thread_start", ctx, ctx->start);
+	emit_event(&jw);
+#endif
+}
+
+void trace_event_thread_exit(void)
+{
+#ifndef NO_PTHREADS
+	struct json_writer jw = JSON_WRITER_INIT;
+	struct thread_context *ctx;
+	uint64_t now;
+
+	if (!trace_event_enabled)
+		return;
+
+	ctx = get_thread_context();
+	if (ctx == &main_thread)
+		BUG("the main thread cannot exit as a thread");
+	now = getnanotime();
+	begin_event(&jw, "thread_exit", ctx, now);
+	jw_object_double(&jw, "t_rel", 6,
+			 (double)(now - ctx->start) / 1000000000);
+	emit_event(&jw);
+
+	pthread_setspecific(thread_key, NULL);
+	free_thread_context(ctx);
+#endif
+}
+
+void trace_event_count_1(enum trace_event_counter counter, uint64_t value)
+{
+	trace_event_lock();
+	counters[counter] += value;
+	trace_event_unlock();
+}
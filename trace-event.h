@@ -0,0 +1,67 @@
+#ifndef TRACE_EVENT_H
+#define TRACE_EVENT_H
+
+/*
+ * With GIT_TRACE_EVENT, git writes a stream of structured events, one
+ * JSON object per line, to the trace destination (which can also be a
+ * unix socket, see Documentation/git.txt). Unlike the free-form lines
+ * of GIT_TRACE_PERFORMANCE, these are meant to be aggregated by tools.
+ *
+ * Every event has the fields "event", "pid", "thread" (the name of the
+ * thread emitting it, "main" for the main thread) and "t_abs" (the
+ * seconds elapsed since the process started). The events are:
+ *
+ *   - "start", with the command line in "argv"
+ *   - "region_enter" and "region_leave", with the "category" and the
+ *     "label" of the region and its "nesting" depth in the thread;
+ *     "region_leave" also has the time spent in the region in "t_rel"
+ *   - "thread_start" and "thread_exit", the latter with the lifetime
+ *     of the thread in "t_rel"
+ *   - "counter", with the "name" and the "value" of every counter,
+ *     emitted at exit
+ *   - "exit", with the exit "code" when it is known
+ *
+ * Regions must be properly nested within each thread.
+ */
+
+enum trace_event_counter {
+	TRACE_COUNTER_OBJECTS_PARSED,
+	TRACE_COUNTER_PACKS_OPENED,
+	TRACE_COUNTER_BYTES_INFLATED,
+	TRACE_COUNTER_LSTAT,
+	TRACE_COUNTER_PACK_RESCANS,
+	TRACE_COUNTER__NR
+};
+
+/* Set when GIT_TRACE_EVENT is enabled, once trace_event_start() ran. */
+extern int trace_event_enabled;
+
+/* Called once by main(), to emit the "start" event. */
+void trace_event_start(const char **argv);
+
+/*
+ * Record the exit code of the process for the "exit" event, and
+ * return it, so that it can be used as `exit(trace_event_exit(code))`.
+ */
+int trace_event_exit(int code);
+
+void trace_event_region_enter(const char *category, const char *label);
+void trace_event_region_leave(const char *category, const char *label);
+
+/*
+ * Name the calling thread, which must not be the main thread. Threads
+ * that are not named get a numbered name on their first event.
+ */
+void trace_event_thread_start(const char *name);
+void trace_event_thread_exit(void);
+
+void trace_event_count_1(enum trace_event_counter counter, uint64_t value);
+
+static inline void trace_event_count(enum trace_event_counter counter,
+				     uint64_t value)
+{
+	if (trace_event_enabled)
+		trace_event_count_1(counter, value);
+}
+
+#endif /* TRACE_EVENT_H */
@@ -23,6 +23,7 @@
 
 #include "cache.h"
 #include "quote.h"
+#include "unix-socket.h"
 
 struct trace_key trace_default_key = { "GIT_TRACE", 0, 0, 0 };
 struct trace_key trace_perf_key = TRACE_KEY_INIT(PERFORMANCE);
@@ -46,6 +47,19 @@ static int get_trace_fd(struct trace_key *key)
 		key->fd = STDERR_FILENO;
 	else if (strlen(trace) == 1 && isdigit(*trace))
 		key->fd = atoi(trace);
+#ifndef NO_UNIX_SOCKETS
+	else if (skip_prefix(trace, "af_unix:", &trace)) {
+		int fd = unix_stream_connect(trace);
+		if (fd == -1) {
+			warning("could not connect to '%s' for tracing: %s",
+				trace, strerror(errno));
+			trace_disable(key);
+		} else {
+			key->fd = fd;
+			key->need_close = 1;
+		}
+	}
+#endif
 	else if (is_absolute_path(trace)) {
 		int fd = open(trace, O_WRONLY | O_APPEND | O_CREAT, 0666);
 		if (fd == -1) {
@@ -18,6 +18,9 @@
 #include "fsmonitor.h"
 #include "object-store.h"
 #include "fetch-object.h"
+#include "parallel-checkout.h"
+#include "trace-event.h"
+#include "sparse-index.h"
 
 /*
  * Error messages expected by scripts out of plumbing commands such as
@@ -383,9 +386,10 @@ static int check_updates(struct unpack_trees_options *o)
 	struct progress *progress = NULL;
 	struct index_state *index = &o->result;
 	struct checkout state = CHECKOUT_INIT;
-	int i;
+	int i, pc_workers, pc_threshold;
 
 	trace_performance_enter();
+	trace_event_region_enter("unpack_trees", "check_updates");
 	state.force = 1;
 	state.quiet = 1;
 	state.refresh_cache = 1;
@@ -424,22 +428,20 @@ static int check_updates(struct unpack_trees_options *o)
 		 * below.
 		 */
 		struct oid_array to_fetch = OID_ARRAY_INIT;
-		int fetch_if_missing_store = fetch_if_missing;
-		fetch_if_missing = 0;
 		for (i = 0; i < index->cache_nr; i++) {
 			struct cache_entry *ce = index->cache[i];
 			if ((ce->ce_flags & CE_UPDATE) &&
-			    !S_ISGITLINK(ce->ce_mode)) {
-				if (!has_object_file(&ce->oid))
-					oid_array_append(&to_fetch, &ce->oid);
-			}
+			    !S_ISGITLINK(ce->ce_mode))
+				oid_array_append(&to_fetch, &ce->oid);
 		}
-		if (to_fetch.nr)
-			fetch_objects(repository_format_partial_clone,
-				      to_fetch.oid, to_fetch.nr);
-		fetch_if_missing = fetch_if_missing_store;
+		prefetch_objects(&to_fetch);
 		oid_array_clear(&to_fetch);
 	}
+
+	get_parallel_checkout_configs(&pc_workers, &pc_threshold);
+	if (pc_workers > 1 && o->update && !o->dry_run)
+		init_parallel_checkout();
+
 	for (i = 0; i < index->cache_nr; i++) {
 		struct cache_entry *ce = index->cache[i];
 
@@ -454,6 +456,8 @@ static int check_updates(struct unpack_trees_options *o)
 			}
 		}
 	}
+	if (pc_workers > 1 && o->update && !o->dry_run)
+		errs |= run_parallel_checkout(&state, pc_workers, pc_threshold);
 	stop_progress(&progress);
 	errs |= finish_delayed_checkout(&state);
 	if (o->update)
@@ -462,6 +466,7 @@ static int check_updates(struct unpack_trees_options *o)
 	if (o->clone)
 		report_collided_checkout(index);
 
+	trace_event_region_leave("unpack_trees", "check_updates");
 	trace_performance_leave("check_updates");
 	return errs != 0;
 }
@@ -1312,16 +1317,24 @@ static int clear_ce_flags_dir(struct index_state *istate,
 	}
 
 	/*
-	 * TODO: check el, if there are no patterns that may conflict
-	 * with ret (iow, we know in advance the incl/excl
-	 * decision for the entire directory), clear flag here without
-	 * calling clear_ce_flags_1(). That function will call
-	 * the expensive is_excluded_from_list() on every entry.
+	 * With cone patterns, the decision for a directory that is
+	 * either entirely in or entirely out of the sparse checkout
+	 * holds for all of its entries, so there is no need to call
+	 * the expensive is_excluded_from_list() on every one of them.
 	 */
-	rc = clear_ce_flags_1(istate, cache, cache_end - cache,
-			      prefix,
-			      select_mask, clear_mask,
-			      el, ret);
+	if (el->use_cone_patterns && ret != MATCHED) {
+		struct cache_entry **ce;
+
+		for (ce = cache; ret && ce != cache_end; ce++)
+			if (!select_mask || ((*ce)->ce_flags & select_mask))
+				(*ce)->ce_flags &= ~clear_mask;
+		rc = cache_end - cache;
+	} else {
+		rc = clear_ce_flags_1(istate, cache, cache_end - cache,
+				      prefix,
+				      select_mask, clear_mask,
+				      el, ret);
+	}
 	strbuf_setlen(prefix, prefix->len - 1);
 	return rc;
 }
@@ -1476,12 +1489,19 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
 
+	/* see diff_cache() for the only caller that can keep it sparse */
+	if (!o->diff_index_cached || len != 1)
+		ensure_full_index(o->src_index);
+
 	trace_performance_enter();
+	trace_event_region_enter("unpack_trees", "unpack_trees");
 	memset(&el, 0, sizeof(el));
 	if (!core_apply_sparse_checkout || !o->update)
 		o->skip_sparse_checkout = 1;
 	if (!o->skip_sparse_checkout) {
 		char *sparse = git_pathdup("info/sparse-checkout");
+
+		el.use_cone_patterns = core_sparse_checkout_cone;
 		if (add_excludes_from_file_to_list(sparse, "", 0, &el, NULL) < 0)
 			o->skip_sparse_checkout = 1;
 		else
@@ -1550,7 +1570,9 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 		}
 
 		trace_performance_enter();
+		trace_event_region_enter("unpack_trees", "traverse_trees");
 		ret = traverse_trees(len, t, &info);
+		trace_event_region_leave("unpack_trees", "traverse_trees");
 		trace_performance_leave("traverse_trees");
 		if (ret < 0)
 			goto return_failed;
@@ -1646,6 +1668,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	o->src_index = NULL;
 
 done:
+	trace_event_region_leave("unpack_trees", "unpack_trees");
 	trace_performance_leave("unpack_trees");
 	clear_exclude_list(&el);
 	return ret;
@@ -1705,6 +1728,7 @@ static int verify_uptodate_1(const struct cache_entry *ce,
 	else if (o->reset || ce_uptodate(ce))
 		return 0;
 
+	trace_event_count(TRACE_COUNTER_LSTAT, 1);
 	if (!lstat(ce->name, &st)) {
 		int flags = CE_MATCH_IGNORE_VALID|CE_MATCH_IGNORE_SKIP_WORKTREE;
 		unsigned changed = ie_match_stat(o->src_index, ce, &st, flags);
@@ -1946,7 +1970,8 @@ static int verify_absent_1(const struct cache_entry *ce,
 	len = check_leading_path(ce->name, ce_namelen(ce));
 	if (!len)
 		return 0;
-	else if (len > 0) {
+	trace_event_count(TRACE_COUNTER_LSTAT, 1);
+	if (len > 0) {
 		char *path;
 		int ret;
 
@@ -25,6 +25,9 @@
 #include "upload-pack.h"
 #include "serve.h"
 #include "commit-reach.h"
+#include "tempfile.h"
+#include "dir.h"
+#include "trace-event.h"
 
 /* Remember to update object flag allocation in object.h */
 #define THEY_HAVE	(1u << 11)
@@ -69,6 +72,33 @@ static int allow_filter;
 static int allow_ref_in_want;
 static struct list_objects_filter_options filter_options;
 
+static int pack_cache_enabled;
+static unsigned long pack_cache_max_size = 1024 * 1024 * 1024;
+static unsigned long pack_cache_max_age = 3600;
+static struct trace_key trace_pack_cache = TRACE_KEY_INIT(PACK_CACHE);
+
+/*
+ * A pre-built pack (or bundle) holding every object reachable from
+ * `tip`, which clients can download from `uri` instead of receiving
+ * those objects in the generated pack.
+ */
+struct packfile_uri {
+	struct object_id tip;
+	char *pack_hash;
+	char *uri;
+};
+static struct packfile_uri *packfile_uris;
+static int packfile_uris_nr, packfile_uris_alloc;
+/* the URI protocols the client accepts, empty if it wants no URIs */
+static struct string_list uri_protocols = STRING_LIST_INIT_DUP;
+/* the tips of the packs sent as URIs, excluded from the pack */
+static struct object_array uri_tip_obj;
+/*
+ * Every "have" we know, in the order received; unlike have_obj, this
+ * does not depend on the order of the haves, see pack_cache_path().
+ */
+static struct oid_array have_oids;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -93,12 +123,302 @@ static void send_client_data(int fd, const char *data, ssize_t sz)
 
 static int write_one_shallow(const struct commit_graft *graft, void *cb_data)
 {
-	FILE *fp = cb_data;
+	struct strbuf *buf = cb_data;
+	if (graft->nr_parent == -1)
+		strbuf_addf(buf, "--shallow %s\n", oid_to_hex(&graft->oid));
+	return 0;
+}
+
+/*
+ * The pack cache keeps the packs sent to clients in
+ * $GIT_DIR/upload-pack-cache, named after a hash of everything that
+ * determines their contents: the pack-objects command line, the sets
+ * of wants, haves and shallow commits (sorted, without duplicates, so
+ * that their order in the request does not matter), the filter and the
+ * tips of all refs (which matter e.g. for --include-tag). A request
+ * that hashes the same is answered with the cached pack, without
+ * running pack-objects.
+ *
+ * Packs are written to a temporary file while they are sent and only
+ * renamed into place once pack-objects succeeded, so concurrent
+ * upload-packs never see a partial pack; when two of them populate the
+ * same entry, the last one wins with identical contents.
+ */
+static int hash_ref_tip(const char *refname, const struct object_id *oid,
+			int flags, void *cb_data)
+{
+	git_hash_ctx *ctx = cb_data;
+
+	the_hash_algo->update_fn(ctx, refname, strlen(refname) + 1);
+	the_hash_algo->update_fn(ctx, oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static int hash_oid(const struct object_id *oid, void *cb_data)
+{
+	git_hash_ctx *ctx = cb_data;
+
+	the_hash_algo->update_fn(ctx, oid->hash, the_hash_algo->rawsz);
+	return 0;
+}
+
+static void hash_oid_set(git_hash_ctx *ctx, const char *name,
+			 struct oid_array *oids)
+{
+	the_hash_algo->update_fn(ctx, name, strlen(name) + 1);
+	oid_array_for_each_unique(oids, hash_oid, ctx);
+	oid_array_clear(oids);
+}
+
+static void add_objects_to_oid_array(struct oid_array *oids,
+				     const struct object_array *objects)
+{
+	int i;
+
+	for (i = 0; i < objects->nr; i++)
+		oid_array_append(oids, &objects->objects[i].item->oid);
+}
+
+static int add_shallow_to_oid_array(const struct commit_graft *graft,
+				    void *cb_data)
+{
 	if (graft->nr_parent == -1)
-		fprintf(fp, "--shallow %s\n", oid_to_hex(&graft->oid));
+		oid_array_append(cb_data, &graft->oid);
+	return 0;
+}
+
+/*
+ * Filters which are spelled differently but select the same objects,
+ * e.g. "blob:limit=1k" and "blob:limit=1024", hash the same.
+ */
+static void hash_filter(git_hash_ctx *ctx)
+{
+	struct strbuf spec = STRBUF_INIT;
+
+	switch (filter_options.choice) {
+	case LOFC_DISABLED:
+		break;
+	case LOFC_BLOB_LIMIT:
+		strbuf_addf(&spec, "blob:limit=%lu",
+			    filter_options.blob_limit_value);
+		break;
+	case LOFC_SPARSE_OID:
+		if (filter_options.sparse_oid_value) {
+			strbuf_addf(&spec, "sparse:oid=%s",
+				    oid_to_hex(filter_options.sparse_oid_value));
+			break;
+		}
+		/* fallthrough */
+	default:
+		strbuf_addstr(&spec, filter_options.filter_spec);
+		break;
+	}
+	the_hash_algo->update_fn(ctx, spec.buf, spec.len + 1);
+	strbuf_release(&spec);
+}
+
+static void pack_cache_path(const struct argv_array *args,
+			    struct strbuf *path)
+{
+	unsigned char hash[GIT_MAX_RAWSZ];
+	struct oid_array oids = OID_ARRAY_INIT;
+	git_hash_ctx ctx;
+	int i;
+
+	the_hash_algo->init_fn(&ctx);
+	for (i = 0; i < args->argc; i++) {
+		/* progress is not part of the pack */
+		if (!strcmp(args->argv[i], "--progress"))
+			continue;
+		/* and the filter is hashed in its canonical form below */
+		if (starts_with(args->argv[i], "--filter="))
+			continue;
+		the_hash_algo->update_fn(&ctx, args->argv[i],
+					 strlen(args->argv[i]) + 1);
+	}
+	hash_filter(&ctx);
+
+	add_objects_to_oid_array(&oids, &want_obj);
+	hash_oid_set(&ctx, "want", &oids);
+	/*
+	 * have_obj leaves out the haves whose child was received
+	 * earlier, which exclude nothing more.
+	 */
+	for (i = 0; i < have_oids.nr; i++)
+		oid_array_append(&oids, &have_oids.oid[i]);
+	add_objects_to_oid_array(&oids, &extra_edge_obj);
+	add_objects_to_oid_array(&oids, &uri_tip_obj);
+	hash_oid_set(&ctx, "not", &oids);
+	if (shallow_nr)
+		for_each_commit_graft(add_shallow_to_oid_array, &oids);
+	hash_oid_set(&ctx, "shallow", &oids);
+
+	head_ref(hash_ref_tip, &ctx);
+	for_each_ref(hash_ref_tip, &ctx);
+	the_hash_algo->final_fn(hash, &ctx);
+
+	strbuf_addf(path, "%s/%s.pack", git_path("upload-pack-cache"),
+		    sha1_to_hex(hash));
+}
+
+static int pack_cache_expired(const struct stat *st)
+{
+	return pack_cache_max_age &&
+	       st->st_mtime + pack_cache_max_age < time(NULL);
+}
+
+/*
+ * Send the cached pack at `path` to the client. Return -1 if there is
+ * no usable pack there, in which case nothing was sent.
+ */
+static int send_cached_pack(const char *path)
+{
+	char data[8192];
+	struct stat st;
+	ssize_t sz;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		trace_printf_key(&trace_pack_cache, "pack-cache: miss %s\n", path);
+		return -1;
+	}
+	if (fstat(fd, &st) || pack_cache_expired(&st)) {
+		trace_printf_key(&trace_pack_cache, "pack-cache: expired %s\n", path);
+		close(fd);
+		unlink(path);
+		return -1;
+	}
+	trace_printf_key(&trace_pack_cache, "pack-cache: hit %s\n", path);
+
+	while ((sz = xread(fd, data, sizeof(data))) > 0) {
+		reset_timeout();
+		send_client_data(1, data, sz);
+	}
+	if (sz < 0)
+		die_errno("git upload-pack: unable to read cached pack '%s'",
+			  path);
+	close(fd);
+
+	if (use_sideband)
+		packet_flush(1);
 	return 0;
 }
 
+struct pack_cache_entry {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static int pack_cache_entry_cmp(const void *a_, const void *b_)
+{
+	const struct pack_cache_entry *a = a_, *b = b_;
+
+	/* newest first */
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Remove the expired packs from the cache, and the oldest ones for as
+ * long as it is larger than uploadpack.packCacheMaxSize.
+ */
+static void prune_pack_cache(void)
+{
+	const char *dir_path = git_path("upload-pack-cache");
+	struct pack_cache_entry *entries = NULL;
+	size_t nr = 0, alloc = 0, i;
+	off_t total = 0;
+	struct strbuf path = STRBUF_INIT;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(dir_path);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+
+		if (!ends_with(de->d_name, ".pack"))
+			continue;
+		strbuf_reset(&path);
+		strbuf_addf(&path, "%s/%s", dir_path, de->d_name);
+		if (stat(path.buf, &st))
+			continue;
+		if (pack_cache_expired(&st)) {
+			trace_printf_key(&trace_pack_cache,
+					 "pack-cache: expired %s\n", path.buf);
+			unlink(path.buf);
+			continue;
+		}
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = xstrdup(path.buf);
+		entries[nr].size = st.st_size;
+		entries[nr].mtime = st.st_mtime;
+		nr++;
+	}
+	closedir(dir);
+
+	QSORT(entries, nr, pack_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		total += entries[i].size;
+		if (pack_cache_max_size && total > pack_cache_max_size) {
+			trace_printf_key(&trace_pack_cache,
+					 "pack-cache: pruned %s\n",
+					 entries[i].path);
+			unlink(entries[i].path);
+		}
+		free(entries[i].path);
+	}
+	free(entries);
+	strbuf_release(&path);
+}
+
+static struct tempfile *create_pack_cache_tempfile(void)
+{
+	const char *dir_path = git_path("upload-pack-cache");
+	struct strbuf template = STRBUF_INIT;
+	struct tempfile *tmp;
+
+	if (mkdir(dir_path, 0777) && errno != EEXIST)
+		return NULL;
+	if (adjust_shared_perm(dir_path))
+		return NULL;
+	strbuf_addf(&template, "%s/tmp_pack_XXXXXX", dir_path);
+	tmp = mks_tempfile(template.buf);
+	strbuf_release(&template);
+	return tmp;
+}
+
+static void write_pack_cache(struct tempfile **tmp, off_t *size,
+			     const char *data, ssize_t sz)
+{
+	if (!*tmp)
+		return;
+	if (write_in_full(get_tempfile_fd(*tmp), data, sz) < 0 ||
+	    (pack_cache_max_size && *size + sz > pack_cache_max_size)) {
+		/* give up on caching this pack */
+		delete_tempfile(tmp);
+		return;
+	}
+	*size += sz;
+}
+
+static void store_cached_pack(struct tempfile **tmp, const char *path)
+{
+	if (!*tmp)
+		return;
+	if (adjust_shared_perm(get_tempfile_path(*tmp)) ||
+	    rename_tempfile(tmp, path)) {
+		delete_tempfile(tmp);
+		return;
+	}
+	trace_printf_key(&trace_pack_cache, "pack-cache: stored %s\n", path);
+	prune_pack_cache();
+}
+
 static void create_pack_file(void)
 {
 	struct child_process pack_objects = CHILD_PROCESS_INIT;
@@ -109,6 +429,10 @@ static void create_pack_file(void)
 	ssize_t sz;
 	int i;
 	FILE *pipe_fd;
+	struct strbuf input = STRBUF_INIT;
+	struct strbuf cache_path = STRBUF_INIT;
+	struct tempfile *cache_tmp = NULL;
+	off_t cache_size = 0;
 
 	if (!pack_objects_hook)
 		pack_objects.git_cmd = 1;
@@ -148,6 +472,35 @@ static void create_pack_file(void)
 		}
 	}
 
+	if (shallow_nr)
+		for_each_commit_graft(write_one_shallow, &input);
+
+	for (i = 0; i < want_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&want_obj.objects[i].item->oid));
+	strbuf_addstr(&input, "--not\n");
+	for (i = 0; i < have_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&have_obj.objects[i].item->oid));
+	for (i = 0; i < extra_edge_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&extra_edge_obj.objects[i].item->oid));
+	for (i = 0; i < uri_tip_obj.nr; i++)
+		strbuf_addf(&input, "%s\n",
+			    oid_to_hex(&uri_tip_obj.objects[i].item->oid));
+	strbuf_addch(&input, '\n');
+
+	if (pack_cache_enabled) {
+		pack_cache_path(&pack_objects.args, &cache_path);
+		if (!send_cached_pack(cache_path.buf)) {
+			child_process_clear(&pack_objects);
+			strbuf_release(&input);
+			strbuf_release(&cache_path);
+			return;
+		}
+		cache_tmp = create_pack_cache_tempfile();
+	}
+
 	pack_objects.in = -1;
 	pack_objects.out = -1;
 	pack_objects.err = -1;
@@ -156,23 +509,10 @@ static void create_pack_file(void)
 		die("git upload-pack: unable to fork git-pack-objects");
 
 	pipe_fd = xfdopen(pack_objects.in, "w");
-
-	if (shallow_nr)
-		for_each_commit_graft(write_one_shallow, pipe_fd);
-
-	for (i = 0; i < want_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&want_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "--not\n");
-	for (i = 0; i < have_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&have_obj.objects[i].item->oid));
-	for (i = 0; i < extra_edge_obj.nr; i++)
-		fprintf(pipe_fd, "%s\n",
-			oid_to_hex(&extra_edge_obj.objects[i].item->oid));
-	fprintf(pipe_fd, "\n");
+	fwrite(input.buf, 1, input.len, pipe_fd);
 	fflush(pipe_fd);
 	fclose(pipe_fd);
+	strbuf_release(&input);
 
 	/* We read from pack_objects.err to capture stderr output for
 	 * progress bar, and pack_objects.out to capture the pack data.
@@ -265,6 +605,7 @@ static void create_pack_file(void)
 			else
 				buffered = -1;
 			send_client_data(1, data, sz);
+			write_pack_cache(&cache_tmp, &cache_size, data, sz);
 		}
 
 		/*
@@ -292,10 +633,13 @@ static void create_pack_file(void)
 	if (0 <= buffered) {
 		data[0] = buffered;
 		send_client_data(1, data, 1);
+		write_pack_cache(&cache_tmp, &cache_size, data, 1);
 		fprintf(stderr, "flushed.\n");
 	}
 	if (use_sideband)
 		packet_flush(1);
+	store_cached_pack(&cache_tmp, cache_path.buf);
+	strbuf_release(&cache_path);
 	return;
 
  fail:
@@ -312,6 +656,7 @@ static int got_oid(const char *hex, struct object_id *oid)
 		die("git upload-pack: expected SHA1 object, got '%s'", hex);
 	if (!has_object_file(oid))
 		return -1;
+	oid_array_append(&have_oids, oid);
 
 	o = parse_object(the_repository, oid);
 	if (!o)
@@ -1005,6 +1350,26 @@ static int find_symref(const char *refname, const struct object_id *oid,
 	return 0;
 }
 
+static int parse_packfile_uri(const char *var, const char *value)
+{
+	struct packfile_uri *p;
+	struct object_id tip, pack_hash;
+	const char *hash, *uri;
+
+	if (!value)
+		return config_error_nonbool(var);
+	if (parse_oid_hex(value, &tip, &hash) || *hash++ != ' ' ||
+	    parse_oid_hex(hash, &pack_hash, &uri) || *uri++ != ' ' || !*uri)
+		return error(_("invalid value for '%s': '%s'"), var, value);
+
+	ALLOC_GROW(packfile_uris, packfile_uris_nr + 1, packfile_uris_alloc);
+	p = &packfile_uris[packfile_uris_nr++];
+	oidcpy(&p->tip, &tip);
+	p->pack_hash = xstrdup(oid_to_hex(&pack_hash));
+	p->uri = xstrdup(uri);
+	return 0;
+}
+
 static int upload_pack_config(const char *var, const char *value, void *unused)
 {
 	if (!strcmp("uploadpack.allowtipsha1inwant", var)) {
@@ -1026,6 +1391,14 @@ static int upload_pack_config(const char *var, const char *value, void *unused)
 		keepalive = git_config_int(var, value);
 		if (!keepalive)
 			keepalive = -1;
+	} else if (!strcmp("uploadpack.packcache", var)) {
+		pack_cache_enabled = git_config_bool(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxsize", var)) {
+		pack_cache_max_size = git_config_ulong(var, value);
+	} else if (!strcmp("uploadpack.packcachemaxage", var)) {
+		pack_cache_max_age = git_config_ulong(var, value);
+	} else if (!strcmp("uploadpack.packfileuri", var)) {
+		return parse_packfile_uri(var, value);
 	} else if (current_config_scope() != CONFIG_SCOPE_REPO) {
 		if (!strcmp("uploadpack.packobjectshook", var))
 			return git_config_string(&pack_objects_hook, var, value);
@@ -1063,10 +1436,16 @@ void upload_pack(struct upload_pack_options *options)
 	if (options->advertise_refs)
 		return;
 
+	trace_event_region_enter("upload-pack", "receive-needs");
 	receive_needs();
+	trace_event_region_leave("upload-pack", "receive-needs");
 	if (want_obj.nr) {
+		trace_event_region_enter("upload-pack", "negotiate");
 		get_common_commits();
+		trace_event_region_leave("upload-pack", "negotiate");
+		trace_event_region_enter("upload-pack", "create-pack");
 		create_pack_file();
+		trace_event_region_leave("upload-pack", "create-pack");
 	}
 }
 
@@ -1249,6 +1628,11 @@ static void process_args(struct packet_reader *request,
 			continue;
 		}
 
+		if (skip_prefix(arg, "packfile-uris ", &p)) {
+			string_list_split(&uri_protocols, p, ',', -1);
+			continue;
+		}
+
 		/* ignore unknown lines maybe? */
 		die("unexpected line: '%s'", arg);
 	}
@@ -1268,6 +1652,7 @@ static int process_haves(struct oid_array *haves, struct oid_array *common)
 			continue;
 
 		oid_array_append(common, oid);
+		oid_array_append(&have_oids, oid);
 
 		o = parse_object(the_repository, oid);
 		if (!o)
@@ -1380,6 +1765,78 @@ static void send_shallow_info(struct upload_pack_data *data)
 	packet_delim(1);
 }
 
+static int uri_protocol_allowed(const char *uri)
+{
+	const char *end = strstr(uri, "://");
+	struct string_list_item *item;
+
+	if (!end)
+		return 0;
+	for_each_string_list_item(item, &uri_protocols)
+		if (strlen(item->string) == end - uri &&
+		    !strncmp(item->string, uri, end - uri))
+			return 1;
+	return 0;
+}
+
+/* Is "tip" reachable from one of the commits among "objs"? */
+static int reachable_from_any(struct commit *tip, struct object_array *objs)
+{
+	int i;
+
+	for (i = 0; i < objs->nr; i++) {
+		struct commit *c = lookup_commit_reference_gently(the_repository,
+					&objs->objects[i].item->oid, 1);
+		if (c && in_merge_bases(tip, c))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * Tell the client which pre-built packs it should download, i.e. those
+ * whose tip it wants but does not have yet, and leave their objects out
+ * of the pack we generate. The pre-built packs hold the full, unfiltered
+ * history of their tip, so they are not offered to shallow or partial
+ * clones.
+ */
+static void send_packfile_uris(struct upload_pack_data *data)
+{
+	int i;
+
+	if (!uri_protocols.nr || !packfile_uris_nr)
+		return;
+	if (data->depth || data->deepen_rev_list || data->shallows.nr ||
+	    is_repository_shallow(the_repository) || filter_options.choice)
+		return;
+
+	for (i = 0; i < packfile_uris_nr; i++) {
+		struct packfile_uri *p = &packfile_uris[i];
+		struct commit *tip;
+
+		if (!uri_protocol_allowed(p->uri))
+			continue;
+		tip = lookup_commit_reference_gently(the_repository, &p->tip, 1);
+		if (!tip || !reachable_from_any(tip, &want_obj) ||
+		    reachable_from_any(tip, &have_obj))
+			continue;
+
+		if (!uri_tip_obj.nr)
+			packet_write_fmt(1, "packfile-uris\n");
+		packet_write_fmt(1, "%s %s\n", p->pack_hash, p->uri);
+		add_object_array(&tip->object, NULL, &uri_tip_obj);
+	}
+
+	if (uri_tip_obj.nr) {
+		packet_delim(1);
+		/*
+		 * The client indexes our pack along with the pre-built
+		 * ones, so it must not have deltas against their objects.
+		 */
+		use_thin_pack = 0;
+	}
+}
+
 enum fetch_state {
 	FETCH_PROCESS_ARGS = 0,
 	FETCH_SEND_ACKS,
@@ -1423,17 +1880,22 @@ int upload_pack_v2(struct repository *r, struct argv_array *keys,
 			}
 			break;
 		case FETCH_SEND_ACKS:
+			trace_event_region_enter("upload-pack", "negotiate");
 			if (process_haves_and_send_acks(&data))
 				state = FETCH_SEND_PACK;
 			else
 				state = FETCH_DONE;
+			trace_event_region_leave("upload-pack", "negotiate");
 			break;
 		case FETCH_SEND_PACK:
 			send_wanted_ref_info(&data);
 			send_shallow_info(&data);
+			send_packfile_uris(&data);
 
 			packet_write_fmt(1, "packfile\n");
+			trace_event_region_enter("upload-pack", "create-pack");
 			create_pack_file();
+			trace_event_region_leave("upload-pack", "create-pack");
 			state = FETCH_DONE;
 			break;
 		case FETCH_DONE:
@@ -1465,6 +1927,10 @@ int upload_pack_advertise(struct repository *r,
 					 &allow_ref_in_want) &&
 		    allow_ref_in_want)
 			strbuf_addstr(value, " ref-in-want");
+
+		if (repo_config_get_value_multi(the_repository,
+						"uploadpack.packfileuri"))
+			strbuf_addstr(value, " packfile-uris");
 	}
 
 	return 1;
@@ -5,6 +5,7 @@
  */
 #include "git-compat-util.h"
 #include "cache.h"
+#include "trace-event.h"
 
 void vreportf(const char *prefix, const char *err, va_list params)
 {
@@ -22,13 +23,13 @@ void vreportf(const char *prefix, const char *err, va_list params)
 static NORETURN void usage_builtin(const char *err, va_list params)
 {
 	vreportf("usage: ", err, params);
-	exit(129);
+	exit(trace_event_exit(129));
 }
 
 static NORETURN void die_builtin(const char *err, va_list params)
 {
 	vreportf("fatal: ", err, params);
-	exit(128);
+	exit(trace_event_exit(128));
 }
 
 static void error_builtin(const char *err, va_list params)
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "config.h"
 #include "wt-status.h"
 #include "object.h"
 #include "dir.h"
@@ -17,6 +18,10 @@
 #include "utf8.h"
 #include "worktree.h"
 #include "lockfile.h"
+#include "sparse-index.h"
+#include "object-store.h"
+#include "thread-utils.h"
+#include "trace-event.h"
 
 static const char cut_line[] =
 "------------------------ >8 ------------------------\n";
@@ -642,6 +647,7 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 {
 	int i;
 
+	ensure_full_index(&the_index);
 	for (i = 0; i < active_nr; i++) {
 		struct string_list_item *it;
 		struct wt_status_change_data *d;
@@ -674,7 +680,7 @@ static void wt_status_collect_changes_initial(struct wt_status *s)
 	}
 }
 
-static void wt_status_collect_untracked(struct wt_status *s)
+static void wt_status_collect_untracked(struct wt_status *s, int threads)
 {
 	int i;
 	struct dir_struct dir;
@@ -697,6 +703,7 @@ static void wt_status_collect_untracked(struct wt_status *s)
 	}
 
 	setup_standard_excludes(&dir);
+	dir.threads = threads;
 
 	fill_directory(&dir, &the_index, &s->pathspec);
 
@@ -724,15 +731,105 @@ static void wt_status_collect_untracked(struct wt_status *s)
 		s->untracked_in_ms = (getnanotime() - t_begin) / 1000000;
 }
 
+/*
+ * Below this many index entries per thread, the untracked files are
+ * looked for in the same thread as the changes.
+ */
+#define STATUS_THREAD_COST (10000)
+
+static int status_threads(struct wt_status *s)
+{
+	int nr = git_env_ulong("GIT_TEST_STATUS_THREADS", 0);
+
+	if (nr)
+		return nr;
+	if (s->threads)
+		return s->threads;
+
+	nr = the_index.cache_nr / STATUS_THREAD_COST;
+	if (nr > online_cpus())
+		nr = online_cpus();
+	return nr;
+}
+
+#ifndef NO_PTHREADS
+static int index_has_gitlinks(struct index_state *istate)
+{
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (S_ISGITLINK(istate->cache[i]->ce_mode))
+			return 1;
+	return 0;
+}
+
+struct untracked_thread {
+	pthread_t pthread;
+	struct wt_status *s;
+	int threads;
+};
+
+static void *collect_untracked_thread_proc(void *data)
+{
+	struct untracked_thread *t = data;
+
+	trace_event_thread_start("untracked");
+	wt_status_collect_untracked(t->s, t->threads);
+	trace_event_thread_exit();
+	return NULL;
+}
+#endif
+
 void wt_status_collect(struct wt_status *s)
 {
+	int threads = status_threads(s);
+#ifndef NO_PTHREADS
+	struct untracked_thread untracked;
+	/*
+	 * The traversal of the working tree for the untracked files does
+	 * not depend on the changes, so it runs in its own threads while
+	 * the index is compared with the working tree and HEAD. A sparse
+	 * index may be expanded by the comparison, so it is not shared.
+	 * Nor is an index with submodules: the comparison looks up their
+	 * gitfiles without the object read lock, while the traversal
+	 * looks up those of nested repositories under it, and both end up
+	 * in the static buffer of real_path().
+	 */
+	int parallel = threads > 1 && s->show_untracked_files &&
+		       !the_index.sparse_index &&
+		       !index_has_gitlinks(&the_index);
+
+	if (parallel) {
+		int err;
+
+		/* both sides look up the index and read objects */
+		lazy_init_name_hash(&the_index);
+		enable_obj_read_lock();
+		untracked.s = s;
+		untracked.threads = threads;
+		err = pthread_create(&untracked.pthread, NULL,
+				     collect_untracked_thread_proc, &untracked);
+		if (err)
+			die(_("unable to create thread: %s"), strerror(err));
+	}
+#endif
+
 	wt_status_collect_changes_worktree(s);
 
 	if (s->is_initial)
 		wt_status_collect_changes_initial(s);
 	else
 		wt_status_collect_changes_index(s);
-	wt_status_collect_untracked(s);
+
+#ifndef NO_PTHREADS
+	if (parallel) {
+		if (pthread_join(untracked.pthread, NULL))
+			die(_("unable to join thread"));
+		disable_obj_read_lock();
+		return;
+	}
+#endif
+	wt_status_collect_untracked(s, threads);
 }
 
 static void wt_longstatus_print_unmerged(struct wt_status *s)
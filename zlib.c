@@ -3,6 +3,7 @@
  * at init time.
  */
 #include "cache.h"
+#include "trace-event.h"
 
 static const char *zerr_to_string(int status)
 {
@@ -110,6 +111,7 @@ void git_inflate_end(git_zstream *strm)
 
 int git_inflate(git_zstream *strm, int flush)
 {
+	unsigned long total_out = strm->total_out;
 	int status;
 
 	for (;;) {
@@ -131,6 +133,8 @@ int git_inflate(git_zstream *strm, int flush)
 			continue;
 		break;
 	}
+	trace_event_count(TRACE_COUNTER_BYTES_INFLATED,
+			  strm->total_out - total_out);
 
 	switch (status) {
 	/* Z_BUF_ERROR: normal, needs more space in the output buffer */